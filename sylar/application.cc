@@ -273,6 +273,7 @@ int Application::run_fiber() {
             }
         }
         server->setConf(i);
+        server->setSharedStack(i.shared_stack);
         //server->start();
         m_servers[i.type].push_back(server);
         svrs.push_back(server);
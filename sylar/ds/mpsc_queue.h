@@ -0,0 +1,92 @@
+#ifndef __SYLAR_DS_MPSC_QUEUE_H__
+#define __SYLAR_DS_MPSC_QUEUE_H__
+
+#include <atomic>
+#include "sylar/noncopyable.h"
+
+namespace sylar {
+namespace ds {
+
+/**
+ * @brief 侵入式MPSC队列节点，需要入队的对象继承该类
+ */
+class MpscNode {
+public:
+    MpscNode()
+        :m_mpscNext(nullptr) {
+    }
+private:
+    template<class T> friend class MpscQueue;
+    std::atomic<MpscNode*> m_mpscNext;
+};
+
+/**
+ * @brief 侵入式无锁多生产者单消费者队列(Vyukov)
+ * @details push为wait-free，只有一次原子交换，不分配内存；pop只能由一个消费者调用。
+ *          生产者交换完队尾但还没有链接next时，pop可能暂时返回nullptr，消费者稍后重试即可
+ */
+template<class T>
+class MpscQueue : Noncopyable {
+public:
+    MpscQueue()
+        :m_head(&m_stub)
+        ,m_tail(&m_stub) {
+    }
+
+    /**
+     * @brief 入队，可以多个线程同时调用
+     * @param[in] v 节点，出队之前不能再次入队
+     */
+    void push(T* v) {
+        pushNode(static_cast<MpscNode*>(v));
+    }
+
+    /**
+     * @brief 出队，只能由一个消费者调用
+     * @return 队列为空(或者生产者还没有完成链接)时返回nullptr
+     */
+    T* pop() {
+        MpscNode* tail = m_tail;
+        MpscNode* next = tail->m_mpscNext.load(std::memory_order_acquire);
+        if(tail == &m_stub) {
+            if(!next) {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->m_mpscNext.load(std::memory_order_acquire);
+        }
+        if(next) {
+            m_tail = next;
+            return static_cast<T*>(tail);
+        }
+        if(tail != m_head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        // 只剩最后一个节点，放回stub才能将其取出
+        pushNode(&m_stub);
+        next = tail->m_mpscNext.load(std::memory_order_acquire);
+        if(next) {
+            m_tail = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+private:
+    void pushNode(MpscNode* n) {
+        n->m_mpscNext.store(nullptr, std::memory_order_relaxed);
+        MpscNode* prev = m_head.exchange(n, std::memory_order_acq_rel);
+        prev->m_mpscNext.store(n, std::memory_order_release);
+    }
+private:
+    /// 生产者端，最后入队的节点
+    std::atomic<MpscNode*> m_head;
+    /// 消费者端，下一个出队的节点
+    MpscNode* m_tail;
+    MpscNode m_stub;
+};
+
+}
+}
+
+#endif
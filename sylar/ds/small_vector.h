@@ -0,0 +1,58 @@
+#ifndef __SYLAR_DS_SMALL_VECTOR_H__
+#define __SYLAR_DS_SMALL_VECTOR_H__
+
+#include <stddef.h>
+#include <vector>
+
+namespace sylar {
+namespace ds {
+
+/**
+ * @brief 前N个元素放在对象内部的vector
+ * @details 元素个数一般很少时避免堆分配，超过N个的部分放到std::vector中。
+ *          只支持追加和整体清空，clear后内部的元素不析构，下次追加时覆盖
+ */
+template<class T, size_t N>
+class SmallVector {
+public:
+    SmallVector()
+        :m_size(0) {
+    }
+
+    void push_back(const T& v) {
+        if(m_size < N) {
+            m_inline[m_size] = v;
+        } else {
+            m_heap.push_back(v);
+        }
+        ++m_size;
+    }
+
+    T& operator[](size_t idx) {
+        return idx < N ? m_inline[idx] : m_heap[idx - N];
+    }
+
+    const T& operator[](size_t idx) const {
+        return idx < N ? m_inline[idx] : m_heap[idx - N];
+    }
+
+    size_t size() const { return m_size;}
+    bool empty() const { return m_size == 0;}
+
+    void clear() {
+        m_size = 0;
+        m_heap.clear();
+    }
+private:
+    /// 内部存放的元素
+    T m_inline[N];
+    /// 元素个数
+    size_t m_size;
+    /// 超过N个的元素
+    std::vector<T> m_heap;
+};
+
+}
+}
+
+#endif
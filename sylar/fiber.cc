@@ -3,7 +3,10 @@
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
+#include "fiber_stack.h"
 #include <atomic>
+#include <algorithm>
+#include <string.h>
 
 namespace sylar {
 
@@ -23,19 +26,52 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-//包装的栈空间分配器，可以使用内存池进行优化，以防频繁的创建销毁线程
-class MallocStackAllocator {
-public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
-    }
+/// 每个线程共享栈的大小，默认1M
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024 * 1024, "fiber shared stack size");
+
+/// 每个线程共享栈的数量，默认4个
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4, "fiber shared stack count per thread");
+
+//包装的栈空间分配器，使用mmap内存池，带保护页，参考fiber_stack.h
+using StackAllocator = FiberStackPool;
+
+/**
+ * @brief 线程共享栈
+ */
+struct Fiber::SharedStack {
+    /// 栈空间起始地址
+    void* stack = nullptr;
+    /// 栈大小
+    size_t size = 0;
+    /// 当前数据在栈上的协程
+    Fiber* occupant = nullptr;
+
+    /// 栈底(高地址)
+    char* top() const { return (char*)stack + size;}
+};
 
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+/**
+ * @brief 当前线程的所有共享栈
+ */
+struct ThreadSharedStacks {
+    std::vector<Fiber::SharedStack*> stacks;
+    /// 下一个分配的共享栈
+    size_t next = 0;
+
+    ~ThreadSharedStacks() {
+        for(auto& i : stacks) {
+            StackAllocator::Dealloc(i->stack, i->size);
+            delete i;
+        }
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local ThreadSharedStacks t_shared_stacks;
+
+/// 保存在堆上的栈数据总大小
+static std::atomic<uint64_t> s_shared_saved_bytes {0};
 
 // 获取当前协程的id
 uint64_t Fiber::GetFiberId() {
@@ -50,10 +86,12 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
+#ifndef SYLAR_FIBER_ASM_CONTEXT
     /// 保存协程上下文
     if(getcontext(&m_ctx)) {
         SYLAR_ASSERT2(false, "getcontext");
     }
+#endif
 
     ++s_fiber_count;
 
@@ -62,31 +100,31 @@ Fiber::Fiber() {
 }
 
 // 有参构造函数
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
     :m_id(++s_fiber_id)
-    ,m_cb(cb) {     //初始化协程运行函数
+    ,m_cb(cb)       //初始化协程运行函数
+    ,m_useCaller(use_caller)
+    ,m_useSharedStack(shared_stack) {
     ++s_fiber_count;
 
+    // 共享栈在第一次运行时才绑定，见prepareSharedStack
+    if(m_useSharedStack) {
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared stack id=" << m_id;
+        return;
+    }
+
     //分配栈空间
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
     m_stack = StackAllocator::Alloc(m_stacksize);
-    
-    // 保存上下文
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
 
     // 对上下文和协程运行函数进行绑定
     if(!use_caller) {
         // use_caller为false时与MainFunc绑定
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        initContext(&Fiber::MainFunc);
     } 
     else {
         // 与CallerMainFunc绑定
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        initContext(&Fiber::CallerMainFunc);
     }
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -95,8 +133,18 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 Fiber::~Fiber() {
     --s_fiber_count;
 
+    //对共享栈子协程进行析构，栈不属于该协程，只释放保存的栈数据
+    if(m_useSharedStack) {
+        SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+        SYLAR_ASSERT(!m_sharedStack || m_sharedStack->occupant != this);
+        if(m_savedStack) {
+            s_shared_saved_bytes -= m_savedSize;
+            free(m_savedStack);
+        }
+    }
+
     //对子协程进行析构
-    if(m_stack) {
+    else if(m_stack) {
         SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
 
         StackAllocator::Dealloc(m_stack, m_stacksize);
@@ -116,54 +164,166 @@ Fiber::~Fiber() {
 }
 
 void Fiber::reset(std::function<void()> cb) {
-    SYLAR_ASSERT(m_stack);
+    SYLAR_ASSERT(m_stack || m_useSharedStack);
     SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
     m_cb = cb;
+    m_useCaller = false;
+    if(m_useSharedStack) {
+        // 共享栈上可能是其它协程的数据，解除绑定，下次运行时重新初始化上下文
+        SYLAR_ASSERT(!m_sharedStack || m_sharedStack->occupant != this);
+        if(m_savedStack) {
+            s_shared_saved_bytes -= m_savedSize;
+            free(m_savedStack);
+            m_savedStack = nullptr;
+            m_savedSize = 0;
+        }
+        m_sharedStack = nullptr;
+        m_stack = nullptr;
+        m_stacksize = 0;
+        m_boundThread = -1;
+    } else {
+        initContext(&Fiber::MainFunc);
+    }
+    m_state = INIT;
+}
+
+char* Fiber::getStackPointer() const {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    return (char*)m_ctx;
+#elif defined(__x86_64__)
+    return (char*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (char*)m_ctx.uc_mcontext.sp;
+#else
+#   error "shared stack fiber is not supported on this platform"
+#endif
+}
+
+void Fiber::SaveSharedStack(SharedStack* stack) {
+    Fiber* occ = stack->occupant;
+    stack->occupant = nullptr;
+    if(!occ) {
+        return;
+    }
+    // 只保存实际使用的部分 [sp, top)
+    char* sp = occ->getStackPointer();
+    SYLAR_ASSERT(sp >= (char*)stack->stack && sp <= stack->top());
+    size_t size = stack->top() - sp;
+    if(occ->m_savedSize != size) {
+        s_shared_saved_bytes -= occ->m_savedSize;
+        free(occ->m_savedStack);
+        occ->m_savedStack = (char*)malloc(size);
+        occ->m_savedSize = size;
+        s_shared_saved_bytes += size;
+    }
+    memcpy(occ->m_savedStack, sp, size);
+}
+
+void Fiber::prepareSharedStack() {
+    if(!m_useSharedStack) {
+        return;
+    }
+    if(!m_sharedStack) {
+        // 第一次运行，轮流绑定当前线程的一个共享栈
+        if(t_shared_stacks.stacks.empty()) {
+            uint32_t count = std::max(g_fiber_shared_stack_count->getValue(), (uint32_t)1);
+            for(uint32_t i = 0; i < count; ++i) {
+                SharedStack* ss = new SharedStack;
+                ss->size = g_fiber_shared_stack_size->getValue();
+                ss->stack = StackAllocator::Alloc(ss->size);
+                t_shared_stacks.stacks.push_back(ss);
+            }
+        }
+        m_sharedStack = t_shared_stacks.stacks[t_shared_stacks.next++ % t_shared_stacks.stacks.size()];
+        m_boundThread = sylar::GetThreadId();
+        m_stack = m_sharedStack->stack;
+        m_stacksize = m_sharedStack->size;
+
+        SaveSharedStack(m_sharedStack);
+        initContext(m_useCaller ? &Fiber::CallerMainFunc : &Fiber::MainFunc);
+        m_sharedStack->occupant = this;
+        return;
+    }
+
+    // 栈上的数据包含绝对地址，只能在绑定的线程的同一个共享栈上恢复
+    SYLAR_ASSERT2(m_boundThread == sylar::GetThreadId(), "shared stack fiber id=" << m_id
+            << " bound_thread=" << m_boundThread << " thread=" << sylar::GetThreadId());
+    if(m_sharedStack->occupant == this) {
+        return;
+    }
+    SaveSharedStack(m_sharedStack);
+    if(m_savedSize) {
+        memcpy(m_sharedStack->top() - m_savedSize, m_savedStack, m_savedSize);
+    }
+    m_sharedStack->occupant = this;
+}
+
+void Fiber::GetSharedStackInfo(size_t& stacks, uint64_t& saved_bytes) {
+    stacks = t_shared_stacks.stacks.size();
+    saved_bytes = s_shared_saved_bytes;
+}
+
+void Fiber::initContext(void (*fn)()) {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    m_ctx = MakeFContext(m_stack, m_stacksize, fn);
+#else
+    // 保存上下文
     if(getcontext(&m_ctx)) {
         SYLAR_ASSERT2(false, "getcontext");
     }
-
     m_ctx.uc_link = nullptr;
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stacksize;
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+    makecontext(&m_ctx, fn, 0);
+#endif
+}
+
+void Fiber::SwapContext(Fiber* from, Fiber* to) {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    sylar_swap_fcontext(&from->m_ctx, to->m_ctx);
+#else
+    if(swapcontext(&from->m_ctx, &to->m_ctx)) {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+#endif
 }
 
 void Fiber::call() {
+    prepareSharedStack();
     SetThis(this);
     m_state = EXEC;
     // 当前线程的主协程 ---> 当前协程
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    SwapContext(t_threadFiber.get(), this);
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
     // 当前协程 ---> 当前线程的主协程
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    SwapContext(this, t_threadFiber.get());
 }
 
-void Fiber::swapIn() {
-    SetThis(this);
+Fiber::State Fiber::swapIn() {
     SYLAR_ASSERT(m_state != EXEC);
+    prepareSharedStack();
+    SetThis(this);
     m_state = EXEC;
+    m_running.store(true, std::memory_order_relaxed);
     // 调度协程 ---> 当前协程
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
+    SwapContext(Scheduler::GetMainFiber(), this);
+    if(m_state == EXEC) {
+        m_state = HOLD;
     }
+    State state = m_state;
+    // 回到调度协程时上下文已经保存完毕，其它线程此后才能恢复该协程
+    m_running.store(false, std::memory_order_release);
+    return state;
 }
 
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
     // 当前协程 ---> 调度协程
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    SwapContext(this, Scheduler::GetMainFiber());
 }
 
 void Fiber::SetThis(Fiber* f) {
@@ -226,6 +386,11 @@ void Fiber::MainFunc() {
     auto raw_ptr = cur.get();
     cur.reset();
 
+    // 已经结束，共享栈上的数据不再需要保存
+    if(raw_ptr->m_sharedStack) {
+        raw_ptr->m_sharedStack->occupant = nullptr;
+    }
+
     // 返回调度协程
     raw_ptr->swapOut();
 
@@ -257,6 +422,11 @@ void Fiber::CallerMainFunc() {
     auto raw_ptr = cur.get();
     cur.reset();
 
+    // 已经结束，共享栈上的数据不再需要保存
+    if(raw_ptr->m_sharedStack) {
+        raw_ptr->m_sharedStack->occupant = nullptr;
+    }
+
     // 返回到当前线程的主协程
     raw_ptr->back();
     SYLAR_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
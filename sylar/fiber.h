@@ -2,6 +2,7 @@
  * @file fiber.h
  * @brief 协程封装
  * @details 基于ucontext_t实现非对称协程。子协程只能和线程主协程切换，而不能和另一个子协程切换
+ *          编译时定义SYLAR_FIBER_ASM_CONTEXT则使用汇编实现的上下文切换(fiber_context.h)
  * @author zq
  */
 #ifndef __SYLAR_FIBER_H__
@@ -9,7 +10,12 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
+#include "fiber_context.h"
+#include "ds/mpsc_queue.h"
+#ifndef SYLAR_FIBER_ASM_CONTEXT
 #include <ucontext.h>
+#endif
 
 namespace sylar {
 
@@ -33,10 +39,14 @@ class Scheduler;
  *  在Linux系统里这个上下文用ucontext_t结构体来表示，通过getcontext()来获取。 
  */
 
+struct ThreadSharedStacks;
+
 //协程类
 //std::enable_shared_from_this：支持Fiber在自身的成员函数中通过shared_from_this获取自身的 std::shared_ptr。
-class Fiber : public std::enable_shared_from_this<Fiber> {
+//继承MpscNode：跨线程调度时协程自身作为无锁注入队列的节点，不需要额外分配内存
+class Fiber : public std::enable_shared_from_this<Fiber>, private ds::MpscNode {
 friend class Scheduler;
+template<class T> friend class ds::MpscQueue;
 public:
     typedef std::shared_ptr<Fiber> ptr;
 
@@ -63,8 +73,14 @@ public:
      * @param[in] cb 协程执行的函数
      * @param[in] stacksize 协程栈大小
      * @param[in] use_caller 是否在MainFiber上调度，感觉没啥大用，只是为了演示非对称模型
+     * @param[in] shared_stack 是否使用共享栈
+     * @details 共享栈模式下协程没有独立的栈，第一次运行时绑定当前线程的一个共享栈(fiber.shared_stack.size)，
+     *          其它协程需要使用该共享栈时，才将该协程栈上实际使用的部分拷贝到一块刚好大小的堆内存中，切回时再拷贝回来。
+     *          适合大量空闲连接的场景，代价是每次切换可能需要拷贝栈。
+     * @attention 共享栈协程绑定第一次运行的线程，之后只能在该线程上调度；
+     *            不能把栈上对象的地址交给其它协程在本协程挂起时使用
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
     
     ~Fiber();
 
@@ -80,8 +96,10 @@ public:
      * @pre getState() != EXEC
      * @post getState() = EXEC
      * @details 即谁调用该函数，谁就会被放到前台来运行。
+     * @return 切换回来时协程的状态，直接swapOut切换出来的协程状态置为HOLD。
+     *         返回之后其它线程可能已经恢复了该协程，调用者应当使用返回值而不是getState()
      */
-    void swapIn();
+    State swapIn();
 
     /**
      * @brief 将当前协程切换到后台, 当前协程 ---> 调度协程
@@ -106,6 +124,19 @@ public:
 
     //返回协程状态
     State getState() const { return m_state;}
+
+    /**
+     * @brief 是否正在被调度线程执行
+     * @details 协程先设置状态再切换出去，状态为HOLD时上下文可能还没有保存完，
+     *          只有swapIn返回之后其它线程才能再次调度该协程
+     */
+    bool isRunning() const { return m_running.load(std::memory_order_acquire);}
+
+    //是否使用共享栈
+    bool isSharedStack() const { return m_useSharedStack;}
+
+    //共享栈协程绑定的线程id，-1表示可以在任意线程执行
+    int getBoundThread() const { return m_boundThread;}
 public:
 
     /**
@@ -142,6 +173,40 @@ public:
 
     //获取当前协程的id
     static uint64_t GetFiberId();
+
+    //返回当前线程共享栈的数量以及保存在堆上的栈数据总大小
+    static void GetSharedStackInfo(size_t& stacks, uint64_t& saved_bytes);
+private:
+    /// 线程共享栈，定义在fiber.cc中
+    struct SharedStack;
+    friend struct ThreadSharedStacks;
+
+    /**
+     * @brief 切换到该协程之前准备好共享栈
+     * @details 第一次运行时绑定当前线程的一个共享栈，否则将共享栈上其它协程的数据保存起来，再恢复自己的数据
+     */
+    void prepareSharedStack();
+
+    /**
+     * @brief 将共享栈当前占用者的栈数据保存到堆上
+     */
+    static void SaveSharedStack(SharedStack* stack);
+
+    /**
+     * @brief 返回挂起时的栈顶指针
+     */
+    char* getStackPointer() const;
+
+    /**
+     * @brief 初始化协程上下文
+     * @param[in] fn 协程入口函数
+     */
+    void initContext(void (*fn)());
+
+    /**
+     * @brief 切换上下文 from ---> to
+     */
+    static void SwapContext(Fiber* from, Fiber* to);
 private:
     uint64_t m_id = 0;              // 协程id
     
@@ -149,12 +214,38 @@ private:
     
     State m_state = INIT;           // 协程状态
     
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    fcontext_t m_ctx = nullptr;     // 协程上下文(保存寄存器之后的栈顶)
+#else
     ucontext_t m_ctx;               // 协程上下文
+#endif
     
     void* m_stack = nullptr;        // 协程运行栈指针
     
     std::function<void()> m_cb;     // 协程运行函数
 
+    bool m_useCaller = false;       // 是否与CallerMainFunc绑定
+
+    bool m_useSharedStack = false;  // 是否使用共享栈
+
+    SharedStack* m_sharedStack = nullptr;   // 绑定的共享栈
+
+    int m_boundThread = -1;         // 共享栈协程绑定的线程id
+
+    char* m_savedStack = nullptr;   // 共享栈模式下保存的栈数据
+
+    size_t m_savedSize = 0;         // 保存的栈数据大小
+
+    std::atomic<bool> m_running {false};    // 是否正在被调度线程执行(swapIn还没有返回)
+
+    std::atomic<bool> m_injected {false};   // 是否在调度器的无锁注入队列中
+
+    ptr m_injectRef;                // 在注入队列中时持有自身的引用，出队时转交给调度器
+
+    int m_injectThread = -1;        // 注入时指定的线程id
+
+    uint64_t m_injectTime = 0;      // 注入时间(微秒)，用于统计入队延迟
+
 };
 
 }
@@ -0,0 +1,147 @@
+#include "fiber_context.h"
+#include <stdint.h>
+
+#ifdef SYLAR_HAS_FCONTEXT
+
+#if defined(__x86_64__)
+
+/**
+ * x86-64 SysV ABI
+ * callee-saved: rbx, rbp, r12-r15, 以及mxcsr和x87控制字
+ * 栈布局(由低到高): [mxcsr|x87cw] r12 r13 r14 r15 rbx rbp ret
+ */
+__asm__ (
+    ".pushsection .text\n"
+    ".globl sylar_swap_fcontext\n"
+    ".type sylar_swap_fcontext,@function\n"
+    ".align 16\n"
+"sylar_swap_fcontext:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r15\n"
+    "    pushq %r14\n"
+    "    pushq %r13\n"
+    "    pushq %r12\n"
+    "    leaq -0x8(%rsp), %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 0x4(%rsp)\n"
+    // 保存当前栈顶，切换到目标栈
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 0x4(%rsp)\n"
+    "    leaq 0x8(%rsp), %rsp\n"
+    "    popq %r12\n"
+    "    popq %r13\n"
+    "    popq %r14\n"
+    "    popq %r15\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size sylar_swap_fcontext,.-sylar_swap_fcontext\n"
+
+    // 第一次切换到新上下文时ret到这里，r12中保存了协程入口函数
+    ".type sylar_fcontext_entry,@function\n"
+    ".align 16\n"
+"sylar_fcontext_entry:\n"
+    "    .cfi_startproc\n"
+    // 告诉unwinder这里是调用栈的底部
+    "    .cfi_undefined rip\n"
+    "    call *%r12\n"
+    "    ud2\n"
+    "    .cfi_endproc\n"
+    ".size sylar_fcontext_entry,.-sylar_fcontext_entry\n"
+    ".popsection\n"
+);
+
+#elif defined(__aarch64__)
+
+/**
+ * AAPCS64
+ * callee-saved: x19-x28, x29(fp), x30(lr), d8-d15
+ * 栈布局(由低到高): d8-d15 x19-x28 x29 x30 padding, 共0xb0字节
+ */
+__asm__ (
+    ".pushsection .text\n"
+    ".globl sylar_swap_fcontext\n"
+    ".type sylar_swap_fcontext,%function\n"
+    ".align 4\n"
+"sylar_swap_fcontext:\n"
+    "    sub sp, sp, #0xb0\n"
+    "    stp d8, d9, [sp, #0x00]\n"
+    "    stp d10, d11, [sp, #0x10]\n"
+    "    stp d12, d13, [sp, #0x20]\n"
+    "    stp d14, d15, [sp, #0x30]\n"
+    "    stp x19, x20, [sp, #0x40]\n"
+    "    stp x21, x22, [sp, #0x50]\n"
+    "    stp x23, x24, [sp, #0x60]\n"
+    "    stp x25, x26, [sp, #0x70]\n"
+    "    stp x27, x28, [sp, #0x80]\n"
+    "    stp x29, x30, [sp, #0x90]\n"
+    // 保存当前栈顶，切换到目标栈
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp d8, d9, [sp, #0x00]\n"
+    "    ldp d10, d11, [sp, #0x10]\n"
+    "    ldp d12, d13, [sp, #0x20]\n"
+    "    ldp d14, d15, [sp, #0x30]\n"
+    "    ldp x19, x20, [sp, #0x40]\n"
+    "    ldp x21, x22, [sp, #0x50]\n"
+    "    ldp x23, x24, [sp, #0x60]\n"
+    "    ldp x25, x26, [sp, #0x70]\n"
+    "    ldp x27, x28, [sp, #0x80]\n"
+    "    ldp x29, x30, [sp, #0x90]\n"
+    "    add sp, sp, #0xb0\n"
+    "    ret\n"
+    ".size sylar_swap_fcontext,.-sylar_swap_fcontext\n"
+
+    // 第一次切换到新上下文时ret到这里，x19中保存了协程入口函数
+    ".type sylar_fcontext_entry,%function\n"
+    ".align 4\n"
+"sylar_fcontext_entry:\n"
+    "    .cfi_startproc\n"
+    // 告诉unwinder这里是调用栈的底部
+    "    .cfi_undefined x30\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    "    .cfi_endproc\n"
+    ".size sylar_fcontext_entry,.-sylar_fcontext_entry\n"
+    ".popsection\n"
+);
+
+#endif
+
+extern "C" void sylar_fcontext_entry();
+
+namespace sylar {
+
+fcontext_t MakeFContext(void* stack, size_t size, void (*fn)()) {
+    // 栈从高地址向低地址增长，栈顶按16字节对齐
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    // 预留16字节，保证ret到入口之后 rsp % 16 == 0，call之后满足ABI的对齐要求
+    uint64_t* sp = (uint64_t*)(top - 16 - 8 * 8);
+    // mxcsr默认值0x1f80，x87控制字默认值0x037f
+    sp[0] = 0x1f80 | ((uint64_t)0x037f << 32);
+    sp[1] = (uint64_t)fn;       // r12
+    sp[2] = 0;                  // r13
+    sp[3] = 0;                  // r14
+    sp[4] = 0;                  // r15
+    sp[5] = 0;                  // rbx
+    sp[6] = 0;                  // rbp
+    sp[7] = (uint64_t)&sylar_fcontext_entry;
+#elif defined(__aarch64__)
+    uint64_t* sp = (uint64_t*)(top - 0xb0);
+    for(int i = 0; i < 0xb0 / 8; ++i) {
+        sp[i] = 0;
+    }
+    sp[8] = (uint64_t)fn;       // x19
+    sp[19] = (uint64_t)&sylar_fcontext_entry;  // x30
+#endif
+    return sp;
+}
+
+}
+
+#endif
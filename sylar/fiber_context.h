@@ -0,0 +1,54 @@
+/**
+ * @file fiber_context.h
+ * @brief 汇编实现的协程上下文切换
+ * @author zq
+ * @details swapcontext每次切换都会调用rt_sigprocmask保存/恢复信号掩码，并且保存了全部寄存器。
+ *  协作式切换只需要保存callee-saved寄存器，这里用汇编实现一个只保存callee-saved寄存器的切换函数，
+ *  寄存器直接压在协程自己的栈上，上下文本身只是一个栈指针。
+ *  目前支持x86-64与aarch64，编译时定义SYLAR_FIBER_ASM_CONTEXT后Fiber使用该实现。
+ */
+#ifndef __SYLAR_FIBER_CONTEXT_H__
+#define __SYLAR_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#   define SYLAR_HAS_FCONTEXT 1
+#endif
+
+#if defined(SYLAR_FIBER_ASM_CONTEXT) && !defined(SYLAR_HAS_FCONTEXT)
+#   undef SYLAR_FIBER_ASM_CONTEXT
+#endif
+
+#ifdef SYLAR_HAS_FCONTEXT
+
+namespace sylar {
+
+/// 协程上下文，即保存了callee-saved寄存器之后的栈顶指针
+typedef void* fcontext_t;
+
+/**
+ * @brief 在栈上构造一个初始上下文
+ * @param[in] stack 栈空间起始地址
+ * @param[in] size 栈空间大小
+ * @param[in] fn 第一次切换到该上下文时执行的函数，不能返回
+ * @return 初始上下文
+ */
+fcontext_t MakeFContext(void* stack, size_t size, void (*fn)());
+
+}
+
+extern "C" {
+
+/**
+ * @brief 切换上下文
+ * @param[out] from 保存当前上下文
+ * @param[in] to 要切换到的上下文
+ */
+void sylar_swap_fcontext(sylar::fcontext_t* from, sylar::fcontext_t to);
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+#include "fiber_stack.h"
+#include "config.h"
+#include "log.h"
+#include "mutex.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include <vector>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_thread_cache =
+    Config::Lookup<uint32_t>("fiber.stack_pool.thread_cache", 16, "fiber stack pool max free stacks per size class per thread");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_global_cache =
+    Config::Lookup<uint32_t>("fiber.stack_pool.global_cache", 256, "fiber stack pool max free stacks per size class in global pool");
+
+static ConfigVar<bool>::ptr g_stack_pool_guard_page =
+    Config::Lookup<bool>("fiber.stack_pool.guard_page", true, "fiber stack guard page");
+
+static ConfigVar<bool>::ptr g_stack_pool_trim =
+    Config::Lookup<bool>("fiber.stack_pool.trim", false, "fiber stack pool madvise(MADV_DONTNEED) idle stacks");
+
+static uint32_t s_thread_cache = 16;
+static uint32_t s_global_cache = 256;
+static bool s_guard_page = true;
+static bool s_trim = false;
+
+namespace {
+struct _StackPoolIniter {
+    _StackPoolIniter() {
+        s_thread_cache = g_stack_pool_thread_cache->getValue();
+        s_global_cache = g_stack_pool_global_cache->getValue();
+        s_guard_page = g_stack_pool_guard_page->getValue();
+        s_trim = g_stack_pool_trim->getValue();
+
+        g_stack_pool_thread_cache->addListener(
+                [](const uint32_t& ov, const uint32_t& nv){
+                s_thread_cache = nv;
+        });
+        g_stack_pool_global_cache->addListener(
+                [](const uint32_t& ov, const uint32_t& nv){
+                s_global_cache = nv;
+        });
+        g_stack_pool_guard_page->addListener(
+                [](const bool& ov, const bool& nv){
+                s_guard_page = nv;
+        });
+        g_stack_pool_trim->addListener(
+                [](const bool& ov, const bool& nv){
+                s_trim = nv;
+        });
+    }
+};
+static _StackPoolIniter _init;
+}
+
+/// 最小的大小级别 16K
+static const size_t s_min_class_shift = 14;
+/// 大小级别数量 16K 32K 64K 128K 256K 512K 1M
+static const size_t s_class_count = 7;
+
+static std::atomic<uint64_t> s_alloc_count = {0};
+static std::atomic<uint64_t> s_dealloc_count = {0};
+static std::atomic<uint64_t> s_reuse_count = {0};
+static std::atomic<uint64_t> s_mmap_count = {0};
+static std::atomic<uint64_t> s_munmap_count = {0};
+static std::atomic<uint64_t> s_trim_count = {0};
+static std::atomic<uint64_t> s_global_cached = {0};
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+/**
+ * @brief 返回大小级别，超出最大级别返回-1
+ */
+static int SizeToClass(size_t size) {
+    size_t cls_size = (size_t)1 << s_min_class_shift;
+    for(size_t i = 0; i < s_class_count; ++i) {
+        if(size <= cls_size) {
+            return i;
+        }
+        cls_size <<= 1;
+    }
+    return -1;
+}
+
+static size_t ClassToSize(int cls) {
+    return (size_t)1 << (s_min_class_shift + cls);
+}
+
+/**
+ * @brief 映射一个栈
+ * @details 布局为 [保护页][栈空间]，无论是否开启保护页都预留一页，保证释放时的计算一致
+ */
+static void* MapStack(size_t size) {
+    size_t page = GetPageSize();
+    void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                      ,MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "fiber stack mmap size=" << size
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        throw std::bad_alloc();
+    }
+    if(s_guard_page && mprotect(base, page, PROT_NONE)) {
+        SYLAR_LOG_ERROR(g_logger) << "fiber stack mprotect guard page errno="
+            << errno << " errstr=" << strerror(errno);
+    }
+    ++s_mmap_count;
+    return (char*)base + page;
+}
+
+static void UnmapStack(void* vp, size_t size) {
+    size_t page = GetPageSize();
+    if(munmap((char*)vp - page, size + page)) {
+        SYLAR_LOG_ERROR(g_logger) << "fiber stack munmap size=" << size
+            << " errno=" << errno << " errstr=" << strerror(errno);
+    }
+    ++s_munmap_count;
+}
+
+/**
+ * @brief 全局空闲链表
+ */
+struct GlobalStackCache {
+    typedef Spinlock MutexType;
+    MutexType mutex;
+    std::vector<void*> lists[s_class_count];
+};
+
+static GlobalStackCache* GetGlobalCache() {
+    // 不析构，避免进程退出时其它线程的线程缓存归还到已经析构的全局链表
+    static GlobalStackCache* s_cache = new GlobalStackCache;
+    return s_cache;
+}
+
+/**
+ * @brief 将栈归还到全局空闲链表，全局空闲链表满了则munmap
+ */
+static void ReleaseToGlobal(int cls, void* vp) {
+    size_t size = ClassToSize(cls);
+    // 放入全局空闲链表的栈短时间内不会被使用，可以释放物理内存，必须在放入链表之前执行
+    if(s_trim) {
+        madvise(vp, size, MADV_DONTNEED);
+        ++s_trim_count;
+    }
+    GlobalStackCache* cache = GetGlobalCache();
+    {
+        GlobalStackCache::MutexType::Lock lock(cache->mutex);
+        if(cache->lists[cls].size() < s_global_cache) {
+            cache->lists[cls].push_back(vp);
+            ++s_global_cached;
+            return;
+        }
+    }
+    UnmapStack(vp, size);
+}
+
+/**
+ * @brief 线程空闲链表
+ */
+static thread_local bool t_cache_destroyed = false;
+
+struct ThreadStackCache {
+    std::vector<void*> lists[s_class_count];
+
+    ~ThreadStackCache() {
+        // 线程退出时其它thread_local对象可能在之后析构并释放栈，之后直接归还到全局空闲链表
+        t_cache_destroyed = true;
+        for(size_t i = 0; i < s_class_count; ++i) {
+            for(auto& vp : lists[i]) {
+                ReleaseToGlobal(i, vp);
+            }
+        }
+    }
+};
+
+static thread_local ThreadStackCache t_cache;
+
+void* FiberStackPool::Alloc(size_t size) {
+    ++s_alloc_count;
+    int cls = SizeToClass(size);
+    if(cls < 0 || t_cache_destroyed) {
+        return MapStack(cls < 0 ? size : ClassToSize(cls));
+    }
+
+    std::vector<void*>& local = t_cache.lists[cls];
+    if(local.empty()) {
+        // 从全局空闲链表批量搬运一半线程缓存上限的栈
+        size_t n = s_thread_cache / 2 + 1;
+        GlobalStackCache* cache = GetGlobalCache();
+        GlobalStackCache::MutexType::Lock lock(cache->mutex);
+        std::vector<void*>& global = cache->lists[cls];
+        while(!global.empty() && n--) {
+            local.push_back(global.back());
+            global.pop_back();
+            --s_global_cached;
+        }
+    }
+    if(!local.empty()) {
+        void* vp = local.back();
+        local.pop_back();
+        ++s_reuse_count;
+        return vp;
+    }
+    return MapStack(ClassToSize(cls));
+}
+
+void FiberStackPool::Dealloc(void* vp, size_t size) {
+    if(!vp) {
+        return;
+    }
+    ++s_dealloc_count;
+    int cls = SizeToClass(size);
+    if(cls < 0) {
+        UnmapStack(vp, size);
+        return;
+    }
+
+    if(t_cache_destroyed) {
+        ReleaseToGlobal(cls, vp);
+        return;
+    }
+    std::vector<void*>& local = t_cache.lists[cls];
+    if(local.size() < s_thread_cache) {
+        local.push_back(vp);
+        return;
+    }
+    ReleaseToGlobal(cls, vp);
+}
+
+FiberStackPool::Stats FiberStackPool::GetStats() {
+    Stats st;
+    st.alloc = s_alloc_count;
+    st.dealloc = s_dealloc_count;
+    st.reuse = s_reuse_count;
+    st.mmap = s_mmap_count;
+    st.munmap = s_munmap_count;
+    st.trim = s_trim_count;
+    st.global_cached = s_global_cached;
+    return st;
+}
+
+std::ostream& FiberStackPool::Dump(std::ostream& os) {
+    Stats st = GetStats();
+    os << "[FiberStackPool alloc=" << st.alloc
+       << " dealloc=" << st.dealloc
+       << " reuse=" << st.reuse
+       << " mmap=" << st.mmap
+       << " munmap=" << st.munmap
+       << " trim=" << st.trim
+       << " global_cached=" << st.global_cached
+       << "]";
+    return os;
+}
+
+}
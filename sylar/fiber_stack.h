@@ -0,0 +1,76 @@
+/**
+ * @file fiber_stack.h
+ * @brief 协程栈内存池
+ * @author zq
+ * @details 协程栈通过mmap分配，最低地址处有一个PROT_NONE的保护页，栈溢出时直接段错误而不是踩坏其它内存。
+ *          按2的幂划分大小级别(16K ~ 1M)，每个线程有自己的空闲链表，超出上限的归还到全局空闲链表，
+ *          全局空闲链表也满了才munmap。可选对全局空闲链表中的栈执行MADV_DONTNEED释放物理内存。
+ *          相关配置:
+ *          fiber.stack_pool.thread_cache 每个线程每个级别最多缓存的栈数量
+ *          fiber.stack_pool.global_cache 全局每个级别最多缓存的栈数量
+ *          fiber.stack_pool.guard_page   是否设置保护页
+ *          fiber.stack_pool.trim         归还到全局空闲链表时是否MADV_DONTNEED
+ */
+#ifndef __SYLAR_FIBER_STACK_H__
+#define __SYLAR_FIBER_STACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+
+namespace sylar {
+
+/**
+ * @brief 协程栈内存池
+ */
+class FiberStackPool {
+public:
+    /**
+     * @brief 统计信息
+     */
+    struct Stats {
+        /// 分配次数
+        uint64_t alloc = 0;
+        /// 释放次数
+        uint64_t dealloc = 0;
+        /// 从空闲链表复用的次数
+        uint64_t reuse = 0;
+        /// mmap次数
+        uint64_t mmap = 0;
+        /// munmap次数
+        uint64_t munmap = 0;
+        /// MADV_DONTNEED次数
+        uint64_t trim = 0;
+        /// 全局空闲链表中的栈数量
+        uint64_t global_cached = 0;
+    };
+
+    /**
+     * @brief 分配协程栈
+     * @param[in] size 栈大小
+     * @return 栈的起始地址(低地址)
+     * @exception 内存不足时抛出std::bad_alloc
+     */
+    static void* Alloc(size_t size);
+
+    /**
+     * @brief 释放协程栈
+     * @param[in] vp Alloc返回的地址
+     * @param[in] size 分配时的栈大小
+     */
+    static void Dealloc(void* vp, size_t size);
+
+    /**
+     * @brief 获取统计信息
+     */
+    static Stats GetStats();
+
+    /**
+     * @brief 输出统计信息
+     */
+    static std::ostream& Dump(std::ostream& os);
+};
+
+}
+
+#endif
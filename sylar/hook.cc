@@ -1,5 +1,6 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <string.h>
 
 #include "config.h"
 #include "log.h"
@@ -37,6 +38,7 @@ static thread_local bool t_hook_enable = false;
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendfile) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -213,6 +215,87 @@ retry:
 }
 
 
+/// 可以提交到io_uring的操作
+enum UringOp {
+    URING_READ,
+    URING_READV,
+    URING_RECV,
+    URING_RECVMSG,
+    URING_WRITE,
+    URING_WRITEV,
+    URING_SEND,
+    URING_SENDMSG,
+    URING_ACCEPT
+};
+
+/**
+ * @brief 通过io_uring执行IO操作
+ * @param[in] fd 文件句柄
+ * @param[in] timeout_so 控制超时的socket选项
+ * @param[out] n 操作的结果，与对应的系统调用相同
+ * @param[in] op 操作类型
+ * @param[in] addr 缓冲区、iovec数组或msghdr
+ * @param[in] len 长度或iovec数量
+ * @param[in] flags send/recv的flags
+ * @param[in] addr2 accept的addrlen
+ * @return 返回true表示已经通过io_uring完成，返回false表示不适用，调用者继续走do_io(epoll)
+ * @details 只有当前IOManager使用io_uring后端、fd是hook管理的阻塞socket时才使用；
+ *          内核返回EAGAIN(不支持在非阻塞socket上等待的老内核)时也回退到epoll。
+ */
+static bool uring_io(int fd, int timeout_so, ssize_t& n, UringOp op
+                     ,const void* addr, size_t len, int flags, void* addr2 = nullptr) {
+#ifdef SYLAR_HAS_IO_URING
+    if(!sylar::t_hook_enable) {
+        return false;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || !iom->isIoUring()) {
+        return false;
+    }
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return false;
+    }
+
+    static const uint8_t s_opcodes[] = {
+        IORING_OP_READ, IORING_OP_READV, IORING_OP_RECV, IORING_OP_RECVMSG,
+        IORING_OP_WRITE, IORING_OP_WRITEV, IORING_OP_SEND, IORING_OP_SENDMSG,
+        IORING_OP_ACCEPT
+    };
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = s_opcodes[op];
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)addr;
+    sqe.len = len;
+    sqe.msg_flags = flags;
+    if(op == URING_ACCEPT) {
+        sqe.addr2 = (uint64_t)addr2;
+        sqe.len = 0;
+    } else if(op == URING_READ || op == URING_READV
+            || op == URING_WRITE || op == URING_WRITEV) {
+        // socket没有文件偏移，-1表示当前位置
+        sqe.off = (uint64_t)-1;
+    }
+
+    int res = iom->asyncIO(&sqe, ctx->getTimeout(timeout_so));
+    if(res == -EAGAIN) {
+        return false;
+    }
+    if(res < 0) {
+        // 没有设置超时时被取消，说明fd被close了
+        errno = res == -ECANCELED ? EBADF : -res;
+        n = -1;
+    } else {
+        n = res;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;
     HOOK_FUN(XX);
@@ -330,19 +413,46 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    // 调用原生的 connect_f，尝试进行连接。如果连接成功（n == 0），则立即返回 0。
-    // 如果连接失败（n != -1）且错误码不是 EINPROGRESS，表示连接失败或其他错误，直接返回 n（即 -1 或其他错误码）。
-    // EINPROGRESS代表连接还在进行中
-    int n = connect_f(fd, addr, addrlen);
-    if(n == 0) {
-        return 0;
-    } 
-    else if(n != -1 || errno != EINPROGRESS) {
-        return n;
-    }
-
     // 获取 IOManager 实例，用于管理和调度异步操作。
     sylar::IOManager* iom = sylar::IOManager::GetThis();
+
+    // 连接是否已经通过io_uring发起
+    bool started = false;
+#ifdef SYLAR_HAS_IO_URING
+    // io_uring后端直接提交connect，由内核完成连接和超时
+    if(iom && iom->isIoUring()) {
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_CONNECT;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)addr;
+        sqe.off = addrlen;
+        int res = iom->asyncIO(&sqe, timeout_ms);
+        if(res == 0) {
+            return 0;
+        }
+        // 内核不支持在非阻塞socket上等待时返回EINPROGRESS，连接已经发起，继续等待可写
+        started = res == -EINPROGRESS || res == -EALREADY;
+        if(!started && res != -EAGAIN) {
+            errno = res == -ECANCELED ? EBADF : -res;
+            return -1;
+        }
+    }
+#endif
+
+    if(!started) {
+        // 调用原生的 connect_f，尝试进行连接。如果连接成功（n == 0），则立即返回 0。
+        // 如果连接失败（n != -1）且错误码不是 EINPROGRESS，表示连接失败或其他错误，直接返回 n（即 -1 或其他错误码）。
+        // EINPROGRESS代表连接还在进行中
+        int n = connect_f(fd, addr, addrlen);
+        if(n == 0) {
+            return 0;
+        } 
+        else if(n != -1 || errno != EINPROGRESS) {
+            return n;
+        }
+    }
+
     sylar::Timer::ptr timer;
 
     // 存储定时器的信息
@@ -426,7 +536,9 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
  * 这意味着当前线程或协程会被挂起，直到操作可以完成或者超时发生。
  */
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    ssize_t n = 0;
+    int fd = uring_io(s, SO_RCVTIMEO, n, URING_ACCEPT, addr, 0, 0, addrlen) ? n
+        : do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
     if(fd >= 0) {
         sylar::FdMgr::GetInstance()->get(fd, true);
     }
@@ -434,45 +546,109 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    ssize_t n = 0;
+    if(uring_io(fd, SO_RCVTIMEO, n, URING_READ, buf, count, 0)) {
+        return n;
+    }
     return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n = 0;
+    if(uring_io(fd, SO_RCVTIMEO, n, URING_READV, iov, iovcnt, 0)) {
+        return n;
+    }
     return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    ssize_t n = 0;
+    if(uring_io(sockfd, SO_RCVTIMEO, n, URING_RECV, buf, len, flags)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
+    // io_uring没有recvfrom，转换为recvmsg
+    struct iovec iov = {buf, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = src_addr;
+    msg.msg_namelen = src_addr && addrlen ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    ssize_t n = 0;
+    if(uring_io(sockfd, SO_RCVTIMEO, n, URING_RECVMSG, &msg, 1, flags)) {
+        if(n >= 0 && src_addr && addrlen) {
+            *addrlen = msg.msg_namelen;
+        }
+        return n;
+    }
     return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
+    ssize_t n = 0;
+    if(uring_io(sockfd, SO_RCVTIMEO, n, URING_RECVMSG, msg, 1, flags)) {
+        return n;
+    }
     return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t n = 0;
+    if(uring_io(fd, SO_SNDTIMEO, n, URING_WRITE, buf, count, 0)) {
+        return n;
+    }
     return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n = 0;
+    if(uring_io(fd, SO_SNDTIMEO, n, URING_WRITEV, iov, iovcnt, 0)) {
+        return n;
+    }
     return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n = 0;
+    if(uring_io(s, SO_SNDTIMEO, n, URING_SEND, msg, len, flags)) {
+        return n;
+    }
     return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
+    // io_uring没有sendto，转换为sendmsg
+    struct iovec iov = {(void*)msg, len};
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = (void*)to;
+    mh.msg_namelen = tolen;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    ssize_t n = 0;
+    if(uring_io(s, SO_SNDTIMEO, n, URING_SENDMSG, &mh, 1, flags)) {
+        return n;
+    }
     return do_io(s, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
+    ssize_t n = 0;
+    if(uring_io(s, SO_SNDTIMEO, n, URING_SENDMSG, msg, 1, flags)) {
+        return n;
+    }
     return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+// io_uring没有sendfile，socket不可写时挂起协程等待可写事件
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
 // 对close进行包装
 int close(int fd) {
     //钩子启用判断
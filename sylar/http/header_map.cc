@@ -0,0 +1,134 @@
+#include "header_map.h"
+
+namespace sylar {
+namespace http {
+
+/// 首次插入时预留的索引项数和arena大小
+static const size_t s_init_entries = 16;
+static const size_t s_init_arena = 512;
+
+std::ostream& operator<<(std::ostream& os, const StringRef& str) {
+    return os.write(str.data(), str.size());
+}
+
+uint32_t HeaderMap::Hash(const char* str, size_t len) {
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        unsigned char c = str[i];
+        if(c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+int HeaderMap::find(const char* name, size_t name_len) const {
+    uint32_t hash = Hash(name, name_len);
+    const char* base = m_arena.data();
+    for(size_t i = 0; i < m_entries.size(); ++i) {
+        const Entry& e = m_entries[i];
+        if(e.hash == hash && e.nameLen == name_len
+                && strncasecmp(base + e.nameOffset, name, name_len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t HeaderMap::append(const char* data, size_t len) {
+    uint32_t offset = m_arena.size();
+    m_arena.append(data, len);
+    return offset;
+}
+
+void HeaderMap::set(const char* name, size_t name_len, const char* value, size_t value_len) {
+    // 参数可能指向arena自身(例如遍历时取得的StringRef)，追加前先拷贝出来
+    const char* begin = m_arena.data();
+    const char* end = begin + m_arena.size();
+    if((name >= begin && name < end) || (value >= begin && value < end)) {
+        std::string n(name, name_len);
+        std::string v(value, value_len);
+        set(n.data(), n.size(), v.data(), v.size());
+        return;
+    }
+
+    int idx = find(name, name_len);
+    if(idx >= 0) {
+        Entry& e = m_entries[idx];
+        if(value_len <= e.valueLen) {
+            memcpy(&m_arena[e.valueOffset], value, value_len);
+            m_garbage += e.valueLen - value_len;
+        } else {
+            m_garbage += e.valueLen;
+            e.valueOffset = append(value, value_len);
+        }
+        e.valueLen = value_len;
+        compact();
+        return;
+    }
+
+    if(m_entries.empty()) {
+        m_entries.reserve(s_init_entries);
+        m_arena.reserve(s_init_arena);
+    }
+    Entry e;
+    e.hash = Hash(name, name_len);
+    e.nameLen = name_len;
+    e.nameOffset = append(name, name_len);
+    e.valueLen = value_len;
+    e.valueOffset = append(value, value_len);
+    m_entries.push_back(e);
+}
+
+bool HeaderMap::get(const char* name, size_t name_len, StringRef& value) const {
+    int idx = find(name, name_len);
+    if(idx < 0) {
+        return false;
+    }
+    const Entry& e = m_entries[idx];
+    value = StringRef(m_arena.data() + e.valueOffset, e.valueLen);
+    return true;
+}
+
+bool HeaderMap::del(const std::string& name) {
+    int idx = find(name.data(), name.size());
+    if(idx < 0) {
+        return false;
+    }
+    m_garbage += m_entries[idx].nameLen + m_entries[idx].valueLen;
+    m_entries.erase(m_entries.begin() + idx);
+    if(m_entries.empty()) {
+        clear();
+    } else {
+        compact();
+    }
+    return true;
+}
+
+void HeaderMap::clear() {
+    m_arena.clear();
+    m_entries.clear();
+    m_garbage = 0;
+}
+
+void HeaderMap::compact() {
+    if(m_garbage * 2 <= m_arena.size() || m_garbage < s_init_arena) {
+        return;
+    }
+    std::string arena;
+    arena.reserve(m_arena.size() - m_garbage);
+    for(auto& e : m_entries) {
+        uint32_t offset = arena.size();
+        arena.append(m_arena, e.nameOffset, e.nameLen);
+        e.nameOffset = offset;
+        offset = arena.size();
+        arena.append(m_arena, e.valueOffset, e.valueLen);
+        e.valueOffset = offset;
+    }
+    m_arena.swap(arena);
+    m_garbage = 0;
+}
+
+}
+}
@@ -0,0 +1,196 @@
+/**
+ * @file header_map.h
+ * @brief 紧凑的HTTP头部存储
+ */
+#ifndef __SYLAR_HTTP_HEADER_MAP_H__
+#define __SYLAR_HTTP_HEADER_MAP_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+#include <string.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 只读字符串片段(不持有内存)
+ * @details 指向HeaderMap内部的数据，HeaderMap被修改后失效
+ */
+class StringRef {
+public:
+    StringRef()
+        :m_data(""), m_size(0) {}
+    StringRef(const char* data, size_t size)
+        :m_data(data), m_size(size) {}
+
+    const char* data() const { return m_data;}
+    size_t size() const { return m_size;}
+    bool empty() const { return m_size == 0;}
+
+    /**
+     * @brief 拷贝成std::string
+     */
+    std::string toString() const { return std::string(m_data, m_size);}
+    operator std::string() const { return toString();}
+
+    /**
+     * @brief 忽略大小写比较
+     */
+    bool equalsIgnoreCase(const char* str, size_t len) const {
+        return m_size == len && strncasecmp(m_data, str, len) == 0;
+    }
+    bool equalsIgnoreCase(const char* str) const {
+        return equalsIgnoreCase(str, strlen(str));
+    }
+
+    bool operator==(const std::string& rhs) const {
+        return m_size == rhs.size() && memcmp(m_data, rhs.data(), m_size) == 0;
+    }
+    bool operator!=(const std::string& rhs) const { return !(*this == rhs);}
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+std::ostream& operator<<(std::ostream& os, const StringRef& str);
+
+/**
+ * @brief HTTP头部容器，名称忽略大小写
+ * @details 名称和值连续存放在一块arena中，索引是一个小数组，每项保存偏移、长度和
+ *          名称小写后的hash，查找时先比较hash再比较名称。
+ *          头部一般只有十几项，线性扫描比std::map的节点分配和比较更快，
+ *          解析时每个字段只追加一次到arena，不再构造临时std::string。
+ *          按插入顺序遍历；覆盖和删除留下的空洞超过一半时整理arena
+ */
+class HeaderMap {
+public:
+    /**
+     * @brief 遍历时的字段，first为名称，second为值
+     */
+    struct Field {
+        StringRef first;
+        StringRef second;
+    };
+
+    class const_iterator {
+    public:
+        const_iterator(const HeaderMap* map, size_t idx)
+            :m_map(map), m_idx(idx) { load();}
+
+        const Field& operator*() const { return m_field;}
+        const Field* operator->() const { return &m_field;}
+        const_iterator& operator++() {
+            ++m_idx;
+            load();
+            return *this;
+        }
+        bool operator==(const const_iterator& rhs) const { return m_idx == rhs.m_idx;}
+        bool operator!=(const const_iterator& rhs) const { return m_idx != rhs.m_idx;}
+    private:
+        void load();
+    private:
+        const HeaderMap* m_map;
+        size_t m_idx;
+        Field m_field;
+    };
+
+    HeaderMap() {}
+
+    /**
+     * @brief 设置字段，名称已存在时覆盖值(保留原来的名称写法和位置)
+     */
+    void set(const char* name, size_t name_len, const char* value, size_t value_len);
+    void set(const std::string& name, const std::string& value) {
+        set(name.data(), name.size(), value.data(), value.size());
+    }
+
+    /**
+     * @brief 查找字段的值
+     * @param[out] value 存在时指向值，HeaderMap修改后失效
+     * @return 是否存在
+     */
+    bool get(const char* name, size_t name_len, StringRef& value) const;
+    bool get(const std::string& name, StringRef& value) const {
+        return get(name.data(), name.size(), value);
+    }
+
+    /**
+     * @brief 是否存在
+     */
+    bool has(const std::string& name) const {
+        return find(name.data(), name.size()) >= 0;
+    }
+
+    /**
+     * @brief 删除字段
+     * @return 是否存在
+     */
+    bool del(const std::string& name);
+
+    /**
+     * @brief 清空，保留已分配的内存
+     */
+    void clear();
+
+    size_t size() const { return m_entries.size();}
+    bool empty() const { return m_entries.empty();}
+
+    const_iterator begin() const { return const_iterator(this, 0);}
+    const_iterator end() const { return const_iterator(this, m_entries.size());}
+
+    /**
+     * @brief 名称小写后的hash(FNV-1a)
+     */
+    static uint32_t Hash(const char* str, size_t len);
+private:
+    /**
+     * @brief 索引项
+     */
+    struct Entry {
+        uint32_t nameOffset;
+        uint32_t nameLen;
+        uint32_t valueOffset;
+        uint32_t valueLen;
+        uint32_t hash;
+    };
+
+    /**
+     * @brief 查找
+     * @return 索引项下标，不存在返回-1
+     */
+    int find(const char* name, size_t name_len) const;
+
+    /**
+     * @brief 追加到arena
+     * @return 偏移
+     */
+    uint32_t append(const char* data, size_t len);
+
+    /**
+     * @brief 空洞超过一半时整理arena
+     */
+    void compact();
+private:
+    /// 名称和值
+    std::string m_arena;
+    /// 索引
+    std::vector<Entry> m_entries;
+    /// arena中不再使用的字节数
+    size_t m_garbage = 0;
+};
+
+inline void HeaderMap::const_iterator::load() {
+    if(m_idx < m_map->m_entries.size()) {
+        const Entry& e = m_map->m_entries[m_idx];
+        const char* base = m_map->m_arena.data();
+        m_field.first = StringRef(base + e.nameOffset, e.nameLen);
+        m_field.second = StringRef(base + e.valueOffset, e.valueLen);
+    }
+}
+
+}
+}
+
+#endif
@@ -73,8 +73,8 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
 
 std::string HttpRequest::getHeader(const std::string& key
                             ,const std::string& def) const {
-    auto it = m_headers.find(key);
-    return it == m_headers.end() ? def : it->second;
+    StringRef v;
+    return m_headers.get(key, v) ? v.toString() : def;
 }
 
 std::shared_ptr<HttpResponse> HttpRequest::createResponse() {
@@ -96,8 +96,23 @@ std::string HttpRequest::getCookie(const std::string& key,const std::string& def
     return it == m_cookies.end() ? def : it->second;
 }
 
+std::string HttpRequest::getPathParam(const std::string& key, const std::string& def) const {
+    const PathParam* p = findPathParam(key);
+    return p ? m_path.substr(p->offset, p->size) : def;
+}
+
+const HttpRequest::PathParam* HttpRequest::findPathParam(const std::string& key) const {
+    for(size_t i = 0; i < m_pathParams.size(); ++i) {
+        const PathParam& p = m_pathParams[i];
+        if(p.name.size() == key.size() && strcasecmp(p.name.c_str(), key.c_str()) == 0) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
 void HttpRequest::setHeader(const std::string& key, const std::string& val) {
-    m_headers[key] = val;
+    m_headers.set(key, val);
 }
 
 void HttpRequest::setParam(const std::string& key, const std::string& val) {
@@ -108,8 +123,16 @@ void HttpRequest::setCookie(const std::string& key, const std::string& val) {
     m_cookies[key] = val;
 }
 
+void HttpRequest::setPathParam(const std::string& key, size_t offset, size_t size) {
+    PathParam p;
+    p.name = key;
+    p.offset = offset;
+    p.size = size;
+    m_pathParams.push_back(p);
+}
+
 void HttpRequest::delHeader(const std::string& key) {
-    m_headers.erase(key);
+    m_headers.del(key);
 }
 
 void HttpRequest::delParam(const std::string& key) {
@@ -121,12 +144,12 @@ void HttpRequest::delCookie(const std::string& key) {
 }
 
 bool HttpRequest::hasHeader(const std::string& key, std::string* val) {
-    auto it = m_headers.find(key);
-    if(it == m_headers.end()) {
+    StringRef v;
+    if(!m_headers.get(key, v)) {
         return false;
     }
     if(val) {
-        *val = it->second;
+        *val = v.toString();
     }
     return true;
 }
@@ -144,6 +167,17 @@ bool HttpRequest::hasParam(const std::string& key, std::string* val) {
     return true;
 }
 
+bool HttpRequest::hasPathParam(const std::string& key, std::string* val) const {
+    const PathParam* p = findPathParam(key);
+    if(!p) {
+        return false;
+    }
+    if(val) {
+        val->assign(m_path, p->offset, p->size);
+    }
+    return true;
+}
+
 bool HttpRequest::hasCookie(const std::string& key, std::string* val) {
     initCookies();
     auto it = m_cookies.find(key);
@@ -182,7 +216,7 @@ std::ostream& HttpRequest::dump(std::ostream& os) const {
         os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
     }
     for(auto& i : m_headers) {
-        if(!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
+        if(!m_websocket && i.first.equalsIgnoreCase("connection")) {
             continue;
         }
         os << i.first << ": " << i.second << "\r\n";
@@ -205,6 +239,9 @@ void HttpRequest::init() {
         } else {
             m_close = true;
         }
+    } else {
+        // HTTP/1.1默认长连接，HTTP/1.0默认短连接
+        m_close = m_version < 0x11;
     }
 }
 
@@ -275,16 +312,16 @@ HttpResponse::HttpResponse(uint8_t version, bool close)
 }
 
 std::string HttpResponse::getHeader(const std::string& key, const std::string& def) const {
-    auto it = m_headers.find(key);
-    return it == m_headers.end() ? def : it->second;
+    StringRef v;
+    return m_headers.get(key, v) ? v.toString() : def;
 }
 
 void HttpResponse::setHeader(const std::string& key, const std::string& val) {
-    m_headers[key] = val;
+    m_headers.set(key, val);
 }
 
 void HttpResponse::delHeader(const std::string& key) {
-    m_headers.erase(key);
+    m_headers.del(key);
 }
 
 void HttpResponse::setRedirect(const std::string& uri) {
@@ -320,35 +357,60 @@ std::string HttpResponse::toString() const {
 }
 
 std::ostream& HttpResponse::dump(std::ostream& os) const {
-    os << "HTTP/"
-       << ((uint32_t)(m_version >> 4))
-       << "."
-       << ((uint32_t)(m_version & 0x0F))
-       << " "
-       << (uint32_t)m_status
-       << " "
-       << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
-       << "\r\n";
+    std::string header;
+    serializeHeader(header);
+    os << header << m_body;
+    return os;
+}
+
+/**
+ * @brief 追加十进制整数
+ */
+static void append_uint(std::string& buf, uint64_t v) {
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    buf.append(p, tmp + sizeof(tmp) - p);
+}
+
+void HttpResponse::serializeHeader(std::string& buf) const {
+    buf.append("HTTP/");
+    buf.push_back('0' + (m_version >> 4));
+    buf.push_back('.');
+    buf.push_back('0' + (m_version & 0x0F));
+    buf.push_back(' ');
+    append_uint(buf, (uint32_t)m_status);
+    buf.push_back(' ');
+    if(m_reason.empty()) {
+        buf.append(HttpStatusToString(m_status));
+    } else {
+        buf.append(m_reason);
+    }
+    buf.append("\r\n");
 
     for(auto& i : m_headers) {
-        if(!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
+        if(!m_websocket && i.first.equalsIgnoreCase("connection")) {
             continue;
         }
-        os << i.first << ": " << i.second << "\r\n";
+        buf.append(i.first.data(), i.first.size()).append(": ")
+           .append(i.second.data(), i.second.size()).append("\r\n");
     }
     for(auto& i : m_cookies) {
-        os << "Set-Cookie: " << i << "\r\n";
+        buf.append("Set-Cookie: ").append(i).append("\r\n");
     }
     if(!m_websocket) {
-        os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+        buf.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
     }
     if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
+        buf.append("content-length: ");
+        append_uint(buf, m_body.size());
+        buf.append("\r\n\r\n");
     } else {
-        os << "\r\n";
+        buf.append("\r\n");
     }
-    return os;
 }
 
 std::ostream& operator<<(std::ostream& os, const HttpRequest& req) {
@@ -13,6 +13,9 @@
 #include <iostream>
 #include <sstream>
 #include <boost/lexical_cast.hpp>
+#include "sylar/stream.h"
+#include "sylar/ds/small_vector.h"
+#include "header_map.h"
 
 namespace sylar {
 
@@ -62,6 +65,8 @@ namespace http {
   XX(32, UNLINK,      UNLINK)       \
   /* icecast */                     \
   XX(33, SOURCE,      SOURCE)       \
+  /* RFC-7540 connection preface */ \
+  XX(34, PRI,         PRI)          \
 
 /* Status Codes */
 #define HTTP_STATUS_MAP(XX)                                                 \
@@ -230,6 +235,42 @@ T getAs(const MapType& m, const std::string& key, const T& def = T()) {
     return def;
 }
 
+/**
+ * @brief 获取HeaderMap中的key值,并转成对应类型,返回是否成功
+ * @details 直接从HeaderMap内部的数据转换，不拷贝出std::string
+ */
+template<class T>
+bool checkGetAs(const HeaderMap& m, const std::string& key, T& val, const T& def = T()) {
+    StringRef v;
+    if(!m.get(key, v)) {
+        val = def;
+        return false;
+    }
+    try {
+        val = boost::lexical_cast<T>(v.data(), v.size());
+        return true;
+    } catch (...) {
+        val = def;
+    }
+    return false;
+}
+
+/**
+ * @brief 获取HeaderMap中的key值,并转成对应类型
+ */
+template<class T>
+T getAs(const HeaderMap& m, const std::string& key, const T& def = T()) {
+    StringRef v;
+    if(!m.get(key, v)) {
+        return def;
+    }
+    try {
+        return boost::lexical_cast<T>(v.data(), v.size());
+    } catch (...) {
+    }
+    return def;
+}
+
 class HttpResponse;
 
 /**
@@ -243,6 +284,20 @@ public:
     /// MAP结构，按照键从小到大排列
     typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
 
+    /**
+     * @brief 路由匹配出的路径参数，值是请求路径中的一段，不做拷贝
+     */
+    struct PathParam {
+        /// 参数名
+        std::string name;
+        /// 值在请求路径中的偏移
+        uint32_t offset;
+        /// 值的长度
+        uint32_t size;
+    };
+    /// 路径参数列表，一般只有几个，放在对象内部
+    typedef sylar::ds::SmallVector<PathParam, 4> PathParamList;
+
     /**
      * @brief 构造函数
      * @param[in] version 版本
@@ -281,9 +336,16 @@ public:
     const std::string& getBody() const { return m_body;}
 
     /**
-     * @brief 返回HTTP请求的消息头MAP
+     * @brief 返回HTTP请求的消息体读取流
+     * @details 消息体以流的方式接收时不为空，此时getBody()为空，
+     *          read返回0表示消息体结束
+     */
+    Stream::ptr getBodyStream() const { return m_bodyStream;}
+
+    /**
+     * @brief 返回HTTP请求的消息头
      */
-    const MapType& getHeaders() const { return m_headers;}
+    const HeaderMap& getHeaders() const { return m_headers;}
 
     /**
      * @brief 返回HTTP请求的参数MAP
@@ -295,6 +357,12 @@ public:
      */
     const MapType& getCookies() const { return m_cookies;}
 
+    /**
+     * @brief 返回路由匹配出的路径参数
+     * @details 例如路由/users/:id匹配/users/42时为{id, offset=7, size=2}，值在getPath()中
+     */
+    const PathParamList& getPathParams() const { return m_pathParams;}
+
     /**
      * @brief 设置HTTP请求的方法名
      * @param[in] v HTTP请求
@@ -311,7 +379,11 @@ public:
      * @brief 设置HTTP请求的路径
      * @param[in] v 请求路径
      */
-    void setPath(const std::string& v) { m_path = v;}
+    void setPath(const std::string& v) {
+        m_path = v;
+        // 路径参数指向原来的路径
+        m_pathParams.clear();
+    }
 
     /**
      * @brief 设置HTTP请求的查询参数
@@ -331,6 +403,11 @@ public:
      */
     void setBody(const std::string& v) { m_body = v;}
 
+    /**
+     * @brief 设置HTTP请求的消息体读取流
+     */
+    void setBodyStream(Stream::ptr v) { m_bodyStream = v;}
+
     /**
      * @brief 是否自动关闭
      */
@@ -352,10 +429,10 @@ public:
     void setWebsocket(bool v) { m_websocket = v;}
 
     /**
-     * @brief 设置HTTP请求的头部MAP
-     * @param[in] v map
+     * @brief 设置HTTP请求的头部
+     * @param[in] v 头部
      */
-    void setHeaders(const MapType& v) { m_headers = v;}
+    void setHeaders(const HeaderMap& v) { m_headers = v;}
 
     /**
      * @brief 设置HTTP请求的参数MAP
@@ -393,6 +470,13 @@ public:
      */
     std::string getCookie(const std::string& key, const std::string& def = "");
 
+    /**
+     * @brief 获取路径参数
+     * @param[in] key 参数名(路由中:后面的名称)
+     * @param[in] def 默认值
+     * @return 如果存在则返回对应值,否则返回默认值
+     */
+    std::string getPathParam(const std::string& key, const std::string& def = "") const;
     
     /**
      * @brief 设置HTTP请求的头部参数
@@ -401,6 +485,14 @@ public:
      */
     void setHeader(const std::string& key, const std::string& val);
 
+    /**
+     * @brief 设置HTTP请求的头部参数
+     * @details 解析器回调使用，名称和值直接追加到头部存储，不构造临时字符串
+     */
+    void setHeader(const char* key, size_t key_len, const char* val, size_t val_len) {
+        m_headers.set(key, key_len, val, val_len);
+    }
+
     /**
      * @brief 设置HTTP请求的请求参数
      * @param[in] key 关键字
@@ -415,6 +507,14 @@ public:
      */
     void setCookie(const std::string& key, const std::string& val);
 
+    /**
+     * @brief 设置路径参数
+     * @param[in] key 关键字
+     * @param[in] offset 值在请求路径中的偏移
+     * @param[in] size 值的长度
+     */
+    void setPathParam(const std::string& key, size_t offset, size_t size);
+
     /**
      * @brief 删除HTTP请求的头部参数
      * @param[in] key 关键字
@@ -457,6 +557,14 @@ public:
      */
     bool hasCookie(const std::string& key, std::string* val = nullptr);
 
+    /**
+     * @brief 判断路径参数是否存在
+     * @param[in] key 关键字
+     * @param[out] val 如果存在,val非空则赋值
+     * @return 是否存在
+     */
+    bool hasPathParam(const std::string& key, std::string* val = nullptr) const;
+
     /**
      * @brief 检查并获取HTTP请求的头部参数
      * @tparam T 转换类型
@@ -538,6 +646,44 @@ public:
         return getAs(m_cookies, key, def);
     }
 
+    /**
+     * @brief 检查并获取路径参数
+     * @tparam T 转换类型
+     * @param[in] key 关键字
+     * @param[out] val 返回值
+     * @param[in] def 默认值
+     * @return 如果存在且转换成功返回true,否则失败val=def
+     */
+    template<class T>
+    bool checkGetPathParamAs(const std::string& key, T& val, const T& def = T()) const {
+        const PathParam* p = findPathParam(key);
+        if(!p) {
+            val = def;
+            return false;
+        }
+        try {
+            val = boost::lexical_cast<T>(m_path.data() + p->offset, p->size);
+            return true;
+        } catch (...) {
+            val = def;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 获取路径参数
+     * @tparam T 转换类型
+     * @param[in] key 关键字
+     * @param[in] def 默认值
+     * @return 如果存在且转换成功返回对应的值,否则返回def
+     */
+    template<class T>
+    T getPathParamAs(const std::string& key, const T& def = T()) const {
+        T val;
+        checkGetPathParamAs(key, val, def);
+        return val;
+    }
+
     /**
      * @brief 序列化输出到流中
      * @param[in, out] os 输出流
@@ -553,6 +699,7 @@ public:
 
     /**
      * @brief 初始化
+     * @details 根据connection头设置是否自动关闭，没有时按HTTP版本的默认行为
      */
     void init();
 
@@ -575,6 +722,12 @@ public:
      * @brief 初始化Cookies
      */
     void initCookies();
+private:
+    /**
+     * @brief 按名称(忽略大小写)查找路径参数
+     * @return 不存在返回nullptr
+     */
+    const PathParam* findPathParam(const std::string& key) const;
 private:
     /// HTTP方法
     HttpMethod m_method;
@@ -595,12 +748,16 @@ private:
     std::string m_fragment;
     /// 请求消息体
     std::string m_body;
-    /// 请求头部MAP
-    MapType m_headers;
+    /// 请求消息体读取流
+    Stream::ptr m_bodyStream;
+    /// 请求头部
+    HeaderMap m_headers;
     /// 请求参数MAP
     MapType m_params;
     /// 请求Cookie MAP
     MapType m_cookies;
+    /// 路由匹配出的路径参数
+    PathParamList m_pathParams;
 };
 
 /**
@@ -639,16 +796,22 @@ public:
      */
     const std::string& getBody() const { return m_body;}
 
+    /**
+     * @brief 返回响应消息体读取流
+     * @details 消息体以流的方式接收时不为空，此时getBody()为空，
+     *          read返回0表示消息体结束
+     */
+    Stream::ptr getBodyStream() const { return m_bodyStream;}
+
     /**
      * @brief 返回响应原因
      */
     const std::string& getReason() const { return m_reason;}
 
     /**
-     * @brief 返回响应头部MAP
-     * @return MAP
+     * @brief 返回响应头部
      */
-    const MapType& getHeaders() const { return m_headers;}
+    const HeaderMap& getHeaders() const { return m_headers;}
 
     /**
      * @brief 设置响应状态
@@ -668,6 +831,11 @@ public:
      */
     void setBody(const std::string& v) { m_body = v;}
 
+    /**
+     * @brief 设置响应消息体读取流
+     */
+    void setBodyStream(Stream::ptr v) { m_bodyStream = v;}
+
     /**
      * @brief 设置响应原因
      * @param[in] v 原因
@@ -675,10 +843,10 @@ public:
     void setReason(const std::string& v) { m_reason = v;}
 
     /**
-     * @brief 设置响应头部MAP
-     * @param[in] v MAP
+     * @brief 设置响应头部
+     * @param[in] v 头部
      */
-    void setHeaders(const MapType& v) { m_headers = v;}
+    void setHeaders(const HeaderMap& v) { m_headers = v;}
 
     /**
      * @brief 是否自动关闭
@@ -715,6 +883,14 @@ public:
      */
     void setHeader(const std::string& key, const std::string& val);
 
+    /**
+     * @brief 设置响应头部参数
+     * @details 解析器回调使用，名称和值直接追加到头部存储，不构造临时字符串
+     */
+    void setHeader(const char* key, size_t key_len, const char* val, size_t val_len) {
+        m_headers.set(key, key_len, val, val_len);
+    }
+
     /**
      * @brief 删除响应头部参数
      * @param[in] key 关键字
@@ -753,6 +929,13 @@ public:
      */
     std::ostream& dump(std::ostream& os) const;
 
+    /**
+     * @brief 把状态行和头部(含结尾的空行)追加到buf中，不包含消息体
+     * @details 不经过iostream，buf可以在连接上复用，配合writev发送消息体时消息体不需要拷贝
+     * @param[in, out] buf 输出缓冲区
+     */
+    void serializeHeader(std::string& buf) const;
+
     /**
      * @brief 转成字符串
      */
@@ -766,6 +949,11 @@ public:
     void setCookie(const std::string& key, const std::string& val,
                    time_t expired = 0, const std::string& path = "",
                    const std::string& domain = "", bool secure = false);
+
+    /**
+     * @brief 获取Set-Cookie列表
+     */
+    const std::vector<std::string>& getCookies() const { return m_cookies;}
 private:
     /// 响应状态
     HttpStatus m_status;
@@ -777,10 +965,12 @@ private:
     bool m_websocket;
     /// 响应消息体
     std::string m_body;
+    /// 响应消息体读取流
+    Stream::ptr m_bodyStream;
     /// 响应原因
     std::string m_reason;
-    /// 响应头部MAP
-    MapType m_headers;
+    /// 响应头部
+    HeaderMap m_headers;
 
     std::vector<std::string> m_cookies;
 };
@@ -0,0 +1,301 @@
+#include "http_body.h"
+#include "sylar/log.h"
+#include <string.h>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 块头一行的最大长度
+static const size_t s_max_line_size = 4096;
+/// 块大小最多的十六进制位数，15位时最大值小于UNTIL_CLOSE
+static const size_t s_max_chunk_size_digits = 15;
+
+static int HexValue(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+HttpBodyReader::HttpBodyReader(Stream::ptr stream, bool chunked, uint64_t length
+                               ,size_t buff_size)
+    :m_stream(stream)
+    ,m_left(chunked ? 0 : length)
+    ,m_chunked(chunked) {
+    if(chunked) {
+        m_buf.resize(buff_size);
+    } else if(length == 0) {
+        m_done = true;
+    }
+}
+
+void HttpBodyReader::feed(const char* data, size_t length) {
+    if(length == 0) {
+        return;
+    }
+    // 把未处理的数据移到开头，再追加
+    if(m_pos > 0) {
+        memmove(&m_buf[0], &m_buf[m_pos], m_end - m_pos);
+        m_end -= m_pos;
+        m_pos = 0;
+    }
+    if(m_buf.size() < m_end + length) {
+        m_buf.resize(m_end + length);
+    }
+    memcpy(&m_buf[m_end], data, length);
+    m_end += length;
+}
+
+int HttpBodyReader::readData(void* buffer, size_t length) {
+    if(m_pos < m_end) {
+        size_t n = std::min(length, m_end - m_pos);
+        memcpy(buffer, &m_buf[m_pos], n);
+        m_pos += n;
+        return n;
+    }
+    // 预读缓冲区为空时直接读到用户内存，不多读
+    return m_stream->read(buffer, length);
+}
+
+bool HttpBodyReader::readLine(std::string& line) {
+    line.clear();
+    while(true) {
+        char* begin = &m_buf[0] + m_pos;
+        char* nl = (char*)memchr(begin, '\n', m_end - m_pos);
+        if(nl) {
+            line.append(begin, nl - begin);
+            m_pos = nl - &m_buf[0] + 1;
+            if(!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return true;
+        }
+        line.append(begin, m_end - m_pos);
+        m_pos = m_end = 0;
+        if(line.size() > s_max_line_size) {
+            SYLAR_LOG_WARN(g_logger) << "http chunk line too long";
+            return false;
+        }
+        int rt = m_stream->read(&m_buf[0], m_buf.size());
+        if(rt <= 0) {
+            return false;
+        }
+        m_end = rt;
+    }
+}
+
+bool HttpBodyReader::readChunkHeader() {
+    std::string line;
+    // 上一块数据后面的\r\n
+    if(m_chunkEnd) {
+        if(!readLine(line) || !line.empty()) {
+            return false;
+        }
+        m_chunkEnd = false;
+    }
+    if(!readLine(line)) {
+        return false;
+    }
+    // 块大小: 只接受1~15位十六进制数字(不允许空白、符号、0x前缀)，
+    // 保证不会等于UNTIL_CLOSE；后面只能是块扩展(;)或行尾
+    uint64_t size = 0;
+    size_t i = 0;
+    for(; i < line.size() && HexValue(line[i]) >= 0; ++i) {
+        size = (size << 4) | HexValue(line[i]);
+    }
+    if(i == 0 || i > s_max_chunk_size_digits
+            || (i < line.size() && line[i] != ';')) {
+        SYLAR_LOG_WARN(g_logger) << "invalid http chunk size: " << line;
+        return false;
+    }
+    if(size > 0) {
+        m_left = size;
+        return true;
+    }
+    // 最后一块，跳过trailer直到空行
+    do {
+        if(!readLine(line)) {
+            return false;
+        }
+    } while(!line.empty());
+    m_done = true;
+    return true;
+}
+
+int HttpBodyReader::read(void* buffer, size_t length) {
+    if(m_error) {
+        return -1;
+    }
+    if(m_done || length == 0) {
+        return 0;
+    }
+    if(m_chunked && m_left == 0) {
+        if(!readChunkHeader()) {
+            m_error = true;
+            return -1;
+        }
+        if(m_done) {
+            return 0;
+        }
+    }
+    int rt = readData(buffer, std::min((uint64_t)length, m_left));
+    if(rt == 0 && m_left == UNTIL_CLOSE) {
+        m_done = true;
+        return 0;
+    }
+    if(rt <= 0) {
+        m_error = true;
+        return -1;
+    }
+    if(m_left != UNTIL_CLOSE) {
+        m_left -= rt;
+    }
+    m_readSize += rt;
+    if(m_left == 0) {
+        if(m_chunked) {
+            m_chunkEnd = true;
+        } else {
+            m_done = true;
+        }
+    }
+    return rt;
+}
+
+int HttpBodyReader::read(ByteArray::ptr ba, size_t length) {
+    if(length == 0) {
+        return 0;
+    }
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    int rt = read(iovs[0].iov_base, iovs[0].iov_len);
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+void HttpBodyReader::close() {
+    if(m_stream) {
+        m_stream->close();
+    }
+}
+
+bool HttpBodyReader::discard() {
+    char buf[4096];
+    int rt = 0;
+    while((rt = read(buf, sizeof(buf))) > 0);
+    return rt == 0;
+}
+
+bool HttpBodyReader::readAll(std::string& body, uint64_t max_size) {
+    if(!m_chunked && m_left != UNTIL_CLOSE && m_left > max_size) {
+        return false;
+    }
+    while(!m_done) {
+        size_t size = body.size();
+        size_t len = (m_chunked || m_left == UNTIL_CLOSE) ? 4096 : m_left;
+        if(size + len > max_size) {
+            len = max_size - size + 1;
+        }
+        body.resize(size + len);
+        int rt = read(&body[size], len);
+        if(rt < 0) {
+            return false;
+        }
+        body.resize(size + rt);
+        if(body.size() > max_size) {
+            SYLAR_LOG_WARN(g_logger) << "http body too large, max_size=" << max_size;
+            return false;
+        }
+    }
+    return true;
+}
+
+HttpBodyWriter::HttpBodyWriter(SocketStream::ptr stream, bool chunked)
+    :m_stream(stream)
+    ,m_chunked(chunked) {
+}
+
+HttpBodyWriter::~HttpBodyWriter() {
+    close();
+}
+
+int HttpBodyWriter::writeChunk(iovec* iovs, size_t count, size_t length) {
+    if(m_closed || m_error) {
+        return -1;
+    }
+    if(length == 0) {
+        // 长度为0的块表示结束，不能发送
+        return 0;
+    }
+    int rt = 0;
+    if(m_chunked) {
+        // 块头 + 数据 + \r\n，一次writev
+        char head[20];
+        int head_len = snprintf(head, sizeof(head), "%zx\r\n", length);
+        iovec local[8];
+        std::vector<iovec> heap;
+        iovec* all = local;
+        if(count + 2 > sizeof(local) / sizeof(local[0])) {
+            heap.resize(count + 2);
+            all = &heap[0];
+        }
+        all[0].iov_base = head;
+        all[0].iov_len = head_len;
+        memcpy(&all[1], iovs, count * sizeof(iovec));
+        all[count + 1].iov_base = (void*)"\r\n";
+        all[count + 1].iov_len = 2;
+        rt = m_stream->writevFixSize(all, count + 2);
+    } else {
+        rt = m_stream->writevFixSize(iovs, count);
+    }
+    if(rt <= 0) {
+        m_error = true;
+        return rt;
+    }
+    m_writeSize += length;
+    return length;
+}
+
+int HttpBodyWriter::write(const void* buffer, size_t length) {
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len = length;
+    return writeChunk(&iov, 1, length);
+}
+
+int HttpBodyWriter::write(ByteArray::ptr ba, size_t length) {
+    std::vector<iovec> iovs;
+    length = ba->getReadBuffers(iovs, length);
+    if(length == 0) {
+        return 0;
+    }
+    int rt = writeChunk(&iovs[0], iovs.size(), length);
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+void HttpBodyWriter::close() {
+    if(m_closed) {
+        return;
+    }
+    m_closed = true;
+    if(m_chunked && !m_error) {
+        if(m_stream->writeFixSize("0\r\n\r\n", 5) <= 0) {
+            m_error = true;
+        }
+    }
+}
+
+}
+}
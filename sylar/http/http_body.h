@@ -0,0 +1,224 @@
+/**
+ * @file http_body.h
+ * @brief HTTP消息体的流式读写(支持chunked编码)
+ */
+#ifndef __SYLAR_HTTP_HTTP_BODY_H__
+#define __SYLAR_HTTP_HTTP_BODY_H__
+
+#include "sylar/stream.h"
+#include "sylar/streams/socket_stream.h"
+#include <string>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 消息体读取流
+ * @details 按Content-Length或chunked编码从底层流中读取消息体，read返回0表示消息体结束。
+ *          Content-Length模式不会多读；chunked模式为了解析块头会预读，
+ *          消息体结束后多读的数据通过getRemainData取回
+ */
+class HttpBodyReader : public Stream {
+public:
+    typedef std::shared_ptr<HttpBodyReader> ptr;
+
+    /// 消息体长度未知，读到连接关闭为止(没有Content-Length的响应)
+    static const uint64_t UNTIL_CLOSE = ~0ull;
+
+    /**
+     * @brief 构造函数
+     * @param[in] stream 底层流
+     * @param[in] chunked 是否chunked编码
+     * @param[in] length 非chunked时消息体长度，UNTIL_CLOSE表示读到连接关闭
+     * @param[in] buff_size chunked模式预读缓冲区大小
+     */
+    HttpBodyReader(Stream::ptr stream, bool chunked, uint64_t length
+                   ,size_t buff_size = 4096);
+
+    /**
+     * @brief 放入解析头部时已经读到的数据，在读底层流之前先使用
+     */
+    void feed(const char* data, size_t length);
+
+    /**
+     * @brief 读取消息体
+     * @return
+     *      @retval >0 读取的长度
+     *      @retval =0 消息体结束
+     *      @retval <0 底层流错误或chunked格式错误
+     */
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 不支持写
+     */
+    virtual int write(const void* buffer, size_t length) override { return -1;}
+    virtual int write(ByteArray::ptr ba, size_t length) override { return -1;}
+
+    /**
+     * @brief 关闭底层流
+     */
+    virtual void close() override;
+
+    /**
+     * @brief 读取剩余的消息体并丢弃
+     * @return 消息体是否完整结束
+     */
+    bool discard();
+
+    /**
+     * @brief 读取剩余的全部消息体
+     * @param[out] body 消息体
+     * @param[in] max_size 最大长度，超过时返回false
+     */
+    bool readAll(std::string& body, uint64_t max_size);
+
+    /**
+     * @brief 消息体是否已经读完
+     */
+    bool isDone() const { return m_done;}
+
+    /**
+     * @brief 是否出错
+     */
+    bool isError() const { return m_error;}
+
+    /**
+     * @brief 是否chunked编码
+     */
+    bool isChunked() const { return m_chunked;}
+
+    /**
+     * @brief 已读取的消息体长度
+     */
+    uint64_t getReadSize() const { return m_readSize;}
+
+    /**
+     * @brief 消息体之后多读的数据
+     */
+    const char* getRemainData() const { return m_buf.data() + m_pos;}
+    size_t getRemainSize() const { return m_end - m_pos;}
+private:
+    /**
+     * @brief 读取一行(不含\r\n)，数据不够时从底层流读取
+     */
+    bool readLine(std::string& line);
+
+    /**
+     * @brief 读取下一个块头，最后一块时读取trailer并结束
+     */
+    bool readChunkHeader();
+
+    /**
+     * @brief 读取消息体数据，优先从预读缓冲区取
+     */
+    int readData(void* buffer, size_t length);
+private:
+    /// 底层流
+    Stream::ptr m_stream;
+    /// 预读缓冲区
+    std::vector<char> m_buf;
+    /// 预读缓冲区中未处理数据的起始位置
+    size_t m_pos = 0;
+    /// 预读缓冲区中数据的结束位置
+    size_t m_end = 0;
+    /// 当前块(或整个消息体)剩余长度
+    uint64_t m_left;
+    /// 已读取的消息体长度
+    uint64_t m_readSize = 0;
+    /// 是否chunked编码
+    bool m_chunked;
+    /// 当前块数据后是否还有\r\n未读
+    bool m_chunkEnd = false;
+    /// 是否结束
+    bool m_done = false;
+    /// 是否出错
+    bool m_error = false;
+};
+
+/**
+ * @brief 消息体写入流
+ * @details chunked模式下每次write发送一个块，close时发送结束块；
+ *          否则直接写入底层流。写入通过协程socket完成，对端接收慢时
+ *          当前协程挂起，从而对生产数据的一方形成背压
+ */
+class HttpBodyWriter : public Stream {
+public:
+    typedef std::shared_ptr<HttpBodyWriter> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] stream 底层socket流
+     * @param[in] chunked 是否chunked编码
+     */
+    HttpBodyWriter(SocketStream::ptr stream, bool chunked);
+
+    /**
+     * @brief 析构函数，没有close时发送结束块
+     */
+    ~HttpBodyWriter();
+
+    /**
+     * @brief 不支持读
+     */
+    virtual int read(void* buffer, size_t length) override { return -1;}
+    virtual int read(ByteArray::ptr ba, size_t length) override { return -1;}
+
+    /**
+     * @brief 写入消息体，全部写完才返回
+     * @return
+     *      @retval >0 写入的长度
+     *      @retval =0 对端关闭
+     *      @retval <0 socket错误或已关闭
+     */
+    virtual int write(const void* buffer, size_t length) override;
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 结束消息体，chunked模式发送结束块，不关闭底层socket
+     */
+    virtual void close() override;
+
+    /**
+     * @brief 是否chunked编码
+     */
+    bool isChunked() const { return m_chunked;}
+
+    /**
+     * @brief 是否已经结束
+     */
+    bool isClosed() const { return m_closed;}
+
+    /**
+     * @brief 是否发生过写错误
+     */
+    bool isError() const { return m_error;}
+
+    /**
+     * @brief 已写入的消息体长度
+     */
+    uint64_t getWriteSize() const { return m_writeSize;}
+private:
+    /**
+     * @brief 按块写入
+     */
+    int writeChunk(iovec* iovs, size_t count, size_t length);
+private:
+    /// 底层socket流
+    SocketStream::ptr m_stream;
+    /// 已写入的消息体长度
+    uint64_t m_writeSize = 0;
+    /// 是否chunked编码
+    bool m_chunked;
+    /// 是否已经结束
+    bool m_closed = false;
+    /// 是否发生过写错误
+    bool m_error = false;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,288 @@
+#include "http_compress.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "sylar/ds/lru_cache.h"
+#include <zlib.h>
+#include <string.h>
+#include <strings.h>
+#include <atomic>
+#include <sstream>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_http_compress_enable =
+    sylar::Config::Lookup("http.compress.enable", true, "http response compress enable");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_min_size =
+    sylar::Config::Lookup("http.compress.min_size"
+                ,(uint64_t)1024, "http response compress min body size");
+
+static sylar::ConfigVar<int>::ptr g_http_compress_level =
+    sylar::Config::Lookup("http.compress.level", (int)6, "http response compress level(1-9)");
+
+static sylar::ConfigVar<std::vector<std::string> >::ptr g_http_compress_types =
+    sylar::Config::Lookup("http.compress.types"
+                ,std::vector<std::string>{"text/", "application/json", "application/javascript"
+                    ,"application/xml", "image/svg+xml"}
+                ,"http response compress content-type prefix");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_cache_size =
+    sylar::Config::Lookup("http.compress.cache_size"
+                ,(uint64_t)1024, "http compressed response cache size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_cache_max_body =
+    sylar::Config::Lookup("http.compress.cache_max_body"
+                ,(uint64_t)(4 * 1024 * 1024), "http compressed response cache max body size");
+
+/// 压缩次数
+static std::atomic<uint64_t> s_compress_count {0};
+/// 压缩前总字节数
+static std::atomic<uint64_t> s_compress_in {0};
+/// 压缩后总字节数
+static std::atomic<uint64_t> s_compress_out {0};
+
+typedef sylar::ds::LruCache<std::string, std::shared_ptr<const std::string> > CompressCache;
+
+static CompressCache& GetCache() {
+    static CompressCache* s_cache = []() {
+        CompressCache* cache = new CompressCache(g_http_compress_cache_size->getValue());
+        g_http_compress_cache_size->addListener([cache](const uint64_t& ov, const uint64_t& nv){
+            cache->setMaxSize(nv);
+        });
+        return cache;
+    }();
+    return *s_cache;
+}
+
+namespace {
+
+/**
+ * @brief 线程内复用的压缩上下文，每次使用前deflateReset，避免反复deflateInit分配内存
+ */
+struct ThreadDeflater {
+    z_stream zs[3];
+    int level[3] = {0, 0, 0};
+    bool inited[3] = {false, false, false};
+
+    ~ThreadDeflater() {
+        for(int i = 0; i < 3; ++i) {
+            if(inited[i]) {
+                deflateEnd(&zs[i]);
+            }
+        }
+    }
+
+    z_stream* get(HttpCompress::Encoding encoding, int lv) {
+        if(inited[encoding] && level[encoding] != lv) {
+            deflateEnd(&zs[encoding]);
+            inited[encoding] = false;
+        }
+        z_stream* z = &zs[encoding];
+        if(!inited[encoding]) {
+            memset(z, 0, sizeof(*z));
+            // gzip: 15 + 16; deflate(zlib格式): 15
+            int window_bits = encoding == HttpCompress::GZIP ? 31 : 15;
+            if(deflateInit2(z, lv, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return nullptr;
+            }
+            inited[encoding] = true;
+            level[encoding] = lv;
+        } else {
+            deflateReset(z);
+        }
+        return z;
+    }
+};
+
+static thread_local ThreadDeflater t_deflater;
+
+}
+
+HttpCompress::Encoding HttpCompress::Negotiate(const std::string& accept_encoding) {
+    float q[3] = {-1, -1, -1};
+    float any = -1;
+    size_t pos = 0;
+    while(pos < accept_encoding.size()) {
+        size_t next = accept_encoding.find(',', pos);
+        if(next == std::string::npos) {
+            next = accept_encoding.size();
+        }
+        std::string item = accept_encoding.substr(pos, next - pos);
+        pos = next + 1;
+
+        float v = 1;
+        size_t semi = item.find(';');
+        if(semi != std::string::npos) {
+            std::string param = sylar::StringUtil::Trim(item.substr(semi + 1));
+            if(strncasecmp(param.c_str(), "q=", 2) == 0) {
+                v = atof(param.c_str() + 2);
+            }
+            item = item.substr(0, semi);
+        }
+        item = sylar::StringUtil::Trim(item);
+        if(strcasecmp(item.c_str(), "gzip") == 0) {
+            q[GZIP] = v;
+        } else if(strcasecmp(item.c_str(), "deflate") == 0) {
+            q[DEFLATE] = v;
+        } else if(item == "*") {
+            any = v;
+        }
+    }
+    for(int i = GZIP; i <= DEFLATE; ++i) {
+        if(q[i] < 0) {
+            q[i] = any;
+        }
+    }
+    if(q[GZIP] > 0 && q[GZIP] >= q[DEFLATE]) {
+        return GZIP;
+    }
+    if(q[DEFLATE] > 0) {
+        return DEFLATE;
+    }
+    return IDENTITY;
+}
+
+const char* HttpCompress::EncodingToString(Encoding encoding) {
+    switch(encoding) {
+        case GZIP:
+            return "gzip";
+        case DEFLATE:
+            return "deflate";
+        default:
+            return "identity";
+    }
+}
+
+bool HttpCompress::Compress(const void* data, size_t length, std::string& out, Encoding encoding) {
+    if(encoding != GZIP && encoding != DEFLATE) {
+        return false;
+    }
+    int level = g_http_compress_level->getValue();
+    if(level < 1 || level > 9) {
+        level = Z_DEFAULT_COMPRESSION;
+    }
+    z_stream* z = t_deflater.get(encoding, level);
+    if(!z) {
+        SYLAR_LOG_ERROR(g_logger) << "deflateInit2 fail, level=" << level;
+        return false;
+    }
+    // 一次压缩完，输出缓冲区按上界分配
+    out.resize(deflateBound(z, length));
+    z->next_in = (Bytef*)data;
+    z->avail_in = length;
+    z->next_out = (Bytef*)&out[0];
+    z->avail_out = out.size();
+    int rt = deflate(z, Z_FINISH);
+    if(rt != Z_STREAM_END) {
+        SYLAR_LOG_ERROR(g_logger) << "deflate fail, rt=" << rt;
+        out.clear();
+        return false;
+    }
+    out.resize(out.size() - z->avail_out);
+    return true;
+}
+
+static bool is_compress_type(const std::string& content_type) {
+    if(content_type.empty()) {
+        return false;
+    }
+    auto types = g_http_compress_types->getValue();
+    for(auto& i : types) {
+        if(strncasecmp(content_type.c_str(), i.c_str(), i.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HttpCompress::Apply(HttpRequest::ptr req, HttpResponse::ptr rsp) {
+    const std::string& body = rsp->getBody();
+    if(!g_http_compress_enable->getValue()
+            || body.size() < g_http_compress_min_size->getValue()
+            || rsp->isWebsocket()) {
+        return false;
+    }
+    int status = (int)rsp->getStatus();
+    if(status < 200 || status == 204 || status == 206 || status == 304) {
+        return false;
+    }
+    if(!rsp->getHeader("Content-Encoding").empty()
+            || !rsp->getHeader("Content-Range").empty()
+            || !is_compress_type(rsp->getHeader("Content-Type"))) {
+        return false;
+    }
+    std::string cache_control = rsp->getHeader("Cache-Control");
+    if(cache_control.find("no-transform") != std::string::npos) {
+        return false;
+    }
+
+    // 响应内容随Accept-Encoding变化，即使这次没有压缩也要告诉缓存
+    std::string vary = rsp->getHeader("Vary");
+    if(vary.empty()) {
+        rsp->setHeader("Vary", "Accept-Encoding");
+    } else if(strcasestr(vary.c_str(), "Accept-Encoding") == nullptr) {
+        rsp->setHeader("Vary", vary + ", Accept-Encoding");
+    }
+
+    Encoding encoding = Negotiate(req->getHeader("Accept-Encoding"));
+    if(encoding == IDENTITY) {
+        return false;
+    }
+
+    // 有ETag说明同一个资源的内容不变，可以缓存压缩结果。缓存是进程共享的，
+    // key要包含Host和查询参数，不同虚拟主机或参数下的ETag可能相同
+    std::string etag = rsp->getHeader("ETag");
+    std::string key;
+    bool cacheable = !etag.empty() && body.size() <= g_http_compress_cache_max_body->getValue()
+                     && cache_control.find("no-store") == std::string::npos;
+    std::shared_ptr<const std::string> data;
+    if(cacheable) {
+        std::string host = req->getHeader("Host");
+        key.reserve(host.size() + req->getPath().size() + req->getQuery().size()
+                    + etag.size() + 16);
+        key.append(host).append("\n").append(req->getPath())
+           .append("?").append(req->getQuery()).append("\n").append(etag)
+           .append("\n").append(EncodingToString(encoding));
+        GetCache().get(key, data);
+    }
+    if(!data) {
+        std::shared_ptr<std::string> out = std::make_shared<std::string>();
+        if(!Compress(body.c_str(), body.size(), *out, encoding)) {
+            return false;
+        }
+        ++s_compress_count;
+        s_compress_in += body.size();
+        s_compress_out += out->size();
+        data = out;
+        if(cacheable) {
+            GetCache().set(key, data);
+        }
+    }
+    rsp->setBody(*data);
+    // servlet显式设置的长度是压缩前的，发送时按消息体重新计算
+    rsp->delHeader("content-length");
+    rsp->setHeader("Content-Encoding", EncodingToString(encoding));
+    // 压缩后是不同的表示，强ETag改成弱ETag
+    if(!etag.empty() && etag.compare(0, 2, "W/") != 0) {
+        rsp->setHeader("ETag", "W/" + etag);
+    }
+    return true;
+}
+
+std::string HttpCompress::ToStatusString() {
+    std::stringstream ss;
+    uint64_t in = s_compress_in;
+    uint64_t out = s_compress_out;
+    ss << "compress_count=" << s_compress_count
+       << " in=" << in << " out=" << out
+       << " ratio=" << (in ? (out * 100.0 / in) : 0) << "%"
+       << " cache: " << GetCache().toStatusString();
+    return ss.str();
+}
+
+}
+}
@@ -0,0 +1,74 @@
+/**
+ * @file http_compress.h
+ * @brief HTTP响应压缩
+ * @details 根据Accept-Encoding协商gzip/deflate，每个线程复用一个z_stream；
+ *          带ETag的响应压缩结果按(路径, ETag, 编码)缓存，热点响应只压缩一次
+ */
+#ifndef __SYLAR_HTTP_HTTP_COMPRESS_H__
+#define __SYLAR_HTTP_HTTP_COMPRESS_H__
+
+#include "http.h"
+#include <string>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HTTP响应压缩
+ */
+class HttpCompress {
+public:
+    /**
+     * @brief 内容编码
+     */
+    enum Encoding {
+        /// 不压缩
+        IDENTITY = 0,
+        /// gzip
+        GZIP = 1,
+        /// deflate(zlib格式)
+        DEFLATE = 2
+    };
+
+    /**
+     * @brief 根据Accept-Encoding选择编码，q值相同时优先gzip
+     * @param[in] accept_encoding Accept-Encoding头的值
+     */
+    static Encoding Negotiate(const std::string& accept_encoding);
+
+    /**
+     * @brief 编码名称
+     */
+    static const char* EncodingToString(Encoding encoding);
+
+    /**
+     * @brief 使用当前线程的z_stream压缩数据
+     * @param[in] data 数据
+     * @param[in] length 数据长度
+     * @param[out] out 压缩结果
+     * @param[in] encoding 编码(GZIP或DEFLATE)
+     * @return 是否成功
+     */
+    static bool Compress(const void* data, size_t length, std::string& out, Encoding encoding);
+
+    /**
+     * @brief 按配置压缩响应消息体
+     * @details 需要满足: 开启了压缩、消息体不小于http.compress.min_size、
+     *          Content-Type在http.compress.types中、响应没有Content-Encoding/Content-Range、
+     *          没有Cache-Control: no-transform。满足类型条件时总是加上Vary: Accept-Encoding
+     * @param[in] req 请求
+     * @param[in, out] rsp 响应
+     * @return 是否压缩了消息体
+     */
+    static bool Apply(HttpRequest::ptr req, HttpResponse::ptr rsp);
+
+    /**
+     * @brief 压缩统计和缓存状态
+     */
+    static std::string ToStatusString();
+};
+
+}
+}
+
+#endif
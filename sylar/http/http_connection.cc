@@ -1,31 +1,279 @@
 #include "http_connection.h"
 #include "http_parser.h"
+#include "sylar/config.h"
+#include "sylar/hook.h"
 #include "sylar/log.h"
 #include "sylar/streams/zlib_stream.h"
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace sylar {
 namespace http {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_http_pool_max_idle_time =
+    sylar::Config::Lookup("http.pool.max_idle_time", (uint32_t)(30 * 1000)
+                ,"http connection pool max idle time(ms)");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http_pool_max_connecting =
+    sylar::Config::Lookup("http.pool.max_connecting", (uint32_t)8
+                ,"http connection pool max concurrent connects");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http_pool_dns_ttl =
+    sylar::Config::Lookup("http.pool.dns_ttl", (uint32_t)(60 * 1000)
+                ,"http connection pool resolved address cache time(ms)");
+
 std::string HttpResult::toString() const {
     std::stringstream ss;
     ss << "[HttpResult result=" << result
        << " error=" << error
        << " response=" << (response ? response->toString() : "nullptr")
+       << " timing(us)=" << timing.dnsUs << "/" << timing.connectUs
+       << "/" << timing.tlsUs << "/" << timing.firstByteUs << "/" << timing.totalUs
        << "]";
     return ss.str();
 }
 
+/**
+ * @brief 一批并发请求的共享状态
+ * @details 执行请求的协程和截止定时器共同持有。调用方返回后还没结束的请求
+ *          在自己的超时内结束，结果被丢弃
+ */
+class HttpBatch : public std::enable_shared_from_this<HttpBatch> {
+public:
+    typedef std::shared_ptr<HttpBatch> ptr;
+    typedef Mutex MutexType;
+    /// 执行第idx个请求，timeout_ms为距截止时间的剩余时间，不限时为~0ull
+    typedef std::function<HttpResult::ptr(HttpBatch* batch, size_t idx
+                                          ,uint64_t timeout_ms)> Executor;
+
+    HttpBatch(size_t size, const HttpBatchOptions& opts, Executor exec)
+        :m_opts(opts)
+        ,m_exec(exec)
+        ,m_results(size)
+        ,m_fds(size, -1)
+        ,m_deadline(~0ull) {
+        // ~0ull表示不限时，很大的超时加上当前时间会溢出，饱和到不限时
+        uint64_t now_ms = sylar::GetCurrentMS();
+        if(opts.timeoutMs < ~0ull - now_ms) {
+            m_deadline = now_ms + opts.timeoutMs;
+        }
+    }
+
+    /**
+     * @brief 执行所有请求，等待全部结束、被取消或者到截止时间
+     */
+    std::vector<HttpResult::ptr> run();
+
+    /**
+     * @brief 连接建立后登记socket，取消时shutdown唤醒阻塞的读写
+     * @details 登记的是dup出来的fd，请求方关闭原fd后不会误伤复用了fd号的其他连接
+     * @return 批量请求已经结束时返回false
+     */
+    bool attach(size_t idx, Socket::ptr sock);
+
+    /**
+     * @brief 注销socket
+     * @return 连接可能已经被shutdown时返回false，不能再复用
+     */
+    bool detach(size_t idx);
+private:
+    /**
+     * @brief 执行协程，依次取还没开始的请求
+     */
+    void work();
+
+    /**
+     * @brief 记录一个请求的结果
+     */
+    void complete(size_t idx, HttpResult::ptr result);
+
+    /**
+     * @brief 还没结束的请求以code结束，shutdown进行中的连接，需要持有锁
+     */
+    void cancel(HttpResult::Error code, const std::string& error);
+private:
+    HttpBatchOptions m_opts;
+    Executor m_exec;
+    MutexType m_mutex;
+    std::vector<HttpResult::ptr> m_results;
+    // 进行中请求的socket(dup)，没有为-1
+    std::vector<int> m_fds;
+    // 截止时间(毫秒)，~0ull表示没有截止时间
+    uint64_t m_deadline;
+    // 下一个要开始的请求
+    std::atomic<size_t> m_next = {0};
+    // 已经结束的请求数
+    size_t m_done = 0;
+    // 结果已经确定，调用方可以返回
+    bool m_finished = false;
+    FiberSemaphore m_sem;
+};
+
+std::vector<HttpResult::ptr> HttpBatch::run() {
+    if(m_results.empty()) {
+        return m_results;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom) {
+        // 不在协程里没法并发，顺序执行
+        work();
+        return m_results;
+    }
+    HttpBatch::ptr self = shared_from_this();
+    size_t workers = m_results.size();
+    if(m_opts.concurrency && m_opts.concurrency < workers) {
+        workers = m_opts.concurrency;
+    }
+    for(size_t i = 0; i < workers; ++i) {
+        iom->schedule([self](){
+            self->work();
+        });
+    }
+    Timer::ptr timer;
+    if(m_deadline != ~0ull) {
+        std::weak_ptr<HttpBatch> weak = self;
+        timer = iom->addTimer(m_opts.timeoutMs, [weak](){
+            HttpBatch::ptr self = weak.lock();
+            if(self) {
+                MutexType::Lock lock(self->m_mutex);
+                self->cancel(HttpResult::Error::TIMEOUT, "batch timeout");
+            }
+        });
+    }
+    m_sem.wait();
+    if(timer) {
+        timer->cancel();
+    }
+    MutexType::Lock lock(m_mutex);
+    return m_results;
+}
+
+void HttpBatch::work() {
+    while(true) {
+        size_t idx = m_next++;
+        if(idx >= m_results.size()) {
+            return;
+        }
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_finished) {
+                return;
+            }
+        }
+        uint64_t now_ms = sylar::GetCurrentMS();
+        HttpResult::ptr result;
+        if(m_deadline == ~0ull) {
+            result = m_exec(this, idx, ~0ull);
+        } else if(now_ms >= m_deadline) {
+            result = std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+                        , nullptr, "batch timeout");
+        } else {
+            result = m_exec(this, idx, m_deadline - now_ms);
+        }
+        complete(idx, result);
+    }
+}
+
+void HttpBatch::complete(size_t idx, HttpResult::ptr result) {
+    MutexType::Lock lock(m_mutex);
+    if(m_finished) {
+        return;
+    }
+    m_results[idx] = result;
+    if(m_opts.onComplete) {
+        m_opts.onComplete(idx, result);
+    }
+    if(++m_done == m_results.size()) {
+        m_finished = true;
+        m_sem.notify();
+    } else if(m_opts.failFast && result->result != (int)HttpResult::Error::OK) {
+        cancel(HttpResult::Error::CANCELLED, "cancelled by request " + std::to_string(idx)
+                + ": " + result->error);
+    }
+}
+
+void HttpBatch::cancel(HttpResult::Error code, const std::string& error) {
+    if(m_finished) {
+        return;
+    }
+    for(size_t i = 0; i < m_results.size(); ++i) {
+        if(!m_results[i]) {
+            m_results[i] = std::make_shared<HttpResult>((int)code, nullptr, error);
+            if(m_opts.onComplete) {
+                m_opts.onComplete(i, m_results[i]);
+            }
+        }
+        if(m_fds[i] >= 0) {
+            ::shutdown(m_fds[i], SHUT_RDWR);
+        }
+    }
+    m_finished = true;
+    m_sem.notify();
+}
+
+bool HttpBatch::attach(size_t idx, Socket::ptr sock) {
+    MutexType::Lock lock(m_mutex);
+    if(m_finished) {
+        return false;
+    }
+    m_fds[idx] = ::dup(sock->getSocket());
+    return true;
+}
+
+bool HttpBatch::detach(size_t idx) {
+    int fd = -1;
+    bool finished = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        fd = m_fds[idx];
+        m_fds[idx] = -1;
+        finished = m_finished;
+    }
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    // 正常结束时所有请求都已detach，还登记着时结束只能是被取消
+    return !finished;
+}
+
+/**
+ * @brief 建立连接，分别记录TCP建连和SSL握手耗时
+ */
+static bool connect_socket(Socket::ptr sock, Address::ptr addr, bool is_ssl
+                           ,uint64_t timeout_ms, HttpTiming& timing) {
+    uint64_t start = sylar::GetCurrentUS();
+    // SSLSocket::connect会连同握手一起做
+    if(!sock->Socket::connect(addr, timeout_ms)) {
+        return false;
+    }
+    uint64_t now = sylar::GetCurrentUS();
+    timing.connectUs = now - start;
+    if(is_ssl) {
+        if(timeout_ms != (uint64_t)-1) {
+            // 握手的读也受超时限制
+            sock->setRecvTimeout(timeout_ms);
+        }
+        if(!std::static_pointer_cast<SSLSocket>(sock)->handshake()) {
+            sock->close();
+            return false;
+        }
+        timing.tlsUs = sylar::GetCurrentUS() - now;
+    }
+    return true;
+}
+
 HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
-    :SocketStream(sock, owner) {
+    :SocketStream(sock, owner)
+    ,m_createTime(sylar::GetCurrentMS()) {
 }
 
 HttpConnection::~HttpConnection() {
     SYLAR_LOG_DEBUG(g_logger) << "HttpConnection::~HttpConnection";
 }
 
-HttpResponse::ptr HttpConnection::recvResponse() {
+HttpResponse::ptr HttpConnection::recvResponse(bool stream) {
     HttpResponseParser::ptr parser(new HttpResponseParser);
     uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
     // 智能指针接管
@@ -35,6 +283,7 @@ HttpResponse::ptr HttpConnection::recvResponse() {
             });
     char* data = buffer.get();
     int offset = 0;
+    m_firstByteTime = 0;
     do {
         // 在offset后面接着读数据
         int len = read(data + offset, buff_size - offset);
@@ -42,6 +291,9 @@ HttpResponse::ptr HttpConnection::recvResponse() {
             close();
             return nullptr;
         }
+        if(!m_firstByteTime) {
+            m_firstByteTime = sylar::GetCurrentUS();
+        }
         // 当前已经读取的数据长度
         len += offset;
         data[len] = '\0';
@@ -67,6 +319,31 @@ HttpResponse::ptr HttpConnection::recvResponse() {
     } while(true);
     // 这里返回引用
     auto& client_parser = parser->getParser();
+    if(stream) {
+        // 缓冲区中剩余的是消息体的开头
+        auto rsp = parser->getData();
+        int status = (int)rsp->getStatus();
+        // HEAD的响应和1xx/204/304没有消息体
+        bool no_body = m_lastMethod == HttpMethod::HEAD
+                    || (status >= 100 && status < 200)
+                    || status == 204 || status == 304;
+        bool chunked = !no_body && client_parser.chunked;
+        uint64_t length = 0;
+        if(!no_body && !chunked) {
+            if(!rsp->getHeader("content-length").empty()) {
+                length = parser->getContentLength();
+            } else if(rsp->getVersion() == 0x10
+                    || strcasecmp(rsp->getHeader("connection").c_str(), "close") == 0) {
+                // 既不是chunked也没有content-length，连接关闭时才表示消息体结束
+                length = HttpBodyReader::UNTIL_CLOSE;
+            }
+        }
+        HttpBodyReader::ptr reader(new HttpBodyReader(shared_from_this(), chunked
+                    ,length, buff_size));
+        reader->feed(data, offset);
+        parser->getData()->setBodyStream(reader);
+        return parser->getData();
+    }
     std::string body;
     // 是否为chunk
     if(client_parser.chunked) {
@@ -171,6 +448,7 @@ HttpResponse::ptr HttpConnection::recvResponse() {
 }
 
 int HttpConnection::sendRequest(HttpRequest::ptr rsp) {
+    m_lastMethod = rsp->getMethod();
     std::stringstream ss;
     ss << *rsp;
     std::string data = ss.str();
@@ -178,6 +456,19 @@ int HttpConnection::sendRequest(HttpRequest::ptr rsp) {
     return writeFixSize(data.c_str(), data.size());
 }
 
+HttpBodyWriter::ptr HttpConnection::startRequest(HttpRequest::ptr req) {
+    bool chunked = false;
+    if(req->getHeader("content-length").empty()) {
+        req->setHeader("Transfer-Encoding", "chunked");
+        chunked = true;
+    }
+    req->setBody("");
+    if(sendRequest(req) <= 0) {
+        return nullptr;
+    }
+    return std::make_shared<HttpBodyWriter>(shared_from_this(), chunked);
+}
+
 HttpResult::ptr HttpConnection::DoGet(const std::string& url
                             , uint64_t timeout_ms
                             , const std::map<std::string, std::string>& headers
@@ -229,9 +520,11 @@ HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
     return DoRequest(method, uri, timeout_ms, headers, body);
 }
 
-HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
+/**
+ * @brief 按uri创建请求，没有Host头部时使用uri的host
+ */
+static HttpRequest::ptr create_request(HttpMethod method
                             , Uri::ptr uri
-                            , uint64_t timeout_ms
                             , const std::map<std::string, std::string>& headers
                             , const std::string& body) {
     // 创建http请求报文
@@ -266,59 +559,120 @@ HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
     }
     // 设置body
     req->setBody(body);
-    return DoRequest(req, uri, timeout_ms);
+    return req;
 }
 
-HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
+HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
                             , Uri::ptr uri
-                            , uint64_t timeout_ms) {
-    //是否启动ssl                             
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    return DoRequest(create_request(method, uri, headers, body), uri, timeout_ms);
+}
+
+/**
+ * @brief 新建连接发送请求，batch不为空时登记连接以便取消
+ */
+static HttpResult::ptr do_request(HttpRequest::ptr req
+                            , Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , HttpBatch* batch
+                            , size_t idx) {
+    uint64_t start = sylar::GetCurrentUS();
+    HttpTiming timing;
+    auto result = [&timing, start](HttpResult::Error code, HttpResponse::ptr rsp
+                                   ,const std::string& error) {
+        HttpResult::ptr rt = std::make_shared<HttpResult>((int)code, rsp, error);
+        timing.totalUs = sylar::GetCurrentUS() - start;
+        rt->timing = timing;
+        return rt;
+    };
+    //是否启动ssl
     bool is_ssl = uri->getScheme() == "https";
     // 通过uri创建address
     Address::ptr addr = uri->createAddress();
+    timing.dnsUs = sylar::GetCurrentUS() - start;
     if(!addr) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_HOST
+        return result(HttpResult::Error::INVALID_HOST
                 , nullptr, "invalid host: " + uri->getHost());
     }
     // 创建TCPsocket或者SSLTCPsocket
     Socket::ptr sock = is_ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
     if(!sock) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::CREATE_SOCKET_ERROR
+        return result(HttpResult::Error::CREATE_SOCKET_ERROR
                 , nullptr, "create socket fail: " + addr->toString()
                         + " errno=" + std::to_string(errno)
                         + " errstr=" + std::string(strerror(errno)));
     }
-    // 发起请求连接
-    if(!sock->connect(addr)) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::CONNECT_FAIL
+    // 发起请求连接，建连也受超时限制
+    if(!connect_socket(sock, addr, is_ssl, timeout_ms, timing)) {
+        return result(HttpResult::Error::CONNECT_FAIL
                 , nullptr, "connect fail: " + addr->toString());
     }
+    if(batch && !batch->attach(idx, sock)) {
+        sock->close();
+        return result(HttpResult::Error::CANCELLED, nullptr, "cancelled");
+    }
     // 设置接收超时时间
     sock->setRecvTimeout(timeout_ms);
     // 创建httpconnection
     HttpConnection::ptr conn = std::make_shared<HttpConnection>(sock);
     // 发送请求报文
+    uint64_t send_time = sylar::GetCurrentUS();
     int rt = conn->sendRequest(req);
+    int err = errno;
+    HttpResponse::ptr rsp;
+    if(rt > 0) {
+        // 接收响应报文
+        rsp = conn->recvResponse();
+    }
+    if(batch) {
+        batch->detach(idx);
+    }
+    conn->close();
     // 若为0，则表示远端关闭连接
     if(rt == 0) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_CLOSE_BY_PEER
+        return result(HttpResult::Error::SEND_CLOSE_BY_PEER
                 , nullptr, "send request closed by peer: " + addr->toString());
     }
     // 小于0，失败
     if(rt < 0) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_SOCKET_ERROR
-                    , nullptr, "send request socket error errno=" + std::to_string(errno)
-                    + " errstr=" + std::string(strerror(errno)));
+        return result(HttpResult::Error::SEND_SOCKET_ERROR
+                    , nullptr, "send request socket error errno=" + std::to_string(err)
+                    + " errstr=" + std::string(strerror(err)));
     }
-    // 接收响应报文
-    auto rsp = conn->recvResponse();
     if(!rsp) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+        return result(HttpResult::Error::TIMEOUT
                     , nullptr, "recv response timeout: " + addr->toString()
                     + " timeout_ms:" + std::to_string(timeout_ms));
     }
+    timing.firstByteUs = conn->getFirstByteTime() - send_time;
     // 结果成功，返回响应报文
-    return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+    return result(HttpResult::Error::OK, rsp, "ok");
+}
+
+HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
+                            , Uri::ptr uri
+                            , uint64_t timeout_ms) {
+    return do_request(req, uri, timeout_ms, nullptr, 0);
+}
+
+std::vector<HttpResult::ptr> HttpConnection::DoBatch(const std::vector<HttpBatchRequest>& reqs
+                            , const HttpBatchOptions& opts) {
+    // 调用方返回后还在进行的请求也要能访问
+    auto items = std::make_shared<std::vector<HttpBatchRequest> >(reqs);
+    HttpBatch::ptr batch = std::make_shared<HttpBatch>(reqs.size(), opts
+            , [items](HttpBatch* batch, size_t idx, uint64_t timeout_ms) {
+        const HttpBatchRequest& item = (*items)[idx];
+        Uri::ptr uri = Uri::Create(item.url);
+        if(!uri) {
+            return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_URL
+                    , nullptr, "invalid url: " + item.url);
+        }
+        return do_request(create_request(item.method, uri, item.headers, item.body)
+                , uri, timeout_ms, batch, idx);
+    });
+    return batch->run();
 }
 
 
@@ -331,6 +685,7 @@ HttpConnectionPool::ptr HttpConnectionPool::Create(const std::string& uri
     Uri::ptr turi = Uri::Create(uri);
     if(!turi) {
         SYLAR_LOG_ERROR(g_logger) << "invalid uri=" << uri;
+        return nullptr;
     }
     // 创建 HttpConnectionPool 对象
     return std::make_shared<HttpConnectionPool>(turi->getHost()
@@ -351,73 +706,180 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host
     ,m_maxSize(max_size)
     ,m_maxAliveTime(max_alive_time)
     ,m_maxRequest(max_request)
-    ,m_isHttps(is_https) {
+    ,m_isHttps(is_https)
+    ,m_minIdle(0)
+    ,m_maxIdleTime(g_http_pool_max_idle_time->getValue())
+    ,m_maxConnecting(0)
+    ,m_dnsTtl(g_http_pool_dns_ttl->getValue()) {
+    setMaxConnecting(g_http_pool_max_connecting->getValue());
 }
 
-HttpConnection::ptr HttpConnectionPool::getConnection() {
-    uint64_t now_ms = sylar::GetCurrentMS();
-    
-    // 存放非法的连接
-    std::vector<HttpConnection*> invalid_conns;
-    
-    // 用来获取当前连接
-    HttpConnection* ptr = nullptr;
-    MutexType::Lock lock(m_mutex);
+HttpConnectionPool::~HttpConnectionPool() {
+    if(m_timer) {
+        m_timer->cancel();
+    }
+    for(auto i : m_conns) {
+        delete i;
+    }
+}
 
-    // 若连接池不为空
-    while(!m_conns.empty()) {
-        // 取出第一个connection
-        auto conn = *m_conns.begin();
-
-        // 弹掉第一个connection
-        m_conns.pop_front();
-        
-        // 不在连接状态，放入非法vec中
-        if(!conn->isConnected()) {
-            invalid_conns.push_back(conn);
-            continue;
-        }
+void HttpConnectionPool::setMaxConnecting(uint32_t v) {
+    m_maxConnecting = v;
+    m_connecting = v ? std::make_shared<FiberSemaphore>(v) : nullptr;
+}
 
-        // 已经超过了最大连接时间，放入非法vec中
-        if((conn->m_createTime + m_maxAliveTime) > now_ms) {
-            invalid_conns.push_back(conn);
-            continue;
+bool HttpConnectionPool::isReusable(HttpConnection* conn, uint64_t now_ms) {
+    if(!conn->isConnected()) {
+        return false;
+    }
+    // 超过最大存活时间或者闲置太久
+    if(m_maxAliveTime && conn->m_createTime + m_maxAliveTime <= now_ms) {
+        return false;
+    }
+    if(m_maxIdleTime && conn->m_releaseTime + m_maxIdleTime <= now_ms) {
+        return false;
+    }
+    // 空闲连接上不应该有数据: 返回0是对端已经关闭，有数据是上一个响应没读完。
+    // 用原始recv，hook后的recv在EAGAIN时会挂起协程
+    char c;
+    ssize_t rt = recv_f(conn->getSocket()->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+HttpConnection* HttpConnectionPool::popIdle() {
+    uint64_t now_ms = sylar::GetCurrentMS();
+    while(true) {
+        HttpConnection* conn = nullptr;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_conns.empty()) {
+                return nullptr;
+            }
+            // 后进先出，最近用过的连接最可能还有效
+            conn = m_conns.back();
+            m_conns.pop_back();
         }
+        if(isReusable(conn, now_ms)) {
+            return conn;
+        }
+        delete conn;
+        --m_total;
+        ++m_expired;
+    }
+}
 
-        // 获得当前connection
-        ptr = conn;
-        break;
+IPAddress::ptr HttpConnectionPool::resolve() {
+    uint64_t now_ms = sylar::GetCurrentMS();
+    {
+        MutexType::Lock lock(m_addrMutex);
+        if(m_addr && now_ms < m_addrExpire) {
+            return m_addr;
+        }
     }
-    lock.unlock();
-    for(auto i : invalid_conns) {
-        delete i;
+    ++m_resolve;
+    IPAddress::ptr addr = Address::LookupAnyIPAddress(m_host);
+    if(!addr) {
+        return nullptr;
+    }
+    addr->setPort(m_port);
+    MutexType::Lock lock(m_addrMutex);
+    m_addr = addr;
+    m_addrExpire = now_ms + m_dnsTtl;
+    return addr;
+}
+
+void HttpConnectionPool::invalidateAddress() {
+    MutexType::Lock lock(m_addrMutex);
+    m_addr = nullptr;
+}
+
+HttpConnection* HttpConnectionPool::createConnection(uint64_t timeout_ms, HttpTiming* timing) {
+    // 不在协程里时无法等待，不限制建连数
+    std::shared_ptr<FiberSemaphore> sem = Scheduler::GetThis() ? m_connecting : nullptr;
+    if(sem && !sem->tryWait()) {
+        ++m_wait;
+        uint64_t start = sylar::GetCurrentUS();
+        // 等待名额也算在请求超时内，否则建连慢的时候会一直挂起
+        bool ok = sem->wait(timeout_ms);
+        uint64_t used = sylar::GetCurrentUS() - start;
+        m_waitUs += used;
+        if(!ok) {
+            SYLAR_LOG_ERROR(g_logger) << "wait connecting timeout: " << m_host
+                << " timeout_ms=" << timeout_ms;
+            return nullptr;
+        }
+        if(timeout_ms != (uint64_t)-1) {
+            // 剩下的时间用于建连
+            timeout_ms = used / 1000 < timeout_ms ? timeout_ms - used / 1000 : 1;
+        }
+        // 等待期间可能有连接放回
+        HttpConnection* conn = popIdle();
+        if(conn) {
+            sem->notify();
+            if(timing) {
+                timing->reused = true;
+            }
+            return conn;
+        }
     }
-    m_total -= invalid_conns.size();
-    
-    // 若没有连接
-    if(!ptr) {
-        // 根据host创建addr
-        IPAddress::ptr addr = Address::LookupAnyIPAddress(m_host);
+
+    HttpTiming tmp;
+    HttpTiming& t = timing ? *timing : tmp;
+    HttpConnection* conn = nullptr;
+    do {
+        uint64_t start = sylar::GetCurrentUS();
+        IPAddress::ptr addr = resolve();
+        t.dnsUs = sylar::GetCurrentUS() - start;
         if(!addr) {
             SYLAR_LOG_ERROR(g_logger) << "get addr fail: " << m_host;
-            return nullptr;
+            break;
         }
-        // 设置端口号
-        addr->setPort(m_port);
         // 创建TcpSocket/SSLTcpSocket
         Socket::ptr sock = m_isHttps ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
         if(!sock) {
             SYLAR_LOG_ERROR(g_logger) << "create sock fail: " << *addr;
-            return nullptr;
+            break;
         }
-        // 连接
-        if(!sock->connect(addr)) {
+        if(!connect_socket(sock, addr, m_isHttps, timeout_ms, t)) {
             SYLAR_LOG_ERROR(g_logger) << "sock connect fail: " << *addr;
-            return nullptr;
+            // 地址可能已经变了，下次重新解析
+            invalidateAddress();
+            break;
         }
-
-        ptr = new HttpConnection(sock);
+        uint64_t used = t.connectUs + t.tlsUs;
+        m_connectUs += used;
+        uint64_t max = m_connectMaxUs;
+        while(used > max && !m_connectMaxUs.compare_exchange_weak(max, used));
+        ++m_connect;
+        conn = new HttpConnection(sock);
         ++m_total;
+    } while(false);
+    if(!conn) {
+        ++m_connectFail;
+    }
+    if(sem) {
+        sem->notify();
+    }
+    return conn;
+}
+
+HttpConnection::ptr HttpConnectionPool::getConnection() {
+    return getConnection(-1, nullptr);
+}
+
+HttpConnection::ptr HttpConnectionPool::getConnection(uint64_t timeout_ms, HttpTiming* timing) {
+    HttpConnection* ptr = popIdle();
+    if(ptr) {
+        ++m_hit;
+        if(timing) {
+            timing->reused = true;
+        }
+    } else {
+        ++m_miss;
+        ptr = createConnection(timeout_ms, timing);
+        if(!ptr) {
+            return nullptr;
+        }
     }
     return HttpConnection::ptr(ptr, std::bind(&HttpConnectionPool::ReleasePtr
                                , std::placeholders::_1, this));
@@ -426,17 +888,108 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
 void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool) {
     // 增加请求计数，每释放一次连接，就表示它已经处理了一个请求。
     ++ptr->m_request;
+    uint64_t now_ms = sylar::GetCurrentMS();
 
     // 检查连接是否需要销毁
     if(!ptr->isConnected()
-            || ((ptr->m_createTime + pool->m_maxAliveTime) >= sylar::GetCurrentMS())
-            || (ptr->m_request >= pool->m_maxRequest)) {
+            || (pool->m_maxAliveTime && ptr->m_createTime + pool->m_maxAliveTime <= now_ms)
+            || (pool->m_maxRequest && ptr->m_request >= pool->m_maxRequest)
+            || !pool->pushIdle(ptr)) {
         delete ptr;
         --pool->m_total;
+    }
+}
+
+bool HttpConnectionPool::pushIdle(HttpConnection* conn) {
+    conn->m_releaseTime = sylar::GetCurrentMS();
+    MutexType::Lock lock(m_mutex);
+    if(m_maxSize && m_conns.size() >= m_maxSize) {
+        return false;
+    }
+    m_conns.push_back(conn);
+    return true;
+}
+
+void HttpConnectionPool::startMaintain(uint64_t interval_ms, sylar::IOManager* iom) {
+    if(m_timer) {
+        m_timer->cancel();
+    }
+    m_iom = iom;
+    std::weak_ptr<HttpConnectionPool> weak = shared_from_this();
+    m_timer = iom->addTimer(interval_ms, [weak](){
+        HttpConnectionPool::ptr self = weak.lock();
+        if(self) {
+            self->maintain();
+        }
+    }, true);
+    // 立即补足最少空闲连接
+    iom->schedule([weak](){
+        HttpConnectionPool::ptr self = weak.lock();
+        if(self) {
+            self->maintain();
+        }
+    });
+}
+
+void HttpConnectionPool::maintain() {
+    uint64_t now_ms = sylar::GetCurrentMS();
+    std::vector<HttpConnection*> invalid;
+    uint32_t idle = 0;
+    {
+        // 检查只是几次非阻塞的系统调用，直接在锁内做，保持栈的顺序
+        MutexType::Lock lock(m_mutex);
+        auto it = m_conns.begin();
+        for(auto conn : m_conns) {
+            if(isReusable(conn, now_ms)) {
+                *it++ = conn;
+            } else {
+                invalid.push_back(conn);
+            }
+        }
+        m_conns.erase(it, m_conns.end());
+        idle = m_conns.size();
+    }
+    for(auto conn : invalid) {
+        delete conn;
+    }
+    m_total -= invalid.size();
+    m_expired += invalid.size();
+
+    if(!m_iom || !m_minIdle) {
         return;
     }
-    MutexType::Lock lock(pool->m_mutex);
-    pool->m_conns.push_back(ptr);
+    uint32_t have = idle + m_warming;
+    uint32_t want = m_maxSize ? std::min(m_minIdle, m_maxSize) : m_minIdle;
+    for(; have < want; ++have) {
+        ++m_warming;
+        HttpConnectionPool::ptr self = shared_from_this();
+        m_iom->schedule([self](){
+            HttpConnection* conn = self->createConnection();
+            if(conn && !self->pushIdle(conn)) {
+                delete conn;
+                --self->m_total;
+            }
+            --self->m_warming;
+        });
+    }
+}
+
+HttpConnectionPool::Stats HttpConnectionPool::getStats() {
+    Stats stats;
+    stats.hit = m_hit;
+    stats.miss = m_miss;
+    stats.connect = m_connect;
+    stats.connectFail = m_connectFail;
+    stats.connectUs = m_connectUs;
+    stats.connectMaxUs = m_connectMaxUs;
+    stats.wait = m_wait;
+    stats.waitUs = m_waitUs;
+    stats.expired = m_expired;
+    stats.resolve = m_resolve;
+    stats.total = m_total;
+    MutexType::Lock lock(m_mutex);
+    stats.idle = m_conns.size();
+    return stats;
 }
 
 HttpResult::ptr HttpConnectionPool::doGet(const std::string& url
@@ -484,6 +1037,13 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
                                     , uint64_t timeout_ms
                                     , const std::map<std::string, std::string>& headers
                                     , const std::string& body) {
+    return doRequest(createRequest(method, url, headers, body), timeout_ms);
+}
+
+HttpRequest::ptr HttpConnectionPool::createRequest(HttpMethod method
+                                    , const std::string& url
+                                    , const std::map<std::string, std::string>& headers
+                                    , const std::string& body) {
     HttpRequest::ptr req = std::make_shared<HttpRequest>();
     req->setPath(url);
     req->setMethod(method);
@@ -511,7 +1071,7 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
         }
     }
     req->setBody(body);
-    return doRequest(req, timeout_ms);
+    return req;
 }
 
 HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
@@ -530,34 +1090,91 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
 
 HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
                                         , uint64_t timeout_ms) {
-    auto conn = getConnection();
+    return doRequest(req, timeout_ms, nullptr, 0);
+}
+
+HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
+                                        , uint64_t timeout_ms
+                                        , HttpBatch* batch
+                                        , size_t idx) {
+    uint64_t start = sylar::GetCurrentUS();
+    HttpTiming timing;
+    auto result = [&timing, start](HttpResult::Error code, HttpResponse::ptr rsp
+                                   ,const std::string& error) {
+        HttpResult::ptr rt = std::make_shared<HttpResult>((int)code, rsp, error);
+        timing.totalUs = sylar::GetCurrentUS() - start;
+        rt->timing = timing;
+        return rt;
+    };
+    auto conn = getConnection(timeout_ms, &timing);
     if(!conn) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_GET_CONNECTION
+        return result(HttpResult::Error::POOL_GET_CONNECTION
                 , nullptr, "pool host:" + m_host + " port:" + std::to_string(m_port));
     }
     auto sock = conn->getSocket();
     if(!sock) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_INVALID_CONNECTION
+        return result(HttpResult::Error::POOL_INVALID_CONNECTION
                 , nullptr, "pool host:" + m_host + " port:" + std::to_string(m_port));
     }
+    if(batch && !batch->attach(idx, sock)) {
+        // 没有用过的连接直接放回
+        return result(HttpResult::Error::CANCELLED, nullptr, "cancelled");
+    }
     sock->setRecvTimeout(timeout_ms);
+    uint64_t send_time = sylar::GetCurrentUS();
     int rt = conn->sendRequest(req);
+    int err = errno;
+    HttpResponse::ptr rsp;
+    if(rt > 0) {
+        rsp = conn->recvResponse();
+    }
+    if(batch && !batch->detach(idx)) {
+        // 可能已经被shutdown，不能放回连接池
+        conn->close();
+    }
+    if(rt <= 0) {
+        // 请求没有发完的连接不能放回连接池
+        conn->close();
+    }
     if(rt == 0) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_CLOSE_BY_PEER
+        return result(HttpResult::Error::SEND_CLOSE_BY_PEER
                 , nullptr, "send request closed by peer: " + sock->getRemoteAddress()->toString());
     }
     if(rt < 0) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_SOCKET_ERROR
-                    , nullptr, "send request socket error errno=" + std::to_string(errno)
-                    + " errstr=" + std::string(strerror(errno)));
+        return result(HttpResult::Error::SEND_SOCKET_ERROR
+                    , nullptr, "send request socket error errno=" + std::to_string(err)
+                    + " errstr=" + std::string(strerror(err)));
     }
-    auto rsp = conn->recvResponse();
     if(!rsp) {
-        return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+        conn->close();
+        return result(HttpResult::Error::TIMEOUT
                     , nullptr, "recv response timeout: " + sock->getRemoteAddress()->toString()
                     + " timeout_ms:" + std::to_string(timeout_ms));
     }
-    return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+    timing.firstByteUs = conn->getFirstByteTime() - send_time;
+    // 响应的m_close不随解析更新，直接看响应头: 服务端要求关闭的连接不再复用
+    std::string conn_header = rsp->getHeader("connection");
+    if(strcasecmp(conn_header.c_str(), "close") == 0
+            || (rsp->getVersion() < 0x11 && strcasecmp(conn_header.c_str(), "keep-alive"))) {
+        conn->close();
+    }
+    return result(HttpResult::Error::OK, rsp, "ok");
+}
+
+std::vector<HttpResult::ptr> HttpConnectionPool::doBatch(const std::vector<HttpBatchRequest>& reqs
+                                        , const HttpBatchOptions& opts) {
+    // 调用方返回后还在进行的请求也要能访问，连接池也要保持存活
+    std::vector<HttpRequest::ptr> prepared;
+    prepared.reserve(reqs.size());
+    for(auto& i : reqs) {
+        prepared.push_back(createRequest(i.method, i.url, i.headers, i.body));
+    }
+    HttpConnectionPool::ptr self = shared_from_this();
+    HttpBatch::ptr batch = std::make_shared<HttpBatch>(reqs.size(), opts
+            , [self, prepared](HttpBatch* batch, size_t idx, uint64_t timeout_ms) {
+        return self->doRequest(prepared[idx], timeout_ms, batch, idx);
+    });
+    return batch->run();
 }
 
 }
@@ -8,14 +8,37 @@
 
 #include "sylar/streams/socket_stream.h"
 #include "http.h"
+#include "http_body.h"
 #include "sylar/uri.h"
 #include "sylar/thread.h"
+#include "sylar/iomanager.h"
 
+#include <atomic>
+#include <functional>
 #include <list>
+#include <vector>
 
 namespace sylar {
 namespace http {
 
+/**
+ * @brief 一次请求各阶段的耗时(微秒)，没有经历的阶段为0
+ */
+struct HttpTiming {
+    /// 解析地址
+    uint64_t dnsUs = 0;
+    /// 建立TCP连接
+    uint64_t connectUs = 0;
+    /// SSL握手
+    uint64_t tlsUs = 0;
+    /// 开始发送请求到收到响应的第一个字节
+    uint64_t firstByteUs = 0;
+    /// 总耗时，连接池请求包括等待建连名额
+    uint64_t totalUs = 0;
+    /// 是否复用了连接池里的连接
+    bool reused = false;
+};
+
 /**
  * @brief HTTP响应结果
  */
@@ -46,6 +69,8 @@ struct HttpResult {
         POOL_GET_CONNECTION = 8,
         /// 无效的连接
         POOL_INVALID_CONNECTION = 9,
+        /// 批量请求中因为其他请求失败被取消
+        CANCELLED = 10,
     };
 
     /**
@@ -67,15 +92,62 @@ struct HttpResult {
     HttpResponse::ptr response;
     /// 错误描述
     std::string error;
+    /// 各阶段耗时
+    HttpTiming timing;
 
     std::string toString() const;
 };
 
+/**
+ * @brief 批量请求中的一个请求
+ */
+struct HttpBatchRequest {
+    /**
+     * @brief 构造函数
+     * @param[in] _method 请求类型
+     * @param[in] _url HttpConnection::DoBatch为完整的url，HttpConnectionPool::doBatch为路径
+     * @param[in] _headers HTTP请求头部参数
+     * @param[in] _body 请求消息体
+     */
+    HttpBatchRequest(HttpMethod _method
+                     ,const std::string& _url
+                     ,const std::map<std::string, std::string>& _headers = {}
+                     ,const std::string& _body = "")
+        :method(_method)
+        ,url(_url)
+        ,headers(_headers)
+        ,body(_body) {}
+
+    HttpMethod method;
+    std::string url;
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+/**
+ * @brief 批量请求的选项
+ */
+struct HttpBatchOptions {
+    /// 整批请求的截止时间(毫秒)，从调用开始计算，到时还没结束的请求返回TIMEOUT；~0ull表示不限时
+    uint64_t timeoutMs = 3000;
+    /// 有请求失败(result不为OK，不看HTTP状态码)时取消其余请求，返回CANCELLED
+    bool failFast = false;
+    /// 同时进行的请求数，0表示全部同时发出
+    uint32_t concurrency = 0;
+    /**
+     * @brief 每个请求结束时按完成顺序回调，被取消的请求也会回调，每个下标恰好一次
+     * @details 在锁内串行调用，不能做阻塞操作；批量调用返回后不会再回调
+     */
+    std::function<void(size_t idx, HttpResult::ptr result)> onComplete;
+};
+
+class HttpBatch;
 class HttpConnectionPool;
 /**
  * @brief HTTP客户端类
  */
-class HttpConnection : public SocketStream {
+class HttpConnection : public SocketStream
+                      ,public std::enable_shared_from_this<HttpConnection> {
 friend class HttpConnectionPool;
 public:
     /// HTTP客户端类智能指针
@@ -175,6 +247,18 @@ public:
                             , Uri::ptr uri
                             , uint64_t timeout_ms);
 
+    /**
+     * @brief 并发发送一批请求，每个请求单独建立连接
+     * @param[in] reqs 请求列表
+     * @param[in] opts 截止时间、失败取消、并发数和完成回调
+     * @details 在IOManager的协程里调用时每个请求在单独的协程里执行，
+     *          否则顺序执行。截止时间到或者被取消时，已经建立连接的请求会被
+     *          shutdown唤醒，还在建连的请求在后台结束，结果被丢弃
+     * @return 和reqs顺序一致的结果
+     */
+    static std::vector<HttpResult::ptr> DoBatch(const std::vector<HttpBatchRequest>& reqs
+                            , const HttpBatchOptions& opts = HttpBatchOptions());
+
     /**
      * @brief 构造函数
      * @param[in] sock Socket类
@@ -189,8 +273,14 @@ public:
 
     /**
      * @brief 接收HTTP响应
+     * @param[in] stream 是否以流的方式接收消息体
+     * @details stream为true时只接收响应头，消息体通过HttpResponse::getBodyStream读取，
+     *          不做content-encoding解码。HEAD请求的响应和1xx/204/304没有消息体；
+     *          既没有content-length也不是chunked时，只有HTTP/1.0或connection: close
+     *          才读到连接关闭，否则当作空消息体。
+     *          连接放回连接池之前需要把消息体读完
      */
-    HttpResponse::ptr recvResponse();
+    HttpResponse::ptr recvResponse(bool stream = false);
 
     /**
      * @brief 发送HTTP请求
@@ -198,26 +288,79 @@ public:
      */
     int sendRequest(HttpRequest::ptr req);
 
+    /**
+     * @brief 以流的方式发送HTTP请求
+     * @details 先发送请求头(req的消息体被忽略)，消息体通过返回的writer写入，
+     *          写完后close再接收响应。没有设置content-length时使用chunked编码
+     * @param[in] req HTTP请求结构
+     * @return 消息体写入流，发送请求头失败返回nullptr
+     */
+    HttpBodyWriter::ptr startRequest(HttpRequest::ptr req);
+
+    /**
+     * @brief 最近一次recvResponse收到第一个字节的时间(微秒)
+     */
+    uint64_t getFirstByteTime() const { return m_firstByteTime;}
+
 private:
     // 创建时间
     uint64_t m_createTime = 0;
+    // 最近一次收到响应第一个字节的时间
+    uint64_t m_firstByteTime = 0;
+    // 最近一次发送的请求方法，HEAD的响应没有消息体
+    HttpMethod m_lastMethod = HttpMethod::GET;
+    // 最近一次放回连接池的时间
+    uint64_t m_releaseTime = 0;
     // 请求数目
     uint64_t m_request = 0;
 };
 
 /**
  * @brief HTTP连接池，仅在长连接有效时使用
+ * @details 空闲连接后进先出，最近用过的连接最先复用，多余的连接在栈底闲置到超时；
+ *          解析的地址按http.pool.dns_ttl缓存；同时建立的连接数受http.pool.max_connecting限制。
+ *          startMaintain后定时检查空闲连接并补足最少空闲连接数
  */
-class HttpConnectionPool {
+class HttpConnectionPool : public std::enable_shared_from_this<HttpConnectionPool> {
 public:
     typedef std::shared_ptr<HttpConnectionPool> ptr;
     typedef Mutex MutexType;
 
+    /**
+     * @brief 统计信息
+     */
+    struct Stats {
+        /// 复用空闲连接的次数
+        uint64_t hit;
+        /// 需要新建连接的次数
+        uint64_t miss;
+        /// 新建连接成功次数
+        uint64_t connect;
+        /// 新建连接失败次数(包括DNS失败)
+        uint64_t connectFail;
+        /// 新建连接总耗时(微秒)
+        uint64_t connectUs;
+        /// 新建连接最大耗时(微秒)
+        uint64_t connectMaxUs;
+        /// 等待建连名额的次数
+        uint64_t wait;
+        /// 等待建连名额的总耗时(微秒)
+        uint64_t waitUs;
+        /// 检查出失效或超时被关闭的空闲连接数
+        uint64_t expired;
+        /// DNS解析次数
+        uint64_t resolve;
+        /// 当前连接总数
+        int32_t total;
+        /// 当前空闲连接数
+        uint32_t idle;
+    };
+
     /**
      * @brief 静态工厂方法，创建一个连接池
      * @param[in] uri 表示 HTTP 连接池的目标 URI
      * @param[in] vhost 虚拟主机名
-     * @param[in] max_size 连接池的最大大小
+     * @param[in] max_size 最多保留的空闲连接数，0表示不限
      * @param[in] max_alive_time 连接的最大存活时间，单位是毫秒
      * @param[in] max_request 连接池中每个连接允许处理的最大请求数
      */
@@ -235,9 +378,56 @@ public:
                        ,uint32_t max_alive_time
                        ,uint32_t max_request);
 
-    // 从连接池冲获取一个连接
+    ~HttpConnectionPool();
+
+    /**
+     * @brief 从连接池获取一个连接
+     * @details 优先取最近放回的空闲连接，取出时检查对端是否已经关闭；
+     *          没有空闲连接时新建，建连并发数到上限时等待
+     */
     HttpConnection::ptr getConnection();
 
+    /**
+     * @brief 启动后台维护定时器: 关闭失效和空闲超时的连接，补足最少空闲连接
+     * @param[in] interval_ms 检查间隔(毫秒)
+     * @param[in] iom 定时器和建连协程所在的IOManager
+     * @details 连接池需要由shared_ptr管理，析构时自动停止
+     */
+    void startMaintain(uint64_t interval_ms = 1000
+                       ,sylar::IOManager* iom = sylar::IOManager::GetThis());
+
+    /**
+     * @brief 执行一次维护，startMaintain的定时器调用
+     */
+    void maintain();
+
+    /**
+     * @brief 最少保持的空闲连接数(startMaintain后生效)
+     */
+    void setMinIdle(uint32_t v) { m_minIdle = v;}
+    uint32_t getMinIdle() const { return m_minIdle;}
+
+    /**
+     * @brief 空闲连接的最长闲置时间(毫秒)，0表示不限
+     */
+    void setMaxIdleTime(uint32_t v) { m_maxIdleTime = v;}
+    uint32_t getMaxIdleTime() const { return m_maxIdleTime;}
+
+    /**
+     * @brief 同时建立连接的最大数量
+     * @details 需要在getConnection之前设置
+     */
+    void setMaxConnecting(uint32_t v);
+    uint32_t getMaxConnecting() const { return m_maxConnecting;}
+
+    /**
+     * @brief 地址缓存时间(毫秒)，0表示每次都解析
+     */
+    void setDnsTtl(uint32_t v) { m_dnsTtl = v;}
+    uint32_t getDnsTtl() const { return m_dnsTtl;}
+
+    Stats getStats();
+
 
     /**
      * @brief 发送HTTP的GET请求
@@ -329,12 +519,77 @@ public:
      */
     HttpResult::ptr doRequest(HttpRequest::ptr req
                             , uint64_t timeout_ms);
+
+    /**
+     * @brief 通过连接池并发发送一批请求
+     * @param[in] reqs 请求列表，url为路径
+     * @param[in] opts 截止时间、失败取消、并发数和完成回调
+     * @details 同HttpConnection::DoBatch，建连并发数还受setMaxConnecting限制；
+     *          被取消的连接不放回连接池。连接池需要由shared_ptr管理
+     * @return 和reqs顺序一致的结果
+     */
+    std::vector<HttpResult::ptr> doBatch(const std::vector<HttpBatchRequest>& reqs
+                            , const HttpBatchOptions& opts = HttpBatchOptions());
 private:
+    /**
+     * @brief 创建请求，没有Host头部时使用vhost或host
+     */
+    HttpRequest::ptr createRequest(HttpMethod method
+                            , const std::string& url
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body);
+
+    /**
+     * @brief 发送请求，batch不为空时登记连接以便取消
+     */
+    HttpResult::ptr doRequest(HttpRequest::ptr req
+                            , uint64_t timeout_ms
+                            , HttpBatch* batch
+                            , size_t idx);
+
+    /**
+     * @brief 获取连接并记录建连耗时
+     * @param[in] timeout_ms 新建连接的超时时间
+     */
+    HttpConnection::ptr getConnection(uint64_t timeout_ms, HttpTiming* timing);
 
     /**
      * @brief 释放一个Http请求连接，即将该连接放回连接池
      */
     static void ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool);
+
+    /**
+     * @brief 空闲连接是否还能用: 已连接、未超时、对端没有关闭也没有多余的数据
+     */
+    bool isReusable(HttpConnection* conn, uint64_t now_ms);
+
+    /**
+     * @brief 从空闲栈顶取一个可用连接，失效的直接关闭
+     */
+    HttpConnection* popIdle();
+
+    /**
+     * @brief 新建一个连接，受建连并发数限制
+     * @details 等待过建连名额时先重新检查空闲连接
+     * @param[in] timeout_ms 超时时间，包括等待建连名额和建连，等待名额超时返回nullptr
+     * @param[out] timing 不为空时记录解析、建连和握手耗时
+     */
+    HttpConnection* createConnection(uint64_t timeout_ms = -1, HttpTiming* timing = nullptr);
+
+    /**
+     * @brief 放回空闲栈顶，空闲连接已满时返回false
+     */
+    bool pushIdle(HttpConnection* conn);
+
+    /**
+     * @brief 取得缓存的地址，过期时重新解析
+     */
+    IPAddress::ptr resolve();
+
+    /**
+     * @brief 建连失败后清除地址缓存
+     */
+    void invalidateAddress();
 private:
     // 主机
     std::string m_host;
@@ -352,12 +607,46 @@ private:
     // 是否是https(关系着是否启用ssl)
     bool m_isHttps;
 
+    // 最少空闲连接数
+    uint32_t m_minIdle;
+    // 最长闲置时间
+    uint32_t m_maxIdleTime;
+    // 同时建连数
+    uint32_t m_maxConnecting;
+    // 地址缓存时间
+    uint32_t m_dnsTtl;
+
     MutexType m_mutex;
-    //Http连接池，每当有请求需要处理的时候，就从m_conns中取出一个连接，然后处理完成之后，重新放入连接池
-    std::list<HttpConnection*> m_conns;
-    
+    // 空闲连接栈，栈顶是最近放回的连接
+    std::vector<HttpConnection*> m_conns;
+    // 建连名额
+    std::shared_ptr<FiberSemaphore> m_connecting;
+
+    MutexType m_addrMutex;
+    // 缓存的地址
+    IPAddress::ptr m_addr;
+    // 地址过期时间
+    uint64_t m_addrExpire = 0;
+
+    // 维护定时器
+    Timer::ptr m_timer;
+    sylar::IOManager* m_iom = nullptr;
+    // 正在预建的连接数
+    std::atomic<uint32_t> m_warming = {0};
+
     // 连接的数量
     std::atomic<int32_t> m_total = {0};
+
+    std::atomic<uint64_t> m_hit = {0};
+    std::atomic<uint64_t> m_miss = {0};
+    std::atomic<uint64_t> m_connect = {0};
+    std::atomic<uint64_t> m_connectFail = {0};
+    std::atomic<uint64_t> m_connectUs = {0};
+    std::atomic<uint64_t> m_connectMaxUs = {0};
+    std::atomic<uint64_t> m_wait = {0};
+    std::atomic<uint64_t> m_waitUs = {0};
+    std::atomic<uint64_t> m_expired = {0};
+    std::atomic<uint64_t> m_resolve = {0};
 };
 
 }
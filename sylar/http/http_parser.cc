@@ -123,6 +123,10 @@ void on_request_version(void *data, const char *at, size_t length) {
     else if(strncmp(at, "HTTP/1.0", length) == 0) {
         v = 0x10;
     } 
+    else if(strncmp(at, "HTTP/2.0", length) == 0) {
+        // HTTP/2连接前言"PRI * HTTP/2.0"，由HttpServer转交给Http2Session
+        v = 0x20;
+    } 
     else {
         SYLAR_LOG_WARN(g_logger) << "invalid http request version: " << std::string(at, length);
         parser->setError(1001);
@@ -142,7 +146,7 @@ void on_request_http_field(void *data, const char *field, size_t flen ,const cha
         //parser->setError(1002);
         return;
     }
-    parser->getData()->setHeader(std::string(field, flen),std::string(value, vlen));
+    parser->getData()->setHeader(field, flen, value, vlen);
 }
 
 
@@ -164,6 +168,13 @@ HttpRequestParser::HttpRequestParser()
     m_parser.data = this;       // 将当前对象指针作为解析器的data传递给回调函数
 }
 
+void HttpRequestParser::reset() {
+    m_error = 0;
+    m_data.reset(new sylar::http::HttpRequest);
+    // http_parser_init只重置状态，回调函数保持不变
+    http_parser_init(&m_parser);
+}
+
 uint64_t HttpRequestParser::getContentLength() {
     return m_data->getHeaderAs<uint64_t>("content-length", 0);
 }
@@ -236,8 +247,7 @@ void on_response_http_field(void *data, const char *field, size_t flen
         //parser->setError(1002);
         return;
     }
-    parser->getData()->setHeader(std::string(field, flen)
-                                ,std::string(value, vlen));
+    parser->getData()->setHeader(field, flen, value, vlen);
 }
 
 
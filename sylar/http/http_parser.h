@@ -27,6 +27,12 @@ public:
      */
     HttpRequestParser();
 
+    /**
+     * @brief 重置解析器，用于在同一连接上解析下一个请求
+     * @details 重置解析状态和错误码，并创建新的HttpRequest
+     */
+    void reset();
+
     /**
      * @brief 解析协议
      * @param[in, out] data 协议文本内存
@@ -1,7 +1,10 @@
 #include "http_server.h"
 #include "sylar/log.h"
+#include "http_compress.h"
 #include "sylar/http/servlets/config_servlet.h"
 #include "sylar/http/servlets/status_servlet.h"
+#include "sylar/util/hash_util.h"
+#include <strings.h>
 
 namespace sylar {
 namespace http {
@@ -27,8 +30,68 @@ void HttpServer::setName(const std::string& v) {
     m_dispatch->setDefault(std::make_shared<NotFoundServlet>(v));
 }
 
+bool HttpServer::start() {
+    if(http2::Http2Session::IsEnabled()) {
+        for(auto& i : m_socks) {
+            SSLSocket::ptr ssl = std::dynamic_pointer_cast<SSLSocket>(i);
+            if(ssl) {
+                ssl->setAlpnProtocols({"h2", "http/1.1"});
+            }
+        }
+    }
+    return TcpServer::start();
+}
+
+void HttpServer::handleRequest(HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr session) {
+    // 设置Server名Head
+    rsp->setHeader("Server", getName());
+    // 执行操作
+    if(m_responseCache) {
+        m_responseCache->handle(req, rsp, session);
+    } else {
+        m_dispatch->handle(req, rsp, session);
+    }
+}
+
+void HttpServer::handleHttp2(http2::Http2Session::ptr session) {
+    session->setIOManager(sylar::IOManager::GetThis());
+    session->setWorker(m_worker);
+    auto self = std::dynamic_pointer_cast<HttpServer>(shared_from_this());
+    // 流没有HttpSession，servlet只能通过HttpResponse返回完整的响应
+    session->setRequestHandler([self](HttpRequest::ptr req, HttpResponse::ptr rsp) {
+        self->handleRequest(req, rsp, nullptr);
+        HttpCompress::Apply(req, rsp);
+    });
+    if(session->start()) {
+        session->waitFinish();
+    }
+}
+
+/**
+ * @brief 解码HTTP2-Settings(base64url，没有填充)
+ */
+static std::string decode_http2_settings(const std::string& v) {
+    std::string str = v;
+    for(auto& c : str) {
+        if(c == '-') {
+            c = '+';
+        } else if(c == '_') {
+            c = '/';
+        }
+    }
+    while(str.size() % 4) {
+        str.push_back('=');
+    }
+    return sylar::base64decode(str);
+}
+
 void HttpServer::handleClient(Socket::ptr client) {
     SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
+    SSLSocket::ptr ssl = std::dynamic_pointer_cast<SSLSocket>(client);
+    if(ssl && ssl->getAlpnSelected() == "h2") {
+        handleHttp2(std::make_shared<http2::Http2Session>(client));
+        return;
+    }
     //创建一个会话
     HttpSession::ptr session(new HttpSession(client));
     do {
@@ -38,16 +101,65 @@ void HttpServer::handleClient(Socket::ptr client) {
             SYLAR_LOG_DEBUG(g_logger) << "recv http request fail, errno=" << errno << " errstr=" << strerror(errno) << " cliet:" << *client << " keep_alive=" << m_isKeepalive;
             break;
         }
+        if(req->getMethod() == HttpMethod::PRI && req->getVersion() == 0x20) {
+            if(!http2::Http2Session::IsEnabled()) {
+                break;
+            }
+            // 明文HTTP/2: 请求行和空行"PRI * HTTP/2.0\r\n\r\n"已经被解析，
+            // 连接前言的剩余部分和之后的帧在解析缓冲区中
+            std::string data(http2::CLIENT_PREFACE, http2::CLIENT_PREFACE_SIZE - 6);
+            char buf[4096];
+            while(session->hasBufferedData()) {
+                int rt = session->read(buf, sizeof(buf));
+                if(rt <= 0) {
+                    break;
+                }
+                data.append(buf, rt);
+            }
+            handleHttp2(std::make_shared<http2::Http2Session>(client, data));
+            break;
+        }
+        // h2c升级，客户端收到101之前不会发送HTTP/2数据，缓冲区中有数据说明是流水线请求，不升级
+        if(!ssl && http2::Http2Session::IsEnabled() && !session->hasBufferedData()
+                && !req->getBodyStream()
+                && strcasecmp(req->getHeader("Upgrade").c_str(), "h2c") == 0
+                && req->hasHeader("HTTP2-Settings")) {
+            std::string settings = decode_http2_settings(req->getHeader("HTTP2-Settings"));
+            req->delHeader("Upgrade");
+            req->delHeader("HTTP2-Settings");
+            req->delHeader("Connection");
+            http2::Http2Session::ptr h2(new http2::Http2Session(client));
+            // HTTP2-Settings不合法时不升级，按HTTP/1.1处理
+            if(h2->upgrade(req, settings)) {
+                HttpResponse::ptr rsp(new HttpResponse(0x11, false));
+                rsp->setStatus(HttpStatus::SWITCHING_PROTOCOLS);
+                // 和websocket握手一样保留Connection: Upgrade
+                rsp->setWebsocket(true);
+                rsp->setHeader("Connection", "Upgrade");
+                rsp->setHeader("Upgrade", "h2c");
+                if(session->sendResponse(rsp) > 0) {
+                    handleHttp2(h2);
+                }
+                break;
+            }
+        }
         // 创建响应报文
         HttpResponse::ptr rsp(new HttpResponse(req->getVersion(),req->isClose() || !m_isKeepalive));
-        // 设置Server名Head
-        rsp->setHeader("Server", getName());
-        // 执行操作
-        m_dispatch->handle(req, rsp, session);
-        // 发送响应报文
-        session->sendResponse(rsp);
+        handleRequest(req, rsp, session);
+        bool close = rsp->isClose();
+        if(session->isResponseStarted()) {
+            // servlet已经通过startResponse以流的方式发送
+            if(!session->endResponse()) {
+                break;
+            }
+        } else {
+            // 按Accept-Encoding压缩消息体
+            HttpCompress::Apply(req, rsp);
+            // 发送响应报文，缓冲区中还有流水线请求时暂存，合并后一起发送
+            session->sendResponse(rsp, close || !session->hasBufferedData());
+        }
 
-        if(!m_isKeepalive || req->isClose()) {
+        if(close) {
             break;
         }
     } while(true);
@@ -10,6 +10,8 @@
 #include "sylar/tcp_server.h"
 #include "http_session.h"
 #include "servlet.h"
+#include "servlets/response_cache_servlet.h"
+#include "sylar/http2/http2_session.h"
 
 namespace sylar {
 namespace http {
@@ -43,21 +45,50 @@ public:
      */
     void setServletDispatch(ServletDispatch::ptr v) { m_dispatch = v;}
 
+    /**
+     * @brief 获取响应缓存
+     */
+    ResponseCacheServlet::ptr getResponseCache() const { return m_responseCache;}
+
+    /**
+     * @brief 设置响应缓存，设置后请求先经过缓存再到ServletDispatch，需要在start之前设置
+     */
+    void setResponseCache(ResponseCacheServlet::ptr v) { m_responseCache = v;}
+
     /**
      * @brief 设置服务器名称
      */
     virtual void setName(const std::string& v) override;
+
+    /**
+     * @brief 启动服务，启用http2时为SSL监听socket设置ALPN(h2, http/1.1)
+     */
+    virtual bool start() override;
 protected:
 
     /**
      * @brief 与客户端通信
+     * @details TLS上ALPN协商出h2、明文连接以HTTP/2连接前言开头或者请求Upgrade: h2c时，
+     *          连接转交给http2::Http2Session处理
      */
     virtual void handleClient(Socket::ptr client) override;
+private:
+    /**
+     * @brief 设置Server头，经过响应缓存(如果有)和ServletDispatch处理请求
+     */
+    void handleRequest(HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr session);
+
+    /**
+     * @brief 以HTTP/2处理连接，直到连接结束
+     */
+    void handleHttp2(http2::Http2Session::ptr session);
 private:
     /// 是否支持长连接
     bool m_isKeepalive;
     /// Servlet分发器
     ServletDispatch::ptr m_dispatch;
+    /// 响应缓存
+    ResponseCacheServlet::ptr m_responseCache;
 };
 
 }
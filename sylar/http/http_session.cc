@@ -1,92 +1,240 @@
 #include "http_session.h"
-#include "http_parser.h"
+#include "sylar/config.h"
+#include <string.h>
 
 namespace sylar {
 namespace http {
 
+static sylar::ConfigVar<uint64_t>::ptr g_http_request_stream_body_size =
+    sylar::Config::Lookup("http.request.stream_body_size"
+                ,(uint64_t)0, "http request body stream threshold, 0 means always read body into memory");
+
+/// 最多合并发送的响应个数
+static const size_t s_max_pending_count = 32;
+/// 暂存的响应超过该长度时立即发送
+static const size_t s_max_pending_size = 64 * 1024;
+
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
-    :SocketStream(sock, owner) {
+    :SocketStream(sock, owner)
+    ,m_parser(new HttpRequestParser) {
 }
 
 HttpRequest::ptr HttpSession::recvRequest() {
-    // 创建HttpRequestParser
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    // 获取缓冲区大小
+    // 上一个请求没有读完的消息体
+    if(!finishBody()) {
+        close();
+        return nullptr;
+    }
+    // 解析缓冲区在连接上复用，只在配置变大时扩容
     uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    // 交给智能指针托管
-    std::shared_ptr<char> buffer(
-            new char[buff_size], [](char* ptr){
-                delete[] ptr;
-            });
-    char* data = buffer.get();
-    int offset = 0;
+    if(m_recvBuf.size() < buff_size) {
+        m_recvBuf.resize(buff_size);
+    }
+    buff_size = m_recvBuf.size();
+    char* data = &m_recvBuf[0];
+    m_parser->reset();
+    // 上次剩余的数据放在缓冲区开头
+    int offset = m_recvOffset;
+    m_recvOffset = 0;
+    // 有剩余数据时先解析剩余数据，不够再读
+    bool need_read = offset == 0;
     do {
-        // 在offset后面接着读数据
-        int len = read(data + offset, buff_size - offset);
-        if(len <= 0) {
-            close();
-            return nullptr;
+        int len = offset;
+        if(need_read) {
+            // 阻塞读之前先把暂存的响应发出去，避免对端等待
+            if(flushResponses() < 0) {
+                close();
+                return nullptr;
+            }
+            // 在offset后面接着读数据
+            int rt = SocketStream::read(data + offset, buff_size - offset);
+            if(rt <= 0) {
+                close();
+                return nullptr;
+            }
+            // 当前已经读取的数据长度
+            len += rt;
         }
-        // 当前已经读取的数据长度
-        len += offset;
+        need_read = true;
         // 解析缓冲区data中的数据
         // execute会将data向前移动nparse个字节，nparse为已经成功解析的字节数
-        size_t nparse = parser->execute(data, len);
-        if(parser->hasError()) {
+        size_t nparse = m_parser->execute(data, len);
+        if(m_parser->hasError()) {
             close();
             return nullptr;
         }
         // 此时data还剩下已经读到的数据 - 解析过的数据
         offset = len - nparse;
+        // 解析结束
+        if(m_parser->isFinished()) {
+            break;
+        }
         // 缓冲区满了还没解析完
         if(offset == (int)buff_size) {
             close();
             return nullptr;
         }
-        // 解析结束
-        if(parser->isFinished()) {
-            break;
-        }
     } while(true);
-    // 获得body(消息体)的长度
-    int64_t length = parser->getContentLength();
-    if(length > 0) {
-        std::string body;
-        body.resize(length);
-
-        int len = 0;
-        // 如果body长度比缓冲区剩余的还大，将缓冲区全部加进来
-        if(length >= offset) {
-            memcpy(&body[0], data, offset);
-            len = offset;
-        } 
-        // 否则将取length
-        else {
-            memcpy(&body[0], data, length);
-            len = length;
-        }
-        length -= offset;
-        // 缓冲区里的数据也不够，继续读取直到满足length
-        if(length > 0) {
-            if(readFixSize(&body[len], length) <= 0) {
+    // 头部之后的数据(消息体及后续请求)留在缓冲区
+    m_recvOffset = offset;
+    HttpRequest::ptr req = m_parser->getData();
+    bool chunked = strcasestr(req->getHeader("transfer-encoding").c_str(), "chunked") != nullptr;
+    uint64_t length = chunked ? 0 : m_parser->getContentLength();
+    if(chunked || length > 0) {
+        m_bodyReader.reset(new HttpBodyReader(shared_from_this(), chunked, length, buff_size));
+        uint64_t stream_size = g_http_request_stream_body_size->getValue();
+        if(stream_size && (chunked || length >= stream_size)) {
+            req->setBodyStream(m_bodyReader);
+        } else {
+            std::string body;
+            if(!m_bodyReader->readAll(body, HttpRequestParser::GetHttpRequestMaxBodySize())
+                    || !finishBody()) {
                 close();
                 return nullptr;
             }
+            // 设置body
+            req->setBody(body);
         }
-        // 设置body
-        parser->getData()->setBody(body);
     }
 
-    parser->getData()->init();
+    req->init();
     //返回解析完的HttpRequest
-    return parser->getData();
+    return req;
+}
+
+bool HttpSession::finishBody() {
+    if(!m_bodyReader) {
+        return true;
+    }
+    HttpBodyReader::ptr reader;
+    reader.swap(m_bodyReader);
+    if(!reader->discard()) {
+        return false;
+    }
+    // 预读缓冲区是从解析缓冲区读出的，放回开头
+    size_t size = reader->getRemainSize();
+    if(size > 0) {
+        if(m_recvBuf.size() < m_recvOffset + size) {
+            m_recvBuf.resize(m_recvOffset + size);
+        }
+        memmove(&m_recvBuf[size], &m_recvBuf[0], m_recvOffset);
+        memcpy(&m_recvBuf[0], reader->getRemainData(), size);
+        m_recvOffset += size;
+    }
+    return true;
 }
 
-int HttpSession::sendResponse(HttpResponse::ptr rsp) {
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+int HttpSession::sendResponse(HttpResponse::ptr rsp, bool flush) {
+    // 头部写入复用的缓冲区，消息体直接引用，发送时一次writev
+    if(m_pending.empty()) {
+        m_sendBuf.clear();
+    }
+    size_t start = m_sendBuf.size();
+    rsp->serializeHeader(m_sendBuf);
+    m_pending.push_back(std::make_pair(m_sendBuf.size(), rsp));
+    size_t size = m_sendBuf.size() - start + rsp->getBody().size();
+    m_pendingSize += size;
+    if(flush || m_pending.size() >= s_max_pending_count
+            || m_pendingSize >= s_max_pending_size) {
+        int rt = flushResponses();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return size;
+}
+
+int HttpSession::flushResponses() {
+    if(m_pending.empty()) {
+        return 0;
+    }
+    iovec iovs[s_max_pending_count * 2];
+    size_t count = 0;
+    size_t start = 0;
+    for(auto& i : m_pending) {
+        iovs[count].iov_base = (void*)(m_sendBuf.c_str() + start);
+        iovs[count].iov_len = i.first - start;
+        ++count;
+        const std::string& body = i.second->getBody();
+        if(!body.empty()) {
+            iovs[count].iov_base = (void*)body.c_str();
+            iovs[count].iov_len = body.size();
+            ++count;
+        }
+        start = i.first;
+    }
+    int rt = writevFixSize(iovs, count);
+    m_pending.clear();
+    m_pendingSize = 0;
+    m_sendBuf.clear();
+    return rt;
+}
+
+HttpBodyWriter::ptr HttpSession::startResponse(HttpResponse::ptr rsp) {
+    bool chunked = false;
+    if(rsp->getHeader("content-length").empty()) {
+        if(rsp->getVersion() >= 0x11) {
+            rsp->setHeader("Transfer-Encoding", "chunked");
+            chunked = true;
+        } else {
+            // HTTP/1.0不支持chunked，关闭连接表示消息体结束
+            rsp->setClose(true);
+        }
+    }
+    rsp->setBody("");
+    // 和之前暂存的响应一起按顺序发出
+    if(sendResponse(rsp) <= 0) {
+        return nullptr;
+    }
+    m_writer.reset(new HttpBodyWriter(shared_from_this(), chunked));
+    return m_writer;
+}
+
+bool HttpSession::endResponse() {
+    if(!m_writer) {
+        return true;
+    }
+    HttpBodyWriter::ptr writer;
+    writer.swap(m_writer);
+    writer->close();
+    return !writer->isError();
+}
+
+void HttpSession::close() {
+    // 消息体读写流持有session，释放以打破循环引用
+    m_bodyReader.reset();
+    m_writer.reset();
+    SocketStream::close();
+}
+
+int HttpSession::read(void* buffer, size_t length) {
+    if(m_recvOffset == 0) {
+        // 流式读取消息体时，阻塞读之前先发送暂存的响应
+        if(flushResponses() < 0) {
+            return -1;
+        }
+        return SocketStream::read(buffer, length);
+    }
+    size_t n = std::min(length, m_recvOffset);
+    memcpy(buffer, &m_recvBuf[0], n);
+    m_recvOffset -= n;
+    memmove(&m_recvBuf[0], &m_recvBuf[n], m_recvOffset);
+    return n;
+}
+
+int HttpSession::read(ByteArray::ptr ba, size_t length) {
+    if(m_recvOffset == 0) {
+        // 流式读取消息体时，阻塞读之前先发送暂存的响应
+        if(flushResponses() < 0) {
+            return -1;
+        }
+        return SocketStream::read(ba, length);
+    }
+    size_t n = std::min(length, m_recvOffset);
+    ba->write(&m_recvBuf[0], n);
+    m_recvOffset -= n;
+    memmove(&m_recvBuf[0], &m_recvBuf[n], m_recvOffset);
+    return n;
 }
 
 }
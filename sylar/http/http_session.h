@@ -9,6 +9,8 @@
 
 #include "sylar/streams/socket_stream.h"
 #include "http.h"
+#include "http_parser.h"
+#include "http_body.h"
 
 namespace sylar {
 namespace http {
@@ -16,7 +18,8 @@ namespace http {
 /**
  * @brief HTTPSession封装
  */
-class HttpSession : public SocketStream {
+class HttpSession : public SocketStream
+                   ,public std::enable_shared_from_this<HttpSession> {
 public:
     /// 智能指针类型定义
     typedef std::shared_ptr<HttpSession> ptr;
@@ -30,17 +33,94 @@ public:
 
     /**
      * @brief 接收HTTP请求
+     * @details 连接上复用同一个解析缓冲区，读多的数据(流水线中的后续请求)
+     *          保留到下一次recvRequest。需要阻塞读之前先发送暂存的响应。
+     *          chunked编码或者长度不小于http.request.stream_body_size的消息体
+     *          不读入内存，通过HttpRequest::getBodyStream读取，
+     *          下一次recvRequest时丢弃没有读完的部分
      */
     HttpRequest::ptr recvRequest();
 
     /**
      * @brief 发送HTTP响应
      * @param[in] rsp HTTP响应
-     * @return >0 发送成功
+     * @param[in] flush 是否立即发送，为false时暂存，和后续响应合并成一次writev
+     * @return >0 发送成功(暂存时返回响应长度)
      *         =0 对方关闭
      *         <0 Socket异常
      */
-    int sendResponse(HttpResponse::ptr rsp);
+    int sendResponse(HttpResponse::ptr rsp, bool flush = true);
+
+    /**
+     * @brief 发送所有暂存的响应
+     * @return >0 发送成功
+     *         =0 对方关闭或没有暂存的响应
+     *         <0 Socket异常
+     */
+    int flushResponses();
+
+    /**
+     * @brief 以流的方式发送响应
+     * @details 先发送响应头(rsp的消息体被忽略)，消息体通过返回的writer写入。
+     *          没有设置content-length时HTTP/1.1使用chunked编码，
+     *          HTTP/1.0则在消息体结束后关闭连接
+     * @param[in] rsp HTTP响应
+     * @return 消息体写入流，发送响应头失败返回nullptr
+     */
+    HttpBodyWriter::ptr startResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 是否已经通过startResponse开始发送响应
+     */
+    bool isResponseStarted() const { return m_writer != nullptr;}
+
+    /**
+     * @brief 结束startResponse开始的响应
+     * @return 响应是否完整发送
+     */
+    bool endResponse();
+
+    /**
+     * @brief 关闭连接，释放消息体读写流
+     */
+    virtual void close() override;
+
+    /**
+     * @brief 缓冲区中是否还有未处理的数据(流水线中的后续请求)
+     */
+    bool hasBufferedData() const { return m_recvOffset > 0;}
+
+    /**
+     * @brief 读取数据，优先返回解析缓冲区中剩余的数据
+     */
+    virtual int read(void* buffer, size_t length) override;
+
+    /**
+     * @brief 读取数据，优先返回解析缓冲区中剩余的数据
+     */
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+private:
+    /**
+     * @brief 读完(丢弃)当前请求剩余的消息体，预读的数据放回解析缓冲区
+     */
+    bool finishBody();
+private:
+    /// 请求解析器，在连接上复用
+    HttpRequestParser::ptr m_parser;
+    /// 请求解析缓冲区
+    std::vector<char> m_recvBuf;
+    /// 缓冲区中剩余未处理数据的长度
+    size_t m_recvOffset = 0;
+    /// 响应头的序列化缓冲区，在连接上复用
+    std::string m_sendBuf;
+    /// 暂存的响应及其头部在m_sendBuf中的结束位置
+    std::vector<std::pair<size_t, HttpResponse::ptr> > m_pending;
+    /// 暂存响应的总长度
+    size_t m_pendingSize = 0;
+    /// 当前请求的消息体读取流
+    HttpBodyReader::ptr m_bodyReader;
+    /// 当前响应的消息体写入流
+    HttpBodyWriter::ptr m_writer;
 };
 
 }
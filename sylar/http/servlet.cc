@@ -1,5 +1,6 @@
 #include "servlet.h"
 #include <fnmatch.h>
+#include <string.h>
 
 namespace sylar {
 namespace http {
@@ -17,6 +18,280 @@ int32_t FunctionServlet::handle(sylar::http::HttpRequest::ptr request
 
 
 
+struct ServletRouter::Node {
+    ~Node() {
+        for(auto i : children) {
+            delete i;
+        }
+        delete param;
+        delete catchAll;
+    }
+
+    /// 压缩的静态前缀
+    std::string prefix;
+    /// 每个静态子节点前缀的首字符，与children一一对应
+    std::string indices;
+    /// 静态子节点
+    std::vector<Node*> children;
+    /// :name 参数子节点
+    Node* param = nullptr;
+    /// *name 通配子节点
+    Node* catchAll = nullptr;
+    /// 参数/通配节点的名称
+    std::string name;
+    /// 在该节点结束的路由/前缀
+    IServletCreator::ptr creator;
+    std::string pattern;
+    uint64_t seq = 0;
+};
+
+ServletRouter::ServletRouter()
+    :m_root(new Node)
+    ,m_prefixRoot(new Node) {
+}
+
+ServletRouter::~ServletRouter() {
+    delete m_root;
+    delete m_prefixRoot;
+}
+
+ServletRouter::Node* ServletRouter::findStatic(Node* node, const char* str, size_t len, bool create) {
+    // node的前缀已经匹配完，在它的静态子节点中继续
+    while(len > 0) {
+        size_t pos = node->indices.find(str[0]);
+        if(pos == std::string::npos) {
+            if(!create) {
+                return nullptr;
+            }
+            Node* child = new Node;
+            child->prefix.assign(str, len);
+            node->indices.push_back(str[0]);
+            node->children.push_back(child);
+            return child;
+        }
+
+        Node* child = node->children[pos];
+        size_t common = 0;
+        size_t max = std::min(len, child->prefix.size());
+        while(common < max && child->prefix[common] == str[common]) {
+            ++common;
+        }
+        if(common < child->prefix.size()) {
+            if(!create) {
+                return nullptr;
+            }
+            // 分裂：child保留公共部分，剩余部分及其所有内容移到新节点
+            Node* tail = new Node;
+            tail->prefix = child->prefix.substr(common);
+            tail->indices.swap(child->indices);
+            tail->children.swap(child->children);
+            std::swap(tail->param, child->param);
+            std::swap(tail->catchAll, child->catchAll);
+            tail->creator.swap(child->creator);
+            tail->pattern.swap(child->pattern);
+            tail->seq = child->seq;
+            child->seq = 0;
+            child->prefix.resize(common);
+            child->indices.push_back(tail->prefix[0]);
+            child->children.push_back(tail);
+        }
+        node = child;
+        str += common;
+        len -= common;
+    }
+    return node;
+}
+
+ServletRouter::Node* ServletRouter::findRoute(const std::string& pattern, bool create) {
+    Node* node = m_root;
+    size_t params = 0;
+    size_t i = 0;
+    while(i < pattern.size()) {
+        size_t j = pattern.find_first_of(":*", i);
+        if(j == std::string::npos) {
+            j = pattern.size();
+        }
+        if(j > i) {
+            node = findStatic(node, pattern.c_str() + i, j - i, create);
+            if(!node) {
+                return nullptr;
+            }
+        }
+        if(j == pattern.size()) {
+            break;
+        }
+
+        if(pattern[j] == ':') {
+            size_t k = pattern.find('/', j);
+            if(k == std::string::npos) {
+                k = pattern.size();
+            }
+            std::string name = pattern.substr(j + 1, k - j - 1);
+            if(name.empty() || name.find_first_of(":*") != std::string::npos
+                    || ++params > MAX_PARAMS) {
+                return nullptr;
+            }
+            if(!node->param) {
+                if(!create) {
+                    return nullptr;
+                }
+                node->param = new Node;
+                node->param->name = name;
+            } else if(node->param->name != name) {
+                return nullptr;
+            }
+            node = node->param;
+            i = k;
+        } else {
+            std::string name = pattern.substr(j + 1);
+            if(name.find_first_of("/:*") != std::string::npos
+                    || (!name.empty() && ++params > MAX_PARAMS)) {
+                return nullptr;
+            }
+            if(!node->catchAll) {
+                if(!create) {
+                    return nullptr;
+                }
+                node->catchAll = new Node;
+                node->catchAll->name = name;
+            } else if(node->catchAll->name != name) {
+                return nullptr;
+            }
+            node = node->catchAll;
+            i = pattern.size();
+        }
+    }
+    return node;
+}
+
+bool ServletRouter::add(const std::string& pattern, IServletCreator::ptr creator) {
+    Node* node = findRoute(pattern, true);
+    if(!node) {
+        return false;
+    }
+    if(!node->creator) {
+        ++m_size;
+    }
+    node->creator = creator;
+    node->pattern = pattern;
+    return true;
+}
+
+bool ServletRouter::del(const std::string& pattern) {
+    Node* node = findRoute(pattern, false);
+    if(!node || !node->creator) {
+        return false;
+    }
+    node->creator.reset();
+    node->pattern.clear();
+    --m_size;
+    return true;
+}
+
+bool ServletRouter::matchNode(const Node* node, const char* path, size_t len, Match& m) const {
+    if(len == 0) {
+        if(node->creator) {
+            m.creator = &node->creator;
+            m.pattern = &node->pattern;
+            return true;
+        }
+    } else {
+        size_t pos = node->indices.find(path[0]);
+        if(pos != std::string::npos) {
+            const Node* child = node->children[pos];
+            size_t n = child->prefix.size();
+            if(len >= n && memcmp(child->prefix.c_str(), path, n) == 0
+                    && matchNode(child, path + n, len - n, m)) {
+                return true;
+            }
+        }
+
+        if(node->param) {
+            const char* end = (const char*)memchr(path, '/', len);
+            size_t n = end ? end - path : len;
+            if(n > 0) {
+                m.params[m.count++] = {&node->param->name, path, n};
+                if(matchNode(node->param, path + n, len - n, m)) {
+                    return true;
+                }
+                --m.count;
+            }
+        }
+    }
+
+    if(node->catchAll && node->catchAll->creator) {
+        if(!node->catchAll->name.empty()) {
+            m.params[m.count++] = {&node->catchAll->name, path, len};
+        }
+        m.creator = &node->catchAll->creator;
+        m.pattern = &node->catchAll->pattern;
+        return true;
+    }
+    return false;
+}
+
+bool ServletRouter::match(const char* path, size_t len, Match& m) const {
+    m.count = 0;
+    m.creator = nullptr;
+    return matchNode(m_root, path, len, m);
+}
+
+void ServletRouter::addPrefix(const std::string& prefix, IServletCreator::ptr creator, uint64_t seq) {
+    Node* node = findStatic(m_prefixRoot, prefix.c_str(), prefix.size(), true);
+    node->creator = creator;
+    node->pattern = prefix + "*";
+    node->seq = seq;
+}
+
+bool ServletRouter::delPrefix(const std::string& prefix) {
+    Node* node = findStatic(m_prefixRoot, prefix.c_str(), prefix.size(), false);
+    if(!node || !node->creator) {
+        return false;
+    }
+    node->creator.reset();
+    node->pattern.clear();
+    return true;
+}
+
+bool ServletRouter::matchPrefix(const char* path, size_t len, Match& m) const {
+    const Node* node = m_prefixRoot;
+    const Node* best = node->creator ? node : nullptr;
+    while(len > 0) {
+        size_t pos = node->indices.find(path[0]);
+        if(pos == std::string::npos) {
+            break;
+        }
+        const Node* child = node->children[pos];
+        size_t n = child->prefix.size();
+        if(len < n || memcmp(child->prefix.c_str(), path, n)) {
+            break;
+        }
+        node = child;
+        path += n;
+        len -= n;
+        if(node->creator && (!best || node->seq < best->seq)) {
+            best = node;
+        }
+    }
+    m.count = 0;
+    if(!best) {
+        m.creator = nullptr;
+        return false;
+    }
+    m.creator = &best->creator;
+    m.pattern = &best->pattern;
+    m.seq = best->seq;
+    return true;
+}
+
+/**
+ * @brief 是否只是以*结尾的前缀匹配
+ */
+static bool is_prefix_glob(const std::string& uri) {
+    return !uri.empty() && uri.back() == '*'
+        && uri.find_first_of("*?[\\") == uri.size() - 1;
+}
+
 ServletDispatch::ServletDispatch()
     :Servlet("ServletDispatch") {
     m_default.reset(new NotFoundServlet("sylar/1.0"));
@@ -25,7 +300,7 @@ ServletDispatch::ServletDispatch()
 int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request
                , sylar::http::HttpResponse::ptr response
                , sylar::http::HttpSession::ptr session) {
-    auto slt = getMatchedServlet(request->getPath());
+    auto slt = getMatchedServlet(request);
     if(slt) {
         slt->handle(request, response, session);
     }
@@ -45,14 +320,14 @@ void ServletDispatch::addServletCreator(const std::string& uri, IServletCreator:
 void ServletDispatch::addGlobServletCreator(const std::string& uri, IServletCreator::ptr creator) {
     RWMutexType::WriteLock lock(m_mutex);
     // 将原先的删除
-    for(auto it = m_globs.begin();
-            it != m_globs.end(); ++it) {
-        if(it->first == uri) {
-            m_globs.erase(it);
-            break;
-        }
-    }
+    doDelGlob(uri);
     m_globs.push_back(std::make_pair(uri, creator));
+    uint64_t seq = ++m_globSeq;
+    if(is_prefix_glob(uri)) {
+        m_router.addPrefix(uri.substr(0, uri.size() - 1), creator, seq);
+    } else {
+        m_complexGlobs.push_back(GlobItem{seq, uri, creator});
+    }
 }
 
 void ServletDispatch::addServlet(const std::string& uri
@@ -64,16 +339,7 @@ void ServletDispatch::addServlet(const std::string& uri
 
 void ServletDispatch::addGlobServlet(const std::string& uri
                                     ,Servlet::ptr slt) {
-    RWMutexType::WriteLock lock(m_mutex);
-    for(auto it = m_globs.begin();
-            it != m_globs.end(); ++it) {
-        if(it->first == uri) {
-            m_globs.erase(it);
-            break;
-        }
-    }
-    m_globs.push_back(std::make_pair(uri
-                , std::make_shared<HoldServletCreator>(slt)));
+    addGlobServletCreator(uri, std::make_shared<HoldServletCreator>(slt));
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri
@@ -88,6 +354,10 @@ void ServletDispatch::delServlet(const std::string& uri) {
 
 void ServletDispatch::delGlobServlet(const std::string& uri) {
     RWMutexType::WriteLock lock(m_mutex);
+    doDelGlob(uri);
+}
+
+void ServletDispatch::doDelGlob(const std::string& uri) {
     for(auto it = m_globs.begin();
             it != m_globs.end(); ++it) {
         if(it->first == uri) {
@@ -95,6 +365,41 @@ void ServletDispatch::delGlobServlet(const std::string& uri) {
             break;
         }
     }
+    if(is_prefix_glob(uri)) {
+        m_router.delPrefix(uri.substr(0, uri.size() - 1));
+        return;
+    }
+    for(auto it = m_complexGlobs.begin();
+            it != m_complexGlobs.end(); ++it) {
+        if(it->uri == uri) {
+            m_complexGlobs.erase(it);
+            break;
+        }
+    }
+}
+
+bool ServletDispatch::addRoute(const std::string& pattern, Servlet::ptr slt) {
+    return addRouteCreator(pattern, std::make_shared<HoldServletCreator>(slt));
+}
+
+bool ServletDispatch::addRoute(const std::string& pattern
+                               ,FunctionServlet::callback cb) {
+    return addRoute(pattern, std::make_shared<FunctionServlet>(cb));
+}
+
+bool ServletDispatch::addRouteCreator(const std::string& pattern, IServletCreator::ptr creator) {
+    RWMutexType::WriteLock lock(m_mutex);
+    if(!m_router.add(pattern, creator)) {
+        return false;
+    }
+    m_routes[pattern] = creator;
+    return true;
+}
+
+void ServletDispatch::delRoute(const std::string& pattern) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_router.del(pattern);
+    m_routes.erase(pattern);
 }
 
 Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
@@ -117,19 +422,45 @@ Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
 }
 
 Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri) {
+    return match(uri, nullptr);
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(HttpRequest::ptr request) {
+    return match(request->getPath(), request.get());
+}
+
+Servlet::ptr ServletDispatch::match(const std::string& uri, HttpRequest* request) {
     RWMutexType::ReadLock lock(m_mutex);
     auto mit = m_datas.find(uri);
     // 先找精准的Servlet
     if(mit != m_datas.end()) {
         return mit->second->get();
     }
-    // 再找模糊的Servlet
-    for(auto it = m_globs.begin();
-            it != m_globs.end(); ++it) {
-        if(!fnmatch(it->first.c_str(), uri.c_str(), 0)) {
-            return it->second->get();
+    // 再找路由
+    ServletRouter::Match m;
+    if(m_router.match(uri.c_str(), uri.size(), m)) {
+        if(request) {
+            // uri就是request的路径，参数只记录在路径中的位置
+            for(size_t i = 0; i < m.count; ++i) {
+                request->setPathParam(*m.params[i].name
+                        ,m.params[i].value - uri.data(), m.params[i].size);
+            }
+        }
+        return (*m.creator)->get();
+    }
+    // 再找模糊的Servlet，多个都满足时取最先添加的
+    bool found = m_router.matchPrefix(uri.c_str(), uri.size(), m);
+    for(auto& i : m_complexGlobs) {
+        if(found && i.seq > m.seq) {
+            break;
+        }
+        if(!fnmatch(i.uri.c_str(), uri.c_str(), 0)) {
+            return i.creator->get();
         }
     }
+    if(found) {
+        return (*m.creator)->get();
+    }
     // 都没有返回404
     return m_default;
 }
@@ -141,6 +472,14 @@ void ServletDispatch::listAllServletCreator(std::map<std::string, IServletCreato
     }
 }
 
+// 将 ServletDispatch 内部保存的所有路由的 Servlet 的创建器信息导出到一个外部的 std::map 容器中。
+void ServletDispatch::listAllRouteCreator(std::map<std::string, IServletCreator::ptr>& infos) {
+    RWMutexType::ReadLock lock(m_mutex);
+    for(auto& i : m_routes) {
+        infos[i.first] = i.second;
+    }
+}
+
 // 将 ServletDispatch 内部保存的所有模糊匹配的 Servlet 的创建器信息导出到一个外部的 std::map 容器中。
 void ServletDispatch::listAllGlobServletCreator(std::map<std::string, IServletCreator::ptr>& infos) {
     RWMutexType::ReadLock lock(m_mutex);
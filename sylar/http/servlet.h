@@ -15,6 +15,7 @@
 #include "http.h"
 #include "http_session.h"
 #include "sylar/thread.h"
+#include "sylar/noncopyable.h"
 #include "sylar/util.h"
 
 namespace sylar {
@@ -151,6 +152,131 @@ public:
     }
 };
 
+/**
+ * @brief 压缩前缀树(radix tree)路由
+ * @details 节点按字符压缩公共前缀，查找只沿着路径走一遍，与路由数量无关，过程中不分配内存。
+ *          支持两类条目：
+ *          1. 路由 add/match：
+ *              静态片段          /users/list
+ *              :name 参数        /users/:id/posts 匹配一个路径段(到下一个'/'为止，不能为空)
+ *              *name 通配        只能在最后，如"/static/"后接"*path"，匹配剩余的所有字符(可以为空)，name可省略
+ *              同一位置的优先级：静态 > 参数 > 通配，匹配失败时会回溯
+ *          2. 前缀 addPrefix/matchPrefix：
+ *              prefix后接任意字符都匹配(即以*结尾的glob)，多个前缀都匹配时返回seq最小的
+ *          该类本身不加锁，由ServletDispatch的读写锁保护
+ */
+class ServletRouter : Noncopyable {
+public:
+    /// 一个路由中最多的参数个数
+    static const size_t MAX_PARAMS = 16;
+
+    /**
+     * @brief 匹配出的参数，指向路由和路径中的内存，不做拷贝
+     */
+    struct Param {
+        /// 参数名
+        const std::string* name;
+        /// 参数值的起始地址
+        const char* value;
+        /// 参数值的长度
+        size_t size;
+    };
+
+    /**
+     * @brief 匹配结果
+     */
+    struct Match {
+        /// 匹配到的Servlet创建器
+        const IServletCreator::ptr* creator = nullptr;
+        /// 匹配到的路由或前缀
+        const std::string* pattern = nullptr;
+        /// 前缀的序号
+        uint64_t seq = 0;
+        /// 参数个数
+        size_t count = 0;
+        /// 参数
+        Param params[MAX_PARAMS];
+    };
+
+    ServletRouter();
+    ~ServletRouter();
+
+    /**
+     * @brief 添加路由，已经存在时替换
+     * @param[in] pattern 路由，如"/users/:id"，或"/static/"后接"*path"的通配
+     * @param[in] creator Servlet创建器
+     * @return 路由不合法(通配不在最后、同一位置的参数名冲突、参数过多等)时返回false
+     */
+    bool add(const std::string& pattern, IServletCreator::ptr creator);
+
+    /**
+     * @brief 删除路由
+     * @return 是否存在
+     */
+    bool del(const std::string& pattern);
+
+    /**
+     * @brief 查找路由
+     * @param[in] path 请求路径
+     * @param[in] len 路径长度
+     * @param[out] m 匹配结果
+     * @return 是否匹配到
+     */
+    bool match(const char* path, size_t len, Match& m) const;
+
+    /**
+     * @brief 添加前缀，已经存在时替换
+     * @param[in] prefix 前缀(不含结尾的*)
+     * @param[in] creator Servlet创建器
+     * @param[in] seq 序号，多个前缀都匹配时取序号最小的
+     */
+    void addPrefix(const std::string& prefix, IServletCreator::ptr creator, uint64_t seq);
+
+    /**
+     * @brief 删除前缀
+     * @return 是否存在
+     */
+    bool delPrefix(const std::string& prefix);
+
+    /**
+     * @brief 查找序号最小的匹配前缀
+     * @param[in] path 请求路径
+     * @param[in] len 路径长度
+     * @param[out] m 匹配结果
+     * @return 是否匹配到
+     */
+    bool matchPrefix(const char* path, size_t len, Match& m) const;
+
+    /**
+     * @brief 路由数量
+     */
+    size_t size() const { return m_size;}
+private:
+    struct Node;
+
+    /**
+     * @brief 找到静态路径对应的节点，create时不存在则创建(必要时分裂节点)
+     */
+    Node* findStatic(Node* node, const char* str, size_t len, bool create);
+
+    /**
+     * @brief 找到路由对应的节点
+     */
+    Node* findRoute(const std::string& pattern, bool create);
+
+    /**
+     * @brief 递归匹配路由
+     */
+    bool matchNode(const Node* node, const char* path, size_t len, Match& m) const;
+private:
+    /// 路由树的根
+    Node* m_root;
+    /// 前缀树的根
+    Node* m_prefixRoot;
+    /// 路由数量
+    size_t m_size = 0;
+};
+
 /**
  * @brief Servlet分发器
  * @details 通过 URI 来匹配和分发不同的 Servlet，并能处理精确匹配和模糊匹配请求
@@ -222,6 +348,39 @@ public:
         addGlobServletCreator(uri, std::make_shared<ServletCreator<T> >());
     }
 
+    /**
+     * @brief 添加路由servlet
+     * @param[in] pattern 路由，支持:name参数和结尾的*name通配，如 /users/:id
+     * @param[in] slt servlet
+     * @details 匹配到的参数通过HttpRequest::getPathParam获取。
+     *          优先级：精准匹配 > 路由 > 模糊匹配
+     * @return 路由不合法时返回false
+     */
+    bool addRoute(const std::string& pattern, Servlet::ptr slt);
+
+    /**
+     * @brief 添加路由servlet
+     * @param[in] pattern 路由
+     * @param[in] cb FunctionServlet回调函数
+     */
+    bool addRoute(const std::string& pattern, FunctionServlet::callback cb);
+
+    /**
+     * @brief 使用 IServletCreator 创建器添加路由
+     */
+    bool addRouteCreator(const std::string& pattern, IServletCreator::ptr creator);
+
+    template<class T>
+    bool addRouteCreator(const std::string& pattern) {
+        return addRouteCreator(pattern, std::make_shared<ServletCreator<T> >());
+    }
+
+    /**
+     * @brief 删除路由servlet
+     * @param[in] pattern 路由
+     */
+    void delRoute(const std::string& pattern);
+
     /**
      * @brief 删除servlet
      * @param[in] uri uri
@@ -267,9 +426,41 @@ public:
      */
     Servlet::ptr getMatchedServlet(const std::string& uri);
 
+    /**
+     * @brief 通过请求获取servlet，匹配到路由时把路径参数设置到请求中
+     * @param[in] request HTTP请求
+     * @return 优先精准匹配,其次路由,再次模糊匹配,最后返回默认
+     */
+    Servlet::ptr getMatchedServlet(HttpRequest::ptr request);
+
     void listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
     void listAllGlobServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
+    void listAllRouteCreator(std::map<std::string, IServletCreator::ptr>& infos);
 private:
+    /**
+     * @brief 匹配servlet
+     * @param[in] uri 请求路径，request非空时必须是request->getPath()
+     * @param[in] request 非空时设置路径参数
+     */
+    Servlet::ptr match(const std::string& uri, HttpRequest* request);
+
+    /**
+     * @brief 删除模糊匹配servlet，需要持有写锁
+     */
+    void doDelGlob(const std::string& uri);
+private:
+    /**
+     * @brief 不能用前缀表示的模糊匹配
+     */
+    struct GlobItem {
+        /// 添加的序号
+        uint64_t seq;
+        /// 模糊匹配的uri
+        std::string uri;
+        /// Servlet创建器
+        IServletCreator::ptr creator;
+    };
+
     /// 读写互斥量
     RWMutexType m_mutex;
     /// 精准匹配servlet MAP
@@ -278,6 +469,14 @@ private:
     /// 模糊匹配servlet 数组
     /// uri(/sylar/*) -> servlet
     std::vector<std::pair<std::string, IServletCreator::ptr> > m_globs;
+    /// 路由(/users/:id)，以及以*结尾的简单模糊匹配(/sylar/*)的前缀
+    ServletRouter m_router;
+    /// 路由 -> servlet，用于遍历
+    std::map<std::string, IServletCreator::ptr> m_routes;
+    /// 其他模糊匹配，按添加顺序
+    std::vector<GlobItem> m_complexGlobs;
+    /// 模糊匹配的序号，多个模糊匹配都满足时取最先添加的
+    uint64_t m_globSeq = 0;
     /// 默认servlet，所有路径都没匹配到时使用
     Servlet::ptr m_default;
 };
@@ -0,0 +1,257 @@
+#include "response_cache_servlet.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <strings.h>
+#include <sstream>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+ResponseCacheServlet::ResponseCacheServlet(Servlet::ptr next, size_t max_size
+                                           ,const std::vector<std::string>& vary)
+    :Servlet("ResponseCacheServlet")
+    ,m_next(next)
+    ,m_cache(max_size) {
+    setVary(vary);
+}
+
+void ResponseCacheServlet::setVary(const std::vector<std::string>& v) {
+    std::vector<std::string> vary;
+    for(auto& i : v) {
+        vary.push_back(sylar::ToLower(i));
+    }
+    RWMutex::WriteLock lock(m_varyMutex);
+    m_vary.swap(vary);
+}
+
+std::vector<std::string> ResponseCacheServlet::getVary() {
+    RWMutex::ReadLock lock(m_varyMutex);
+    return m_vary;
+}
+
+int64_t ResponseCacheServlet::ParseMaxAge(const std::string& cache_control) {
+    int64_t max_age = -1;
+    int64_t s_maxage = -1;
+    size_t pos = 0;
+    while(pos < cache_control.size()) {
+        size_t next = cache_control.find(',', pos);
+        if(next == std::string::npos) {
+            next = cache_control.size();
+        }
+        std::string item = sylar::StringUtil::Trim(cache_control.substr(pos, next - pos));
+        pos = next + 1;
+        if(strcasecmp(item.c_str(), "no-store") == 0
+                || strcasecmp(item.c_str(), "no-cache") == 0
+                || strcasecmp(item.c_str(), "private") == 0) {
+            return -1;
+        }
+        if(strncasecmp(item.c_str(), "max-age=", 8) == 0) {
+            max_age = atoll(item.c_str() + 8);
+        } else if(strncasecmp(item.c_str(), "s-maxage=", 9) == 0) {
+            s_maxage = atoll(item.c_str() + 9);
+        }
+    }
+    return s_maxage >= 0 ? s_maxage : max_age;
+}
+
+bool ResponseCacheServlet::makeKey(HttpRequest::ptr request, std::string& key) {
+    HttpMethod method = request->getMethod();
+    if(method != HttpMethod::GET && method != HttpMethod::HEAD) {
+        return false;
+    }
+    // 带认证信息的响应因人而异，不能共享
+    if(!request->getHeader("Authorization").empty()) {
+        return false;
+    }
+    if(request->getHeader("Cache-Control").find("no-store") != std::string::npos) {
+        return false;
+    }
+    key.reserve(request->getPath().size() + request->getQuery().size() + 16);
+    key.append(HttpMethodToString(method)).append(" ")
+       .append(request->getPath()).append("?").append(request->getQuery());
+    RWMutex::ReadLock lock(m_varyMutex);
+    for(auto& i : m_vary) {
+        key.append("\n").append(request->getHeader(i));
+    }
+    return true;
+}
+
+ResponseCacheServlet::Entry::ptr ResponseCacheServlet::makeEntry(HttpResponse::ptr response
+                                                                 ,HttpSession::ptr session) {
+    // 流式发送的响应没有完整的消息体
+    if((session && session->isResponseStarted()) || response->getBodyStream()) {
+        return nullptr;
+    }
+    switch(response->getStatus()) {
+        case HttpStatus::OK:
+        case HttpStatus::NON_AUTHORITATIVE_INFORMATION:
+        case HttpStatus::MOVED_PERMANENTLY:
+        case HttpStatus::NOT_FOUND:
+        case HttpStatus::GONE:
+            break;
+        default:
+            return nullptr;
+    }
+    if(!response->getCookies().empty() || !response->getHeader("Set-Cookie").empty()) {
+        return nullptr;
+    }
+    int64_t max_age = ParseMaxAge(response->getHeader("Cache-Control"));
+    if(max_age <= 0) {
+        return nullptr;
+    }
+    // 响应随key之外的请求头变化时不能缓存；Accept-Encoding由压缩层在缓存之后处理
+    std::string vary = response->getHeader("Vary");
+    if(!vary.empty()) {
+        std::vector<std::string> vary_list = getVary();
+        size_t pos = 0;
+        while(pos < vary.size()) {
+            size_t next = vary.find(',', pos);
+            if(next == std::string::npos) {
+                next = vary.size();
+            }
+            std::string name = sylar::ToLower(sylar::StringUtil::Trim(vary.substr(pos, next - pos)));
+            pos = next + 1;
+            if(name.empty() || name == "accept-encoding") {
+                continue;
+            }
+            if(std::find(vary_list.begin(), vary_list.end(), name) == vary_list.end()) {
+                return nullptr;
+            }
+        }
+    }
+    Entry::ptr entry(new Entry);
+    entry->status = response->getStatus();
+    entry->reason = response->getReason();
+    entry->headers = response->getHeaders();
+    entry->body = response->getBody();
+    entry->createTime = sylar::GetCurrentMS();
+    entry->expireTime = entry->createTime + max_age * 1000;
+    return entry;
+}
+
+ResponseCacheServlet::Entry::ptr ResponseCacheServlet::lookup(const std::string& key) {
+    Entry::ptr entry;
+    if(!m_cache.get(key, entry)) {
+        return nullptr;
+    }
+    if(entry->expireTime <= sylar::GetCurrentMS()) {
+        m_cache.del(key);
+        return nullptr;
+    }
+    return entry;
+}
+
+void ResponseCacheServlet::fill(Entry::ptr entry, HttpResponse::ptr response) {
+    response->setStatus(entry->status);
+    response->setReason(entry->reason);
+    for(auto& i : entry->headers) {
+        response->setHeader(i.first.data(), i.first.size()
+                            ,i.second.data(), i.second.size());
+    }
+    response->setHeader("Age", std::to_string((sylar::GetCurrentMS() - entry->createTime) / 1000));
+    response->setBody(entry->body);
+}
+
+int32_t ResponseCacheServlet::handle(sylar::http::HttpRequest::ptr request
+                                     ,sylar::http::HttpResponse::ptr response
+                                     ,sylar::http::HttpSession::ptr session) {
+    std::string key;
+    if(!makeKey(request, key)) {
+        ++m_bypass;
+        return m_next->handle(request, response, session);
+    }
+    // Cache-Control: no-cache 要求重新生成，结果仍然可以存入缓存
+    if(request->getHeader("Cache-Control").find("no-cache") == std::string::npos) {
+        Entry::ptr entry = lookup(key);
+        if(entry) {
+            ++m_hit;
+            fill(entry, response);
+            return 0;
+        }
+    }
+
+    Pending::ptr pending;
+    bool leader = false;
+    {
+        Mutex::Lock lock(m_pendingMutex);
+        auto it = m_pending.find(key);
+        if(it != m_pending.end()) {
+            pending = it->second;
+            ++pending->waiters;
+        } else {
+            pending = std::make_shared<Pending>();
+            m_pending[key] = pending;
+            leader = true;
+        }
+    }
+
+    if(!leader) {
+        // 同一个key正在计算，等待结果
+        ++m_coalesce;
+        pending->sem.wait();
+        if(pending->result) {
+            fill(pending->result, response);
+            return 0;
+        }
+        // 结果不可缓存，自己计算
+        return m_next->handle(request, response, session);
+    }
+
+    ++m_miss;
+    // 下游抛出异常时也要移除m_pending并唤醒等待的协程，否则它们会一直等在sem上
+    struct PendingGuard {
+        PendingGuard(ResponseCacheServlet* s, const std::string& k, Pending::ptr p)
+            :self(s), key(k), pending(p) {
+        }
+        ~PendingGuard() {
+            self->finishPending(key, pending, entry);
+        }
+        ResponseCacheServlet* self;
+        const std::string& key;
+        Pending::ptr pending;
+        Entry::ptr entry;
+    } guard(this, key, pending);
+
+    int32_t rt = m_next->handle(request, response, session);
+    if(rt == 0) {
+        guard.entry = makeEntry(response, session);
+    }
+    if(guard.entry) {
+        m_cache.checkTimeout();
+        m_cache.set(key, guard.entry, guard.entry->expireTime - guard.entry->createTime);
+        ++m_store;
+    }
+    return rt;
+}
+
+void ResponseCacheServlet::finishPending(const std::string& key, Pending::ptr pending
+                                         ,Entry::ptr entry) {
+    size_t waiters = 0;
+    {
+        Mutex::Lock lock(m_pendingMutex);
+        m_pending.erase(key);
+        pending->result = entry;
+        waiters = pending->waiters;
+    }
+    for(size_t i = 0; i < waiters; ++i) {
+        pending->sem.notify();
+    }
+}
+
+std::string ResponseCacheServlet::toStatusString() {
+    std::stringstream ss;
+    uint64_t hit = m_hit;
+    uint64_t miss = m_miss;
+    uint64_t coalesce = m_coalesce;
+    uint64_t total = hit + miss + coalesce;
+    ss << "hit=" << hit << " miss=" << miss << " coalesce=" << coalesce
+       << " bypass=" << m_bypass << " store=" << m_store
+       << " hit_rate=" << (total ? ((hit + coalesce) * 100.0 / total) : 0) << "%"
+       << " cache: " << m_cache.toStatusString();
+    return ss.str();
+}
+
+}
+}
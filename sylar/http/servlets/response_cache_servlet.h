@@ -0,0 +1,155 @@
+/**
+ * @file response_cache_servlet.h
+ * @brief HTTP响应缓存
+ * @details 放在ServletDispatch前面，缓存GET/HEAD请求的响应。
+ *          key由方法、路径、查询参数和配置的Vary请求头组成，过期时间取响应的Cache-Control: max-age；
+ *          同一个key并发未命中时只有一个协程执行下游Servlet，其余协程等待结果
+ */
+#ifndef __SYLAR_HTTP_SERVLETS_RESPONSE_CACHE_SERVLET_H__
+#define __SYLAR_HTTP_SERVLETS_RESPONSE_CACHE_SERVLET_H__
+
+#include "sylar/http/servlet.h"
+#include "sylar/ds/timed_lru_cache.h"
+#include "sylar/mutex.h"
+#include <atomic>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HTTP响应缓存Servlet
+ */
+class ResponseCacheServlet : public Servlet {
+public:
+    typedef std::shared_ptr<ResponseCacheServlet> ptr;
+
+    /**
+     * @brief 缓存的响应
+     */
+    struct Entry {
+        typedef std::shared_ptr<Entry> ptr;
+        /// 状态码
+        HttpStatus status;
+        /// 原因短语
+        std::string reason;
+        /// 响应头
+        HeaderMap headers;
+        /// 消息体
+        std::string body;
+        /// 缓存时间(毫秒)
+        uint64_t createTime;
+        /// 过期时间(毫秒)
+        uint64_t expireTime;
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] next 下游Servlet，一般是ServletDispatch
+     * @param[in] max_size 最多缓存的响应数量
+     * @param[in] vary 参与key计算的请求头
+     */
+    ResponseCacheServlet(Servlet::ptr next, size_t max_size = 1024
+                         ,const std::vector<std::string>& vary = {});
+
+    virtual int32_t handle(sylar::http::HttpRequest::ptr request
+                   , sylar::http::HttpResponse::ptr response
+                   , sylar::http::HttpSession::ptr session) override;
+
+    /**
+     * @brief 获取下游Servlet
+     */
+    Servlet::ptr getNext() const { return m_next;}
+
+    /**
+     * @brief 设置参与key计算的请求头
+     */
+    void setVary(const std::vector<std::string>& v);
+
+    /**
+     * @brief 获取参与key计算的请求头
+     */
+    std::vector<std::string> getVary();
+
+    /**
+     * @brief 清空缓存
+     */
+    void clear() { m_cache.clear();}
+
+    /**
+     * @brief 统计信息
+     */
+    std::string toStatusString();
+
+    uint64_t getHit() const { return m_hit;}
+    uint64_t getMiss() const { return m_miss;}
+    uint64_t getCoalesce() const { return m_coalesce;}
+
+    /**
+     * @brief 从Cache-Control中解析max-age(优先s-maxage)，不可缓存时返回-1
+     */
+    static int64_t ParseMaxAge(const std::string& cache_control);
+private:
+    /**
+     * @brief 正在计算的响应，等待的协程在sem上等待
+     */
+    struct Pending {
+        typedef std::shared_ptr<Pending> ptr;
+        FiberSemaphore sem;
+        size_t waiters = 0;
+        Entry::ptr result;
+    };
+
+    /**
+     * @brief 计算缓存key，请求不可缓存时返回false
+     */
+    bool makeKey(HttpRequest::ptr request, std::string& key);
+
+    /**
+     * @brief 判断响应是否可以缓存，可以时生成Entry
+     */
+    Entry::ptr makeEntry(HttpResponse::ptr response, HttpSession::ptr session);
+
+    /**
+     * @brief 查找未过期的缓存
+     */
+    Entry::ptr lookup(const std::string& key);
+
+    /**
+     * @brief 用缓存填充响应
+     */
+    void fill(Entry::ptr entry, HttpResponse::ptr response);
+
+    /**
+     * @brief 结束key的计算，移除m_pending并把结果交给等待的协程
+     * @param[in] entry 可缓存的结果，不可缓存或下游失败时为nullptr，等待的协程各自计算
+     */
+    void finishPending(const std::string& key, Pending::ptr pending, Entry::ptr entry);
+private:
+    /// 下游Servlet
+    Servlet::ptr m_next;
+    /// 缓存
+    sylar::ds::TimedLruCache<std::string, Entry::ptr> m_cache;
+    /// 参与key计算的请求头(小写)
+    std::vector<std::string> m_vary;
+    /// m_vary的锁
+    RWMutex m_varyMutex;
+    /// 正在计算的key
+    std::unordered_map<std::string, Pending::ptr> m_pending;
+    /// m_pending的锁
+    Mutex m_pendingMutex;
+    /// 命中
+    std::atomic<uint64_t> m_hit {0};
+    /// 未命中
+    std::atomic<uint64_t> m_miss {0};
+    /// 等待其他协程的结果
+    std::atomic<uint64_t> m_coalesce {0};
+    /// 不可缓存的请求
+    std::atomic<uint64_t> m_bypass {0};
+    /// 存入缓存
+    std::atomic<uint64_t> m_store {0};
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,365 @@
+#include "static_file_servlet.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+StaticFileServlet::FileEntry::~FileEntry() {
+    if(fd >= 0) {
+        ::close(fd);
+    }
+}
+
+StaticFileServlet::StaticFileServlet(const std::string& root, const std::string& prefix
+                                     ,size_t max_files, uint32_t check_interval_ms)
+    :Servlet("StaticFileServlet")
+    ,m_root(root)
+    ,m_prefix(prefix)
+    ,m_checkInterval(check_interval_ms)
+    ,m_cache(max_files) {
+    while(m_root.size() > 1 && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+}
+
+const char* StaticFileServlet::GetContentType(const std::string& path) {
+    static const std::unordered_map<std::string, const char*> s_types = {
+        {"html", "text/html; charset=utf-8"},
+        {"htm", "text/html; charset=utf-8"},
+        {"css", "text/css; charset=utf-8"},
+        {"js", "application/javascript; charset=utf-8"},
+        {"json", "application/json; charset=utf-8"},
+        {"txt", "text/plain; charset=utf-8"},
+        {"xml", "text/xml; charset=utf-8"},
+        {"svg", "image/svg+xml"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"ico", "image/x-icon"},
+        {"webp", "image/webp"},
+        {"woff", "font/woff"},
+        {"woff2", "font/woff2"},
+        {"pdf", "application/pdf"},
+        {"zip", "application/zip"},
+        {"gz", "application/gzip"},
+        {"mp4", "video/mp4"},
+        {"mp3", "audio/mpeg"},
+        {"wasm", "application/wasm"},
+    };
+    auto pos = path.rfind('.');
+    if(pos != std::string::npos && path.find('/', pos) == std::string::npos) {
+        std::string ext = path.substr(pos + 1);
+        for(auto& c : ext) {
+            c = tolower(c);
+        }
+        auto it = s_types.find(ext);
+        if(it != s_types.end()) {
+            return it->second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+std::string StaticFileServlet::FormatHttpDate(time_t ts) {
+    struct tm tm;
+    gmtime_r(&ts, &tm);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+time_t StaticFileServlet::ParseHttpDate(const std::string& str) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end) {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+int StaticFileServlet::ParseRange(const std::string& range, uint64_t size
+                                  ,uint64_t& offset, uint64_t& length) {
+    if(strncasecmp(range.c_str(), "bytes=", 6) != 0) {
+        return 0;
+    }
+    const char* p = range.c_str() + 6;
+    // 多个范围需要multipart/byteranges，直接返回整个文件
+    if(strchr(p, ',')) {
+        return 0;
+    }
+    while(*p == ' ') {
+        ++p;
+    }
+    char* end = nullptr;
+    if(*p == '-') {
+        // bytes=-n 最后n个字节
+        if(!isdigit(p[1])) {
+            return 0;
+        }
+        uint64_t n = strtoull(p + 1, &end, 10);
+        if(*end) {
+            return 0;
+        }
+        if(n == 0 || size == 0) {
+            return -1;
+        }
+        n = std::min(n, size);
+        offset = size - n;
+        length = n;
+        return 1;
+    }
+    if(!isdigit(*p)) {
+        return 0;
+    }
+    uint64_t first = strtoull(p, &end, 10);
+    if(*end != '-') {
+        return 0;
+    }
+    p = end + 1;
+    uint64_t last = size ? size - 1 : 0;
+    if(*p) {
+        if(!isdigit(*p)) {
+            return 0;
+        }
+        last = strtoull(p, &end, 10);
+        if(*end) {
+            return 0;
+        }
+        if(last < first) {
+            return 0;
+        }
+        last = std::min(last, size - 1);
+    }
+    if(first >= size) {
+        return -1;
+    }
+    offset = first;
+    length = last - first + 1;
+    return 1;
+}
+
+bool StaticFileServlet::toFilePath(const std::string& path, std::string& file) const {
+    if(path.compare(0, m_prefix.size(), m_prefix) != 0) {
+        return false;
+    }
+    std::string rel = sylar::StringUtil::UrlDecode(path.substr(m_prefix.size()), false);
+    if(rel.empty() || rel[0] != '/') {
+        rel = "/" + rel;
+    }
+    if(rel.find('\0') != std::string::npos) {
+        return false;
+    }
+    // 逐段检查，不允许跳出根目录
+    size_t pos = 0;
+    while(pos < rel.size()) {
+        size_t next = rel.find('/', pos + 1);
+        if(next == std::string::npos) {
+            next = rel.size();
+        }
+        std::string seg = rel.substr(pos + 1, next - pos - 1);
+        if(seg == "..") {
+            return false;
+        }
+        pos = next;
+    }
+    if(rel.back() == '/') {
+        rel += "index.html";
+    }
+    file = m_root + rel;
+    return true;
+}
+
+StaticFileServlet::FileEntry::ptr StaticFileServlet::openFile(const std::string& file) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+    FileEntry::ptr entry(new FileEntry);
+    entry->fd = fd;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->inode = st.st_ino;
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)st.st_mtime
+            ,(unsigned long)st.st_size);
+    entry->etag = etag;
+    entry->lastModified = FormatHttpDate(st.st_mtime);
+    entry->contentType = GetContentType(file);
+    entry->checkTime = sylar::GetCurrentMS();
+    return entry;
+}
+
+StaticFileServlet::FileEntry::ptr StaticFileServlet::getFile(const std::string& file) {
+    FileEntry::ptr entry;
+    if(m_cache.get(file, entry)) {
+        uint64_t now = sylar::GetCurrentMS();
+        if(entry->checkTime + m_checkInterval > now) {
+            return entry;
+        }
+        struct stat st;
+        if(stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)
+                && st.st_ino == entry->inode
+                && (uint64_t)st.st_size == entry->size
+                && st.st_mtime == entry->mtime) {
+            entry->checkTime = now;
+            return entry;
+        }
+        // 文件被修改、替换或删除
+        m_cache.del(file);
+    }
+    entry = openFile(file);
+    if(entry) {
+        m_cache.set(file, entry);
+    }
+    return entry;
+}
+
+static bool etag_match(const std::string& header, const std::string& etag) {
+    // 弱比较，忽略W/前缀
+    size_t pos = 0;
+    while(pos < header.size()) {
+        size_t next = header.find(',', pos);
+        if(next == std::string::npos) {
+            next = header.size();
+        }
+        std::string tag = sylar::StringUtil::Trim(header.substr(pos, next - pos));
+        if(tag == "*") {
+            return true;
+        }
+        if(tag.compare(0, 2, "W/") == 0) {
+            tag = tag.substr(2);
+        }
+        if(tag == etag) {
+            return true;
+        }
+        pos = next + 1;
+    }
+    return false;
+}
+
+bool StaticFileServlet::notModified(HttpRequest::ptr request, FileEntry::ptr entry) const {
+    // If-None-Match优先于If-Modified-Since
+    std::string inm = request->getHeader("If-None-Match");
+    if(!inm.empty()) {
+        return etag_match(inm, entry->etag);
+    }
+    std::string ims = request->getHeader("If-Modified-Since");
+    if(!ims.empty()) {
+        time_t t = ParseHttpDate(ims);
+        return t != -1 && entry->mtime <= t;
+    }
+    return false;
+}
+
+int32_t StaticFileServlet::handle(sylar::http::HttpRequest::ptr request
+                                  ,sylar::http::HttpResponse::ptr response
+                                  ,sylar::http::HttpSession::ptr session) {
+    HttpMethod method = request->getMethod();
+    if(method != HttpMethod::GET && method != HttpMethod::HEAD) {
+        response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+        response->setHeader("Allow", "GET, HEAD");
+        response->setBody("method not allowed");
+        return 0;
+    }
+    std::string file;
+    if(!toFilePath(request->getPath(), file)) {
+        response->setStatus(HttpStatus::FORBIDDEN);
+        response->setBody("forbidden");
+        return 0;
+    }
+    FileEntry::ptr entry = getFile(file);
+    if(!entry) {
+        response->setStatus(HttpStatus::NOT_FOUND);
+        response->setBody("not found");
+        return 0;
+    }
+    response->setHeader("ETag", entry->etag);
+    response->setHeader("Last-Modified", entry->lastModified);
+    response->setHeader("Accept-Ranges", "bytes");
+    if(notModified(request, entry)) {
+        response->setStatus(HttpStatus::NOT_MODIFIED);
+        return 0;
+    }
+
+    uint64_t offset = 0;
+    uint64_t length = entry->size;
+    std::string range = request->getHeader("Range");
+    if(!range.empty()) {
+        // If-Range不匹配时文件已经变化，返回整个文件
+        std::string if_range = request->getHeader("If-Range");
+        if(if_range.empty() || if_range == entry->etag
+                || if_range == entry->lastModified) {
+            int rt = ParseRange(range, entry->size, offset, length);
+            if(rt < 0) {
+                response->setStatus(HttpStatus::RANGE_NOT_SATISFIABLE);
+                response->setHeader("Content-Range", "bytes */" + std::to_string(entry->size));
+                response->setBody("range not satisfiable");
+                return 0;
+            }
+            if(rt > 0) {
+                response->setStatus(HttpStatus::PARTIAL_CONTENT);
+                response->setHeader("Content-Range", "bytes " + std::to_string(offset)
+                        + "-" + std::to_string(offset + length - 1)
+                        + "/" + std::to_string(entry->size));
+            }
+        }
+    }
+    response->setHeader("Content-Type", entry->contentType);
+    response->setHeader("content-length", std::to_string(length));
+
+    if(!session) {
+        // 没有连接可以sendfile(HTTP/2的流)，读入消息体由调用方发送
+        if(method == HttpMethod::GET && length > 0) {
+            std::string body(length, '\0');
+            size_t done = 0;
+            while(done < length) {
+                ssize_t rt = pread(entry->fd, &body[done], length - done, offset + done);
+                if(rt <= 0) {
+                    SYLAR_LOG_DEBUG(g_logger) << "pread " << file << " fail, rt=" << rt
+                        << " errno=" << errno << " errstr=" << strerror(errno);
+                    response->setStatus(HttpStatus::INTERNAL_SERVER_ERROR);
+                    response->delHeader("content-length");
+                    response->delHeader("Content-Range");
+                    response->setBody("read file fail");
+                    return -1;
+                }
+                done += rt;
+            }
+            response->setBody(body);
+        }
+        return 0;
+    }
+    // 先发送响应头(和之前暂存的流水线响应一起)，消息体由sendfile发送
+    if(!session->startResponse(response)) {
+        response->setClose(true);
+        return -1;
+    }
+    if(method == HttpMethod::GET && length > 0) {
+        int64_t rt = session->sendFileFixSize(entry->fd, offset, length);
+        if(rt != (int64_t)length) {
+            // 发送了部分消息体，连接不能再复用
+            SYLAR_LOG_DEBUG(g_logger) << "sendfile " << file << " fail, rt=" << rt
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            response->setClose(true);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+}
+}
@@ -0,0 +1,133 @@
+/**
+ * @file static_file_servlet.h
+ * @brief 静态文件Servlet
+ * @details 文件内容通过sendfile直接从内核发送，不经过HttpResponse的消息体
+ *          (没有HttpSession时，如HTTP/2的流，读入消息体)；
+ *          支持Range、If-None-Match/If-Modified-Since，文件句柄和元数据按路径缓存
+ */
+#ifndef __SYLAR_HTTP_SERVLETS_STATIC_FILE_SERVLET_H__
+#define __SYLAR_HTTP_SERVLETS_STATIC_FILE_SERVLET_H__
+
+#include "sylar/http/servlet.h"
+#include "sylar/ds/lru_cache.h"
+#include <atomic>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 静态文件Servlet
+ */
+class StaticFileServlet : public Servlet {
+public:
+    typedef std::shared_ptr<StaticFileServlet> ptr;
+
+    /**
+     * @brief 缓存的文件句柄和元数据
+     * @details 析构时关闭句柄。发送中的请求持有智能指针，
+     *          文件被淘汰或者更新后句柄在发送结束后才关闭
+     */
+    struct FileEntry {
+        typedef std::shared_ptr<FileEntry> ptr;
+        ~FileEntry();
+
+        /// 文件句柄
+        int fd = -1;
+        /// 文件大小
+        uint64_t size = 0;
+        /// 修改时间
+        time_t mtime = 0;
+        /// inode
+        ino_t inode = 0;
+        /// ETag
+        std::string etag;
+        /// Last-Modified
+        std::string lastModified;
+        /// Content-Type
+        std::string contentType;
+        /// 上次检查文件是否变化的时间(毫秒)
+        std::atomic<uint64_t> checkTime {0};
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] root 文件根目录
+     * @param[in] prefix 请求路径中需要去掉的前缀，如"/static"
+     * @param[in] max_files 最多缓存的文件数量
+     * @param[in] check_interval_ms 缓存的文件多久重新stat检查一次变化
+     */
+    StaticFileServlet(const std::string& root, const std::string& prefix = ""
+                      ,size_t max_files = 1024, uint32_t check_interval_ms = 1000);
+
+    virtual int32_t handle(sylar::http::HttpRequest::ptr request
+                   , sylar::http::HttpResponse::ptr response
+                   , sylar::http::HttpSession::ptr session) override;
+
+    /**
+     * @brief 缓存状态
+     */
+    std::string toStatusString() { return m_cache.toStatusString();}
+
+    /**
+     * @brief 根据扩展名返回Content-Type
+     */
+    static const char* GetContentType(const std::string& path);
+
+    /**
+     * @brief 格式化HTTP日期(RFC 7231 IMF-fixdate)
+     */
+    static std::string FormatHttpDate(time_t ts);
+
+    /**
+     * @brief 解析HTTP日期，失败返回-1
+     */
+    static time_t ParseHttpDate(const std::string& str);
+
+    /**
+     * @brief 解析单个Range
+     * @param[in] range Range头的值
+     * @param[in] size 文件大小
+     * @param[out] offset 起始位置
+     * @param[out] length 长度
+     * @return
+     *      @retval 1 合法的单个范围
+     *      @retval 0 忽略Range，返回整个文件(格式不认识或者多个范围)
+     *      @retval -1 范围不可满足
+     */
+    static int ParseRange(const std::string& range, uint64_t size
+                          ,uint64_t& offset, uint64_t& length);
+private:
+    /**
+     * @brief 请求路径转换为文件路径，包含".."等非法路径时返回false
+     */
+    bool toFilePath(const std::string& path, std::string& file) const;
+
+    /**
+     * @brief 获取文件，缓存过期时重新stat，文件变化时重新打开
+     */
+    FileEntry::ptr getFile(const std::string& file);
+
+    /**
+     * @brief 打开文件
+     */
+    FileEntry::ptr openFile(const std::string& file);
+
+    /**
+     * @brief 判断条件请求是否命中(返回304)
+     */
+    bool notModified(HttpRequest::ptr request, FileEntry::ptr entry) const;
+private:
+    /// 文件根目录
+    std::string m_root;
+    /// 路径前缀
+    std::string m_prefix;
+    /// 检查文件变化的间隔
+    uint32_t m_checkInterval;
+    /// 文件缓存
+    sylar::ds::LruCache<std::string, FileEntry::ptr> m_cache;
+};
+
+}
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "status_servlet.h"
 #include "sylar/sylar.h"
+#include "sylar/fiber_stack.h"
+#include "sylar/http/http_compress.h"
 
 namespace sylar {
 namespace http {
@@ -69,6 +71,9 @@ int32_t StatusServlet::handle(sylar::http::HttpRequest::ptr request
     XX("main_running_time") << format_used_time(time(0) - ProcessInfoMgr::GetInstance()->main_start_time) << std::endl;
     ss << "===================================================" << std::endl;
     XX("fibers") << sylar::Fiber::TotalFibers() << std::endl;
+    XX("fiber_stacks");
+    sylar::FiberStackPool::Dump(ss) << std::endl;
+    XX("http_compress") << HttpCompress::ToStatusString() << std::endl;
     ss << "===================================================" << std::endl;
     ss << "<Logger>" << std::endl;
     ss << sylar::LoggerMgr::GetInstance()->toYamlString() << std::endl;
@@ -119,6 +124,11 @@ int32_t StatusServlet::handle(sylar::http::HttpRequest::ptr request
                     infos.clear();
                 }
             }
+            auto rc = hs->getResponseCache();
+            if(rc) {
+                ss << "[ResponseCache]" << std::endl;
+                XX2("stats") << rc->toStatusString() << std::endl;
+            }
         }
     }
     ss << "===================================================" << std::endl;
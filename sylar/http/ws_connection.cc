@@ -47,9 +47,12 @@ std::pair<HttpResult::ptr, WSConnection::ptr> WSConnection::Create(Uri::ptr uri
     req->setMethod(HttpMethod::GET);
     bool has_host = false;
     bool has_conn = false;
+    bool has_ext = false;
     for(auto& i : headers) {
         if(strcasecmp(i.first.c_str(), "connection") == 0) {
             has_conn = true;
+        } else if(strcasecmp(i.first.c_str(), "Sec-WebSocket-Extensions") == 0) {
+            has_ext = true;
         } else if(!has_host && strcasecmp(i.first.c_str(), "host") == 0) {
             has_host = !i.second.empty();
         }
@@ -66,6 +69,12 @@ std::pair<HttpResult::ptr, WSConnection::ptr> WSConnection::Create(Uri::ptr uri
     if(!has_host) {
         req->setHeader("Host", uri->getHost());
     }
+    if(!has_ext) {
+        std::string offer = WSDeflate::ClientOffer();
+        if(!offer.empty()) {
+            req->setHeader("Sec-WebSocket-Extensions", offer);
+        }
+    }
 
    int rt = conn->sendRequest(req);
     if(rt == 0) {
@@ -88,20 +97,30 @@ std::pair<HttpResult::ptr, WSConnection::ptr> WSConnection::Create(Uri::ptr uri
         return std::make_pair(std::make_shared<HttpResult>(50
                     , rsp, "not websocket server " + addr->toString()), nullptr);
     }
+    std::string extensions = rsp->getHeader("Sec-WebSocket-Extensions");
+    if(!extensions.empty()) {
+        // 服务端接受了不认识或不合法的扩展参数时必须断开(RFC 7692 5)
+        conn->m_deflate = WSDeflate::ClientAccept(extensions);
+        if(!conn->m_deflate) {
+            return std::make_pair(std::make_shared<HttpResult>(51
+                        , rsp, "invalid Sec-WebSocket-Extensions: " + extensions), nullptr);
+        }
+    }
     return std::make_pair(std::make_shared<HttpResult>((int)HttpResult::Error::OK
                 , rsp, "ok"), conn);
 }
 
 WSFrameMessage::ptr WSConnection::recvMessage() {
-    return WSRecvMessage(this, true);
+    return WSRecvMessage(this, true, m_deflate.get());
 }
 
 int32_t WSConnection::sendMessage(WSFrameMessage::ptr msg, bool fin) {
-    return WSSendMessage(this, msg, true, fin);
+    return WSSendMessage(this, msg, true, fin, m_deflate.get());
 }
 
 int32_t WSConnection::sendMessage(const std::string& msg, int32_t opcode, bool fin) {
-    return WSSendMessage(this, std::make_shared<WSFrameMessage>(opcode, msg), true, fin);
+    return WSSendMessage(this, std::make_shared<WSFrameMessage>(opcode, msg), true, fin
+                         ,m_deflate.get());
 }
 
 int32_t WSConnection::ping() {
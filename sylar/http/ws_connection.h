@@ -22,6 +22,13 @@ public:
     int32_t sendMessage(const std::string& msg, int32_t opcode = WSFrameHead::TEXT_FRAME, bool fin = true);
     int32_t ping();
     int32_t pong();
+
+    /**
+     * @brief 握手协商出的permessage-deflate状态，未启用时为空
+     */
+    WSDeflate::ptr getDeflate() const { return m_deflate;}
+private:
+    WSDeflate::ptr m_deflate;
 };
 
 }
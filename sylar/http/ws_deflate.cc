@@ -0,0 +1,404 @@
+#include "ws_deflate.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <string.h>
+#include <strings.h>
+#include <vector>
+#include <sstream>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_ws_deflate_enable =
+    sylar::Config::Lookup("websocket.deflate.enable", true, "websocket permessage-deflate enable");
+
+static sylar::ConfigVar<int>::ptr g_ws_deflate_window_bits =
+    sylar::Config::Lookup("websocket.deflate.window_bits", (int)15
+                ,"websocket permessage-deflate max window bits(9-15)");
+
+static sylar::ConfigVar<int>::ptr g_ws_deflate_mem_level =
+    sylar::Config::Lookup("websocket.deflate.mem_level", (int)8
+                ,"websocket permessage-deflate deflate memory level(1-9)");
+
+static sylar::ConfigVar<int>::ptr g_ws_deflate_level =
+    sylar::Config::Lookup("websocket.deflate.level", (int)6
+                ,"websocket permessage-deflate compress level(1-9)");
+
+static sylar::ConfigVar<bool>::ptr g_ws_deflate_no_context_takeover =
+    sylar::Config::Lookup("websocket.deflate.no_context_takeover", false
+                ,"websocket permessage-deflate reset compress context after each message");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ws_deflate_max_memory =
+    sylar::Config::Lookup("websocket.deflate.max_memory", (uint32_t)(320 * 1024)
+                ,"websocket permessage-deflate zlib memory budget per connection");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ws_deflate_min_size =
+    sylar::Config::Lookup("websocket.deflate.min_size", (uint32_t)64
+                ,"websocket permessage-deflate min message size to compress");
+
+static const char* EXTENSION_NAME = "permessage-deflate";
+/// zlib的raw deflate不支持8位窗口
+static const int MIN_WINDOW_BITS = 9;
+static const int MAX_WINDOW_BITS = 15;
+
+namespace {
+
+/**
+ * @brief 一个permessage-deflate的参数组
+ */
+struct Offer {
+    bool valid = true;
+    bool serverNoContextTakeover = false;
+    bool clientNoContextTakeover = false;
+    /// 0表示没有这个参数
+    int serverMaxWindowBits = 0;
+    /// -1表示没有这个参数，0表示没有值
+    int clientMaxWindowBits = -1;
+};
+
+}
+
+static int clamp(int v, int min, int max) {
+    return v < min ? min : (v > max ? max : v);
+}
+
+/**
+ * @brief 解析窗口大小参数，合法范围8-15，不合法返回-1
+ */
+static int parse_window_bits(std::string v) {
+    if(v.size() >= 2 && v.front() == '"' && v.back() == '"') {
+        v = v.substr(1, v.size() - 2);
+    }
+    if(v.empty() || v.size() > 2 || v[0] == '0') {
+        return -1;
+    }
+    for(auto c : v) {
+        if(c < '0' || c > '9') {
+            return -1;
+        }
+    }
+    int bits = atoi(v.c_str());
+    return bits >= 8 && bits <= 15 ? bits : -1;
+}
+
+/**
+ * @brief 解析Sec-WebSocket-Extensions中的permessage-deflate参数组，保持顺序
+ * @details 参数重复、未知参数或者值不合法时该组valid为false
+ */
+static std::vector<Offer> parse_offers(const std::string& header) {
+    std::vector<Offer> offers;
+    std::vector<std::string> items = sylar::split(header, ',');
+    for(auto& item : items) {
+        std::vector<std::string> params = sylar::split(item, ';');
+        if(params.empty() || strcasecmp(sylar::StringUtil::Trim(params[0]).c_str()
+                    , EXTENSION_NAME)) {
+            continue;
+        }
+        Offer offer;
+        for(size_t i = 1; i < params.size() && offer.valid; ++i) {
+            std::string param = sylar::StringUtil::Trim(params[i]);
+            std::string name = param;
+            std::string value;
+            bool has_value = false;
+            size_t pos = param.find('=');
+            if(pos != std::string::npos) {
+                name = sylar::StringUtil::Trim(param.substr(0, pos));
+                value = sylar::StringUtil::Trim(param.substr(pos + 1));
+                has_value = true;
+            }
+            if(strcasecmp(name.c_str(), "server_no_context_takeover") == 0) {
+                offer.valid = !has_value && !offer.serverNoContextTakeover;
+                offer.serverNoContextTakeover = true;
+            } else if(strcasecmp(name.c_str(), "client_no_context_takeover") == 0) {
+                offer.valid = !has_value && !offer.clientNoContextTakeover;
+                offer.clientNoContextTakeover = true;
+            } else if(strcasecmp(name.c_str(), "server_max_window_bits") == 0) {
+                int bits = has_value ? parse_window_bits(value) : -1;
+                offer.valid = bits > 0 && offer.serverMaxWindowBits == 0;
+                offer.serverMaxWindowBits = bits;
+            } else if(strcasecmp(name.c_str(), "client_max_window_bits") == 0) {
+                int bits = has_value ? parse_window_bits(value) : 0;
+                offer.valid = bits >= 0 && offer.clientMaxWindowBits < 0;
+                offer.clientMaxWindowBits = bits;
+            } else {
+                offer.valid = false;
+            }
+        }
+        offers.push_back(offer);
+    }
+    return offers;
+}
+
+/**
+ * @brief 按内存预算裁剪，每次缩小占用最大的一项
+ * @param[in] recv_adjustable 对端是否接受限制它的压缩窗口
+ * @return 最小配置也超过预算时返回false
+ */
+static bool fit_budget(int& send_bits, int& mem_level, int& recv_bits, bool recv_adjustable) {
+    size_t budget = g_ws_deflate_max_memory->getValue();
+    while(WSDeflate::EstimateMemory(send_bits, mem_level, recv_bits) > budget) {
+        size_t window = send_bits > MIN_WINDOW_BITS ? (1 << (send_bits + 2)) : 0;
+        size_t hash = mem_level > 1 ? (1 << (mem_level + 9)) : 0;
+        size_t recv = recv_adjustable && recv_bits > MIN_WINDOW_BITS ? (1 << recv_bits) : 0;
+        if(window == 0 && hash == 0 && recv == 0) {
+            return false;
+        }
+        if(window >= hash && window >= recv) {
+            --send_bits;
+        } else if(hash >= recv) {
+            --mem_level;
+        } else {
+            --recv_bits;
+        }
+    }
+    return true;
+}
+
+size_t WSDeflate::EstimateMemory(int send_bits, int mem_level, int recv_bits) {
+    // zlib文档: deflate (1 << (windowBits+2)) + (1 << (memLevel+9))，inflate (1 << windowBits)，
+    // 另加两个状态结构体
+    return (1 << (send_bits + 2)) + (1 << (mem_level + 9)) + (1 << recv_bits) + 14 * 1024;
+}
+
+WSDeflate::ptr WSDeflate::ServerNegotiate(const std::string& header, std::string& response) {
+    if(!g_ws_deflate_enable->getValue() || header.empty()) {
+        return nullptr;
+    }
+    int cfg_bits = clamp(g_ws_deflate_window_bits->getValue(), MIN_WINDOW_BITS, MAX_WINDOW_BITS);
+    bool cfg_no_context = g_ws_deflate_no_context_takeover->getValue();
+    for(auto& offer : parse_offers(header)) {
+        if(!offer.valid) {
+            continue;
+        }
+        int send_bits = cfg_bits;
+        if(offer.serverMaxWindowBits) {
+            if(offer.serverMaxWindowBits < MIN_WINDOW_BITS) {
+                continue;
+            }
+            send_bits = std::min(send_bits, offer.serverMaxWindowBits);
+        }
+        // 客户端没有带client_max_window_bits时不能限制它的窗口
+        bool recv_adjustable = offer.clientMaxWindowBits >= 0;
+        int recv_bits = MAX_WINDOW_BITS;
+        if(recv_adjustable) {
+            recv_bits = cfg_bits;
+            if(offer.clientMaxWindowBits > 0) {
+                recv_bits = std::min(recv_bits, offer.clientMaxWindowBits);
+            }
+        }
+        int mem_level = clamp(g_ws_deflate_mem_level->getValue(), 1, 9);
+        if(!fit_budget(send_bits, mem_level, recv_bits, recv_adjustable)) {
+            continue;
+        }
+
+        Params params;
+        params.serverMaxWindowBits = send_bits;
+        params.clientMaxWindowBits = recv_bits;
+        params.serverNoContextTakeover = offer.serverNoContextTakeover || cfg_no_context;
+        params.clientNoContextTakeover = offer.clientNoContextTakeover || cfg_no_context;
+        WSDeflate::ptr deflate(new WSDeflate(params, true, mem_level));
+        if(!deflate->isValid()) {
+            return nullptr;
+        }
+
+        std::stringstream ss;
+        ss << EXTENSION_NAME;
+        if(params.serverNoContextTakeover) {
+            ss << "; server_no_context_takeover";
+        }
+        if(params.clientNoContextTakeover) {
+            ss << "; client_no_context_takeover";
+        }
+        if(offer.serverMaxWindowBits || send_bits < MAX_WINDOW_BITS) {
+            ss << "; server_max_window_bits=" << send_bits;
+        }
+        if(recv_adjustable && (offer.clientMaxWindowBits > 0 || recv_bits < MAX_WINDOW_BITS)) {
+            ss << "; client_max_window_bits=" << recv_bits;
+        }
+        response = ss.str();
+        return deflate;
+    }
+    return nullptr;
+}
+
+std::string WSDeflate::ClientOffer() {
+    if(!g_ws_deflate_enable->getValue()) {
+        return "";
+    }
+    int send_bits = clamp(g_ws_deflate_window_bits->getValue(), MIN_WINDOW_BITS, MAX_WINDOW_BITS);
+    int recv_bits = send_bits;
+    int mem_level = clamp(g_ws_deflate_mem_level->getValue(), 1, 9);
+    if(!fit_budget(send_bits, mem_level, recv_bits, true)) {
+        return "";
+    }
+    std::stringstream ss;
+    ss << EXTENSION_NAME << "; client_max_window_bits";
+    if(send_bits < MAX_WINDOW_BITS) {
+        ss << "=" << send_bits;
+    }
+    if(recv_bits < MAX_WINDOW_BITS) {
+        ss << "; server_max_window_bits=" << recv_bits;
+    }
+    if(g_ws_deflate_no_context_takeover->getValue()) {
+        ss << "; client_no_context_takeover; server_no_context_takeover";
+    }
+    return ss.str();
+}
+
+WSDeflate::ptr WSDeflate::ClientAccept(const std::string& header) {
+    std::vector<Offer> offers = parse_offers(header);
+    if(offers.size() != 1 || !offers[0].valid || offers[0].clientMaxWindowBits == 0) {
+        SYLAR_LOG_INFO(g_logger) << "invalid Sec-WebSocket-Extensions: " << header;
+        return nullptr;
+    }
+    const Offer& offer = offers[0];
+    // 按ClientOffer同样的方式计算请求过的参数
+    int send_bits = clamp(g_ws_deflate_window_bits->getValue(), MIN_WINDOW_BITS, MAX_WINDOW_BITS);
+    int recv_bits = send_bits;
+    int mem_level = clamp(g_ws_deflate_mem_level->getValue(), 1, 9);
+    fit_budget(send_bits, mem_level, recv_bits, true);
+
+    int server_bits = offer.serverMaxWindowBits ? offer.serverMaxWindowBits : MAX_WINDOW_BITS;
+    if(server_bits > recv_bits) {
+        SYLAR_LOG_INFO(g_logger) << "Sec-WebSocket-Extensions server_max_window_bits="
+            << server_bits << " > " << recv_bits;
+        return nullptr;
+    }
+    if(offer.clientMaxWindowBits > 0) {
+        send_bits = std::min(send_bits, offer.clientMaxWindowBits);
+    }
+    if(send_bits < MIN_WINDOW_BITS) {
+        SYLAR_LOG_INFO(g_logger) << "unsupported client_max_window_bits=" << send_bits;
+        return nullptr;
+    }
+    Params params;
+    params.serverMaxWindowBits = server_bits;
+    params.clientMaxWindowBits = send_bits;
+    params.serverNoContextTakeover = offer.serverNoContextTakeover;
+    params.clientNoContextTakeover = offer.clientNoContextTakeover
+                                     || g_ws_deflate_no_context_takeover->getValue();
+    WSDeflate::ptr deflate(new WSDeflate(params, false, mem_level));
+    return deflate->isValid() ? deflate : nullptr;
+}
+
+WSDeflate::WSDeflate(const Params& params, bool server, int mem_level)
+    :m_params(params)
+    ,m_memLevel(mem_level)
+    ,m_valid(false)
+    ,m_sendLock(1) {
+    m_sendBits = server ? params.serverMaxWindowBits : params.clientMaxWindowBits;
+    m_recvBits = server ? params.clientMaxWindowBits : params.serverMaxWindowBits;
+    m_sendReset = server ? params.serverNoContextTakeover : params.clientNoContextTakeover;
+    m_recvReset = server ? params.clientNoContextTakeover : params.serverNoContextTakeover;
+
+    memset(&m_deflate, 0, sizeof(m_deflate));
+    memset(&m_inflate, 0, sizeof(m_inflate));
+    int level = g_ws_deflate_level->getValue();
+    if(level < 1 || level > 9) {
+        level = Z_DEFAULT_COMPRESSION;
+    }
+    // 负的windowBits表示raw deflate，没有zlib头和校验
+    if(deflateInit2(&m_deflate, level, Z_DEFLATED, -std::max(m_sendBits, MIN_WINDOW_BITS)
+                , m_memLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+        SYLAR_LOG_ERROR(g_logger) << "deflateInit2 fail window_bits=" << m_sendBits
+            << " mem_level=" << m_memLevel;
+        return;
+    }
+    // 8位窗口的数据可以用9位窗口解压
+    if(inflateInit2(&m_inflate, -std::max(m_recvBits, MIN_WINDOW_BITS)) != Z_OK) {
+        SYLAR_LOG_ERROR(g_logger) << "inflateInit2 fail window_bits=" << m_recvBits;
+        deflateEnd(&m_deflate);
+        return;
+    }
+    m_valid = true;
+}
+
+WSDeflate::~WSDeflate() {
+    if(m_valid) {
+        deflateEnd(&m_deflate);
+        inflateEnd(&m_inflate);
+    }
+}
+
+bool WSDeflate::shouldCompress(size_t size) const {
+    return size >= g_ws_deflate_min_size->getValue();
+}
+
+size_t WSDeflate::getMemory() const {
+    return EstimateMemory(m_sendBits, m_memLevel, m_recvBits);
+}
+
+bool WSDeflate::compress(const void* data, size_t length, std::string& out) {
+    z_stream* z = &m_deflate;
+    out.resize(deflateBound(z, length) + 16);
+    size_t out_len = 0;
+    z->next_in = (Bytef*)data;
+    z->avail_in = length;
+    do {
+        if(out.size() - out_len < 64) {
+            out.resize(out.size() * 2);
+        }
+        z->next_out = (Bytef*)&out[out_len];
+        z->avail_out = out.size() - out_len;
+        int rt = deflate(z, Z_SYNC_FLUSH);
+        out_len = out.size() - z->avail_out;
+        if(rt != Z_OK && rt != Z_BUF_ERROR) {
+            SYLAR_LOG_ERROR(g_logger) << "deflate fail rt=" << rt;
+            deflateReset(z);
+            return false;
+        }
+    } while(z->avail_in > 0 || z->avail_out == 0);
+    // 同步刷新以00 00 ff ff结尾，RFC 7692要求去掉，接收方解压前补回
+    if(out_len >= 4 && memcmp(&out[out_len - 4], "\x00\x00\xff\xff", 4) == 0) {
+        out_len -= 4;
+    }
+    out.resize(out_len);
+    if(m_sendReset) {
+        deflateReset(z);
+    }
+    return true;
+}
+
+bool WSDeflate::decompress(const void* data, size_t length, std::string& out, size_t max_size) {
+    static const uint8_t s_tail[4] = {0x00, 0x00, 0xff, 0xff};
+    z_stream* z = &m_inflate;
+    out.resize(std::min(std::max(length * 4, (size_t)1024), max_size + 1));
+    size_t out_len = 0;
+    bool end = false;
+    for(int part = 0; part < 2 && !end; ++part) {
+        z->next_in = part == 0 ? (Bytef*)data : (Bytef*)s_tail;
+        z->avail_in = part == 0 ? length : sizeof(s_tail);
+        do {
+            if(out_len == out.size()) {
+                out.resize(std::min(out.size() * 2, max_size + 1));
+            }
+            z->next_out = (Bytef*)&out[out_len];
+            z->avail_out = out.size() - out_len;
+            int rt = inflate(z, Z_SYNC_FLUSH);
+            out_len = out.size() - z->avail_out;
+            if(rt == Z_STREAM_END) {
+                // 对端用了BFINAL结束块，之后需要重新开始
+                inflateReset(z);
+                end = true;
+                break;
+            }
+            if((rt != Z_OK && rt != Z_BUF_ERROR) || out_len > max_size) {
+                SYLAR_LOG_INFO(g_logger) << "inflate fail rt=" << rt << " out_len=" << out_len
+                    << " max_size=" << max_size;
+                inflateReset(z);
+                return false;
+            }
+        } while(z->avail_in > 0 || z->avail_out == 0);
+    }
+    out.resize(out_len);
+    if(m_recvReset && !end) {
+        inflateReset(z);
+    }
+    return true;
+}
+
+}
+}
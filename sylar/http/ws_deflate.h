@@ -0,0 +1,137 @@
+/**
+ * @file ws_deflate.h
+ * @brief WebSocket permessage-deflate扩展(RFC 7692)
+ */
+#ifndef __SYLAR_HTTP_WS_DEFLATE_H__
+#define __SYLAR_HTTP_WS_DEFLATE_H__
+
+#include "sylar/mutex.h"
+#include <zlib.h>
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 一个WebSocket连接的压缩状态
+ * @details 发送和接收方向各有一个z_stream，默认在消息之间保留(上下文接管)，
+ *          后面的消息可以引用前面消息的内容，适合重复结构的JSON推送。
+ *          窗口大小和内存级别按websocket.deflate.max_memory裁剪，
+ *          预算内放不下时不启用扩展
+ */
+class WSDeflate {
+public:
+    typedef std::shared_ptr<WSDeflate> ptr;
+
+    /**
+     * @brief 协商出的参数
+     */
+    struct Params {
+        /// 服务端压缩窗口(server_max_window_bits)
+        int serverMaxWindowBits = 15;
+        /// 客户端压缩窗口(client_max_window_bits)
+        int clientMaxWindowBits = 15;
+        /// 服务端每条消息后重置压缩状态
+        bool serverNoContextTakeover = false;
+        /// 客户端每条消息后重置压缩状态
+        bool clientNoContextTakeover = false;
+    };
+
+    /**
+     * @brief 服务端协商
+     * @param[in] offer 请求的Sec-WebSocket-Extensions
+     * @param[out] response 响应的Sec-WebSocket-Extensions
+     * @return 没有可接受的permessage-deflate或者未开启时返回nullptr
+     */
+    static WSDeflate::ptr ServerNegotiate(const std::string& offer, std::string& response);
+
+    /**
+     * @brief 客户端请求的Sec-WebSocket-Extensions，未开启时返回空
+     */
+    static std::string ClientOffer();
+
+    /**
+     * @brief 客户端根据响应的Sec-WebSocket-Extensions创建
+     * @param[in] response 响应头的值，不能为空
+     * @return 响应不合法时返回nullptr
+     */
+    static WSDeflate::ptr ClientAccept(const std::string& response);
+
+    /**
+     * @brief 构造函数
+     * @param[in] params 协商出的参数
+     * @param[in] server 是否服务端
+     * @param[in] mem_level 压缩的内存级别(1-9)
+     */
+    WSDeflate(const Params& params, bool server, int mem_level = 8);
+    ~WSDeflate();
+
+    /**
+     * @brief 是否初始化成功
+     */
+    bool isValid() const { return m_valid;}
+
+    /**
+     * @brief 是否值得压缩(不小于websocket.deflate.min_size)
+     */
+    bool shouldCompress(size_t size) const;
+
+    /**
+     * @brief 压缩一条消息，去掉结尾的00 00 ff ff
+     * @return 是否成功
+     */
+    bool compress(const void* data, size_t length, std::string& out);
+
+    /**
+     * @brief 解压一条消息
+     * @param[in] max_size 解压后的最大长度
+     * @return 数据错误或超过max_size时返回false
+     */
+    bool decompress(const void* data, size_t length, std::string& out, size_t max_size);
+
+    /**
+     * @brief 发送锁
+     * @details 上下文接管时压缩顺序必须和发送顺序一致，压缩和发送需要在锁内完成
+     */
+    FiberSemaphore& getSendLock() { return m_sendLock;}
+
+    const Params& getParams() const { return m_params;}
+
+    /**
+     * @brief zlib占用内存的估计值
+     */
+    size_t getMemory() const;
+
+    /**
+     * @brief 估计zlib占用的内存
+     * @param[in] send_bits 压缩窗口
+     * @param[in] mem_level 压缩内存级别
+     * @param[in] recv_bits 解压窗口
+     */
+    static size_t EstimateMemory(int send_bits, int mem_level, int recv_bits);
+private:
+    /// 协商出的参数
+    Params m_params;
+    /// 压缩窗口
+    int m_sendBits;
+    /// 解压窗口
+    int m_recvBits;
+    /// 压缩内存级别
+    int m_memLevel;
+    /// 每条消息后重置压缩状态
+    bool m_sendReset;
+    /// 每条消息后重置解压状态
+    bool m_recvReset;
+    /// 是否初始化成功
+    bool m_valid;
+    z_stream m_deflate;
+    z_stream m_inflate;
+    FiberSemaphore m_sendLock;
+};
+
+}
+}
+
+#endif
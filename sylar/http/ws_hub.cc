@@ -0,0 +1,239 @@
+#include "ws_hub.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ws_hub_max_queue_bytes =
+    sylar::Config::Lookup("websocket.hub.max_queue_bytes", (uint32_t)(1024 * 1024)
+                ,"websocket hub max outbound bytes per connection");
+
+static sylar::ConfigVar<std::string>::ptr g_ws_hub_slow_policy =
+    sylar::Config::Lookup("websocket.hub.slow_policy", std::string("buffer")
+                ,"websocket hub slow consumer policy: drop, disconnect, buffer");
+
+/// 一次writev最多合并的帧数，不超过IOV_MAX
+static const size_t s_max_batch = 64;
+
+WSHub::WSHub(sylar::IOManager* worker)
+    :m_worker(worker)
+    ,m_policy(BUFFER)
+    ,m_maxQueueBytes(g_ws_hub_max_queue_bytes->getValue()) {
+    const std::string& policy = g_ws_hub_slow_policy->getValue();
+    if(policy == "drop") {
+        m_policy = DROP;
+    } else if(policy == "disconnect") {
+        m_policy = DISCONNECT;
+    } else if(policy != "buffer") {
+        SYLAR_LOG_WARN(g_logger) << "invalid websocket.hub.slow_policy=" << policy
+            << ", use buffer";
+    }
+}
+
+bool WSHub::subscribe(const std::string& topic, WSSession::ptr session) {
+    RWMutexType::WriteLock lock(m_mutex);
+    Subscriber::ptr& sub = m_subscribers[session.get()];
+    if(!sub) {
+        sub = std::make_shared<Subscriber>();
+        sub->session = session;
+    }
+    if(!sub->topics.insert(topic).second) {
+        return false;
+    }
+    m_topics[topic].insert(sub);
+    return true;
+}
+
+bool WSHub::unsubscribe(const std::string& topic, WSSession::ptr session) {
+    RWMutexType::WriteLock lock(m_mutex);
+    auto it = m_subscribers.find(session.get());
+    if(it == m_subscribers.end() || !it->second->topics.erase(topic)) {
+        return false;
+    }
+    auto tit = m_topics.find(topic);
+    tit->second.erase(it->second);
+    if(tit->second.empty()) {
+        m_topics.erase(tit);
+    }
+    // 没有订阅的连接保留到remove，send还可以用
+    return true;
+}
+
+void WSHub::remove(WSSession::ptr session) {
+    Subscriber::ptr sub;
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        auto it = m_subscribers.find(session.get());
+        if(it == m_subscribers.end()) {
+            return;
+        }
+        sub = it->second;
+        m_subscribers.erase(it);
+        for(auto& topic : sub->topics) {
+            auto tit = m_topics.find(topic);
+            tit->second.erase(sub);
+            if(tit->second.empty()) {
+                m_topics.erase(tit);
+            }
+        }
+    }
+    Spinlock::Lock lock(sub->mutex);
+    sub->closed = true;
+    sub->queue.clear();
+}
+
+size_t WSHub::publish(const std::string& topic, const std::string& data, int opcode) {
+    // 广播的帧不压缩: 上下文接管时每个连接的压缩结果都不同，
+    // 未置RSV1的帧在协商了permessage-deflate的连接上也是合法的
+    Frame frame = std::make_shared<const std::string>(WSEncodeFrame(opcode, data));
+    ++m_published;
+    size_t count = 0;
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_topics.find(topic);
+    if(it == m_topics.end()) {
+        return 0;
+    }
+    for(auto& sub : it->second) {
+        if(enqueue(sub, frame)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool WSHub::send(WSSession::ptr session, const std::string& data, int opcode) {
+    Subscriber::ptr sub;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_subscribers.find(session.get());
+        if(it == m_subscribers.end()) {
+            return false;
+        }
+        sub = it->second;
+    }
+    return enqueue(sub, std::make_shared<const std::string>(WSEncodeFrame(opcode, data)));
+}
+
+size_t WSHub::getSubscriberCount(const std::string& topic) {
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_topics.find(topic);
+    return it == m_topics.end() ? 0 : it->second.size();
+}
+
+WSHub::Stats WSHub::getStats() const {
+    Stats stats;
+    stats.published = m_published;
+    stats.queued = m_queued;
+    stats.dropped = m_dropped;
+    stats.disconnected = m_disconnected;
+    stats.writes = m_writes;
+    return stats;
+}
+
+bool WSHub::enqueue(Subscriber::ptr sub, const Frame& frame) {
+    bool start = false;
+    bool disconnect = false;
+    {
+        Spinlock::Lock lock(sub->mutex);
+        if(sub->closed) {
+            return false;
+        }
+        if(sub->bytes + frame->size() > m_maxQueueBytes) {
+            if(m_policy == DISCONNECT) {
+                sub->closed = true;
+                sub->queue.clear();
+                disconnect = true;
+            } else if(m_policy == DROP) {
+                // 正在发送的那批已经交给writev，只能丢还在排队的
+                while(!sub->queue.empty() && sub->bytes + frame->size() > m_maxQueueBytes) {
+                    sub->bytes -= sub->queue.front()->size();
+                    sub->queue.pop_front();
+                    ++m_dropped;
+                }
+            }
+            if(!disconnect && sub->bytes + frame->size() > m_maxQueueBytes) {
+                ++m_dropped;
+                return false;
+            }
+        }
+        if(!disconnect) {
+            sub->queue.push_back(frame);
+            sub->bytes += frame->size();
+            if(!sub->writing) {
+                sub->writing = true;
+                start = true;
+            }
+        }
+    }
+    if(disconnect) {
+        ++m_disconnected;
+        SYLAR_LOG_INFO(g_logger) << "websocket hub disconnect slow consumer "
+            << *sub->session->getSocket();
+        // 只shutdown，读协程收到EOF后按正常流程关闭fd
+        ::shutdown(sub->session->getSocket()->getSocket(), SHUT_RDWR);
+        return false;
+    }
+    ++m_queued;
+    if(start) {
+        WSHub::ptr self = shared_from_this();
+        m_worker->schedule([self, sub](){
+            self->writeLoop(sub);
+        });
+    }
+    return true;
+}
+
+void WSHub::writeLoop(Subscriber::ptr sub) {
+    std::vector<Frame> batch;
+    std::vector<iovec> iovs;
+    batch.reserve(s_max_batch);
+    iovs.reserve(s_max_batch);
+    while(true) {
+        batch.clear();
+        {
+            Spinlock::Lock lock(sub->mutex);
+            if(sub->closed || sub->queue.empty()) {
+                sub->writing = false;
+                return;
+            }
+            while(!sub->queue.empty() && batch.size() < s_max_batch) {
+                batch.push_back(std::move(sub->queue.front()));
+                sub->queue.pop_front();
+            }
+        }
+        // 排队期间积攒的帧一次writev发出
+        iovs.resize(batch.size());
+        size_t total = 0;
+        for(size_t i = 0; i < batch.size(); ++i) {
+            iovs[i].iov_base = (void*)batch[i]->data();
+            iovs[i].iov_len = batch[i]->size();
+            total += batch[i]->size();
+        }
+        FiberSemaphore& send_lock = sub->session->getSendLock();
+        send_lock.wait();
+        int rt = sub->session->writevFixSize(&iovs[0], iovs.size());
+        send_lock.notify();
+        ++m_writes;
+
+        Spinlock::Lock lock(sub->mutex);
+        if(rt <= 0) {
+            sub->closed = true;
+            sub->queue.clear();
+            sub->writing = false;
+            lock.unlock();
+            SYLAR_LOG_DEBUG(g_logger) << "websocket hub write fail rt=" << rt
+                << " errno=" << errno;
+            ::shutdown(sub->session->getSocket()->getSocket(), SHUT_RDWR);
+            return;
+        }
+        sub->bytes -= total;
+    }
+}
+
+}
+}
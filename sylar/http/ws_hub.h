@@ -0,0 +1,162 @@
+/**
+ * @file ws_hub.h
+ * @brief WebSocket按主题广播
+ * @details 一条消息只编码一次成共享的帧缓冲，按引用放进每个订阅连接的发送队列；
+ *          每个连接一个发送协程，一次writev发出队列里积攒的多个帧。
+ *          发送跟不上的连接按SlowPolicy处理，不会拖慢发布方和其他连接
+ */
+#ifndef __SYLAR_HTTP_WS_HUB_H__
+#define __SYLAR_HTTP_WS_HUB_H__
+
+#include "ws_session.h"
+#include "sylar/iomanager.h"
+#include "sylar/mutex.h"
+#include <atomic>
+#include <deque>
+#include <set>
+#include <unordered_map>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief WebSocket广播中心
+ */
+class WSHub : public std::enable_shared_from_this<WSHub> {
+public:
+    typedef std::shared_ptr<WSHub> ptr;
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 慢连接处理策略
+     */
+    enum SlowPolicy {
+        /// 发送队列超过上限时丢弃最早排队的帧，慢连接总是拿到最新的数据
+        DROP = 0,
+        /// 发送队列超过上限时断开连接
+        DISCONNECT = 1,
+        /// 发送队列缓存到上限，超过后丢弃新消息，已排队的帧都会发出
+        BUFFER = 2
+    };
+
+    /**
+     * @brief 统计信息
+     */
+    struct Stats {
+        /// 发布的消息数
+        uint64_t published;
+        /// 进入发送队列的帧数
+        uint64_t queued;
+        /// 丢弃的帧数
+        uint64_t dropped;
+        /// 因为慢被断开的连接数
+        uint64_t disconnected;
+        /// writev调用次数
+        uint64_t writes;
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] worker 发送协程运行的调度器
+     */
+    WSHub(sylar::IOManager* worker = sylar::IOManager::GetThis());
+
+    /**
+     * @brief 订阅主题
+     * @return 已经订阅过返回false
+     */
+    bool subscribe(const std::string& topic, WSSession::ptr session);
+
+    /**
+     * @brief 取消订阅
+     */
+    bool unsubscribe(const std::string& topic, WSSession::ptr session);
+
+    /**
+     * @brief 移除连接的所有订阅，连接关闭时调用
+     */
+    void remove(WSSession::ptr session);
+
+    /**
+     * @brief 向主题的所有订阅者发送消息
+     * @return 进入发送队列的连接数
+     */
+    size_t publish(const std::string& topic, const std::string& data
+                   ,int opcode = WSFrameHead::TEXT_FRAME);
+
+    /**
+     * @brief 经过发送队列给单个连接发送，和广播的帧保持顺序
+     * @details 连接需要已经订阅过主题
+     */
+    bool send(WSSession::ptr session, const std::string& data
+              ,int opcode = WSFrameHead::TEXT_FRAME);
+
+    /**
+     * @brief 主题的订阅者数量
+     */
+    size_t getSubscriberCount(const std::string& topic);
+
+    SlowPolicy getSlowPolicy() const { return m_policy;}
+    void setSlowPolicy(SlowPolicy v) { m_policy = v;}
+
+    /**
+     * @brief 每个连接发送队列(含正在发送)的字节上限
+     */
+    size_t getMaxQueueBytes() const { return m_maxQueueBytes;}
+    void setMaxQueueBytes(size_t v) { m_maxQueueBytes = v;}
+
+    Stats getStats() const;
+private:
+    /// 编码好的帧，所有订阅者共享
+    typedef std::shared_ptr<const std::string> Frame;
+
+    /**
+     * @brief 一个订阅连接
+     */
+    struct Subscriber {
+        typedef std::shared_ptr<Subscriber> ptr;
+        WSSession::ptr session;
+        /// 订阅的主题，受WSHub::m_mutex保护
+        std::set<std::string> topics;
+
+        Spinlock mutex;
+        /// 等待发送的帧
+        std::deque<Frame> queue;
+        /// 队列和正在发送的字节数
+        size_t bytes = 0;
+        /// 是否有发送协程在运行
+        bool writing = false;
+        /// 写失败或者被断开
+        bool closed = false;
+    };
+
+    /**
+     * @brief 按策略放入发送队列，必要时启动发送协程
+     */
+    bool enqueue(Subscriber::ptr sub, const Frame& frame);
+
+    /**
+     * @brief 发送协程，队列空时退出
+     */
+    void writeLoop(Subscriber::ptr sub);
+private:
+    sylar::IOManager* m_worker;
+    RWMutexType m_mutex;
+    /// 主题 -> 订阅者
+    std::unordered_map<std::string, std::set<Subscriber::ptr> > m_topics;
+    /// 连接 -> 订阅者
+    std::unordered_map<WSSession*, Subscriber::ptr> m_subscribers;
+    SlowPolicy m_policy;
+    size_t m_maxQueueBytes;
+
+    std::atomic<uint64_t> m_published {0};
+    std::atomic<uint64_t> m_queued {0};
+    std::atomic<uint64_t> m_dropped {0};
+    std::atomic<uint64_t> m_disconnected {0};
+    std::atomic<uint64_t> m_writes {0};
+};
+
+}
+}
+
+#endif
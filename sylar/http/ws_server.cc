@@ -9,6 +9,7 @@ static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 WSServer::WSServer(sylar::IOManager* worker, sylar::IOManager* io_worker, sylar::IOManager* accept_worker)
     :TcpServer(worker, io_worker, accept_worker) {
     m_dispatch.reset(new WSServletDispatch);
+    m_hub = std::make_shared<WSHub>(io_worker);
     m_type = "websocket_server";
 }
 
@@ -44,6 +45,7 @@ void WSServer::handleClient(Socket::ptr client) {
         }
         servlet->onClose(header, session);
     } while(0);
+    m_hub->remove(session);
     session->close();
 }
 
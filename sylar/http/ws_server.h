@@ -4,6 +4,7 @@
 #include "sylar/tcp_server.h"
 #include "ws_session.h"
 #include "ws_servlet.h"
+#include "ws_hub.h"
 
 namespace sylar {
 namespace http {
@@ -18,10 +19,17 @@ public:
 
     WSServletDispatch::ptr getWSServletDispatch() const { return m_dispatch;}
     void setWSServletDispatch(WSServletDispatch::ptr v) { m_dispatch = v;}
+
+    /**
+     * @brief 广播中心，连接断开时自动移除订阅
+     */
+    WSHub::ptr getHub() const { return m_hub;}
+    void setHub(WSHub::ptr v) { m_hub = v;}
 protected:
     virtual void handleClient(Socket::ptr client) override;
 protected:
     WSServletDispatch::ptr m_dispatch;
+    WSHub::ptr m_hub;
 };
 
 }
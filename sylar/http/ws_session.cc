@@ -1,7 +1,12 @@
 #include "ws_session.h"
 #include "sylar/log.h"
 #include "sylar/endian.h"
+#include "sylar/streams/socket_stream.h"
 #include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SYLAR_WS_MASK_X86
+#endif
 
 namespace sylar {
 namespace http {
@@ -13,7 +18,8 @@ sylar::ConfigVar<uint32_t>::ptr g_websocket_message_max_size
             ,(uint32_t) 1024 * 1024 * 32, "websocket message max size");
 
 WSSession::WSSession(Socket::ptr sock, bool owner)
-    :HttpSession(sock, owner) {
+    :HttpSession(sock, owner)
+    ,m_sendLock(1) {
 }
 
 HttpRequest::ptr WSSession::handleShake() {
@@ -53,6 +59,14 @@ HttpRequest::ptr WSSession::handleShake() {
         rsp->setHeader("Upgrade", "websocket");
         rsp->setHeader("Connection", "Upgrade");
         rsp->setHeader("Sec-WebSocket-Accept", v);
+        std::string extensions = req->getHeader("Sec-WebSocket-Extensions");
+        if(!extensions.empty()) {
+            std::string accept;
+            m_deflate = WSDeflate::ServerNegotiate(extensions, accept);
+            if(m_deflate) {
+                rsp->setHeader("Sec-WebSocket-Extensions", accept);
+            }
+        }
 
         sendResponse(rsp);
         SYLAR_LOG_DEBUG(g_logger) << *req;
@@ -84,25 +98,127 @@ std::string WSFrameHead::toString() const {
 }
 
 WSFrameMessage::ptr WSSession::recvMessage() {
-    return WSRecvMessage(this, false);
+    return WSRecvMessage(this, false, m_deflate.get());
 }
 
 int32_t WSSession::sendMessage(WSFrameMessage::ptr msg, bool fin) {
-    return WSSendMessage(this, msg, false, fin);
+    m_sendLock.wait();
+    int32_t rt = WSSendMessage(this, msg, false, fin, m_deflate.get());
+    m_sendLock.notify();
+    return rt;
 }
 
 int32_t WSSession::sendMessage(const std::string& msg, int32_t opcode, bool fin) {
-    return WSSendMessage(this, std::make_shared<WSFrameMessage>(opcode, msg), false, fin);
+    return sendMessage(std::make_shared<WSFrameMessage>(opcode, msg), fin);
 }
 
 int32_t WSSession::ping() {
-    return WSPing(this);
+    m_sendLock.wait();
+    int32_t rt = WSPing(this);
+    m_sendLock.notify();
+    return rt;
+}
+
+/**
+ * @brief 每次处理8字节，src和dst从掩码的第0个字节开始对齐
+ */
+static void ws_mask_word(const uint8_t* src, uint8_t* dst, size_t len, const uint8_t* mask) {
+    // 掩码按内存顺序重复两次，和大小端无关
+    uint64_t m;
+    memcpy(&m, mask, 4);
+    memcpy((char*)&m + 4, mask, 4);
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, src + i, 8);
+        v ^= m;
+        memcpy(dst + i, &v, 8);
+    }
+    for(; i < len; ++i) {
+        dst[i] = src[i] ^ mask[i & 3];
+    }
+}
+
+#ifdef SYLAR_WS_MASK_X86
+static void ws_mask_sse2(const uint8_t* src, uint8_t* dst, size_t len, const uint8_t* mask) {
+    int32_t m;
+    memcpy(&m, mask, 4);
+    __m128i vm = _mm_set1_epi32(m);
+    size_t i = 0;
+    for(; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, vm));
+        _mm_storeu_si128((__m128i*)(dst + i + 16), _mm_xor_si128(b, vm));
+        _mm_storeu_si128((__m128i*)(dst + i + 32), _mm_xor_si128(c, vm));
+        _mm_storeu_si128((__m128i*)(dst + i + 48), _mm_xor_si128(d, vm));
+    }
+    for(; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, vm));
+    }
+    ws_mask_word(src + i, dst + i, len - i, mask);
+}
+
+__attribute__((target("avx2")))
+static void ws_mask_avx2(const uint8_t* src, uint8_t* dst, size_t len, const uint8_t* mask) {
+    int32_t m;
+    memcpy(&m, mask, 4);
+    __m256i vm = _mm256_set1_epi32(m);
+    size_t i = 0;
+    for(; i + 128 <= len; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, vm));
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_xor_si256(b, vm));
+        _mm256_storeu_si256((__m256i*)(dst + i + 64), _mm256_xor_si256(c, vm));
+        _mm256_storeu_si256((__m256i*)(dst + i + 96), _mm256_xor_si256(d, vm));
+    }
+    for(; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, vm));
+    }
+    // 调用方不是AVX编译的，编译器不会自动插入vzeroupper，
+    // 不清零高128位后面的SSE指令(包括memcpy)会很慢
+    _mm256_zeroupper();
+    ws_mask_word(src + i, dst + i, len - i, mask);
 }
 
-WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
+static bool has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+void WSMask(const void* src, void* dst, size_t len, const uint8_t* mask) {
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* d = (uint8_t*)dst;
+#ifdef SYLAR_WS_MASK_X86
+    // 短数据不值得切换到向量寄存器；AVX2每次调用有清零高位的开销，只用于较长的数据
+    if(len >= 256) {
+        static const bool s_avx2 = has_avx2();
+        if(s_avx2) {
+            ws_mask_avx2(s, d, len, mask);
+            return;
+        }
+    }
+    if(len >= 64) {
+        ws_mask_sse2(s, d, len, mask);
+        return;
+    }
+#endif
+    ws_mask_word(s, d, len, mask);
+}
+
+WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client, WSDeflate* deflate) {
     int opcode = 0;
+    bool compressed = false;
     std::string data;
-    int cur_len = 0;
+    uint64_t cur_len = 0;
     do {
         WSFrameHead ws_head;
         if(stream->readFixSize(&ws_head, sizeof(ws_head)) <= 0) {
@@ -112,7 +228,9 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
 
         if(ws_head.opcode == WSFrameHead::PING) {
             SYLAR_LOG_INFO(g_logger) << "PING";
-            if(WSPong(stream) <= 0) {
+            // WSSession可能有其他协程在发送，回复要经过它的发送锁
+            WSSession* session = dynamic_cast<WSSession*>(stream);
+            if((session ? session->pong() : WSPong(stream)) <= 0) {
                 break;
             }
         } else if(ws_head.opcode == WSFrameHead::PONG) {
@@ -123,52 +241,74 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
                 SYLAR_LOG_INFO(g_logger) << "WSFrameHead mask != 1";
                 break;
             }
-            uint64_t length = 0;
-            if(ws_head.payload == 126) {
-                uint16_t len = 0;
-                if(stream->readFixSize(&len, sizeof(len)) <= 0) {
+            // RSV1只能出现在消息的第一帧，表示整条消息是压缩的
+            if(ws_head.rsv1) {
+                if(!deflate || ws_head.opcode == WSFrameHead::CONTINUE) {
+                    SYLAR_LOG_INFO(g_logger) << "unexpected WSFrameHead rsv1 " << ws_head.toString();
                     break;
                 }
+                compressed = true;
+            }
+            // 扩展长度和掩码一次读出
+            uint8_t ext[12];
+            size_t len_size = ws_head.payload == 126 ? 2 : (ws_head.payload == 127 ? 8 : 0);
+            size_t ext_size = len_size + (ws_head.mask ? 4 : 0);
+            if(ext_size && stream->readFixSize(ext, ext_size) <= 0) {
+                break;
+            }
+            uint64_t length = 0;
+            if(len_size == 2) {
+                uint16_t len = 0;
+                memcpy(&len, ext, sizeof(len));
                 length = sylar::byteswapOnLittleEndian(len);
-            } else if(ws_head.payload == 127) {
+            } else if(len_size == 8) {
                 uint64_t len = 0;
-                if(stream->readFixSize(&len, sizeof(len)) <= 0) {
-                    break;
-                }
+                memcpy(&len, ext, sizeof(len));
                 length = sylar::byteswapOnLittleEndian(len);
             } else {
                 length = ws_head.payload;
             }
 
-            if((cur_len + length) >= g_websocket_message_max_size->getValue()) {
-                SYLAR_LOG_WARN(g_logger) << "WSFrameMessage length > "
-                    << g_websocket_message_max_size->getValue()
-                    << " (" << (cur_len + length) << ")";
+            // RFC 6455 5.2: 64位长度的最高位必须为0
+            if(length >> 63) {
+                SYLAR_LOG_INFO(g_logger) << "invalid WSFrameHead payload length " << length;
+                break;
+            }
+            // cur_len不会超过上限，用减法比较，避免cur_len + length溢出
+            uint64_t max_size = g_websocket_message_max_size->getValue();
+            if(length > max_size - cur_len) {
+                SYLAR_LOG_WARN(g_logger) << "WSFrameMessage length > " << max_size
+                    << " (" << cur_len << " + " << length << ")";
                 break;
             }
 
-            char mask[4] = {0};
-            if(ws_head.mask) {
-                if(stream->readFixSize(mask, sizeof(mask)) <= 0) {
+            // 载荷直接读入消息缓冲区，原地解码
+            if(length > 0) {
+                data.resize(cur_len + length);
+                if(stream->readFixSize(&data[cur_len], length) <= 0) {
                     break;
                 }
-            }
-            data.resize(cur_len + length);
-            if(stream->readFixSize(&data[cur_len], length) <= 0) {
-                break;
-            }
-            if(ws_head.mask) {
-                for(int i = 0; i < (int)length; ++i) {
-                    data[cur_len + i] ^= mask[i % 4];
+                if(ws_head.mask) {
+                    WSMask(&data[cur_len], &data[cur_len], length, ext + len_size);
                 }
+                cur_len += length;
             }
-            cur_len += length;
 
             if(!opcode && ws_head.opcode != WSFrameHead::CONTINUE) {
                 opcode = ws_head.opcode;
             }
 
             if(ws_head.fin) {
+                if(compressed) {
+                    std::string out;
+                    if(!deflate->decompress(data.data(), cur_len, out
+                                , g_websocket_message_max_size->getValue())) {
+                        SYLAR_LOG_WARN(g_logger) << "WSFrameMessage decompress fail, length="
+                            << cur_len;
+                        break;
+                    }
+                    data.swap(out);
+                }
                 SYLAR_LOG_DEBUG(g_logger) << data;
                 return WSFrameMessage::ptr(new WSFrameMessage(opcode, std::move(data)));
             }
@@ -180,61 +320,125 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
     return nullptr;
 }
 
-int32_t WSSendMessage(Stream* stream, WSFrameMessage::ptr msg, bool client, bool fin) {
-    do {
-        WSFrameHead ws_head;
-        memset(&ws_head, 0, sizeof(ws_head));
-        ws_head.fin = fin;
-        ws_head.opcode = msg->getOpcode();
-        ws_head.mask = client;
-        uint64_t size = msg->getData().size();
-        if(size < 126) {
-            ws_head.payload = size;
-        } else if(size < 65536) {
-            ws_head.payload = 126;
-        } else {
-            ws_head.payload = 127;
+/**
+ * @brief 帧头和扩展长度写入head(至少10字节)，返回长度，不含掩码
+ */
+static size_t ws_encode_head(WSFrameHead ws_head, uint64_t size, uint8_t* head) {
+    if(size < 126) {
+        ws_head.payload = size;
+    } else if(size < 65536) {
+        ws_head.payload = 126;
+    } else {
+        ws_head.payload = 127;
+    }
+    size_t head_len = sizeof(ws_head);
+    memcpy(head, &ws_head, sizeof(ws_head));
+    if(ws_head.payload == 126) {
+        uint16_t len = sylar::byteswapOnLittleEndian((uint16_t)size);
+        memcpy(head + head_len, &len, sizeof(len));
+        head_len += sizeof(len);
+    } else if(ws_head.payload == 127) {
+        uint64_t len = sylar::byteswapOnLittleEndian(size);
+        memcpy(head + head_len, &len, sizeof(len));
+        head_len += sizeof(len);
+    }
+    return head_len;
+}
+
+std::string WSEncodeFrame(int opcode, const std::string& data, bool fin) {
+    WSFrameHead ws_head;
+    memset(&ws_head, 0, sizeof(ws_head));
+    ws_head.fin = fin;
+    ws_head.opcode = opcode;
+    uint8_t head[sizeof(ws_head) + 8];
+    size_t head_len = ws_encode_head(ws_head, data.size(), head);
+    std::string frame;
+    frame.reserve(head_len + data.size());
+    frame.append((const char*)head, head_len);
+    frame.append(data);
+    return frame;
+}
+
+/**
+ * @brief 组装帧头并和载荷一起发出，失败返回-1
+ */
+static int32_t ws_send_frame(Stream* stream, WSFrameHead ws_head, const std::string& data, bool client) {
+    uint64_t size = data.size();
+    // 帧头、扩展长度和掩码拼在一起，和载荷一次writev发出
+    uint8_t head[sizeof(ws_head) + 12];
+    size_t head_len = ws_encode_head(ws_head, size, head);
+    const char* payload = data.c_str();
+    std::string masked;
+    if(client) {
+        // 掩码后的数据写到单独的缓冲区，不修改调用方的消息
+        uint32_t rand_value = rand();
+        memcpy(head + head_len, &rand_value, 4);
+        masked.resize(size);
+        WSMask(data.c_str(), &masked[0], size, head + head_len);
+        head_len += 4;
+        payload = masked.c_str();
+    }
+
+    SocketStream* ss = dynamic_cast<SocketStream*>(stream);
+    if(ss && size > 0) {
+        iovec iovs[2];
+        iovs[0].iov_base = head;
+        iovs[0].iov_len = head_len;
+        iovs[1].iov_base = (void*)payload;
+        iovs[1].iov_len = size;
+        if(ss->writevFixSize(iovs, 2) <= 0) {
+            return -1;
         }
-        
-        if(stream->writeFixSize(&ws_head, sizeof(ws_head)) <= 0) {
-            break;
+    } else {
+        if(stream->writeFixSize(head, head_len) <= 0) {
+            return -1;
         }
-        if(ws_head.payload == 126) {
-            uint16_t len = size;
-            len = sylar::byteswapOnLittleEndian(len);
-            if(stream->writeFixSize(&len, sizeof(len)) <= 0) {
-                break;
-            }
-        } else if(ws_head.payload == 127) {
-            uint64_t len = sylar::byteswapOnLittleEndian(size);
-            if(stream->writeFixSize(&len, sizeof(len)) <= 0) {
-                break;
-            }
+        if(size > 0 && stream->writeFixSize(payload, size) <= 0) {
+            return -1;
         }
-        if(client) {
-            char mask[4];
-            uint32_t rand_value = rand();
-            memcpy(mask, &rand_value, sizeof(mask));
-            std::string& data = msg->getData();
-            for(size_t i = 0; i < data.size(); ++i) {
-                data[i] ^= mask[i % 4];
-            }
+    }
+    return size + head_len;
+}
 
-            if(stream->writeFixSize(mask, sizeof(mask)) <= 0) {
-                break;
-            }
-        }
-        if(stream->writeFixSize(msg->getData().c_str(), size) <= 0) {
-            break;
+int32_t WSSendMessage(Stream* stream, WSFrameMessage::ptr msg, bool client, bool fin
+                      ,WSDeflate* deflate) {
+    WSFrameHead ws_head;
+    memset(&ws_head, 0, sizeof(ws_head));
+    ws_head.fin = fin;
+    ws_head.opcode = msg->getOpcode();
+    ws_head.mask = client;
+    const std::string& data = msg->getData();
+
+    int32_t rt = -1;
+    // 分片消息的压缩状态要跨多次调用，只压缩单帧消息
+    if(deflate && fin && (ws_head.opcode == WSFrameHead::TEXT_FRAME
+                || ws_head.opcode == WSFrameHead::BIN_FRAME)
+            && deflate->shouldCompress(data.size())) {
+        // 上下文接管时对端按压缩顺序解压，压缩和发送在同一把锁内
+        FiberSemaphore& lock = deflate->getSendLock();
+        lock.wait();
+        std::string compressed;
+        if(deflate->compress(data.data(), data.size(), compressed)) {
+            ws_head.rsv1 = 1;
+            rt = ws_send_frame(stream, ws_head, compressed, client);
+        } else {
+            rt = ws_send_frame(stream, ws_head, data, client);
         }
-        return size + sizeof(ws_head);
-    } while(0);
-    stream->close();
-    return -1;
+        lock.notify();
+    } else {
+        rt = ws_send_frame(stream, ws_head, data, client);
+    }
+    if(rt < 0) {
+        stream->close();
+    }
+    return rt;
 }
 
 int32_t WSSession::pong() {
-    return WSPong(this);
+    m_sendLock.wait();
+    int32_t rt = WSPong(this);
+    m_sendLock.notify();
+    return rt;
 }
 
 int32_t WSPing(Stream* stream) {
@@ -3,6 +3,7 @@
 
 #include "sylar/config.h"
 #include "sylar/http/http_session.h"
+#include "sylar/http/ws_deflate.h"
 #include <stdint.h>
 
 namespace sylar {
@@ -65,17 +66,55 @@ public:
     int32_t sendMessage(const std::string& msg, int32_t opcode = WSFrameHead::TEXT_FRAME, bool fin = true);
     int32_t ping();
     int32_t pong();
+
+    /**
+     * @brief 握手协商出的permessage-deflate状态，未启用时为空
+     */
+    WSDeflate::ptr getDeflate() const { return m_deflate;}
+
+    /**
+     * @brief 发送锁，sendMessage/ping/pong和WSHub的发送协程共用，保证帧不交错
+     */
+    FiberSemaphore& getSendLock() { return m_sendLock;}
 private:
     bool handleServerShake();
     bool handleClientShake();
+private:
+    WSDeflate::ptr m_deflate;
+    FiberSemaphore m_sendLock;
 };
 
 extern sylar::ConfigVar<uint32_t>::ptr g_websocket_message_max_size;
-WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client);
-int32_t WSSendMessage(Stream* stream, WSFrameMessage::ptr msg, bool client, bool fin);
+/**
+ * @brief 接收一条完整的消息
+ * @param[in] deflate 协商出的压缩状态，为空时收到RSV1置位的帧断开连接
+ */
+WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client, WSDeflate* deflate = nullptr);
+
+/**
+ * @brief 发送一帧
+ * @param[in] deflate 协商出的压缩状态，只压缩不分片的文本和二进制消息
+ */
+int32_t WSSendMessage(Stream* stream, WSFrameMessage::ptr msg, bool client, bool fin
+                      ,WSDeflate* deflate = nullptr);
 int32_t WSPing(Stream* stream);
+
+/**
+ * @brief 编码一个不带掩码的完整帧(服务端方向)，编码一次可以发给多个连接
+ */
+std::string WSEncodeFrame(int opcode, const std::string& data, bool fin = true);
 int32_t WSPong(Stream* stream);
 
+/**
+ * @brief WebSocket掩码运算(RFC 6455 5.3)，掩码和解码是同一个运算
+ * @details 按CPU支持选择AVX2/SSE2实现，其他平台每次处理8字节
+ * @param[in] src 源数据
+ * @param[out] dst 目标地址，可以和src相同(原地运算)
+ * @param[in] len 长度
+ * @param[in] mask 4字节掩码，从src[0]开始对齐
+ */
+void WSMask(const void* src, void* dst, size_t len, const uint8_t* mask);
+
 }
 }
 
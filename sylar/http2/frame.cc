@@ -0,0 +1,157 @@
+#include "frame.h"
+#include "sylar/streams/socket_stream.h"
+#include "sylar/log.h"
+#include <sstream>
+
+namespace sylar {
+namespace http2 {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+const char* FrameTypeToString(FrameType type) {
+    static const char* s_names[] = {"DATA", "HEADERS", "PRIORITY", "RST_STREAM"
+        ,"SETTINGS", "PUSH_PROMISE", "PING", "GOAWAY", "WINDOW_UPDATE", "CONTINUATION"};
+    uint8_t v = (uint8_t)type;
+    return v < sizeof(s_names) / sizeof(s_names[0]) ? s_names[v] : "UNKNOWN";
+}
+
+const char* Http2ErrorToString(Http2Error error) {
+    static const char* s_names[] = {"NO_ERROR", "PROTOCOL_ERROR", "INTERNAL_ERROR"
+        ,"FLOW_CONTROL_ERROR", "SETTINGS_TIMEOUT", "STREAM_CLOSED", "FRAME_SIZE_ERROR"
+        ,"REFUSED_STREAM", "CANCEL", "COMPRESSION_ERROR", "CONNECT_ERROR"
+        ,"ENHANCE_YOUR_CALM", "INADEQUATE_SECURITY", "HTTP_1_1_REQUIRED"};
+    uint32_t v = (uint32_t)error;
+    return v < sizeof(s_names) / sizeof(s_names[0]) ? s_names[v] : "UNKNOWN";
+}
+
+static void put_uint32(uint8_t* buf, uint32_t v) {
+    buf[0] = v >> 24;
+    buf[1] = v >> 16;
+    buf[2] = v >> 8;
+    buf[3] = v;
+}
+
+static void append_uint32(std::string& out, uint32_t v) {
+    uint8_t buf[4];
+    put_uint32(buf, v);
+    out.append((const char*)buf, 4);
+}
+
+void FrameHeader::encode(uint8_t* buf) const {
+    buf[0] = length >> 16;
+    buf[1] = length >> 8;
+    buf[2] = length;
+    buf[3] = (uint8_t)type;
+    buf[4] = flags;
+    put_uint32(buf + 5, id & 0x7fffffff);
+}
+
+void FrameHeader::decode(const uint8_t* buf) {
+    length = ((uint32_t)buf[0] << 16) | ((uint32_t)buf[1] << 8) | buf[2];
+    type = (FrameType)buf[3];
+    flags = buf[4];
+    id = (((uint32_t)buf[5] << 24) | ((uint32_t)buf[6] << 16)
+            | ((uint32_t)buf[7] << 8) | buf[8]) & 0x7fffffff;
+}
+
+Frame::Frame(FrameType type, uint8_t flags, uint32_t id, const std::string& payload)
+    :data(payload) {
+    header.type = type;
+    header.flags = flags;
+    header.id = id;
+    header.length = payload.size();
+}
+
+std::string Frame::toString() const {
+    std::stringstream ss;
+    ss << "[Frame type=" << FrameTypeToString(header.type)
+       << " flags=0x" << std::hex << (int)header.flags << std::dec
+       << " id=" << header.id
+       << " length=" << header.length << "]";
+    return ss.str();
+}
+
+Frame::ptr Frame::CreateSettings(const std::vector<std::pair<SettingsId, uint32_t> >& settings) {
+    std::string data;
+    for(auto& i : settings) {
+        data.push_back((char)((uint16_t)i.first >> 8));
+        data.push_back((char)((uint16_t)i.first & 0xff));
+        append_uint32(data, i.second);
+    }
+    return std::make_shared<Frame>(FrameType::SETTINGS, 0, 0, data);
+}
+
+Frame::ptr Frame::CreateSettingsAck() {
+    return std::make_shared<Frame>(FrameType::SETTINGS, ACK, 0);
+}
+
+Frame::ptr Frame::CreateWindowUpdate(uint32_t id, uint32_t increment) {
+    std::string data;
+    append_uint32(data, increment & 0x7fffffff);
+    return std::make_shared<Frame>(FrameType::WINDOW_UPDATE, 0, id, data);
+}
+
+Frame::ptr Frame::CreateRstStream(uint32_t id, Http2Error error) {
+    std::string data;
+    append_uint32(data, (uint32_t)error);
+    return std::make_shared<Frame>(FrameType::RST_STREAM, 0, id, data);
+}
+
+Frame::ptr Frame::CreateGoAway(uint32_t last_id, Http2Error error, const std::string& debug) {
+    std::string data;
+    append_uint32(data, last_id & 0x7fffffff);
+    append_uint32(data, (uint32_t)error);
+    data.append(debug);
+    return std::make_shared<Frame>(FrameType::GOAWAY, 0, 0, data);
+}
+
+Frame::ptr Frame::CreatePing(bool ack, const std::string& opaque) {
+    return std::make_shared<Frame>(FrameType::PING, ack ? ACK : 0, 0, opaque);
+}
+
+Frame::ptr FrameCodec::ParseFrom(Stream::ptr stream, uint32_t max_size, Http2Error& error) {
+    error = Http2Error::NO_ERROR;
+    uint8_t buf[FRAME_HEADER_SIZE];
+    if(stream->readFixSize(buf, sizeof(buf)) <= 0) {
+        return nullptr;
+    }
+    Frame::ptr frame = std::make_shared<Frame>();
+    frame->header.decode(buf);
+    if(frame->header.length > max_size) {
+        SYLAR_LOG_DEBUG(g_logger) << "http2 frame too large " << frame->toString()
+            << " max_size=" << max_size;
+        error = Http2Error::FRAME_SIZE_ERROR;
+        return nullptr;
+    }
+    if(frame->header.length > 0) {
+        frame->data.resize(frame->header.length);
+        if(stream->readFixSize(&frame->data[0], frame->data.size()) <= 0) {
+            return nullptr;
+        }
+    }
+    return frame;
+}
+
+int FrameCodec::SerializeTo(Stream::ptr stream, Frame::ptr frame) {
+    uint8_t buf[FRAME_HEADER_SIZE];
+    frame->header.length = frame->data.size();
+    frame->header.encode(buf);
+    SocketStream::ptr ss = std::dynamic_pointer_cast<SocketStream>(stream);
+    if(ss && !frame->data.empty()) {
+        iovec iovs[2];
+        iovs[0].iov_base = buf;
+        iovs[0].iov_len = sizeof(buf);
+        iovs[1].iov_base = &frame->data[0];
+        iovs[1].iov_len = frame->data.size();
+        return ss->writevFixSize(iovs, 2);
+    }
+    int rt = stream->writeFixSize(buf, sizeof(buf));
+    if(rt <= 0 || frame->data.empty()) {
+        return rt;
+    }
+    int rt2 = stream->writeFixSize(frame->data.c_str(), frame->data.size());
+    return rt2 <= 0 ? rt2 : rt + rt2;
+}
+
+}
+}
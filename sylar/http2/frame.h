@@ -0,0 +1,160 @@
+/**
+ * @file frame.h
+ * @brief HTTP/2帧(RFC 7540 第4、6章)
+ */
+#ifndef __SYLAR_HTTP2_FRAME_H__
+#define __SYLAR_HTTP2_FRAME_H__
+
+#include "sylar/stream.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace sylar {
+namespace http2 {
+
+/// 连接前言
+static const char CLIENT_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t CLIENT_PREFACE_SIZE = sizeof(CLIENT_PREFACE) - 1;
+
+/// 帧头长度
+static const size_t FRAME_HEADER_SIZE = 9;
+
+/**
+ * @brief 帧类型
+ */
+enum class FrameType : uint8_t {
+    DATA            = 0x0,
+    HEADERS         = 0x1,
+    PRIORITY        = 0x2,
+    RST_STREAM      = 0x3,
+    SETTINGS        = 0x4,
+    PUSH_PROMISE    = 0x5,
+    PING            = 0x6,
+    GOAWAY          = 0x7,
+    WINDOW_UPDATE   = 0x8,
+    CONTINUATION    = 0x9,
+};
+
+/**
+ * @brief 帧标志
+ */
+enum FrameFlag {
+    END_STREAM      = 0x1,
+    ACK             = 0x1,
+    END_HEADERS     = 0x4,
+    PADDED          = 0x8,
+    PRIORITY        = 0x20,
+};
+
+/**
+ * @brief 错误码
+ */
+enum class Http2Error : uint32_t {
+    NO_ERROR            = 0x0,
+    PROTOCOL_ERROR      = 0x1,
+    INTERNAL_ERROR      = 0x2,
+    FLOW_CONTROL_ERROR  = 0x3,
+    SETTINGS_TIMEOUT    = 0x4,
+    STREAM_CLOSED       = 0x5,
+    FRAME_SIZE_ERROR    = 0x6,
+    REFUSED_STREAM      = 0x7,
+    CANCEL              = 0x8,
+    COMPRESSION_ERROR   = 0x9,
+    CONNECT_ERROR       = 0xa,
+    ENHANCE_YOUR_CALM   = 0xb,
+    INADEQUATE_SECURITY = 0xc,
+    HTTP_1_1_REQUIRED   = 0xd,
+};
+
+/**
+ * @brief SETTINGS参数
+ */
+enum class SettingsId : uint16_t {
+    HEADER_TABLE_SIZE       = 0x1,
+    ENABLE_PUSH             = 0x2,
+    MAX_CONCURRENT_STREAMS  = 0x3,
+    INITIAL_WINDOW_SIZE     = 0x4,
+    MAX_FRAME_SIZE          = 0x5,
+    MAX_HEADER_LIST_SIZE    = 0x6,
+};
+
+const char* FrameTypeToString(FrameType type);
+const char* Http2ErrorToString(Http2Error error);
+
+/**
+ * @brief 帧头
+ */
+struct FrameHeader {
+    /// 负载长度(24位)
+    uint32_t length = 0;
+    /// 类型
+    FrameType type = FrameType::DATA;
+    /// 标志
+    uint8_t flags = 0;
+    /// 流ID(31位)
+    uint32_t id = 0;
+
+    /**
+     * @brief 编码到9字节缓冲区
+     */
+    void encode(uint8_t* buf) const;
+
+    /**
+     * @brief 从9字节缓冲区解码
+     */
+    void decode(const uint8_t* buf);
+
+    bool hasFlag(uint8_t f) const { return flags & f;}
+};
+
+/**
+ * @brief 帧
+ */
+struct Frame {
+    typedef std::shared_ptr<Frame> ptr;
+
+    Frame() {}
+    Frame(FrameType type, uint8_t flags, uint32_t id, const std::string& payload = "");
+
+    /// 帧头
+    FrameHeader header;
+    /// 负载
+    std::string data;
+
+    std::string toString() const;
+
+    static Frame::ptr CreateSettings(const std::vector<std::pair<SettingsId, uint32_t> >& settings);
+    static Frame::ptr CreateSettingsAck();
+    static Frame::ptr CreateWindowUpdate(uint32_t id, uint32_t increment);
+    static Frame::ptr CreateRstStream(uint32_t id, Http2Error error);
+    static Frame::ptr CreateGoAway(uint32_t last_id, Http2Error error, const std::string& debug = "");
+    static Frame::ptr CreatePing(bool ack, const std::string& opaque);
+};
+
+/**
+ * @brief 帧读写
+ */
+class FrameCodec {
+public:
+    /**
+     * @brief 读取一个帧
+     * @param[in] stream 流
+     * @param[in] max_size 允许的最大负载长度(SETTINGS_MAX_FRAME_SIZE)
+     * @param[out] error 超过max_size时为FRAME_SIZE_ERROR
+     * @return 读取失败或帧太大时返回nullptr
+     */
+    static Frame::ptr ParseFrom(Stream::ptr stream, uint32_t max_size, Http2Error& error);
+
+    /**
+     * @brief 写入一个帧(帧头和负载一次writev)
+     * @return 写入的字节数，失败返回<=0
+     */
+    static int SerializeTo(Stream::ptr stream, Frame::ptr frame);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,338 @@
+#include "hpack.h"
+#include "huffman.h"
+#include <string.h>
+
+namespace sylar {
+namespace http2 {
+
+static const HeaderField s_static_table[DynamicTable::STATIC_SIZE] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+DynamicTable::DynamicTable(uint32_t max_size)
+    :m_size(0)
+    ,m_maxSize(max_size) {
+}
+
+void DynamicTable::evict(uint32_t size) {
+    while(!m_entries.empty() && m_size + size > m_maxSize) {
+        auto& back = m_entries.back();
+        m_size -= EntrySize(back.name, back.value);
+        m_entries.pop_back();
+    }
+}
+
+void DynamicTable::add(const std::string& name, const std::string& value) {
+    uint32_t size = EntrySize(name, value);
+    evict(size);
+    // 比整个表还大时清空表，不插入
+    if(size > m_maxSize) {
+        return;
+    }
+    m_entries.emplace_front(name, value);
+    m_size += size;
+}
+
+const HeaderField* DynamicTable::get(uint64_t index) const {
+    if(index == 0 || index > STATIC_SIZE + m_entries.size()) {
+        return nullptr;
+    }
+    if(index <= STATIC_SIZE) {
+        return &s_static_table[index - 1];
+    }
+    index -= STATIC_SIZE + 1;
+    if(index >= m_entries.size()) {
+        return nullptr;
+    }
+    return &m_entries[index];
+}
+
+uint32_t DynamicTable::find(const std::string& name, const std::string& value, bool& value_match) const {
+    uint32_t name_index = 0;
+    value_match = false;
+    for(uint32_t i = 0; i < STATIC_SIZE; ++i) {
+        if(s_static_table[i].name == name) {
+            if(s_static_table[i].value == value) {
+                value_match = true;
+                return i + 1;
+            }
+            if(!name_index) {
+                name_index = i + 1;
+            }
+        }
+    }
+    for(uint32_t i = 0; i < m_entries.size(); ++i) {
+        if(m_entries[i].name == name) {
+            if(m_entries[i].value == value) {
+                value_match = true;
+                return i + STATIC_SIZE + 1;
+            }
+            if(!name_index) {
+                name_index = i + STATIC_SIZE + 1;
+            }
+        }
+    }
+    return name_index;
+}
+
+void DynamicTable::setMaxSize(uint32_t v) {
+    m_maxSize = v;
+    evict(0);
+}
+
+HPack::HPack(DynamicTable& table)
+    :m_table(table) {
+}
+
+void HPack::EncodeInteger(uint64_t value, int prefix, uint8_t flags, std::string& out) {
+    uint64_t max = (1 << prefix) - 1;
+    if(value < max) {
+        out.push_back((char)(flags | value));
+        return;
+    }
+    out.push_back((char)(flags | max));
+    value -= max;
+    while(value >= 128) {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+int HPack::DecodeInteger(const uint8_t* data, size_t len, int prefix, uint64_t& value) {
+    if(len == 0) {
+        return -1;
+    }
+    uint64_t max = (1 << prefix) - 1;
+    value = data[0] & max;
+    if(value < max) {
+        return 1;
+    }
+    int shift = 0;
+    for(size_t i = 1; i < len; ++i) {
+        // 限制在32位以内，防止溢出
+        if(shift > 28) {
+            return -1;
+        }
+        value += (uint64_t)(data[i] & 0x7f) << shift;
+        shift += 7;
+        if(!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+void HPack::EncodeString(const std::string& str, std::string& out) {
+    size_t hlen = Huffman::EncodeLen(str);
+    if(hlen < str.size()) {
+        EncodeInteger(hlen, 7, 0x80, out);
+        Huffman::EncodeString(str, out);
+    } else {
+        EncodeInteger(str.size(), 7, 0, out);
+        out.append(str);
+    }
+}
+
+int HPack::DecodeString(const uint8_t* data, size_t len, std::string& str) {
+    uint64_t slen = 0;
+    int n = DecodeInteger(data, len, 7, slen);
+    if(n < 0 || slen > len - n) {
+        return -1;
+    }
+    str.clear();
+    if(data[0] & 0x80) {
+        if(!Huffman::DecodeString(data + n, slen, str)) {
+            return -1;
+        }
+    } else {
+        str.assign((const char*)data + n, slen);
+    }
+    return n + slen;
+}
+
+int HPack::parse(const uint8_t* data, size_t len, std::vector<HeaderField>& headers
+                 ,uint32_t max_table_size, uint64_t max_list_size) {
+    size_t pos = 0;
+    bool header_seen = false;
+    // 解码后的大小，引用动态表的1字节索引可以展开成很大的字段
+    uint64_t list_size = 0;
+    while(pos < len) {
+        uint8_t c = data[pos];
+        uint64_t index = 0;
+        int n = 0;
+        if(c & 0x80) {
+            // 6.1 索引
+            n = DecodeInteger(data + pos, len - pos, 7, index);
+            if(n < 0) {
+                return -1;
+            }
+            const HeaderField* hf = m_table.get(index);
+            if(!hf) {
+                return -1;
+            }
+            list_size += DynamicTable::EntrySize(hf->name, hf->value);
+            if(list_size > max_list_size) {
+                return -2;
+            }
+            headers.push_back(*hf);
+            pos += n;
+            header_seen = true;
+            continue;
+        }
+        if((c & 0xe0) == 0x20) {
+            // 6.3 动态表大小更新，只能出现在头部块开头
+            if(header_seen) {
+                return -1;
+            }
+            n = DecodeInteger(data + pos, len - pos, 5, index);
+            if(n < 0 || index > max_table_size) {
+                return -1;
+            }
+            m_table.setMaxSize(index);
+            pos += n;
+            continue;
+        }
+        // 6.2 字面量: 01 带索引, 0000 不索引, 0001 永不索引
+        bool incremental = (c & 0xc0) == 0x40;
+        int prefix = incremental ? 6 : 4;
+        n = DecodeInteger(data + pos, len - pos, prefix, index);
+        if(n < 0) {
+            return -1;
+        }
+        pos += n;
+        HeaderField hf;
+        if(index) {
+            const HeaderField* name = m_table.get(index);
+            if(!name) {
+                return -1;
+            }
+            hf.name = name->name;
+        } else {
+            n = DecodeString(data + pos, len - pos, hf.name);
+            if(n < 0) {
+                return -1;
+            }
+            pos += n;
+        }
+        n = DecodeString(data + pos, len - pos, hf.value);
+        if(n < 0) {
+            return -1;
+        }
+        pos += n;
+        list_size += DynamicTable::EntrySize(hf.name, hf.value);
+        if(list_size > max_list_size) {
+            return -2;
+        }
+        if(incremental) {
+            m_table.add(hf.name, hf.value);
+        }
+        headers.push_back(std::move(hf));
+        header_seen = true;
+    }
+    return 0;
+}
+
+void HPack::setMaxTableSize(uint32_t v) {
+    m_pendingTableSize = v;
+}
+
+static bool is_sensitive(const std::string& name) {
+    return name == "authorization" || name == "cookie" || name == "set-cookie"
+        || name == "proxy-authorization";
+}
+
+void HPack::pack(const std::vector<HeaderField>& headers, std::string& out) {
+    if(m_pendingTableSize >= 0) {
+        m_table.setMaxSize(m_pendingTableSize);
+        EncodeInteger(m_pendingTableSize, 5, 0x20, out);
+        m_pendingTableSize = -1;
+    }
+    for(auto& i : headers) {
+        bool value_match = false;
+        uint32_t index = m_table.find(i.name, i.value, value_match);
+        if(value_match) {
+            EncodeInteger(index, 7, 0x80, out);
+            continue;
+        }
+        bool sensitive = is_sensitive(i.name);
+        // 太大的字段加入动态表会把其他项都挤掉，不索引
+        bool incremental = !sensitive
+            && DynamicTable::EntrySize(i.name, i.value) <= m_table.getMaxSize() / 2;
+        if(incremental) {
+            EncodeInteger(index, 6, 0x40, out);
+        } else {
+            EncodeInteger(index, 4, sensitive ? 0x10 : 0, out);
+        }
+        if(!index) {
+            EncodeString(i.name, out);
+        }
+        EncodeString(i.value, out);
+        if(incremental) {
+            m_table.add(i.name, i.value);
+        }
+    }
+}
+
+}
+}
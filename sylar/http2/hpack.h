@@ -0,0 +1,168 @@
+/**
+ * @file hpack.h
+ * @brief HPACK头部压缩(RFC 7541)
+ */
+#ifndef __SYLAR_HTTP2_HPACK_H__
+#define __SYLAR_HTTP2_HPACK_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+namespace sylar {
+namespace http2 {
+
+/**
+ * @brief 头部字段
+ */
+struct HeaderField {
+    HeaderField() {}
+    HeaderField(const std::string& n, const std::string& v)
+        :name(n), value(v) {}
+
+    std::string name;
+    std::string value;
+};
+
+/**
+ * @brief HPACK索引表: 1-61为静态表，62开始为动态表(最新插入的在前)
+ */
+class DynamicTable {
+public:
+    /// 静态表大小
+    static const uint32_t STATIC_SIZE = 61;
+
+    /**
+     * @brief 构造函数
+     * @param[in] max_size 动态表最大大小(字节，按RFC计算每项+32)
+     */
+    DynamicTable(uint32_t max_size = 4096);
+
+    /**
+     * @brief 插入一项，超过最大大小时淘汰最老的
+     */
+    void add(const std::string& name, const std::string& value);
+
+    /**
+     * @brief 按索引获取
+     * @details 参数是解码出的原始索引，不截断，超出静态表加动态表的都返回nullptr
+     * @return 索引不存在时返回nullptr
+     */
+    const HeaderField* get(uint64_t index) const;
+
+    /**
+     * @brief 查找
+     * @param[in] name 名称
+     * @param[in] value 值
+     * @param[out] value_match 值是否也匹配
+     * @return 索引，没找到返回0
+     */
+    uint32_t find(const std::string& name, const std::string& value, bool& value_match) const;
+
+    /**
+     * @brief 设置最大大小，淘汰超出的项
+     */
+    void setMaxSize(uint32_t v);
+    uint32_t getMaxSize() const { return m_maxSize;}
+
+    /**
+     * @brief 当前大小
+     */
+    uint32_t getSize() const { return m_size;}
+
+    /**
+     * @brief 动态表项数
+     */
+    size_t getCount() const { return m_entries.size();}
+
+    /**
+     * @brief 一项占用的大小
+     */
+    static uint32_t EntrySize(const std::string& name, const std::string& value) {
+        return name.size() + value.size() + 32;
+    }
+private:
+    void evict(uint32_t size);
+private:
+    /// 动态表
+    std::deque<HeaderField> m_entries;
+    /// 当前大小
+    uint32_t m_size;
+    /// 最大大小
+    uint32_t m_maxSize;
+};
+
+/**
+ * @brief HPACK编解码
+ * @details 同一个连接的每个方向各用一个DynamicTable，编解码必须按头部块在连接上的顺序进行
+ */
+class HPack {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] table 索引表
+     */
+    HPack(DynamicTable& table);
+
+    /**
+     * @brief 解码一个完整的头部块
+     * @param[in] data 数据
+     * @param[in] len 长度
+     * @param[out] headers 头部字段
+     * @param[in] max_table_size 对端允许设置的动态表最大大小(SETTINGS_HEADER_TABLE_SIZE)
+     * @param[in] max_list_size 解码后头部列表的最大大小(SETTINGS_MAX_HEADER_LIST_SIZE)，
+     *            每个字段按name+value+32计算，边解码边检查
+     * @return 成功返回0，格式错误返回-1(连接需要以COMPRESSION_ERROR关闭)，
+     *         超过max_list_size返回-2(动态表已经不同步，连接需要以ENHANCE_YOUR_CALM关闭)
+     */
+    int parse(const uint8_t* data, size_t len, std::vector<HeaderField>& headers
+              ,uint32_t max_table_size = 4096, uint64_t max_list_size = ~0ull);
+
+    /**
+     * @brief 编码头部字段，结果追加到out
+     * @details 完整匹配时使用索引，否则带索引的字面量；
+     *          authorization、cookie等敏感字段不加入动态表
+     */
+    void pack(const std::vector<HeaderField>& headers, std::string& out);
+
+    /**
+     * @brief 编码时调整动态表大小，下一个头部块开头发送大小更新
+     */
+    void setMaxTableSize(uint32_t v);
+
+    /**
+     * @brief 编码整数(RFC 7541 5.1)
+     * @param[in] value 值
+     * @param[in] prefix 前缀位数
+     * @param[in] flags 第一个字节中前缀之外的高位
+     */
+    static void EncodeInteger(uint64_t value, int prefix, uint8_t flags, std::string& out);
+
+    /**
+     * @brief 解码整数
+     * @return 消耗的字节数，失败返回-1
+     */
+    static int DecodeInteger(const uint8_t* data, size_t len, int prefix, uint64_t& value);
+
+    /**
+     * @brief 编码字符串，Huffman更短时使用Huffman
+     */
+    static void EncodeString(const std::string& str, std::string& out);
+
+    /**
+     * @brief 解码字符串
+     * @return 消耗的字节数，失败返回-1
+     */
+    static int DecodeString(const uint8_t* data, size_t len, std::string& str);
+private:
+    /// 索引表
+    DynamicTable& m_table;
+    /// 下一个头部块开头需要发送的动态表大小更新，-1表示没有
+    int64_t m_pendingTableSize = -1;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,869 @@
+#include "http2_session.h"
+#include "sylar/http/http_parser.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <string.h>
+
+namespace sylar {
+namespace http2 {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 本端的SETTINGS_HEADER_TABLE_SIZE，不发送这个设置，为协议默认值
+static const uint32_t s_header_table_size = 4096;
+
+static sylar::ConfigVar<bool>::ptr g_http2_enable =
+    sylar::Config::Lookup("http2.enable", true, "http2 enable");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_max_concurrent_streams =
+    sylar::Config::Lookup("http2.max_concurrent_streams", (uint32_t)128
+                , "http2 max concurrent streams per connection");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_initial_window_size =
+    sylar::Config::Lookup("http2.initial_window_size", (uint32_t)(1024 * 1024)
+                , "http2 stream initial window size");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_connection_window_size =
+    sylar::Config::Lookup("http2.connection_window_size", (uint32_t)(16 * 1024 * 1024)
+                , "http2 connection window size");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_max_frame_size =
+    sylar::Config::Lookup("http2.max_frame_size", (uint32_t)16384
+                , "http2 max frame size");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_max_header_list_size =
+    sylar::Config::Lookup("http2.max_header_list_size", (uint32_t)(64 * 1024)
+                , "http2 max header list size");
+
+/// 窗口的最大值 2^31-1
+static const int64_t MAX_WINDOW_SIZE = 0x7fffffff;
+/// 读缓冲区大小
+static const size_t READ_BUFFER_SIZE = 16 * 1024;
+
+static uint32_t get_uint32(const char* data) {
+    const uint8_t* p = (const uint8_t*)data;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+            | ((uint32_t)p[2] << 8) | p[3];
+}
+
+bool Http2Session::IsEnabled() {
+    return g_http2_enable->getValue();
+}
+
+Http2Session::Http2Session(Socket::ptr sock, const std::string& init_data)
+    :AsyncSocketStream(sock, true)
+    ,m_readBuf(init_data.begin(), init_data.end())
+    ,m_readSize(init_data.size())
+    ,m_decoder(m_recvTable)
+    ,m_encoder(m_sendTable) {
+    m_maxConcurrentStreams = g_http2_max_concurrent_streams->getValue();
+    m_initialWindow = std::min((int64_t)g_http2_initial_window_size->getValue(), MAX_WINDOW_SIZE);
+    m_connectionWindow = std::min((int64_t)g_http2_connection_window_size->getValue(), MAX_WINDOW_SIZE);
+    // SETTINGS_MAX_FRAME_SIZE的合法范围是 [2^14, 2^24-1]
+    m_maxFrameSize = std::max(16384u, std::min(g_http2_max_frame_size->getValue(), 0xffffffu));
+    m_maxHeaderListSize = g_http2_max_header_list_size->getValue();
+    SYLAR_LOG_DEBUG(g_logger) << "Http2Session::Http2Session " << this;
+}
+
+Http2Session::~Http2Session() {
+    SYLAR_LOG_DEBUG(g_logger) << "Http2Session::~Http2Session " << this;
+}
+
+bool Http2Session::start() {
+    // 服务端连接前言: SETTINGS必须是第一个帧
+    FrameSendCtx::ptr ctx(new FrameSendCtx);
+    ctx->frames.push_back(Frame::CreateSettings({
+                {SettingsId::ENABLE_PUSH, 0}
+                ,{SettingsId::MAX_CONCURRENT_STREAMS, m_maxConcurrentStreams}
+                ,{SettingsId::INITIAL_WINDOW_SIZE, m_initialWindow}
+                ,{SettingsId::MAX_FRAME_SIZE, m_maxFrameSize}
+                ,{SettingsId::MAX_HEADER_LIST_SIZE, m_maxHeaderListSize}}));
+    // 连接窗口不能通过SETTINGS调整，只能用WINDOW_UPDATE
+    if(m_connectionWindow > m_recvWindow) {
+        ctx->frames.push_back(Frame::CreateWindowUpdate(0, m_connectionWindow - m_recvWindow));
+        m_recvWindow = m_connectionWindow;
+    }
+    enqueue(ctx);
+    if(!AsyncSocketStream::start()) {
+        return false;
+    }
+    if(m_upgradeStream) {
+        dispatch(m_upgradeStream);
+        m_upgradeStream = nullptr;
+    }
+    return true;
+}
+
+bool Http2Session::upgrade(http::HttpRequest::ptr req, const std::string& settings) {
+    if(settings.size() % 6 || applySettings(settings) != Http2Error::NO_ERROR) {
+        return false;
+    }
+    Http2Stream::ptr stream = std::make_shared<Http2Stream>(1, m_peerInitialWindow, m_initialWindow);
+    stream->setRequest(req);
+    stream->setState(Http2Stream::HALF_CLOSED_REMOTE);
+    {
+        RWMutex::WriteLock lock(m_streamMutex);
+        m_streams[1] = stream;
+    }
+    m_lastStreamId = 1;
+    m_upgradeStream = stream;
+    return true;
+}
+
+size_t Http2Session::getStreamCount() {
+    RWMutex::ReadLock lock(m_streamMutex);
+    return m_streams.size();
+}
+
+int Http2Session::read(void* buffer, size_t length) {
+    if(m_readOffset >= m_readSize) {
+        if(length >= READ_BUFFER_SIZE) {
+            return SocketStream::read(buffer, length);
+        }
+        if(m_readBuf.size() < READ_BUFFER_SIZE) {
+            m_readBuf.resize(READ_BUFFER_SIZE);
+        }
+        m_readOffset = 0;
+        m_readSize = 0;
+        int rt = SocketStream::read(&m_readBuf[0], m_readBuf.size());
+        if(rt <= 0) {
+            return rt;
+        }
+        m_readSize = rt;
+    }
+    size_t n = std::min(length, m_readSize - m_readOffset);
+    memcpy(buffer, &m_readBuf[m_readOffset], n);
+    m_readOffset += n;
+    return n;
+}
+
+int Http2Session::read(ByteArray::ptr ba, size_t length) {
+    if(m_readOffset < m_readSize) {
+        size_t n = std::min(length, m_readSize - m_readOffset);
+        ba->write(&m_readBuf[m_readOffset], n);
+        m_readOffset += n;
+        return n;
+    }
+    return SocketStream::read(ba, length);
+}
+
+bool Http2Session::FrameSendCtx::doSend(AsyncSocketStream::ptr stream) {
+    for(auto& i : frames) {
+        if(FrameCodec::SerializeTo(stream, i) <= 0) {
+            return false;
+        }
+    }
+    return !close;
+}
+
+bool Http2Session::FrameSendCtx::doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) {
+    uint8_t buf[FRAME_HEADER_SIZE];
+    for(auto& i : frames) {
+        i->header.length = i->data.size();
+        i->header.encode(buf);
+        buffer->write(buf, sizeof(buf));
+        // DATA帧的负载引用Frame的内存，不拷贝
+        buffer->append(i->data.c_str(), i->data.size(), i);
+    }
+    return !close;
+}
+
+void Http2Session::sendFrame(Frame::ptr frame) {
+    FrameSendCtx::ptr ctx(new FrameSendCtx);
+    ctx->frames.push_back(frame);
+    enqueue(ctx);
+}
+
+void Http2Session::connectionError(Http2Error error, const std::string& debug) {
+    if(m_goaway) {
+        return;
+    }
+    m_goaway = true;
+    SYLAR_LOG_DEBUG(g_logger) << "http2 connection error " << Http2ErrorToString(error)
+        << " " << debug << " last_stream_id=" << m_lastStreamId << " " << this;
+    FrameSendCtx::ptr ctx(new FrameSendCtx);
+    ctx->frames.push_back(Frame::CreateGoAway(m_lastStreamId, error, debug));
+    ctx->close = true;
+    enqueue(ctx);
+}
+
+void Http2Session::streamError(uint32_t id, Http2Error error) {
+    SYLAR_LOG_DEBUG(g_logger) << "http2 stream error id=" << id
+        << " " << Http2ErrorToString(error) << " " << this;
+    sendFrame(Frame::CreateRstStream(id, error));
+    Http2Stream::ptr stream = getStream(id);
+    if(stream) {
+        Mutex::Lock lock(m_windowMutex);
+        stream->setState(Http2Stream::CLOSED);
+        stream->wakeup();
+    }
+    delStream(id);
+}
+
+Http2Stream::ptr Http2Session::getStream(uint32_t id) {
+    RWMutex::ReadLock lock(m_streamMutex);
+    auto it = m_streams.find(id);
+    return it == m_streams.end() ? nullptr : it->second;
+}
+
+void Http2Session::delStream(uint32_t id) {
+    RWMutex::WriteLock lock(m_streamMutex);
+    m_streams.erase(id);
+}
+
+void Http2Session::wakeupAll() {
+    RWMutex::ReadLock lock(m_streamMutex);
+    for(auto& i : m_streams) {
+        i.second->wakeup();
+    }
+}
+
+AsyncSocketStream::Ctx::ptr Http2Session::doRecv() {
+    if(!m_prefaceDone) {
+        char buf[CLIENT_PREFACE_SIZE];
+        if(readFixSize(buf, sizeof(buf)) <= 0
+                || memcmp(buf, CLIENT_PREFACE, CLIENT_PREFACE_SIZE)) {
+            SYLAR_LOG_DEBUG(g_logger) << "http2 invalid connection preface " << this;
+            innerClose();
+            return nullptr;
+        }
+        m_prefaceDone = true;
+        return nullptr;
+    }
+    Http2Error error;
+    Frame::ptr frame = FrameCodec::ParseFrom(shared_from_this(), m_maxFrameSize, error);
+    if(!frame) {
+        if(error != Http2Error::NO_ERROR) {
+            // 帧负载没有读出，连接无法继续解析，等待GOAWAY发送后关闭
+            connectionError(error);
+        } else {
+            innerClose();
+        }
+        return nullptr;
+    }
+    if(!m_goaway) {
+        handleFrame(frame);
+    }
+    return nullptr;
+}
+
+void Http2Session::doRead() {
+    AsyncSocketStream::doRead();
+    {
+        // 唤醒等待发送窗口的流，它们会发现连接已经断开
+        Mutex::Lock lock(m_windowMutex);
+        wakeupAll();
+    }
+    m_finish.notify();
+}
+
+void Http2Session::handleFrame(Frame::ptr frame) {
+    // 头部块必须连续，中间不能插入其他帧
+    if(m_headerStreamId && (frame->header.type != FrameType::CONTINUATION
+                || frame->header.id != m_headerStreamId)) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "expect CONTINUATION");
+        return;
+    }
+    switch(frame->header.type) {
+        case FrameType::DATA:
+            handleData(frame);
+            break;
+        case FrameType::HEADERS:
+            handleHeaders(frame);
+            break;
+        case FrameType::CONTINUATION:
+            handleContinuation(frame);
+            break;
+        case FrameType::SETTINGS:
+            handleSettings(frame);
+            break;
+        case FrameType::PING:
+            handlePing(frame);
+            break;
+        case FrameType::RST_STREAM:
+            handleRstStream(frame);
+            break;
+        case FrameType::WINDOW_UPDATE:
+            handleWindowUpdate(frame);
+            break;
+        case FrameType::GOAWAY:
+            handleGoAway(frame);
+            break;
+        case FrameType::PRIORITY:
+            if(frame->header.id == 0) {
+                connectionError(Http2Error::PROTOCOL_ERROR, "PRIORITY on stream 0");
+            } else if(frame->data.size() != 5) {
+                streamError(frame->header.id, Http2Error::FRAME_SIZE_ERROR);
+            }
+            break;
+        case FrameType::PUSH_PROMISE:
+            connectionError(Http2Error::PROTOCOL_ERROR, "PUSH_PROMISE from client");
+            break;
+        default:
+            // 未知类型的帧必须忽略
+            break;
+    }
+}
+
+void Http2Session::handleData(Frame::ptr frame) {
+    uint32_t id = frame->header.id;
+    if(id == 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "DATA on stream 0");
+        return;
+    }
+    // 流量控制按整个负载(含填充)计算
+    size_t len = frame->data.size();
+    if((int64_t)len > m_recvWindow) {
+        connectionError(Http2Error::FLOW_CONTROL_ERROR);
+        return;
+    }
+    m_recvWindow -= len;
+    m_recvUnacked += len;
+    if(m_recvUnacked >= m_connectionWindow / 2) {
+        sendFrame(Frame::CreateWindowUpdate(0, m_recvUnacked));
+        m_recvWindow += m_recvUnacked;
+        m_recvUnacked = 0;
+    }
+
+    Http2Stream::ptr stream = getStream(id);
+    if(!stream) {
+        if(id > m_lastStreamId) {
+            connectionError(Http2Error::PROTOCOL_ERROR, "DATA on idle stream");
+        } else {
+            streamError(id, Http2Error::STREAM_CLOSED);
+        }
+        return;
+    }
+    if(stream->isRemoteClosed()) {
+        streamError(id, Http2Error::STREAM_CLOSED);
+        return;
+    }
+    if((int64_t)len > stream->getRecvWindow()) {
+        streamError(id, Http2Error::FLOW_CONTROL_ERROR);
+        return;
+    }
+    stream->setRecvWindow(stream->getRecvWindow() - len);
+
+    size_t begin = 0;
+    size_t end = len;
+    if(frame->header.hasFlag(PADDED)) {
+        if(len < 1 || (uint8_t)frame->data[0] >= len) {
+            connectionError(Http2Error::PROTOCOL_ERROR, "invalid padding");
+            return;
+        }
+        begin = 1;
+        end -= (uint8_t)frame->data[0];
+    }
+    std::string& body = stream->getBody();
+    if(body.size() + end - begin > http::HttpRequestParser::GetHttpRequestMaxBodySize()) {
+        streamError(id, Http2Error::CANCEL);
+        return;
+    }
+    body.append(frame->data, begin, end - begin);
+
+    if(frame->header.hasFlag(END_STREAM)) {
+        {
+            Mutex::Lock lock(m_windowMutex);
+            stream->setState(Http2Stream::HALF_CLOSED_REMOTE);
+        }
+        dispatch(stream);
+        return;
+    }
+    stream->setRecvUnacked(stream->getRecvUnacked() + len);
+    if(stream->getRecvUnacked() >= m_initialWindow / 2) {
+        sendFrame(Frame::CreateWindowUpdate(id, stream->getRecvUnacked()));
+        stream->setRecvWindow(stream->getRecvWindow() + stream->getRecvUnacked());
+        stream->setRecvUnacked(0);
+    }
+}
+
+void Http2Session::handleHeaders(Frame::ptr frame) {
+    uint32_t id = frame->header.id;
+    if(id == 0 || (id & 1) == 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "invalid HEADERS stream id");
+        return;
+    }
+    const std::string& data = frame->data;
+    size_t begin = 0;
+    size_t end = data.size();
+    if(frame->header.hasFlag(PADDED)) {
+        if(end < 1 || (uint8_t)data[0] >= end) {
+            connectionError(Http2Error::PROTOCOL_ERROR, "invalid padding");
+            return;
+        }
+        begin = 1;
+        end -= (uint8_t)data[0];
+    }
+    if(frame->header.hasFlag(PRIORITY)) {
+        // 忽略优先级(依赖流ID + 权重)
+        if(end - begin < 5) {
+            connectionError(Http2Error::FRAME_SIZE_ERROR, "invalid HEADERS priority");
+            return;
+        }
+        begin += 5;
+    }
+    m_headerBlock.assign(data, begin, end - begin);
+    if(m_headerBlock.size() > m_maxHeaderListSize) {
+        connectionError(Http2Error::ENHANCE_YOUR_CALM, "header block too large");
+        return;
+    }
+    m_headerEndStream = frame->header.hasFlag(END_STREAM);
+    if(frame->header.hasFlag(END_HEADERS)) {
+        onHeaderBlock(id, m_headerEndStream);
+    } else {
+        m_headerStreamId = id;
+    }
+}
+
+void Http2Session::handleContinuation(Frame::ptr frame) {
+    if(m_headerStreamId == 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "unexpected CONTINUATION");
+        return;
+    }
+    m_headerBlock.append(frame->data);
+    if(m_headerBlock.size() > m_maxHeaderListSize) {
+        connectionError(Http2Error::ENHANCE_YOUR_CALM, "header block too large");
+        return;
+    }
+    if(frame->header.hasFlag(END_HEADERS)) {
+        m_headerStreamId = 0;
+        onHeaderBlock(frame->header.id, m_headerEndStream);
+    }
+}
+
+void Http2Session::onHeaderBlock(uint32_t id, bool end_stream) {
+    // 即使之后拒绝这个流也要解码，保持动态表和对端同步
+    std::vector<HeaderField> headers;
+    int rt = m_decoder.parse((const uint8_t*)m_headerBlock.c_str(), m_headerBlock.size(), headers
+                             ,s_header_table_size, m_maxHeaderListSize);
+    m_headerBlock.clear();
+    if(rt == -2) {
+        connectionError(Http2Error::ENHANCE_YOUR_CALM, "header list too large");
+        return;
+    } else if(rt) {
+        connectionError(Http2Error::COMPRESSION_ERROR);
+        return;
+    }
+
+    Http2Stream::ptr stream = getStream(id);
+    if(stream) {
+        // 请求尾部(trailers)，必须结束流，内容忽略
+        if(stream->isRemoteClosed()) {
+            connectionError(Http2Error::STREAM_CLOSED, "HEADERS on half-closed stream");
+        } else if(!end_stream) {
+            streamError(id, Http2Error::PROTOCOL_ERROR);
+        } else {
+            {
+                Mutex::Lock lock(m_windowMutex);
+                stream->setState(Http2Stream::HALF_CLOSED_REMOTE);
+            }
+            dispatch(stream);
+        }
+        return;
+    }
+    if(id <= m_lastStreamId) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "stream id not increasing");
+        return;
+    }
+    m_lastStreamId = id;
+    if(getStreamCount() >= m_maxConcurrentStreams) {
+        streamError(id, Http2Error::REFUSED_STREAM);
+        return;
+    }
+    http::HttpRequest::ptr req = buildRequest(headers);
+    if(!req) {
+        streamError(id, Http2Error::PROTOCOL_ERROR);
+        return;
+    }
+    {
+        Mutex::Lock lock(m_windowMutex);
+        stream = std::make_shared<Http2Stream>(id, m_peerInitialWindow, m_initialWindow);
+        stream->setState(end_stream ? Http2Stream::HALF_CLOSED_REMOTE : Http2Stream::OPEN);
+    }
+    stream->setRequest(req);
+    {
+        RWMutex::WriteLock lock(m_streamMutex);
+        m_streams[id] = stream;
+    }
+    if(end_stream) {
+        dispatch(stream);
+    }
+}
+
+http::HttpRequest::ptr Http2Session::buildRequest(const std::vector<HeaderField>& headers) {
+    http::HttpRequest::ptr req(new http::HttpRequest(0x20, false));
+    std::string method;
+    std::string scheme;
+    std::string authority;
+    std::string path;
+    std::string cookie;
+    bool regular = false;
+    for(auto& i : headers) {
+        if(i.name.empty()) {
+            return nullptr;
+        }
+        if(i.name[0] == ':') {
+            // 伪头部必须在普通头部之前，且不能重复
+            std::string* v = nullptr;
+            if(i.name == ":method") {
+                v = &method;
+            } else if(i.name == ":scheme") {
+                v = &scheme;
+            } else if(i.name == ":authority") {
+                v = &authority;
+            } else if(i.name == ":path") {
+                v = &path;
+            }
+            if(regular || !v || !v->empty()) {
+                return nullptr;
+            }
+            *v = i.value;
+            continue;
+        }
+        regular = true;
+        for(auto c : i.name) {
+            if(c >= 'A' && c <= 'Z') {
+                return nullptr;
+            }
+        }
+        // HTTP/2不允许连接相关的头部
+        if(i.name == "connection" || i.name == "keep-alive" || i.name == "proxy-connection"
+                || i.name == "transfer-encoding" || i.name == "upgrade"
+                || (i.name == "te" && i.value != "trailers")) {
+            return nullptr;
+        }
+        // 多个cookie头部合并(RFC 7540 8.1.2.5)
+        if(i.name == "cookie") {
+            if(!cookie.empty()) {
+                cookie.append("; ");
+            }
+            cookie.append(i.value);
+            continue;
+        }
+        std::string old;
+        if(req->hasHeader(i.name, &old)) {
+            req->setHeader(i.name, old + ", " + i.value);
+        } else {
+            req->setHeader(i.name, i.value);
+        }
+    }
+    if(method.empty() || scheme.empty() || path.empty()) {
+        return nullptr;
+    }
+    http::HttpMethod m = http::CharsToHttpMethod(method.c_str());
+    if(m == http::HttpMethod::INVALID_METHOD) {
+        return nullptr;
+    }
+    req->setMethod(m);
+
+    size_t pos = path.find('#');
+    if(pos != std::string::npos) {
+        req->setFragment(path.substr(pos + 1));
+        path.resize(pos);
+    }
+    pos = path.find('?');
+    if(pos != std::string::npos) {
+        req->setQuery(path.substr(pos + 1));
+        path.resize(pos);
+    }
+    req->setPath(path);
+    if(!authority.empty() && !req->hasHeader("host")) {
+        req->setHeader("host", authority);
+    }
+    if(!cookie.empty()) {
+        req->setHeader("cookie", cookie);
+    }
+    return req;
+}
+
+void Http2Session::handleSettings(Frame::ptr frame) {
+    if(frame->header.id != 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "SETTINGS on stream");
+        return;
+    }
+    if(frame->header.hasFlag(ACK)) {
+        if(!frame->data.empty()) {
+            connectionError(Http2Error::FRAME_SIZE_ERROR, "SETTINGS ack with payload");
+        }
+        return;
+    }
+    if(frame->data.size() % 6) {
+        connectionError(Http2Error::FRAME_SIZE_ERROR, "invalid SETTINGS length");
+        return;
+    }
+    Http2Error error = applySettings(frame->data);
+    if(error != Http2Error::NO_ERROR) {
+        connectionError(error, "invalid SETTINGS");
+        return;
+    }
+    sendFrame(Frame::CreateSettingsAck());
+}
+
+Http2Error Http2Session::applySettings(const std::string& data) {
+    for(size_t i = 0; i + 6 <= data.size(); i += 6) {
+        uint16_t id = ((uint8_t)data[i] << 8) | (uint8_t)data[i + 1];
+        uint32_t value = get_uint32(&data[i + 2]);
+        switch((SettingsId)id) {
+            case SettingsId::HEADER_TABLE_SIZE:
+                {
+                    // 编码端可以使用不超过对端上限的任意大小
+                    Mutex::Lock lock(m_sendMutex);
+                    m_encoder.setMaxTableSize(std::min(value, 4096u));
+                }
+                break;
+            case SettingsId::ENABLE_PUSH:
+                if(value > 1) {
+                    return Http2Error::PROTOCOL_ERROR;
+                }
+                break;
+            case SettingsId::INITIAL_WINDOW_SIZE:
+                {
+                    if(value > MAX_WINDOW_SIZE) {
+                        return Http2Error::FLOW_CONTROL_ERROR;
+                    }
+                    // 已有流的发送窗口按差值调整(RFC 7540 6.9.2)
+                    Mutex::Lock lock(m_windowMutex);
+                    int64_t delta = (int64_t)value - m_peerInitialWindow;
+                    m_peerInitialWindow = value;
+                    RWMutex::ReadLock lock2(m_streamMutex);
+                    for(auto& s : m_streams) {
+                        int64_t w = s.second->getSendWindow() + delta;
+                        if(w > MAX_WINDOW_SIZE) {
+                            return Http2Error::FLOW_CONTROL_ERROR;
+                        }
+                        s.second->setSendWindow(w);
+                        if(delta > 0) {
+                            s.second->wakeup();
+                        }
+                    }
+                }
+                break;
+            case SettingsId::MAX_FRAME_SIZE:
+                {
+                    if(value < 16384 || value > 0xffffff) {
+                        return Http2Error::PROTOCOL_ERROR;
+                    }
+                    Mutex::Lock lock(m_windowMutex);
+                    m_peerMaxFrameSize = value;
+                }
+                break;
+            default:
+                // MAX_CONCURRENT_STREAMS只限制服务端推送，不需要处理；未知参数忽略
+                break;
+        }
+    }
+    return Http2Error::NO_ERROR;
+}
+
+void Http2Session::handlePing(Frame::ptr frame) {
+    if(frame->header.id != 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "PING on stream");
+        return;
+    }
+    if(frame->data.size() != 8) {
+        connectionError(Http2Error::FRAME_SIZE_ERROR, "invalid PING length");
+        return;
+    }
+    if(!frame->header.hasFlag(ACK)) {
+        sendFrame(Frame::CreatePing(true, frame->data));
+    }
+}
+
+void Http2Session::handleRstStream(Frame::ptr frame) {
+    uint32_t id = frame->header.id;
+    if(id == 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "RST_STREAM on stream 0");
+        return;
+    }
+    if(frame->data.size() != 4) {
+        connectionError(Http2Error::FRAME_SIZE_ERROR, "invalid RST_STREAM length");
+        return;
+    }
+    Http2Stream::ptr stream = getStream(id);
+    if(!stream) {
+        if(id > m_lastStreamId) {
+            connectionError(Http2Error::PROTOCOL_ERROR, "RST_STREAM on idle stream");
+        }
+        return;
+    }
+    SYLAR_LOG_DEBUG(g_logger) << "http2 stream reset by peer " << stream->toString()
+        << " error=" << Http2ErrorToString((Http2Error)get_uint32(frame->data.c_str()));
+    {
+        Mutex::Lock lock(m_windowMutex);
+        stream->setState(Http2Stream::CLOSED);
+        stream->wakeup();
+    }
+    delStream(id);
+}
+
+void Http2Session::handleWindowUpdate(Frame::ptr frame) {
+    uint32_t id = frame->header.id;
+    if(frame->data.size() != 4) {
+        connectionError(Http2Error::FRAME_SIZE_ERROR, "invalid WINDOW_UPDATE length");
+        return;
+    }
+    uint32_t increment = get_uint32(frame->data.c_str()) & 0x7fffffff;
+    if(id == 0) {
+        if(increment == 0) {
+            connectionError(Http2Error::PROTOCOL_ERROR, "WINDOW_UPDATE increment 0");
+            return;
+        }
+        Mutex::Lock lock(m_windowMutex);
+        m_sendWindow += increment;
+        if(m_sendWindow > MAX_WINDOW_SIZE) {
+            lock.unlock();
+            connectionError(Http2Error::FLOW_CONTROL_ERROR, "connection window overflow");
+            return;
+        }
+        wakeupAll();
+        return;
+    }
+
+    Http2Stream::ptr stream = getStream(id);
+    if(!stream) {
+        return;
+    }
+    if(increment == 0) {
+        streamError(id, Http2Error::PROTOCOL_ERROR);
+        return;
+    }
+    Mutex::Lock lock(m_windowMutex);
+    int64_t w = stream->getSendWindow() + increment;
+    if(w > MAX_WINDOW_SIZE) {
+        lock.unlock();
+        streamError(id, Http2Error::FLOW_CONTROL_ERROR);
+        return;
+    }
+    stream->setSendWindow(w);
+    stream->wakeup();
+}
+
+void Http2Session::handleGoAway(Frame::ptr frame) {
+    if(frame->header.id != 0) {
+        connectionError(Http2Error::PROTOCOL_ERROR, "GOAWAY on stream");
+        return;
+    }
+    if(frame->data.size() < 8) {
+        connectionError(Http2Error::FRAME_SIZE_ERROR, "invalid GOAWAY length");
+        return;
+    }
+    m_peerGoaway = true;
+    SYLAR_LOG_DEBUG(g_logger) << "http2 peer goaway last_stream_id="
+        << (get_uint32(frame->data.c_str()) & 0x7fffffff)
+        << " error=" << Http2ErrorToString((Http2Error)get_uint32(frame->data.c_str() + 4))
+        << " " << this;
+}
+
+void Http2Session::dispatch(Http2Stream::ptr stream) {
+    if(!stream->getBody().empty()) {
+        stream->getRequest()->setBody(stream->getBody());
+        std::string().swap(stream->getBody());
+    }
+    m_worker->schedule(std::bind(&Http2Session::handleRequest
+                , std::dynamic_pointer_cast<Http2Session>(shared_from_this()), stream));
+}
+
+void Http2Session::handleRequest(Http2Stream::ptr stream) {
+    http::HttpRequest::ptr req = stream->getRequest();
+    http::HttpResponse::ptr rsp(new http::HttpResponse(0x20, false));
+    if(m_requestHandler) {
+        m_requestHandler(req, rsp);
+    } else {
+        rsp->setStatus(http::HttpStatus::NOT_FOUND);
+    }
+    {
+        Mutex::Lock lock(m_windowMutex);
+        if(stream->getState() == Http2Stream::CLOSED) {
+            return;
+        }
+    }
+
+    std::vector<HeaderField> headers;
+    headers.emplace_back(":status", std::to_string((int)rsp->getStatus()));
+    for(auto& i : rsp->getHeaders()) {
+        std::string name = sylar::ToLower(i.first.toString());
+        if(name == "connection" || name == "keep-alive" || name == "proxy-connection"
+                || name == "transfer-encoding" || name == "upgrade") {
+            continue;
+        }
+        headers.emplace_back(name, i.second.toString());
+    }
+    for(auto& i : rsp->getCookies()) {
+        headers.emplace_back("set-cookie", i);
+    }
+    const std::string& body = rsp->getBody();
+    if(!body.empty() && rsp->getHeader("content-length").empty()) {
+        headers.emplace_back("content-length", std::to_string(body.size()));
+    }
+    bool end_stream = body.empty() || req->getMethod() == http::HttpMethod::HEAD;
+    sendHeaders(stream->getId(), headers, end_stream);
+    if(!end_stream) {
+        sendData(stream, body);
+    }
+    {
+        Mutex::Lock lock(m_windowMutex);
+        stream->setState(Http2Stream::CLOSED);
+    }
+    delStream(stream->getId());
+}
+
+void Http2Session::sendHeaders(uint32_t id, const std::vector<HeaderField>& headers, bool end_stream) {
+    uint32_t max_size = 16384;
+    {
+        Mutex::Lock lock(m_windowMutex);
+        max_size = m_peerMaxFrameSize;
+    }
+    FrameSendCtx::ptr ctx(new FrameSendCtx);
+    // 编码和入队在同一把锁下，对端按入队顺序解码
+    Mutex::Lock lock(m_sendMutex);
+    std::string block;
+    m_encoder.pack(headers, block);
+    size_t pos = 0;
+    do {
+        size_t n = std::min((size_t)max_size, block.size() - pos);
+        uint8_t flags = (pos + n == block.size()) ? END_HEADERS : 0;
+        if(pos == 0 && end_stream) {
+            flags |= END_STREAM;
+        }
+        ctx->frames.push_back(std::make_shared<Frame>(pos == 0 ? FrameType::HEADERS
+                    : FrameType::CONTINUATION, flags, id, block.substr(pos, n)));
+        pos += n;
+    } while(pos < block.size());
+    enqueue(ctx);
+}
+
+bool Http2Session::sendData(Http2Stream::ptr stream, const std::string& body) {
+    size_t pos = 0;
+    while(pos < body.size()) {
+        int64_t n = 0;
+        {
+            Mutex::Lock lock(m_windowMutex);
+            if(stream->getState() == Http2Stream::CLOSED || !isConnected()) {
+                return false;
+            }
+            n = std::min(m_sendWindow, stream->getSendWindow());
+            n = std::min(n, (int64_t)m_peerMaxFrameSize);
+            n = std::min(n, (int64_t)(body.size() - pos));
+            if(n > 0) {
+                m_sendWindow -= n;
+                stream->setSendWindow(stream->getSendWindow() - n);
+            } else {
+                stream->setWaiting();
+            }
+        }
+        if(n <= 0) {
+            // 等待WINDOW_UPDATE、SETTINGS、RST_STREAM或者连接断开
+            stream->wait();
+            continue;
+        }
+        bool last = pos + n == body.size();
+        sendFrame(std::make_shared<Frame>(FrameType::DATA, last ? END_STREAM : 0
+                    , stream->getId(), body.substr(pos, n)));
+        pos += n;
+    }
+    return true;
+}
+
+}
+}
@@ -0,0 +1,218 @@
+/**
+ * @file http2_session.h
+ * @brief HTTP/2服务端会话
+ * @details 建立在AsyncSocketStream之上: 读协程解析帧，发送统一经过写队列，
+ *          请求在worker上处理，多个流的响应在同一个连接上交错发送。
+ *          不支持服务端推送，忽略优先级
+ */
+#ifndef __SYLAR_HTTP2_HTTP2_SESSION_H__
+#define __SYLAR_HTTP2_HTTP2_SESSION_H__
+
+#include "sylar/streams/async_socket_stream.h"
+#include "frame.h"
+#include "hpack.h"
+#include "http2_stream.h"
+#include <functional>
+
+namespace sylar {
+namespace http2 {
+
+/**
+ * @brief HTTP/2服务端会话
+ */
+class Http2Session : public AsyncSocketStream {
+public:
+    typedef std::shared_ptr<Http2Session> ptr;
+    typedef std::function<void(http::HttpRequest::ptr, http::HttpResponse::ptr)> request_handler;
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock 连接
+     * @param[in] init_data 已经从连接上读出的数据(HTTP/1.1解析缓冲区中的剩余部分)，先于socket读取
+     */
+    Http2Session(Socket::ptr sock, const std::string& init_data = "");
+    ~Http2Session();
+
+    /**
+     * @brief 发送本端SETTINGS，启动读写协程
+     */
+    virtual bool start() override;
+
+    /**
+     * @brief 等待连接结束(读协程退出)
+     */
+    void waitFinish() { m_finish.wait();}
+
+    /**
+     * @brief 设置请求处理函数，在worker上调用
+     */
+    void setRequestHandler(request_handler v) { m_requestHandler = v;}
+
+    /**
+     * @brief h2c升级(RFC 7540 3.2): 升级前的HTTP/1.1请求作为流1，需要在start之前调用
+     * @param[in] req 升级请求
+     * @param[in] settings 解码后的HTTP2-Settings请求头
+     * @return settings格式错误返回false
+     */
+    bool upgrade(http::HttpRequest::ptr req, const std::string& settings);
+
+    /**
+     * @brief 当前活跃的流数量
+     */
+    size_t getStreamCount();
+
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 是否启用HTTP/2(http2.enable)
+     */
+    static bool IsEnabled();
+protected:
+    /**
+     * @brief 发送帧的上下文，frames按顺序写出
+     */
+    struct FrameSendCtx : public SendCtx {
+        typedef std::shared_ptr<FrameSendCtx> ptr;
+        std::vector<Frame::ptr> frames;
+        /// 写完后关闭连接(GOAWAY)
+        bool close = false;
+
+        virtual bool doSend(AsyncSocketStream::ptr stream) override;
+        virtual bool canBatch() const override { return true;}
+        virtual bool doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) override;
+    };
+
+    virtual Ctx::ptr doRecv() override;
+    virtual void doRead() override;
+private:
+    void sendFrame(Frame::ptr frame);
+
+    /**
+     * @brief 连接错误: 发送GOAWAY后关闭连接，之后收到的帧全部丢弃
+     */
+    void connectionError(Http2Error error, const std::string& debug = "");
+
+    /**
+     * @brief 流错误: 发送RST_STREAM并关闭流
+     */
+    void streamError(uint32_t id, Http2Error error);
+
+    /**
+     * @brief 应用SETTINGS负载
+     */
+    Http2Error applySettings(const std::string& data);
+
+    void handleFrame(Frame::ptr frame);
+    void handleData(Frame::ptr frame);
+    void handleHeaders(Frame::ptr frame);
+    void handleContinuation(Frame::ptr frame);
+    void handleSettings(Frame::ptr frame);
+    void handlePing(Frame::ptr frame);
+    void handleRstStream(Frame::ptr frame);
+    void handleWindowUpdate(Frame::ptr frame);
+    void handleGoAway(Frame::ptr frame);
+
+    /**
+     * @brief 头部块接收完整(HEADERS + CONTINUATION)
+     */
+    void onHeaderBlock(uint32_t id, bool end_stream);
+
+    /**
+     * @brief 由头部字段生成请求，伪头部不合法时返回nullptr
+     */
+    http::HttpRequest::ptr buildRequest(const std::vector<HeaderField>& headers);
+
+    Http2Stream::ptr getStream(uint32_t id);
+    void delStream(uint32_t id);
+
+    /**
+     * @brief 对端发送END_STREAM，在worker上处理请求
+     */
+    void dispatch(Http2Stream::ptr stream);
+
+    /**
+     * @brief 处理请求并发送响应(worker)
+     */
+    void handleRequest(Http2Stream::ptr stream);
+
+    /**
+     * @brief 发送响应头，HEADERS超过对端最大帧大小时拆分出CONTINUATION
+     */
+    void sendHeaders(uint32_t id, const std::vector<HeaderField>& headers, bool end_stream);
+
+    /**
+     * @brief 按流量控制窗口发送DATA
+     * @return 流被重置或连接断开返回false
+     */
+    bool sendData(Http2Stream::ptr stream, const std::string& body);
+
+    /**
+     * @brief 唤醒所有等待发送窗口的流
+     */
+    void wakeupAll();
+private:
+    /// 读缓冲区，构造时放入init_data，之后批量从socket读取，避免每个帧头一次系统调用
+    std::vector<char> m_readBuf;
+    /// 读缓冲区中已消费的位置
+    size_t m_readOffset = 0;
+    /// 读缓冲区中有效数据的长度
+    size_t m_readSize = 0;
+    /// 是否已经读到连接前言
+    bool m_prefaceDone = false;
+    /// 是否已经发送GOAWAY
+    bool m_goaway = false;
+    /// 对端是否已经发送GOAWAY
+    bool m_peerGoaway = false;
+    /// 连接结束
+    FiberSemaphore m_finish;
+    /// 请求处理函数
+    request_handler m_requestHandler;
+
+    /// 解码用的索引表，只在读协程中使用
+    DynamicTable m_recvTable;
+    HPack m_decoder;
+    /// 编码用的索引表，编码和入队在m_sendMutex下进行，保证头部块的顺序
+    DynamicTable m_sendTable;
+    HPack m_encoder;
+    Mutex m_sendMutex;
+
+    /// 正在接收的头部块所属的流，0表示没有
+    uint32_t m_headerStreamId = 0;
+    /// 正在接收的头部块是否带END_STREAM
+    bool m_headerEndStream = false;
+    /// 正在接收的头部块
+    std::string m_headerBlock;
+
+    /// 活跃的流
+    std::unordered_map<uint32_t, Http2Stream::ptr> m_streams;
+    RWMutex m_streamMutex;
+    /// 对端创建的最大流ID
+    uint32_t m_lastStreamId = 0;
+    /// h2c升级时的流1
+    Http2Stream::ptr m_upgradeStream;
+
+    /// 窗口锁，保护连接和所有流的发送窗口、流状态以及对端SETTINGS
+    Mutex m_windowMutex;
+    /// 连接发送窗口
+    int64_t m_sendWindow = 65535;
+    /// 连接接收窗口
+    int64_t m_recvWindow = 65535;
+    /// 连接上未归还的接收字节数
+    uint32_t m_recvUnacked = 0;
+
+    /// 对端SETTINGS
+    uint32_t m_peerInitialWindow = 65535;
+    uint32_t m_peerMaxFrameSize = 16384;
+    /// 本端SETTINGS
+    uint32_t m_maxConcurrentStreams;
+    uint32_t m_initialWindow;
+    uint32_t m_connectionWindow;
+    uint32_t m_maxFrameSize;
+    uint32_t m_maxHeaderListSize;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "http2_stream.h"
+#include <sstream>
+
+namespace sylar {
+namespace http2 {
+
+Http2Stream::Http2Stream(uint32_t id, int64_t send_window, int64_t recv_window)
+    :m_id(id)
+    ,m_sendWindow(send_window)
+    ,m_recvWindow(recv_window) {
+}
+
+void Http2Stream::wakeup() {
+    if(m_waiting) {
+        m_waiting = false;
+        m_sem.notify();
+    }
+}
+
+const char* Http2Stream::StateToString(State s) {
+    switch(s) {
+        case IDLE: return "IDLE";
+        case OPEN: return "OPEN";
+        case HALF_CLOSED_LOCAL: return "HALF_CLOSED_LOCAL";
+        case HALF_CLOSED_REMOTE: return "HALF_CLOSED_REMOTE";
+        case CLOSED: return "CLOSED";
+        default: return "UNKNOWN";
+    }
+}
+
+std::string Http2Stream::toString() const {
+    std::stringstream ss;
+    ss << "[Http2Stream id=" << m_id
+       << " state=" << StateToString(m_state)
+       << " send_window=" << m_sendWindow
+       << " recv_window=" << m_recvWindow
+       << "]";
+    return ss.str();
+}
+
+}
+}
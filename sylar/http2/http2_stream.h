@@ -0,0 +1,114 @@
+/**
+ * @file http2_stream.h
+ * @brief HTTP/2流(RFC 7540 第5章)
+ */
+#ifndef __SYLAR_HTTP2_HTTP2_STREAM_H__
+#define __SYLAR_HTTP2_HTTP2_STREAM_H__
+
+#include "sylar/http/http.h"
+#include "sylar/mutex.h"
+#include <memory>
+
+namespace sylar {
+namespace http2 {
+
+/**
+ * @brief HTTP/2流
+ * @details 发送窗口和状态由Http2Session在它的窗口锁下读写，接收窗口只在读协程中使用
+ */
+class Http2Stream {
+public:
+    typedef std::shared_ptr<Http2Stream> ptr;
+
+    /**
+     * @brief 流状态(服务端不发送PUSH_PROMISE，没有reserved状态)
+     */
+    enum State {
+        IDLE,
+        OPEN,
+        HALF_CLOSED_LOCAL,
+        HALF_CLOSED_REMOTE,
+        CLOSED,
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] id 流ID
+     * @param[in] send_window 发送窗口(对端的SETTINGS_INITIAL_WINDOW_SIZE)
+     * @param[in] recv_window 接收窗口(本端的SETTINGS_INITIAL_WINDOW_SIZE)
+     */
+    Http2Stream(uint32_t id, int64_t send_window, int64_t recv_window);
+
+    uint32_t getId() const { return m_id;}
+
+    State getState() const { return m_state;}
+    void setState(State v) { m_state = v;}
+
+    /**
+     * @brief 对端是否已经发送END_STREAM
+     */
+    bool isRemoteClosed() const { return m_state == HALF_CLOSED_REMOTE || m_state == CLOSED;}
+
+    http::HttpRequest::ptr getRequest() const { return m_request;}
+    void setRequest(http::HttpRequest::ptr v) { m_request = v;}
+
+    /**
+     * @brief 请求消息体
+     */
+    std::string& getBody() { return m_body;}
+
+    int64_t getSendWindow() const { return m_sendWindow;}
+    void setSendWindow(int64_t v) { m_sendWindow = v;}
+
+    int64_t getRecvWindow() const { return m_recvWindow;}
+    void setRecvWindow(int64_t v) { m_recvWindow = v;}
+
+    /**
+     * @brief 已接收但还没有通过WINDOW_UPDATE归还的字节数
+     */
+    uint32_t getRecvUnacked() const { return m_recvUnacked;}
+    void setRecvUnacked(uint32_t v) { m_recvUnacked = v;}
+
+    /**
+     * @brief 标记正在等待发送窗口，之后由wakeup唤醒
+     */
+    void setWaiting() { m_waiting = true;}
+
+    /**
+     * @brief 唤醒等待发送窗口的协程
+     */
+    void wakeup();
+
+    /**
+     * @brief 等待wakeup
+     */
+    void wait() { m_sem.wait();}
+
+    std::string toString() const;
+
+    static const char* StateToString(State s);
+private:
+    /// 流ID
+    uint32_t m_id;
+    /// 状态
+    State m_state = IDLE;
+    /// 请求
+    http::HttpRequest::ptr m_request;
+    /// 请求消息体
+    std::string m_body;
+    /// 发送窗口，对端调小SETTINGS_INITIAL_WINDOW_SIZE时可能为负
+    int64_t m_sendWindow;
+    /// 接收窗口
+    int64_t m_recvWindow;
+    /// 未归还的接收字节数
+    uint32_t m_recvUnacked = 0;
+    /// 是否有协程在等待发送窗口
+    bool m_waiting = false;
+    /// 等待发送窗口的信号量
+    FiberSemaphore m_sem;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file huffman.h
+ * @brief HPACK Huffman编码(RFC 7541 附录B)
+ */
+#ifndef __SYLAR_HTTP2_HUFFMAN_H__
+#define __SYLAR_HTTP2_HUFFMAN_H__
+
+#include <string>
+#include <stdint.h>
+
+namespace sylar {
+namespace http2 {
+
+/**
+ * @brief HPACK Huffman编解码
+ */
+class Huffman {
+public:
+    /**
+     * @brief 编码后的长度(字节)
+     */
+    static size_t EncodeLen(const std::string& str);
+
+    /**
+     * @brief 编码，结果追加到out
+     */
+    static void EncodeString(const std::string& str, std::string& out);
+
+    /**
+     * @brief 解码，结果追加到out
+     * @return 填充不合法或者包含EOS时返回false
+     */
+    static bool DecodeString(const uint8_t* data, size_t len, std::string& out);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include "io_uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+
+namespace sylar {
+
+#ifdef SYLAR_HAS_IO_URING
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+int IoUring::init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(entries, &p);
+    if(fd < 0) {
+        return -errno;
+    }
+    m_fd = fd;
+    m_sqEntries = p.sq_entries;
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                    ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return -errno;
+    }
+    if(single) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return -errno;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                      ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return -errno;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + p.sq_off.head);
+    m_sqTail = (unsigned*)(sq + p.sq_off.tail);
+    m_sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqArray = (unsigned*)(sq + p.sq_off.array);
+    m_sqFlags = (unsigned*)(sq + p.sq_off.flags);
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + p.cq_off.head);
+    m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+    m_cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    m_sqeHead = m_sqeTail = *m_sqTail;
+    return 0;
+}
+
+uint32_t IoUring::sqSpace() const {
+    return m_sqEntries - (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE));
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(m_sqeTail - head >= m_sqEntries) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & *m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submit() {
+    return submitAndWait(0);
+}
+
+int IoUring::submitAndWait(uint32_t wait_nr) {
+    unsigned mask = *m_sqMask;
+    unsigned tail = *m_sqTail;
+    while(m_sqeHead != m_sqeTail) {
+        m_sqArray[tail & mask] = m_sqeHead & mask;
+        ++tail;
+        ++m_sqeHead;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+    // 上次没有被内核接收完的也一起提交
+    unsigned to_submit = tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(!to_submit && !wait_nr) {
+        return 0;
+    }
+    int rt = sys_io_uring_enter(m_fd, to_submit, wait_nr
+                                ,wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    return rt < 0 ? -errno : rt;
+}
+
+io_uring_cqe* IoUring::peekCqe() {
+    unsigned head = *m_cqHead;
+    if(head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &m_cqes[head & *m_cqMask];
+}
+
+void IoUring::cqeSeen() {
+    __atomic_store_n(m_cqHead, *m_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+bool IoUring::cqOverflow() const {
+    return __atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW;
+}
+
+int IoUring::flushOverflow() {
+    int rt = sys_io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    return rt < 0 ? -errno : rt;
+}
+
+int IoUring::registerBuffers(const iovec* iovs, unsigned count) {
+    int rt = sys_io_uring_register(m_fd, IORING_REGISTER_BUFFERS, iovs, count);
+    return rt < 0 ? -errno : 0;
+}
+
+int IoUring::registerEventfd(int fd) {
+    int rt = sys_io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &fd, 1);
+    return rt < 0 ? -errno : 0;
+}
+
+#else
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+}
+
+int IoUring::init(uint32_t entries) {
+    return -ENOSYS;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    return nullptr;
+}
+
+int IoUring::submit() {
+    return -ENOSYS;
+}
+
+int IoUring::submitAndWait(uint32_t wait_nr) {
+    return -ENOSYS;
+}
+
+io_uring_cqe* IoUring::peekCqe() {
+    return nullptr;
+}
+
+void IoUring::cqeSeen() {
+}
+
+uint32_t IoUring::sqSpace() const {
+    return 0;
+}
+
+bool IoUring::cqOverflow() const {
+    return false;
+}
+
+int IoUring::flushOverflow() {
+    return -ENOSYS;
+}
+
+int IoUring::registerBuffers(const iovec* iovs, unsigned count) {
+    return -ENOSYS;
+}
+
+int IoUring::registerEventfd(int fd) {
+    return -ENOSYS;
+}
+
+#endif
+
+}
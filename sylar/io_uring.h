@@ -0,0 +1,148 @@
+/**
+ * @file io_uring.h
+ * @brief io_uring 封装
+ * @author zq
+ * @details 直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用，不依赖liburing。
+ *          只封装IOManager用到的部分：获取SQE、批量提交、取CQE、注册缓冲区和eventfd。
+ *          该类本身不加锁，由使用者保证SQ只有一个生产者、CQ只有一个消费者。
+ */
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "noncopyable.h"
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#       define SYLAR_HAS_IO_URING 1
+#   endif
+#endif
+
+#ifdef SYLAR_HAS_IO_URING
+#include <linux/io_uring.h>
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace sylar {
+
+/**
+ * @brief io_uring 实例
+ */
+class IoUring : Noncopyable {
+public:
+    IoUring();
+    ~IoUring();
+
+    /**
+     * @brief 创建io_uring实例
+     * @param[in] entries SQ的大小
+     * @return 成功返回0，失败返回-errno(内核不支持、被禁用等)
+     */
+    int init(uint32_t entries);
+
+    /**
+     * @brief 是否创建成功
+     */
+    bool isValid() const { return m_fd >= 0;}
+
+    /**
+     * @brief 获取一个空闲的SQE，已经清零
+     * @return SQ已满时返回nullptr，需要先submit
+     */
+    io_uring_sqe* getSqe();
+
+    /**
+     * @brief 已经获取但还没有提交给内核的SQE数量
+     */
+    uint32_t pendingSubmit() const { return m_sqeTail - m_sqeHead;}
+
+    /**
+     * @brief SQ中还能获取的SQE数量
+     */
+    uint32_t sqSpace() const;
+
+    /**
+     * @brief 将获取的SQE提交给内核
+     * @return 内核接收的数量，失败返回-errno
+     */
+    int submit();
+
+    /**
+     * @brief 提交获取的SQE，并等待至少wait_nr个CQE完成
+     * @return 内核接收的数量，失败返回-errno
+     */
+    int submitAndWait(uint32_t wait_nr);
+
+    /**
+     * @brief 取一个完成的CQE
+     * @return 没有时返回nullptr，处理完之后必须调用cqeSeen
+     */
+    io_uring_cqe* peekCqe();
+
+    /**
+     * @brief 标记peekCqe返回的CQE已经处理完
+     */
+    void cqeSeen();
+
+    /**
+     * @brief CQ是否溢出
+     * @details 内核支持IORING_FEAT_NODROP时溢出的CQE暂存在内核中，需要调用flushOverflow取回
+     */
+    bool cqOverflow() const;
+
+    /**
+     * @brief 让内核把溢出的CQE放回CQ
+     * @return 失败返回-errno
+     */
+    int flushOverflow();
+
+    /**
+     * @brief 注册固定缓冲区，之后可以使用IORING_OP_READ_FIXED/WRITE_FIXED
+     * @return 成功返回0，失败返回-errno
+     */
+    int registerBuffers(const iovec* iovs, unsigned count);
+
+    /**
+     * @brief 注册eventfd，有CQE完成时eventfd可读
+     * @return 成功返回0，失败返回-errno
+     */
+    int registerEventfd(int fd);
+private:
+    /// io_uring 句柄
+    int m_fd = -1;
+    /// SQ大小
+    uint32_t m_sqEntries = 0;
+
+    /// SQ环形缓冲区的映射
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    /// CQ环形缓冲区的映射，内核支持IORING_FEAT_SINGLE_MMAP时与SQ共享
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    /// SQE数组的映射
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqMask = nullptr;
+    unsigned* m_sqArray = nullptr;
+    unsigned* m_sqFlags = nullptr;
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+
+    /// 已经提交到SQ环的位置
+    uint32_t m_sqeHead = 0;
+    /// 已经获取的位置
+    uint32_t m_sqeTail = 0;
+};
+
+}
+
+#endif
@@ -1,10 +1,14 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
+#include "util.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -12,6 +16,33 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+/// IO后端，epoll 或 io_uring，创建IOManager时读取
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>("iomanager.backend", "epoll", "iomanager backend, epoll or io_uring");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring.entries", 256, "io_uring submission queue entries");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_batch =
+    Config::Lookup<uint32_t>("iomanager.io_uring.batch", 32, "io_uring submit immediately when pending sqes reach this count");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_buffers =
+    Config::Lookup<uint32_t>("iomanager.io_uring.buffers", 0, "io_uring registered buffer count");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_buffer_size =
+    Config::Lookup<uint32_t>("iomanager.io_uring.buffer_size", 16 * 1024, "io_uring registered buffer size");
+
+struct IOManager::IoOp {
+    /// 完成后唤醒的调度器
+    Scheduler* scheduler = nullptr;
+    /// 等待完成的协程
+    Fiber::ptr fiber;
+    /// 操作的fd上下文
+    FdContext* fd_ctx = nullptr;
+    /// CQE的结果
+    int res = 0;
+};
+
 enum EpollCtlOp {
 };
 
@@ -93,8 +124,8 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) {     //先执行Scheduler的构造函数
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name, bool work_stealing)
+    :Scheduler(threads, use_caller, name, work_stealing) {     //先执行Scheduler的构造函数
 
     // 创建内核事件表
     m_epfd = epoll_create(5000);
@@ -123,6 +154,10 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     SYLAR_ASSERT(!rt);
 
     contextResize(32);
+
+    if(g_iomanager_backend->getValue() == "io_uring") {
+        initIoUring();
+    }
     SYLAR_LOG_DEBUG(g_logger)<<"IOManager() end";
     start();
 }
@@ -133,6 +168,14 @@ IOManager::~IOManager() {
     close(m_tickleFds[0]);
     close(m_tickleFds[1]);
 
+    if(m_ring) {
+        delete m_ring;
+        close(m_ringEventFd);
+    }
+    if(m_ringBuffers) {
+        munmap(m_ringBuffers, m_ringBufferSize * m_ringBufferCount);
+    }
+
     for(size_t i = 0; i < m_fdContexts.size(); ++i) {
         if(m_fdContexts[i]) {
             delete m_fdContexts[i];
@@ -140,6 +183,111 @@ IOManager::~IOManager() {
     }
 }
 
+#ifdef SYLAR_HAS_IO_URING
+/// 按fd取消操作的CQE的user_data，IoOp的地址不会是这个值
+static const uint64_t s_cancel_user_data = 1;
+
+/**
+ * @brief 检查内核是否支持IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL
+ * @details 在没有操作的fd上取消一次，旧内核不认识这些标志，返回-EINVAL
+ */
+static bool ProbeCancelFd(IoUring* ring, int fd) {
+    io_uring_sqe* sqe = ring->getSqe();
+    if(!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = s_cancel_user_data;
+    if(ring->submitAndWait(1) < 0) {
+        return false;
+    }
+    io_uring_cqe* cqe = ring->peekCqe();
+    if(!cqe) {
+        return false;
+    }
+    int res = cqe->res;
+    ring->cqeSeen();
+    return res >= 0 || res == -ENOENT;
+}
+#endif
+
+void IOManager::initIoUring() {
+#ifdef SYLAR_HAS_IO_URING
+    IoUring* ring = new IoUring;
+    int rt = ring->init(g_io_uring_entries->getValue());
+    if(rt) {
+        SYLAR_LOG_WARN(g_logger) << "IOManager name=" << getName() << " io_uring init fail, rt="
+            << rt << " (" << strerror(-rt) << "), fallback to epoll";
+        delete ring;
+        return;
+    }
+
+    // 完成事件通过eventfd通知，eventfd和其他socket一起由epoll等待
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // close时靠按fd取消来唤醒io_uring中的操作，内核不支持(5.19以下)时操作会一直挂起
+    if(efd >= 0 && !ProbeCancelFd(ring, efd)) {
+        SYLAR_LOG_WARN(g_logger) << "IOManager name=" << getName()
+            << " io_uring cancel by fd not supported, fallback to epoll";
+        close(efd);
+        delete ring;
+        return;
+    }
+    if(efd < 0 || ring->registerEventfd(efd)) {
+        SYLAR_LOG_WARN(g_logger) << "IOManager name=" << getName()
+            << " io_uring register eventfd fail, fallback to epoll";
+        if(efd >= 0) {
+            close(efd);
+        }
+        delete ring;
+        return;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = efd;
+    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, efd, &event);
+    SYLAR_ASSERT(!rt);
+
+    uint32_t count = g_io_uring_buffers->getValue();
+    size_t size = g_io_uring_buffer_size->getValue();
+    if(count && size) {
+        void* mem = mmap(nullptr, count * size, PROT_READ | PROT_WRITE
+                         ,MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem != MAP_FAILED) {
+            std::vector<iovec> iovs(count);
+            for(uint32_t i = 0; i < count; ++i) {
+                iovs[i].iov_base = (char*)mem + i * size;
+                iovs[i].iov_len = size;
+            }
+            rt = ring->registerBuffers(&iovs[0], count);
+            if(rt) {
+                SYLAR_LOG_WARN(g_logger) << "IOManager name=" << getName()
+                    << " io_uring register buffers fail, rt=" << rt
+                    << " (" << strerror(-rt) << ") count=" << count << " size=" << size;
+                munmap(mem, count * size);
+            } else {
+                m_ringBuffers = (char*)mem;
+                m_ringBufferSize = size;
+                m_ringBufferCount = count;
+                for(int i = count - 1; i >= 0; --i) {
+                    m_freeBuffers.push_back(i);
+                }
+            }
+        }
+    }
+
+    m_ringEventFd = efd;
+    m_ringBatch = std::max(g_io_uring_batch->getValue(), (uint32_t)1);
+    m_ring = ring;
+    SYLAR_LOG_INFO(g_logger) << "IOManager name=" << getName() << " use io_uring backend";
+#else
+    SYLAR_LOG_WARN(g_logger) << "IOManager name=" << getName()
+        << " io_uring not supported, fallback to epoll";
+#endif
+}
+
 void IOManager::contextResize(size_t size) {
     m_fdContexts.resize(size);
 
@@ -151,19 +299,21 @@ void IOManager::contextResize(size_t size) {
     }
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
+IOManager::FdContext* IOManager::getFdContext(int fd) {
     RWMutexType::ReadLock lock(m_mutex);
     if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } 
-    else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
+        return m_fdContexts[fd];
+    }
+    lock.unlock();
+    RWMutexType::WriteLock lock2(m_mutex);
+    if((int)m_fdContexts.size() <= fd) {
         contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
     }
+    return m_fdContexts[fd];
+}
+
+int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+    FdContext* fd_ctx = getFdContext(fd);
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
 
@@ -298,6 +448,11 @@ bool IOManager::cancelAll(int fd) {
     FdContext* fd_ctx = m_fdContexts[fd];
     lock.unlock();
 
+    // io_uring中的操作持有文件引用，close不会让它们返回，需要主动取消
+    if(m_ring && fd_ctx->ringOps) {
+        cancelIoUring(fd);
+    }
+
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(!fd_ctx->events) {
         return false;
@@ -329,6 +484,220 @@ bool IOManager::cancelAll(int fd) {
     return true;
 }
 
+int IOManager::asyncIO(const io_uring_sqe* sqe, uint64_t timeout_ms) {
+#ifdef SYLAR_HAS_IO_URING
+    if(!m_ring) {
+        return -ENOSYS;
+    }
+    Fiber::ptr fiber = Fiber::GetThis();
+    // 共享栈协程挂起后栈内容会被换出，内核不能异步写它栈上的缓冲区
+    if(fiber->isSharedStack()) {
+        return -EAGAIN;
+    }
+
+    IoOp op;
+    op.scheduler = Scheduler::GetThis();
+    op.fd_ctx = sqe->fd >= 0 ? getFdContext(sqe->fd) : nullptr;
+    bool has_timeout = timeout_ms != ~0ull;
+    __kernel_timespec ts;
+    uint64_t start = 0;
+    if(has_timeout) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = timeout_ms % 1000 * 1000000;
+        start = GetCurrentMS();
+    }
+    uint32_t need = has_timeout ? 2 : 1;
+
+    bool need_tickle = false;
+    {
+        Spinlock::Lock lock(m_sqMutex);
+        if(m_ring->sqSpace() < need) {
+            m_ring->submit();
+            if(m_ring->sqSpace() < need) {
+                return -EAGAIN;
+            }
+        }
+        op.fiber = fiber;
+        fiber.reset();
+        if(op.fd_ctx) {
+            ++op.fd_ctx->ringOps;
+        }
+        ++m_pendingEventCount;
+
+        io_uring_sqe* s = m_ring->getSqe();
+        *s = *sqe;
+        s->user_data = (uint64_t)&op;
+        if(has_timeout) {
+            // 超时由内核处理，超时后操作以-ECANCELED完成
+            s->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* t = m_ring->getSqe();
+            t->opcode = IORING_OP_LINK_TIMEOUT;
+            t->fd = -1;
+            t->addr = (uint64_t)&ts;
+            t->len = 1;
+            t->user_data = 0;
+        }
+
+        // 积攒到一定数量立即提交，否则等线程进入idle时再批量提交
+        uint32_t pending = m_ring->pendingSubmit();
+        if(pending >= m_ringBatch) {
+            int rt = m_ring->submit();
+            if(rt < 0 && rt != -EAGAIN && rt != -EBUSY && rt != -EINTR) {
+                SYLAR_LOG_ERROR(g_logger) << "io_uring submit fail, rt=" << rt
+                    << " (" << strerror(-rt) << ")";
+            }
+        } else if(pending == need) {
+            need_tickle = true;
+        }
+    }
+    // 让空闲的线程去提交
+    if(need_tickle) {
+        tickle();
+    }
+
+    Fiber::YieldToHold();
+
+    if(op.res == -ECANCELED && has_timeout
+            && GetCurrentMS() - start >= timeout_ms) {
+        return -ETIMEDOUT;
+    }
+    return op.res;
+#else
+    return -ENOSYS;
+#endif
+}
+
+void IOManager::submitIoUring() {
+    Spinlock::Lock lock(m_sqMutex);
+    if(!m_ring->pendingSubmit()) {
+        return;
+    }
+    int rt = m_ring->submit();
+    if(rt < 0 && rt != -EAGAIN && rt != -EBUSY && rt != -EINTR) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring submit fail, rt=" << rt
+            << " (" << strerror(-rt) << ")";
+    }
+}
+
+size_t IOManager::reapIoUring() {
+    size_t count = 0;
+#ifdef SYLAR_HAS_IO_URING
+    Spinlock::Lock lock(m_cqMutex);
+    while(true) {
+        io_uring_cqe* cqe = nullptr;
+        while((cqe = m_ring->peekCqe())) {
+            IoOp* op = (IoOp*)cqe->user_data;
+            int res = cqe->res;
+            m_ring->cqeSeen();
+            // 链接的超时操作，忽略
+            if(!op) {
+                continue;
+            }
+            // 按fd取消的结果，成功时是取消的操作数
+            if(cqe->user_data == s_cancel_user_data) {
+                if(res < 0 && res != -ENOENT) {
+                    SYLAR_LOG_ERROR(g_logger) << "io_uring cancel fail, res=" << res
+                        << " (" << strerror(-res) << ")";
+                }
+                continue;
+            }
+            // op在协程栈上，协程被唤醒之后就不能再访问
+            Scheduler* scheduler = op->scheduler;
+            Fiber::ptr fiber;
+            fiber.swap(op->fiber);
+            if(op->fd_ctx) {
+                --op->fd_ctx->ringOps;
+            }
+            op->res = res;
+            --m_pendingEventCount;
+            scheduler->schedule(&fiber);
+            ++count;
+        }
+        if(!m_ring->cqOverflow()) {
+            break;
+        }
+        m_ring->flushOverflow();
+    }
+#endif
+    return count;
+}
+
+void IOManager::cancelIoUring(int fd) {
+#ifdef SYLAR_HAS_IO_URING
+    Spinlock::Lock lock(m_sqMutex);
+    io_uring_sqe* sqe = m_ring->getSqe();
+    if(!sqe) {
+        m_ring->submit();
+        sqe = m_ring->getSqe();
+        if(!sqe) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring cancel fd=" << fd << " fail, sq full";
+            return;
+        }
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = s_cancel_user_data;
+    // 必须在fd关闭之前提交
+    int rt = m_ring->submit();
+    if(rt < 0 && rt != -EAGAIN && rt != -EBUSY && rt != -EINTR) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring cancel fd=" << fd << " submit fail, rt="
+            << rt << " (" << strerror(-rt) << ")";
+    }
+#endif
+}
+
+int IOManager::acquireBuffer(void** buf, size_t* len) {
+    Spinlock::Lock lock(m_bufMutex);
+    if(m_freeBuffers.empty() || !m_ringBuffers) {
+        return -1;
+    }
+    int idx = m_freeBuffers.back();
+    m_freeBuffers.pop_back();
+    *buf = m_ringBuffers + idx * m_ringBufferSize;
+    *len = m_ringBufferSize;
+    return idx;
+}
+
+void IOManager::releaseBuffer(int idx) {
+    Spinlock::Lock lock(m_bufMutex);
+    m_freeBuffers.push_back(idx);
+}
+
+int IOManager::readFixed(int fd, int idx, void* buf, size_t len
+                         ,int64_t offset, uint64_t timeout_ms) {
+#ifdef SYLAR_HAS_IO_URING
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ_FIXED;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)buf;
+    sqe.len = len;
+    sqe.off = offset;
+    sqe.buf_index = idx;
+    return asyncIO(&sqe, timeout_ms);
+#else
+    return -ENOSYS;
+#endif
+}
+
+int IOManager::writeFixed(int fd, int idx, const void* buf, size_t len
+                          ,int64_t offset, uint64_t timeout_ms) {
+#ifdef SYLAR_HAS_IO_URING
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE_FIXED;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)buf;
+    sqe.len = len;
+    sqe.off = offset;
+    sqe.buf_index = idx;
+    return asyncIO(&sqe, timeout_ms);
+#else
+    return -ENOSYS;
+#endif
+}
+
 IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
@@ -402,6 +771,19 @@ void IOManager::idle() {
                 next_timeout = MAX_TIMEOUT;
             }
 
+            // 进入idle之前已经有协程注入(此时投递者可能看不到空闲线程而没有tickle)，不阻塞
+            if(hasInjectedTasks()) {
+                next_timeout = 0;
+            }
+
+            // 阻塞之前把积攒的SQE提交给内核，提交时就完成的操作(如socket缓冲区未满的send)直接收割，不再阻塞
+            if(m_ring) {
+                submitIoUring();
+                if(reapIoUring()) {
+                    next_timeout = 0;
+                }
+            }
+
             /*  
              * 阻塞在这里，但有3中情况能够唤醒epoll_wait
              * 1. 超时时间到了  
@@ -438,6 +820,13 @@ void IOManager::idle() {
                 continue;
             }
 
+            // io_uring有操作完成，下面统一收割
+            if(m_ring && event.data.fd == m_ringEventFd) {
+                uint64_t dummy;
+                while(read(m_ringEventFd, &dummy, sizeof(dummy)) > 0);
+                continue;
+            }
+
             // 获取事件的上下文
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
@@ -491,6 +880,10 @@ void IOManager::idle() {
             }
         }
 
+        if(m_ring) {
+            reapIoUring();
+        }
+
         Fiber::ptr cur = Fiber::GetThis();
         auto raw_ptr = cur.get();
         cur.reset();
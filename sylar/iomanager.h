@@ -1,6 +1,6 @@
 /**
  * @file iomanager.h
- * @brief 基于Epoll的IO协程调度器
+ * @brief 基于Epoll的IO协程调度器，可选io_uring后端
  * @author zq
  */
 #ifndef __SYLAR_IOMANAGER_H__
@@ -8,6 +8,7 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include "io_uring.h"
 
 namespace sylar {
 
@@ -77,16 +78,23 @@ private:
         Event events = NONE;
         /// 事件的Mutex
         MutexType mutex;
+        /// 正在io_uring中执行的操作数量，close时需要取消
+        std::atomic<int> ringOps = {0};
     };
 
+    /// 一个提交到io_uring的操作，保存在发起协程的栈上
+    struct IoOp;
+
 public:
     /**
      * @brief 构造函数
      * @param[in] threads 线程数量
      * @param[in] use_caller 是否将当前线程也作为调度线程，即如果为true，调度协程在main函数所在的线程，如果为false，则调度协程在一个新开的线程中。即是否将main线程也参与执行任务
      * @param[in] name 调度器的名称
+     * @param[in] work_stealing 是否启用工作窃取模式，参考Scheduler
      */
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+              ,bool work_stealing = false);
 
     /**
      * @brief 析构函数
@@ -126,6 +134,54 @@ public:
      */
     bool cancelAll(int fd);
 
+    /**
+     * @brief 是否使用io_uring后端
+     * @details 由配置iomanager.backend决定，io_uring不可用时回退到epoll
+     */
+    bool isIoUring() const { return m_ring != nullptr;}
+
+    /**
+     * @brief 通过io_uring执行一个IO操作，挂起当前协程直到完成
+     * @param[in] sqe 已经填好的SQE，会被拷贝，user_data由IOManager设置
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 返回CQE的结果，失败返回-errno，超时返回-ETIMEDOUT
+     * @attention 非io_uring后端返回-ENOSYS；SQ已满或当前是共享栈协程返回-EAGAIN，调用者应回退到epoll
+     */
+    int asyncIO(const io_uring_sqe* sqe, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 申请一块注册到io_uring的固定缓冲区
+     * @param[out] buf 缓冲区地址
+     * @param[out] len 缓冲区大小
+     * @return 返回缓冲区下标，没有空闲缓冲区返回-1
+     */
+    int acquireBuffer(void** buf, size_t* len);
+
+    /**
+     * @brief 归还固定缓冲区
+     * @param[in] idx acquireBuffer返回的下标
+     */
+    void releaseBuffer(int idx);
+
+    /**
+     * @brief 使用固定缓冲区读(IORING_OP_READ_FIXED)
+     * @param[in] fd 文件句柄
+     * @param[in] idx 缓冲区下标
+     * @param[in] buf 读入的位置，必须在缓冲区idx内
+     * @param[in] len 读取的长度
+     * @param[in] offset 文件偏移，-1表示当前位置
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 同asyncIO
+     */
+    int readFixed(int fd, int idx, void* buf, size_t len
+                  ,int64_t offset = -1, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 使用固定缓冲区写(IORING_OP_WRITE_FIXED)，参数同readFixed
+     */
+    int writeFixed(int fd, int idx, const void* buf, size_t len
+                   ,int64_t offset = -1, uint64_t timeout_ms = ~0ull);
+
     /**
      * @brief 返回当前的IOManager
      */
@@ -167,6 +223,32 @@ protected:
      * @return 返回是否可以停止
      */
     bool stopping(uint64_t& timeout);
+private:
+    /**
+     * @brief 获取fd的上下文，不存在则扩容
+     */
+    FdContext* getFdContext(int fd);
+
+    /**
+     * @brief 初始化io_uring后端，失败时保持epoll
+     */
+    void initIoUring();
+
+    /**
+     * @brief 将积攒的SQE提交给内核
+     */
+    void submitIoUring();
+
+    /**
+     * @brief 处理io_uring中完成的操作，唤醒对应的协程
+     * @return 唤醒的协程数量
+     */
+    size_t reapIoUring();
+
+    /**
+     * @brief 取消fd上所有正在io_uring中执行的操作
+     */
+    void cancelIoUring(int fd);
 private:
     /// epoll 文件句柄，即内核事件表句柄
     int m_epfd = 0;
@@ -178,6 +260,27 @@ private:
     RWMutexType m_mutex;
     /// socket事件上下文的容器
     std::vector<FdContext*> m_fdContexts;
+
+    /// io_uring实例，为空表示使用epoll
+    IoUring* m_ring = nullptr;
+    /// 注册到io_uring的eventfd，有完成事件时在epoll中可读
+    int m_ringEventFd = -1;
+    /// 达到该数量的SQE立即提交，否则在线程进入idle时批量提交
+    uint32_t m_ringBatch = 32;
+    /// 保护SQ
+    Spinlock m_sqMutex;
+    /// 保护CQ
+    Spinlock m_cqMutex;
+    /// 固定缓冲区
+    char* m_ringBuffers = nullptr;
+    /// 每个固定缓冲区的大小
+    size_t m_ringBufferSize = 0;
+    /// 固定缓冲区的数量
+    size_t m_ringBufferCount = 0;
+    /// 空闲的固定缓冲区下标
+    std::vector<int> m_freeBuffers;
+    /// 保护m_freeBuffers
+    Spinlock m_bufMutex;
 };
 
 }
@@ -4,6 +4,12 @@
 #include <functional>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/uio.h>
+#include <algorithm>
 #include "config.h"
 #include "util.h"
 #include "macro.h"
@@ -53,12 +59,13 @@ LogLevel::Level LogLevel::FromString(const std::string& str) {
 }
 
 LogEventWrap::LogEventWrap(LogEvent::ptr e)
-    :m_event(e) {
+    :m_event(std::move(e)) {
 }
 
 LogEventWrap::~LogEventWrap() {
     // 获取日志器->调用日志器的log来进行写入
     m_event->getLogger()->log(m_event->getLevel(), m_event);
+    LogEvent::Recycle(m_event);
 }
 
 void LogEvent::format(const char* fmt, ...) {
@@ -69,18 +76,82 @@ void LogEvent::format(const char* fmt, ...) {
 }
 
 void LogEvent::format(const char* fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
+    // 大部分日志放得进栈上的缓冲区，放不下时才分配
+    char buf[512];
+    va_list ap;
+    va_copy(ap, al);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if(len < 0) {
+        return;
+    }
+    if(len < (int)sizeof(buf)) {
+        m_ss.write(buf, len);
+        return;
+    }
+    char* p = nullptr;
+    len = vasprintf(&p, fmt, al);
     if(len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+        m_ss.write(p, len);
+        free(p);
     }
 }
 
-std::stringstream& LogEventWrap::getSS() {
+LogStream& LogEventWrap::getSS() {
     return m_event->getSS();
 }
 
+LogStream::Buffer::Buffer(size_t capacity)
+    :m_data(capacity ? capacity : 1) {
+    reset();
+}
+
+void LogStream::Buffer::grow(size_t n) {
+    size_t used = size();
+    size_t cap = m_data.size() * 2;
+    while(cap < used + n) {
+        cap *= 2;
+    }
+    m_data.resize(cap);
+    setp(&m_data[0], &m_data[0] + cap);
+    pbump(used);
+}
+
+int LogStream::Buffer::overflow(int c) {
+    if(c == traits_type::eof()) {
+        return traits_type::not_eof(c);
+    }
+    grow(1);
+    *pptr() = c;
+    pbump(1);
+    return c;
+}
+
+std::streamsize LogStream::Buffer::xsputn(const char* s, std::streamsize n) {
+    if(epptr() - pptr() < n) {
+        grow(n);
+    }
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+}
+
+LogStream::LogStream(size_t capacity)
+    :std::ostream(nullptr)
+    ,m_buf(capacity) {
+    rdbuf(&m_buf);
+}
+
+void LogStream::reset() {
+    m_buf.reset();
+    std::ostream::clear();
+    // 上一次使用者可能修改了格式(std::hex等)
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    precision(6);
+    width(0);
+    fill(' ');
+}
+
 
 void LogAppender::setFormatter(LogFormatter::ptr val) {
     MutexType::Lock lock(m_mutex);
@@ -105,7 +176,7 @@ public:
      * @brief 重写继承自FormatItem的format，将Message输出至流os中
      */
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
+        os.write(event->getContentData(), event->getContentSize());
     }
 };
 
@@ -157,25 +228,41 @@ public:
     }
 };
 
+static std::atomic<uint64_t> s_datetime_item_id {0};
+
 class DateTimeFormatItem : public LogFormatter::FormatItem {
 public:
     DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format) {
+        :m_format(format)
+        ,m_id(++s_datetime_item_id) {
         if(m_format.empty()) {
             m_format = "%Y-%m-%d %H:%M:%S";
         }
     }
 
     void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        struct tm tm;
+        // 时间精度是秒，同一秒内复用上次格式化的结果
+        struct Cache {
+            uint64_t id;
+            time_t time;
+            size_t len;
+            char buf[64];
+        };
+        static thread_local Cache t_cache = {0, 0, 0, {0}};
         time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        if(t_cache.id != m_id || t_cache.time != time) {
+            struct tm tm;
+            localtime_r(&time, &tm);
+            t_cache.len = strftime(t_cache.buf, sizeof(t_cache.buf), m_format.c_str(), &tm);
+            t_cache.id = m_id;
+            t_cache.time = time;
+        }
+        os.write(t_cache.buf, t_cache.len);
     }
 private:
     std::string m_format;
+    /// 唯一id，用于线程缓存的校验
+    uint64_t m_id;
 };
 
 class FilenameFormatItem : public LogFormatter::FormatItem {
@@ -240,6 +327,69 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
     ,m_level(level) {
 }
 
+namespace {
+
+/**
+ * @brief 线程缓存的日志事件
+ */
+struct LogEventCache {
+    ~LogEventCache();
+    std::vector<LogEvent::ptr> events;
+};
+
+/// 缓存已经析构(线程退出阶段的日志不再使用缓存)
+static thread_local bool t_event_cache_dead = false;
+static thread_local LogEventCache t_event_cache;
+/// 每个线程最多缓存的日志事件，嵌套日志(在<<中又写日志)时才会用到多个
+static const size_t s_max_cached_events = 8;
+
+LogEventCache::~LogEventCache() {
+    t_event_cache_dead = true;
+}
+
+}
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name) {
+    if(t_event_cache_dead || t_event_cache.events.empty()) {
+        return LogEvent::ptr(new LogEvent(logger, level, file, line, elapse
+                    ,thread_id, fiber_id, time, thread_name));
+    }
+    LogEvent::ptr event = std::move(t_event_cache.events.back());
+    t_event_cache.events.pop_back();
+    event->m_file = file;
+    event->m_line = line;
+    event->m_elapse = elapse;
+    event->m_threadId = thread_id;
+    event->m_fiberId = fiber_id;
+    event->m_time = time;
+    event->m_threadName = thread_name;
+    event->m_ss.reset();
+    event->m_logger = logger;
+    event->m_level = level;
+    return event;
+}
+
+void LogEvent::Recycle(LogEvent::ptr& event) {
+    // 被appender等持有的事件不能复用
+    if(t_event_cache_dead || !event || event.use_count() != 1) {
+        event.reset();
+        return;
+    }
+    auto& events = t_event_cache.events;
+    if(events.size() >= s_max_cached_events) {
+        event.reset();
+        return;
+    }
+    if(events.capacity() < s_max_cached_events) {
+        events.reserve(s_max_cached_events);
+    }
+    event->m_logger.reset();
+    events.push_back(std::move(event));
+}
+
 Logger::Logger(const std::string& name)
     :m_name(name)
     ,m_level(LogLevel::DEBUG) {
@@ -429,18 +579,360 @@ std::string StdoutLogAppender::toYamlString() {
     return ss.str();
 }
 
+/**
+ * @brief 单生产者单消费者的字节环形缓冲区
+ * @details head只由所属线程推进，tail只由持有m_drainMutex的消费者推进。
+ *          记录按整条写入后才推进head，所以[tail, head)总是完整的记录，最多分成两段。
+ */
+struct AsyncLogAppender::Buffer {
+    Buffer(size_t size)
+        :data(new char[size])
+        ,size(size) {
+    }
+
+    ~Buffer() {
+        delete[] data;
+    }
+
+    size_t used() const {
+        return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire);
+    }
+
+    bool push(const char* str, size_t len) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if(size - (h - tail.load(std::memory_order_acquire)) < len) {
+            return false;
+        }
+        size_t pos = h & (size - 1);
+        size_t n = std::min(len, size - pos);
+        memcpy(data + pos, str, n);
+        if(n < len) {
+            memcpy(data, str + n, len - n);
+        }
+        head.store(h + len, std::memory_order_release);
+        return true;
+    }
+
+    char* data;
+    size_t size;
+    /// 所属线程已经退出
+    std::atomic<bool> closed {false};
+    /// 所属Appender已经析构
+    std::atomic<bool> orphan {false};
+    char pad0[64];
+    /// 写入位置，生产者推进
+    std::atomic<uint64_t> head {0};
+    char pad1[64];
+    /// 读取位置，消费者推进
+    std::atomic<uint64_t> tail {0};
+};
+
+static std::atomic<uint64_t> s_async_appender_id {0};
+
+AsyncLogAppender::AsyncLogAppender(const std::string& filename, size_t buffer_size
+                                   ,Overflow overflow, uint32_t flush_interval)
+    :m_filename(filename)
+    ,m_bufferSize(1024)
+    ,m_overflow(overflow)
+    ,m_flushInterval(flush_interval ? flush_interval : 1)
+    ,m_id(++s_async_appender_id) {
+    while(m_bufferSize < buffer_size) {
+        m_bufferSize <<= 1;
+    }
+    reopen();
+    m_lastTime = time(0);
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "async_log"));
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    m_stopping = true;
+    m_sem.notify();
+    m_thread->join();
+
+    Spinlock::Lock lock(m_buffersMutex);
+    for(auto& i : m_buffers) {
+        i->orphan = true;
+    }
+    m_buffers.clear();
+    lock.unlock();
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+AsyncLogAppender::Buffer* AsyncLogAppender::getBuffer() {
+    // 线程退出时标记缓冲区，由后台线程写完后回收
+    static thread_local bool t_dead = false;
+    struct LocalBuffers {
+        std::vector<std::pair<uint64_t, std::shared_ptr<Buffer> > > list;
+        ~LocalBuffers() {
+            for(auto& i : list) {
+                i.second->closed.store(true, std::memory_order_release);
+            }
+            t_dead = true;
+        }
+    };
+    if(t_dead) {
+        return nullptr;
+    }
+    static thread_local LocalBuffers t_buffers;
+
+    auto& list = t_buffers.list;
+    for(auto& i : list) {
+        if(i.first == m_id) {
+            return i.second.get();
+        }
+    }
+
+    for(auto it = list.begin(); it != list.end();) {
+        if(it->second->orphan) {
+            it = list.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::shared_ptr<Buffer> buf(new Buffer(m_bufferSize));
+    list.push_back(std::make_pair(m_id, buf));
+    Spinlock::Lock lock(m_buffersMutex);
+    m_buffers.push_back(buf);
+    return buf.get();
+}
+
+void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if(level < m_level) {
+        return;
+    }
+    // 格式化到线程局部的流中，不分配内存
+    static thread_local LogStream t_ss(1024);
+    t_ss.reset();
+    getFormatter()->format(t_ss, logger, level, event);
+    const char* str = t_ss.data();
+    size_t len = t_ss.size();
+    Buffer* buf = getBuffer();
+
+    if(!buf || len > buf->size) {
+        // 放不进缓冲区的超长日志，或者线程正在退出，先写完之前的，保证顺序
+        Mutex::Lock lock(m_drainMutex);
+        drain();
+        if(m_fd >= 0 && write(m_fd, str, len) < 0) {
+            std::cout << "AsyncLogAppender write " << m_filename << " error: "
+                      << strerror(errno) << std::endl;
+        }
+    } else {
+        while(!buf->push(str, len)) {
+            if(m_overflow != BLOCK) {
+                ++m_dropped;
+                return;
+            }
+            if(!m_notified.exchange(true)) {
+                m_sem.notify();
+            }
+            sched_yield();
+        }
+        if(buf->used() > buf->size / 2 && !m_notified.exchange(true)) {
+            m_sem.notify();
+        }
+    }
+
+    if(level == LogLevel::FATAL) {
+        flush();
+    }
+}
+
+void AsyncLogAppender::flush() {
+    Mutex::Lock lock(m_drainMutex);
+    drain();
+    if(m_fd >= 0) {
+        fdatasync(m_fd);
+    }
+}
+
+void AsyncLogAppender::run() {
+    while(!m_stopping) {
+        m_sem.waitFor(m_flushInterval);
+        m_notified = false;
+        Mutex::Lock lock(m_drainMutex);
+        drain();
+    }
+    Mutex::Lock lock(m_drainMutex);
+    drain();
+}
+
+static void writev_all(int fd, struct iovec* iov, int cnt, const std::string& filename) {
+    while(cnt > 0) {
+        ssize_t rt = writev(fd, iov, cnt);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cout << "AsyncLogAppender writev " << filename << " error: "
+                      << strerror(errno) << std::endl;
+            return;
+        }
+        size_t n = rt;
+        while(cnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+size_t AsyncLogAppender::drain() {
+    uint64_t now = time(0);
+    if(now >= m_lastTime + 3) {
+        reopen();
+        m_lastTime = now;
+    }
+
+    // 持有m_drainMutex，线程局部不会被其他线程使用
+    static thread_local std::vector<std::shared_ptr<Buffer> > t_list;
+    {
+        Spinlock::Lock lock(m_buffersMutex);
+        for(auto it = m_buffers.begin(); it != m_buffers.end();) {
+            // 先看closed再看数据，closed之后不会再有新数据
+            if((*it)->closed.load(std::memory_order_acquire) && !(*it)->used()) {
+                it = m_buffers.erase(it);
+            } else {
+                t_list.push_back(*it);
+                ++it;
+            }
+        }
+    }
+
+    static const int MAX_IOV = 64;
+    struct iovec iov[MAX_IOV];
+    std::pair<Buffer*, uint64_t> tails[MAX_IOV / 2];
+    int niov = 0;
+    int ntail = 0;
+    size_t total = 0;
+
+    auto commit = [&]() {
+        if(niov && m_fd >= 0) {
+            writev_all(m_fd, iov, niov, m_filename);
+        }
+        for(int i = 0; i < ntail; ++i) {
+            tails[i].first->tail.store(tails[i].second, std::memory_order_release);
+        }
+        niov = 0;
+        ntail = 0;
+    };
+
+    std::string dropped;
+    uint64_t drop = m_dropped;
+    if(m_overflow == COUNT && drop != m_reported) {
+        dropped = "AsyncLogAppender dropped " + std::to_string(drop - m_reported)
+                  + " log records\n";
+        m_reported = drop;
+        iov[niov].iov_base = (void*)dropped.c_str();
+        iov[niov].iov_len = dropped.size();
+        ++niov;
+        total += dropped.size();
+    }
+
+    for(auto& buf : t_list) {
+        uint64_t tail = buf->tail.load(std::memory_order_relaxed);
+        uint64_t head = buf->head.load(std::memory_order_acquire);
+        if(tail == head) {
+            continue;
+        }
+        if(niov + 2 > MAX_IOV) {
+            commit();
+        }
+        size_t pos = tail & (buf->size - 1);
+        size_t len = head - tail;
+        size_t n = std::min(len, buf->size - pos);
+        iov[niov].iov_base = buf->data + pos;
+        iov[niov].iov_len = n;
+        ++niov;
+        if(n < len) {
+            iov[niov].iov_base = buf->data;
+            iov[niov].iov_len = len - n;
+            ++niov;
+        }
+        tails[ntail++] = std::make_pair(buf.get(), head);
+        total += len;
+    }
+    commit();
+    t_list.clear();
+    return total;
+}
+
+bool AsyncLogAppender::reopen() {
+    int fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        FSUtil::Mkdir(FSUtil::Dirname(m_filename));
+        fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if(fd < 0) {
+        std::cout << "AsyncLogAppender open " << m_filename << " error: "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = fd;
+    return true;
+}
+
+std::string AsyncLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "AsyncLogAppender";
+    node["file"] = m_filename;
+    node["buffer_size"] = m_bufferSize;
+    node["overflow"] = OverflowToString(m_overflow);
+    node["flush_interval"] = m_flushInterval;
+    if(m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if(m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+AsyncLogAppender::Overflow AsyncLogAppender::OverflowFromString(const std::string& str) {
+    if(strcasecmp(str.c_str(), "drop") == 0) {
+        return DROP;
+    }
+    if(strcasecmp(str.c_str(), "count") == 0) {
+        return COUNT;
+    }
+    return BLOCK;
+}
+
+const char* AsyncLogAppender::OverflowToString(Overflow v) {
+    switch(v) {
+        case DROP:
+            return "drop";
+        case COUNT:
+            return "count";
+        default:
+            return "block";
+    }
+}
+
 LogFormatter::LogFormatter(const std::string& pattern)
     :m_pattern(pattern) { 
     init();
 }
 
 std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
+    static thread_local LogStream t_ss;
+    t_ss.reset();
     // 遍历每个日志项，依次调用各个日志项的format函数来进行输出
     for(auto& i : m_items) {
-        i->format(ss, logger, level, event);
+        i->format(t_ss, logger, level, event);
     }
-    return ss.str();
+    return t_ss.str();
 }
 
 std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
@@ -580,16 +1072,23 @@ Logger::ptr LoggerManager::getLogger(const std::string& name) {
 
 // 用来描述一个日志输出器LogAppender的配置
 struct LogAppenderDefine {
-    int type = 0; //1 File, 2 Stdout
+    int type = 0; //1 File, 2 Stdout, 3 Async
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string formatter;
     std::string file;
+    // 以下只用于AsyncLogAppender
+    uint64_t buffer_size = 64 * 1024;
+    AsyncLogAppender::Overflow overflow = AsyncLogAppender::BLOCK;
+    uint32_t flush_interval = 100;
 
     bool operator==(const LogAppenderDefine& oth) const {
         return type == oth.type
             && level == oth.level
             && formatter == oth.formatter
-            && file == oth.file;
+            && file == oth.file
+            && buffer_size == oth.buffer_size
+            && overflow == oth.overflow
+            && flush_interval == oth.flush_interval;
     }
 };
 
@@ -658,6 +1157,26 @@ public:
                     if(a["formatter"].IsDefined()) {
                         lad.formatter = a["formatter"].as<std::string>();
                     }
+                } else if(type == "AsyncLogAppender") {
+                    lad.type = 3;
+                    if(!a["file"].IsDefined()) {
+                        std::cout << "log config error: asyncappender file is null, " << a
+                              << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if(a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+                    if(a["buffer_size"].IsDefined()) {
+                        lad.buffer_size = a["buffer_size"].as<uint64_t>();
+                    }
+                    if(a["overflow"].IsDefined()) {
+                        lad.overflow = AsyncLogAppender::OverflowFromString(a["overflow"].as<std::string>());
+                    }
+                    if(a["flush_interval"].IsDefined()) {
+                        lad.flush_interval = a["flush_interval"].as<uint32_t>();
+                    }
                 } else if(type == "StdoutLogAppender") {
                     lad.type = 2;
                     if(a["formatter"].IsDefined()) {
@@ -696,6 +1215,12 @@ public:
                 na["file"] = a.file;
             } else if(a.type == 2) {
                 na["type"] = "StdoutLogAppender";
+            } else if(a.type == 3) {
+                na["type"] = "AsyncLogAppender";
+                na["file"] = a.file;
+                na["buffer_size"] = a.buffer_size;
+                na["overflow"] = AsyncLogAppender::OverflowToString(a.overflow);
+                na["flush_interval"] = a.flush_interval;
             }
             if(a.level != LogLevel::UNKNOW) {
                 na["level"] = LogLevel::ToString(a.level);
@@ -754,6 +1279,9 @@ struct LogIniter {
                         } else {
                             continue;
                         }
+                    } else if(a.type == 3) {
+                        ap.reset(new AsyncLogAppender(a.file, a.buffer_size
+                                    ,a.overflow, a.flush_interval));
                     }
                     ap->setLevel(a.level);
                     if(!a.formatter.empty()) {
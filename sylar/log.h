@@ -43,7 +43,7 @@
  * 我们使用是这样使用,首先定义logger： logger=SYLAR_LOG_ROOT()
  * 然后就可以调用对应的宏，SYLAR_LOG_INFO(logger)<<"test";
  * 接下来，对该宏进行一个展开
- * 1. 首先，new一个LogEvent对象，并且一个智能指针指向它，然后将这个LogEvent对象传入LogEventWrap的构造函数来构造一个LogEventWrap的临时对象
+ * 1. 首先，通过LogEvent::Create从线程缓存中取一个LogEvent对象(缓存为空时才new)，然后将这个LogEvent对象传入LogEventWrap的构造函数来构造一个LogEventWrap的临时对象
  * （为什么要这么做，具体见LogEventWrap的定义处）。
  * 2. 然后该临时对象会调用getSS()。在getSS()中，临时对象的LogEvent成员又会调用对应的getSS(),而在LogEvent的getSS()中，会获取已经写好的日志内容字符串流。
  * 3. 而该字符串流是什么时候写好的呢，是在临时对象析构时，即离开if语句之后会自动进行析构，并且调用Logger的log函数来进行写入。
@@ -54,9 +54,9 @@
 //使用流式方式将日志级别level的日志写入到logger
 #define SYLAR_LOG_LEVEL(logger, level) \
     if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
                         __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-                sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getSS()
+                sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getSS()
 
 //使用流式方式将日志写入到logger
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
@@ -73,9 +73,9 @@
 
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
     if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
                         __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-                sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+                sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getEvent()->format(fmt, __VA_ARGS__)
 
 //使用格式化方式将日志写入到logger
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
@@ -117,6 +117,56 @@ public:
     //static关键字表示该方法属于类本身，而非类的实例。可以通过类名直接调用，而无须new一个具体的对象再来进行调用。例如，LogLevel::ToString(LogLevel::DEBUG)获取DEBUG字符串
 };
 
+/**
+ * @brief 日志内容流
+ * @details 写入到自己管理的连续缓冲区中，clear之后保留容量，重复使用时不再分配内存。
+ *          可以直接取得内容的指针和长度，不需要像std::stringstream::str()一样拷贝。
+ */
+class LogStream : public std::ostream {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 初始容量
+     */
+    LogStream(size_t capacity = 256);
+
+    /**
+     * @brief 返回内容的起始地址，不以'\0'结尾
+     */
+    const char* data() const { return m_buf.data();}
+
+    /**
+     * @brief 返回内容长度
+     */
+    size_t size() const { return m_buf.size();}
+
+    /**
+     * @brief 返回内容的拷贝
+     */
+    std::string str() const { return std::string(data(), size());}
+
+    /**
+     * @brief 清空内容(保留容量)和错误状态
+     */
+    void reset();
+private:
+    class Buffer : public std::streambuf {
+    public:
+        Buffer(size_t capacity);
+        const char* data() const { return pbase();}
+        size_t size() const { return pptr() - pbase();}
+        void reset() { setp(&m_data[0], &m_data[0] + m_data.size());}
+    protected:
+        int overflow(int c) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+    private:
+        void grow(size_t n);
+    private:
+        std::vector<char> m_data;
+    };
+    Buffer m_buf;
+};
+
 /**
  * @brief 日志事件，用于记录日志现场信息，比如该日志的级别，文件名/行号，日志消息，线程/协程号，所属日志器名称等。
  */
@@ -139,6 +189,18 @@ public:
      */
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level ,const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string& thread_name);
 
+    /**
+     * @brief 从当前线程的缓存中取一个日志事件，参数同构造函数
+     * @details 缓存为空时才会分配，事件的内容流和线程名称都保留上次的容量，热路径上没有堆分配
+     */
+    static LogEvent::ptr Create(std::shared_ptr<Logger> logger, LogLevel::Level level ,const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string& thread_name);
+
+    /**
+     * @brief 把日志事件放回当前线程的缓存
+     * @details 只有没有被其他地方持有时才会放回，调用后event为空
+     */
+    static void Recycle(LogEvent::ptr& event);
+
     /**
      * @brief 返回文件名
      */
@@ -179,6 +241,16 @@ public:
      */
     std::string getContent() const { return m_ss.str();}
 
+    /**
+     * @brief 返回日志内容的起始地址，不以'\0'结尾
+     */
+    const char* getContentData() const { return m_ss.data();}
+
+    /**
+     * @brief 返回日志内容的长度
+     */
+    size_t getContentSize() const { return m_ss.size();}
+
     /**
      * @brief 返回日志器
      */
@@ -192,7 +264,7 @@ public:
     /**
      * @brief 返回日志内容字符串流
      */
-    std::stringstream& getSS() { return m_ss;}
+    LogStream& getSS() { return m_ss;}
 
     /**
      * @brief 格式化写入日志内容
@@ -219,7 +291,7 @@ private:
     /// 线程名称
     std::string m_threadName;
     /// 日志内容流
-    std::stringstream m_ss;
+    LogStream m_ss;
     /// 日志器
     std::shared_ptr<Logger> m_logger;
     /// 日志等级
@@ -254,7 +326,7 @@ public:
      * @brief 获取日志内容流
      * @attention 通过调用LogEvent的getSS()来将日志消息写入到字符串流中
      */
-    std::stringstream& getSS();
+    LogStream& getSS();
 
 private:
     /// 日志事件
@@ -579,6 +651,135 @@ private:
     uint64_t m_lastTime = 0;
 };
 
+/**
+ * @brief 异步输出到文件的Appender
+ * @details 调用线程只负责格式化，并把格式化后的记录拷贝到本线程独占的环形缓冲区(单生产者单消费者，无锁)。
+ *          后台线程定期或在缓冲区过半时把所有线程缓冲区中的数据用一次writev批量写入文件，
+ *          文件的定期重新打开也在后台线程中完成，调用线程不再受磁盘延迟影响。
+ *          FATAL级别的日志会在返回前同步刷盘。
+ */
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    /**
+     * @brief 缓冲区满时的处理策略
+     */
+    enum Overflow {
+        /// 等待后台线程腾出空间
+        BLOCK = 0,
+        /// 丢弃该条日志
+        DROP = 1,
+        /// 丢弃该条日志，并在文件中记录丢弃的条数
+        COUNT = 2
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] filename 日志文件路径
+     * @param[in] buffer_size 每个线程的缓冲区大小(字节)，向上取整到2的幂
+     * @param[in] overflow 缓冲区满时的处理策略
+     * @param[in] flush_interval 后台线程的刷盘间隔(毫秒)
+     */
+    AsyncLogAppender(const std::string& filename, size_t buffer_size = 64 * 1024
+                     ,Overflow overflow = BLOCK, uint32_t flush_interval = 100);
+
+    /**
+     * @brief 析构函数
+     * @details 停止后台线程，并写完缓冲区中剩余的日志
+     */
+    ~AsyncLogAppender();
+
+    /**
+     * @brief 格式化后放入当前线程的缓冲区
+     */
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+    std::string toYamlString() override;
+
+    /**
+     * @brief 同步写出所有缓冲区中的日志
+     */
+    void flush();
+
+    /**
+     * @brief 返回因缓冲区满而丢弃的日志条数
+     */
+    uint64_t getDropped() const { return m_dropped;}
+
+    /**
+     * @brief 返回溢出策略
+     */
+    Overflow getOverflow() const { return m_overflow;}
+
+    /**
+     * @brief 字符串转溢出策略，无法识别时返回BLOCK
+     */
+    static Overflow OverflowFromString(const std::string& str);
+
+    /**
+     * @brief 溢出策略转字符串
+     */
+    static const char* OverflowToString(Overflow v);
+private:
+    struct Buffer;
+
+    /**
+     * @brief 获取当前线程在该Appender上的缓冲区，第一次调用时创建
+     * @return 线程退出阶段(线程局部变量已经析构)返回nullptr
+     */
+    Buffer* getBuffer();
+
+    /**
+     * @brief 后台线程
+     */
+    void run();
+
+    /**
+     * @brief 把所有缓冲区中的数据写入文件
+     * @return 写入的字节数
+     */
+    size_t drain();
+
+    /**
+     * @brief 重新打开日志文件
+     */
+    bool reopen();
+private:
+    /// 文件路径
+    std::string m_filename;
+    /// 文件句柄
+    int m_fd = -1;
+    /// 每个线程缓冲区的大小
+    size_t m_bufferSize;
+    /// 溢出策略
+    Overflow m_overflow;
+    /// 刷盘间隔(毫秒)
+    uint32_t m_flushInterval;
+    /// 唯一id，线程局部的缓冲区表按id查找，避免地址复用
+    uint64_t m_id;
+    /// 所有线程的缓冲区
+    std::vector<std::shared_ptr<Buffer> > m_buffers;
+    /// m_buffers 的锁
+    Spinlock m_buffersMutex;
+    /// 同一时间只有一个消费者
+    Mutex m_drainMutex;
+    /// 唤醒后台线程
+    Semaphore m_sem;
+    /// 是否已经唤醒过后台线程，避免每条日志都notify
+    std::atomic<bool> m_notified {false};
+    /// 是否停止
+    std::atomic<bool> m_stopping {false};
+    /// 丢弃的条数
+    std::atomic<uint64_t> m_dropped {0};
+    /// 已经写入文件的丢弃条数
+    uint64_t m_reported = 0;
+    /// 上次重新打开时间(秒)
+    uint64_t m_lastTime = 0;
+    /// 后台线程
+    Thread::ptr m_thread;
+};
+
 /**
  * @brief 日志器管理类
  */
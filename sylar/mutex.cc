@@ -1,6 +1,9 @@
 #include "mutex.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "iomanager.h"
+#include <errno.h>
+#include <time.h>
 
 namespace sylar {
 
@@ -25,6 +28,28 @@ void Semaphore::wait() {
     }
 }
 
+bool Semaphore::waitFor(uint64_t ms) {
+    // sem_timedwait 使用CLOCK_REALTIME的绝对时间
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    while(sem_timedwait(&m_semaphore, &ts)) {
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno == ETIMEDOUT) {
+            return false;
+        }
+        throw std::logic_error("sem_timedwait error");
+    }
+    return true;
+}
+
 void Semaphore::notify() {
     // 释放信号量，增加信号量值。如果有线程因 wait 阻塞，将唤醒其中一个线程。
     if(sem_post(&m_semaphore)) {
@@ -65,6 +90,48 @@ void FiberSemaphore::wait() {
     Fiber::YieldToHold();
 }
 
+bool FiberSemaphore::wait(uint64_t timeout_ms) {
+    IOManager* iom = IOManager::GetThis();
+    if(timeout_ms == ~0ull || !iom) {
+        wait();
+        return true;
+    }
+    Fiber::ptr self = Fiber::GetThis();
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_concurrency > 0u) {
+            --m_concurrency;
+            return true;
+        }
+        if(!timeout_ms) {
+            return false;
+        }
+        m_waiters.push_back(std::make_pair(Scheduler::GetThis(), self));
+    }
+    // 超时时从等待队列中移除自己再唤醒，已经被notify取出的不再处理
+    std::shared_ptr<bool> timeout(new bool(false));
+    std::weak_ptr<bool> weak(timeout);
+    Timer::ptr timer = iom->addConditionTimer(timeout_ms, [this, weak, self](){
+        std::shared_ptr<bool> t = weak.lock();
+        if(!t) {
+            return;
+        }
+        MutexType::Lock lock(m_mutex);
+        for(auto it = m_waiters.begin(); it != m_waiters.end(); ++it) {
+            if(it->second == self) {
+                *t = true;
+                Scheduler* scheduler = it->first;
+                m_waiters.erase(it);
+                scheduler->schedule(self);
+                return;
+            }
+        }
+    }, weak);
+    Fiber::YieldToHold();
+    timer->cancel();
+    return !*timeout;
+}
+
 void FiberSemaphore::notify() {
     MutexType::Lock lock(m_mutex);
     if(!m_waiters.empty()) {
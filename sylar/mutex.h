@@ -39,6 +39,9 @@ public:
     //获取信号量
     void wait();
 
+    //获取信号量，最多等待ms毫秒，超时返回false
+    bool waitFor(uint64_t ms);
+
     //释放信号量
     void notify();
 private:
@@ -348,6 +351,12 @@ public:
 
     bool tryWait();
     void wait();
+    /**
+     * @brief 最多等待timeout_ms毫秒
+     * @details 需要在IOManager的协程中调用，timeout_ms为~0ull时一直等待
+     * @return 拿到名额返回true，超时返回false
+     */
+    bool wait(uint64_t timeout_ms);
     void notify();
 
     size_t getConcurrency() const { return m_concurrency;}
@@ -53,19 +53,23 @@ int32_t RockStream::sendMessage(Message::ptr msg) {
 
 RockResult::ptr RockStream::request(RockRequest::ptr req, uint32_t timeout_ms) {
     if(isConnected()) {
-        RockCtx::ptr ctx(new RockCtx);
+        RockCtx::ptr ctx = newCtx<RockCtx>();
         ctx->request = req;
-        ctx->sn = req->getSn();
         ctx->timeout = timeout_ms;
         ctx->scheduler = sylar::Scheduler::GetThis();
         ctx->fiber = sylar::Fiber::GetThis();
-        addCtx(ctx);
+        if(!addCtx(ctx)) {
+            return std::make_shared<RockResult>(AsyncSocketStream::TOO_MANY_REQUESTS, 0, nullptr, req);
+        }
+        req->setSn(ctx->sn);
         uint64_t ts = sylar::GetCurrentMS();
         ctx->timer = sylar::IOManager::GetThis()->addTimer(timeout_ms,
                 std::bind(&RockStream::onTimeOut, shared_from_this(), ctx));
         enqueue(ctx);
         sylar::Fiber::YieldToHold();
-        return std::make_shared<RockResult>(ctx->result, sylar::GetCurrentMS() - ts, ctx->response, req);
+        auto rt = std::make_shared<RockResult>(ctx->result, sylar::GetCurrentMS() - ts, ctx->response, req);
+        releaseCtx(std::move(ctx));
+        return rt;
     } else {
         return std::make_shared<RockResult>(AsyncSocketStream::NOT_CONNECT, 0, nullptr, req);
     }
@@ -81,6 +85,22 @@ bool RockStream::RockCtx::doSend(AsyncSocketStream::ptr stream) {
                 ->m_decoder->serializeTo(stream, request) > 0;
 }
 
+void RockStream::RockCtx::reset() {
+    request = nullptr;
+    response = nullptr;
+    Ctx::reset();
+}
+
+bool RockStream::RockSendCtx::doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) {
+    return std::dynamic_pointer_cast<RockStream>(stream)
+                ->m_decoder->serializeTo(buffer, msg) > 0;
+}
+
+bool RockStream::RockCtx::doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) {
+    return std::dynamic_pointer_cast<RockStream>(stream)
+                ->m_decoder->serializeTo(buffer, request) > 0;
+}
+
 AsyncSocketStream::Ctx::ptr RockStream::doRecv() {
     //SYLAR_LOG_INFO(g_logger) << "doRecv " << this;
     auto msg = m_decoder->parseFrom(shared_from_this());
@@ -37,6 +37,10 @@ public:
     ~RockStream();
 
     int32_t sendMessage(Message::ptr msg);
+    /**
+     * @brief 发送请求并等待响应
+     * @details req的sn由连接分配，调用前设置的sn会被覆盖
+     */
     RockResult::ptr request(RockRequest::ptr req, uint32_t timeout_ms);
 
     request_handler getRequestHandler() const { return m_requestHandler;}
@@ -64,6 +68,8 @@ protected:
         Message::ptr msg;
 
         virtual bool doSend(AsyncSocketStream::ptr stream) override;
+        virtual bool canBatch() const override { return true;}
+        virtual bool doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) override;
     };
 
     struct RockCtx : public Ctx {
@@ -71,7 +77,10 @@ protected:
         RockRequest::ptr request;
         RockResponse::ptr response;
 
+        virtual void reset() override;
         virtual bool doSend(AsyncSocketStream::ptr stream) override;
+        virtual bool canBatch() const override { return true;}
+        virtual bool doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) override;
     };
 
     virtual Ctx::ptr doRecv() override;
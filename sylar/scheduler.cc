@@ -2,6 +2,8 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "util.h"
+#include <algorithm>
 
 namespace sylar {
 
@@ -13,8 +15,24 @@ static thread_local Scheduler* t_scheduler = nullptr;
 /// 当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber* t_scheduler_fiber = nullptr;
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
-    :m_name(name) {
+/// 工作窃取模式下当前线程本地队列的下标，不是调度线程时为-1
+static thread_local int t_worker_index = -1;
+
+/// 工作窃取模式下选择窃取对象的随机数种子
+static thread_local uint32_t t_steal_seed = 0;
+
+/// 每调度多少次任务检查一次全局注入队列，避免全局队列中的任务饥饿
+static const uint32_t s_global_check_interval = 61;
+
+/// 每次从全局注入队列搬运的最大任务数量
+static const size_t s_global_batch_size = 64;
+
+/// 每次从无锁注入队列取出的最大任务数量
+static const size_t s_inject_batch_size = 128;
+
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name, bool work_stealing)
+    :m_name(name)
+    ,m_workStealing(work_stealing) {
     SYLAR_ASSERT(threads > 0);
 
     // 调度协程在main函数所在的线程中
@@ -43,6 +61,14 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    // 每个调度线程(包括use_caller的主线程)一个本地队列
+    if(m_workStealing) {
+        m_workers.resize(m_threadCount + (use_caller ? 1 : 0));
+        for(size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers[i] = new WorkerQueue;
+        }
+    }
 }
 
 Scheduler::~Scheduler() {
@@ -50,6 +76,9 @@ Scheduler::~Scheduler() {
     if(GetThis() == this) {
         t_scheduler = nullptr;
     }
+    for(auto& i : m_workers) {
+        delete i;
+    }
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -141,6 +170,15 @@ void Scheduler::run() {
         t_scheduler_fiber = Fiber::GetThis().get();
     }
 
+    // 工作窃取模式下，为当前线程绑定一个本地队列
+    if(m_workStealing) {
+        size_t idx = m_workerIndex++;
+        SYLAR_ASSERT(idx < m_workers.size());
+        t_worker_index = idx;
+        t_steal_seed = sylar::GetThreadId();
+        m_workers[idx]->threadId = sylar::GetThreadId();
+    }
+
     // 设置idle协程，如果没有任务，则会执行idle协程
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
 
@@ -152,8 +190,16 @@ void Scheduler::run() {
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
-        {
+        if(m_workStealing) {
+            is_active = popTask(ft, tickle_me);
+        } else {
             MutexType::Lock lock(m_mutex);
+            // 先将无锁注入队列中的协程批量搬到任务队列
+            if(m_injectSize > 0) {
+                drainInjected(m_fibers, s_inject_batch_size);
+                // 没有取完(或者生产者还没有完成入队)，稍后再来
+                tickle_me |= m_injectSize > 0;
+            }
             // 遍历协程队列，取出任务
             auto it = m_fibers.begin();
             while(it != m_fibers.end()) {
@@ -166,8 +212,8 @@ void Scheduler::run() {
 
                 SYLAR_ASSERT(it->fiber || it->cb);
 
-                //该任务已经在执行中，跳过
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                //该任务已经在执行中(或者还没有完成切换)，跳过
+                if(it->fiber && it->fiber->isRunning()) {
                     ++it;
                     continue;
                 }
@@ -175,12 +221,12 @@ void Scheduler::run() {
                 ft = *it;
 
                 //在任务队列中，删除该任务
-                m_fibers.erase(it++);
+                it = m_fibers.erase(it);
                 ++m_activeThreadCount;
                 is_active = true;
                 break;
             }
-            // 判断 it 是否到达了 m_fibers 的末尾。如果没有到达末尾，说明查找成功，结果为 true；否则为 false。
+            // 判断 it 是否到达了 m_fibers 的末尾。如果没有到达末尾，说明还有其它任务，结果为 true；否则为 false。
             tickle_me |= it != m_fibers.end();
         }
 
@@ -193,17 +239,14 @@ void Scheduler::run() {
         if(ft.fiber && (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT)) {
             
             // 开始执行该协程，执行完成之后，会回到这里
-            ft.fiber->swapIn();
+            // 回来之后协程可能已经被其它线程恢复，只能使用swapIn返回的状态，HOLD状态由swapIn设置
+            Fiber::State state = ft.fiber->swapIn();
             --m_activeThreadCount;
 
             // 如果执行完成之后，协程的状态被置为了READY,则将fiber重新加入到任务队列中
-            if(ft.fiber->getState() == Fiber::READY) {
+            if(state == Fiber::READY) {
                 schedule(ft.fiber);
             } 
-            // 如果为INIT或HOLD状态
-            else if(ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
-            }
             // 执行完毕重置数据ft
             ft.reset();
         } 
@@ -219,17 +262,16 @@ void Scheduler::run() {
             }
 
             ft.reset();
-            cb_fiber->swapIn();
+            Fiber::State state = cb_fiber->swapIn();
             --m_activeThreadCount;
-            if(cb_fiber->getState() == Fiber::READY) {
+            if(state == Fiber::READY) {
                 schedule(cb_fiber);
                 cb_fiber.reset();
             } 
-            else if(cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM) {
+            else if(state == Fiber::EXCEPT || state == Fiber::TERM) {
                 cb_fiber->reset(nullptr);
             } 
             else {
-                cb_fiber->m_state = Fiber::HOLD;
                 cb_fiber.reset();
             }
         } 
@@ -242,6 +284,7 @@ void Scheduler::run() {
             }
             if(idle_fiber->getState() == Fiber::TERM) {
                 SYLAR_LOG_INFO(g_logger) << "idle fiber term";
+                t_worker_index = -1;
                 break;
             }
 
@@ -259,9 +302,282 @@ void Scheduler::tickle() {
     SYLAR_LOG_INFO(g_logger) << "tickle";
 }
 
+bool Scheduler::injectFiber(FiberAndThread& ft, bool& need_tickle) {
+    if(!ft.fiber) {
+        return false;
+    }
+    if(m_workStealing) {
+        // 工作窃取模式下只替代全局队列：调度线程自己产生的任务和指定线程的任务仍然直接进入本地队列
+        if(ft.thread != -1 || (t_scheduler == this && t_worker_index >= 0)) {
+            return false;
+        }
+    }
+    Fiber* f = ft.fiber.get();
+    // 同一个协程同时只能在队列中出现一次
+    if(f->m_injected.exchange(true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    f->m_injectThread = ft.thread;
+    f->m_injectTime = sylar::GetCurrentUS();
+    f->m_injectRef.swap(ft.fiber);
+
+    if(m_workStealing) {
+        ++m_pendingTasks;
+    }
+    uint64_t depth = ++m_injectSize;
+    ++m_injectEnqueue;
+    m_injectQueue.push(f);
+
+    uint64_t max_depth = m_injectMaxDepth;
+    while(depth > max_depth
+            && !m_injectMaxDepth.compare_exchange_weak(max_depth, depth)) {
+    }
+    need_tickle = m_workStealing ? hasIdleThreads() : depth == 1;
+    return true;
+}
+
+template<class Container>
+size_t Scheduler::drainInjected(Container& out, size_t max) {
+    uint64_t now = sylar::GetCurrentUS();
+    uint64_t latency = 0;
+    uint64_t max_latency = 0;
+    size_t n = 0;
+    while(n < max) {
+        Fiber* f = m_injectQueue.pop();
+        if(!f) {
+            break;
+        }
+        Fiber::ptr fiber;
+        fiber.swap(f->m_injectRef);
+        int thread = f->m_injectThread;
+        uint64_t lat = now > f->m_injectTime ? now - f->m_injectTime : 0;
+        latency += lat;
+        max_latency = std::max(max_latency, lat);
+        // 释放之后协程可以再次入队
+        f->m_injected.store(false, std::memory_order_release);
+        out.push_back(FiberAndThread(&fiber, thread));
+        ++n;
+    }
+    if(n) {
+        m_injectSize -= n;
+        ++m_injectBatches;
+        m_injectLatency += latency;
+        uint64_t cur = m_injectMaxLatency;
+        while(max_latency > cur
+                && !m_injectMaxLatency.compare_exchange_weak(cur, max_latency)) {
+        }
+    }
+    return n;
+}
+
+Scheduler::InjectStats Scheduler::getInjectStats() const {
+    InjectStats st;
+    st.enqueue = m_injectEnqueue;
+    st.batches = m_injectBatches;
+    st.depth = m_injectSize;
+    st.max_depth = m_injectMaxDepth;
+    st.total_latency_us = m_injectLatency;
+    st.max_latency_us = m_injectMaxLatency;
+    return st;
+}
+
+bool Scheduler::pushTask(FiberAndThread& ft) {
+    ++m_pendingTasks;
+
+    WorkerQueue* target = nullptr;
+    if(ft.thread == -1) {
+        // 调度线程自己产生的任务放入自己的本地队列
+        if(t_scheduler == this && t_worker_index >= 0) {
+            target = m_workers[t_worker_index];
+        }
+    } else {
+        // 指定线程的任务放入目标线程的本地队列，目标线程还未启动时进入全局队列
+        for(auto& i : m_workers) {
+            if(i->threadId == ft.thread) {
+                target = i;
+                break;
+            }
+        }
+    }
+
+    if(target) {
+        WorkerQueue::MutexType::Lock lock(target->mutex);
+        if(ft.thread == -1) {
+            target->tasks.push_back(std::move(ft));
+        } else {
+            target->pinned.push_back(std::move(ft));
+            ++target->pinnedSize;
+        }
+        ++target->size;
+    } else {
+        MutexType::Lock lock(m_mutex);
+        m_fibers.push_back(std::move(ft));
+        ++m_globalSize;
+    }
+    // 有空闲线程时通知其过来窃取或者执行指定给它的任务
+    return hasIdleThreads();
+}
+
+/**
+ * @brief 从队列中取出第一个不在执行中的任务
+ * @details 协程可能在被重新调度之后还没有完成切换(例如switchTo)，此时不能执行该协程
+ */
+template<class Queue, class Task>
+static bool TakeRunnable(Queue& q, Task& ft) {
+    for(auto it = q.begin(); it != q.end(); ++it) {
+        SYLAR_ASSERT(it->fiber || it->cb);
+        if(it->fiber && it->fiber->isRunning()) {
+            continue;
+        }
+        ft = std::move(*it);
+        q.erase(it);
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::popLocal(WorkerQueue* local, FiberAndThread& ft, bool& tickle_me) {
+    if(local->size == 0) {
+        return false;
+    }
+    WorkerQueue::MutexType::Lock lock(local->mutex);
+    bool pinned = TakeRunnable(local->pinned, ft);
+    if(!pinned && !TakeRunnable(local->tasks, ft)) {
+        // 队列中只剩下正在执行中的协程，通知自己稍后再来
+        tickle_me = true;
+        return false;
+    }
+    // 先增加工作线程数量再减少任务数量，保证stopping()不会误判
+    ++m_activeThreadCount;
+    --local->size;
+    if(pinned) {
+        --local->pinnedSize;
+    }
+    --m_pendingTasks;
+    // 本地还有可窃取的任务，通知空闲线程
+    tickle_me |= !local->tasks.empty();
+    return true;
+}
+
+bool Scheduler::grabGlobal(WorkerQueue* local) {
+    if(m_globalSize == 0 && m_injectSize == 0) {
+        return false;
+    }
+    std::vector<FiberAndThread> batch;
+    {
+        MutexType::Lock lock(m_mutex);
+        // 无锁注入队列中的都是可以在任意线程执行的协程
+        if(m_injectSize > 0) {
+            drainInjected(batch, std::min(m_injectSize / m_workers.size() + 1, (uint64_t)s_global_batch_size));
+        }
+        // 按线程数平分全局队列中的任务
+        size_t n = std::min(m_fibers.size() / m_workers.size() + 1, s_global_batch_size);
+        auto it = m_fibers.begin();
+        size_t injected = batch.size();
+        while(it != m_fibers.end() && batch.size() - injected < n) {
+            // 指定给其它线程的任务留在全局队列中
+            if(it->thread != -1 && it->thread != local->threadId) {
+                ++it;
+                continue;
+            }
+            batch.push_back(std::move(*it));
+            it = m_fibers.erase(it);
+        }
+        m_globalSize -= batch.size() - injected;
+    }
+    if(batch.empty()) {
+        return false;
+    }
+
+    WorkerQueue::MutexType::Lock lock(local->mutex);
+    for(auto& i : batch) {
+        if(i.thread == -1) {
+            local->tasks.push_back(std::move(i));
+        } else {
+            local->pinned.push_back(std::move(i));
+            ++local->pinnedSize;
+        }
+    }
+    local->size += batch.size();
+    return true;
+}
+
+bool Scheduler::stealTasks(WorkerQueue* local) {
+    size_t count = m_workers.size();
+    // xorshift 随机选择起始的窃取对象
+    t_steal_seed ^= t_steal_seed << 13;
+    t_steal_seed ^= t_steal_seed >> 17;
+    t_steal_seed ^= t_steal_seed << 5;
+    size_t start = t_steal_seed % count;
+
+    std::vector<FiberAndThread> stolen;
+    for(size_t i = 0; i < count; ++i) {
+        WorkerQueue* victim = m_workers[(start + i) % count];
+        if(victim == local || victim->size <= victim->pinnedSize) {
+            continue;
+        }
+        {
+            WorkerQueue::MutexType::Lock lock(victim->mutex);
+            // 从队尾窃取一半，所属线程从队头取，减少冲突
+            size_t n = (victim->tasks.size() + 1) / 2;
+            for(size_t x = 0; x < n; ++x) {
+                stolen.push_back(std::move(victim->tasks.back()));
+                victim->tasks.pop_back();
+            }
+            victim->size -= n;
+        }
+        if(!stolen.empty()) {
+            break;
+        }
+    }
+    if(stolen.empty()) {
+        return false;
+    }
+
+    WorkerQueue::MutexType::Lock lock(local->mutex);
+    for(auto it = stolen.rbegin(); it != stolen.rend(); ++it) {
+        local->tasks.push_back(std::move(*it));
+    }
+    local->size += stolen.size();
+    local->stealCount += stolen.size();
+    return true;
+}
+
+bool Scheduler::popTask(FiberAndThread& ft, bool& tickle_me) {
+    SYLAR_ASSERT(t_worker_index >= 0);
+    WorkerQueue* local = m_workers[t_worker_index];
+
+    // 周期性优先检查全局队列
+    if(++local->tick % s_global_check_interval == 0) {
+        grabGlobal(local);
+    }
+    if(popLocal(local, ft, tickle_me)) {
+        return true;
+    }
+    if(grabGlobal(local) && popLocal(local, ft, tickle_me)) {
+        return true;
+    }
+    if(stealTasks(local) && popLocal(local, ft, tickle_me)) {
+        return true;
+    }
+
+    // 其它线程有指定给它执行的任务，通知其退出idle
+    for(auto& i : m_workers) {
+        if(i != local && i->pinnedSize > 0) {
+            tickle_me = true;
+            break;
+        }
+    }
+    return false;
+}
+
 bool Scheduler::stopping() {
+    if(m_workStealing) {
+        return m_autoStop && m_stopping && m_pendingTasks == 0 && m_activeThreadCount == 0;
+    }
     MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && m_fibers.empty() && m_injectSize == 0
+        && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
@@ -288,6 +604,7 @@ std::ostream& Scheduler::dump(std::ostream& os) {
        << " active_count=" << m_activeThreadCount
        << " idle_count=" << m_idleThreadCount
        << " stopping=" << m_stopping
+       << " work_stealing=" << m_workStealing
        << " ]" << std::endl << "    ";
     for(size_t i = 0; i < m_threadIds.size(); ++i) {
         if(i) {
@@ -295,6 +612,24 @@ std::ostream& Scheduler::dump(std::ostream& os) {
         }
         os << m_threadIds[i];
     }
+    InjectStats st = getInjectStats();
+    os << std::endl << "    [inject depth=" << st.depth
+       << " max_depth=" << st.max_depth
+       << " enqueue=" << st.enqueue
+       << " batches=" << st.batches
+       << " avg_latency_us=" << (st.enqueue > st.depth ? st.total_latency_us / (st.enqueue - st.depth) : 0)
+       << " max_latency_us=" << st.max_latency_us
+       << "]";
+    if(m_workStealing) {
+        os << std::endl << "    global=" << m_globalSize;
+        for(auto& i : m_workers) {
+            os << std::endl << "    [worker thread=" << i->threadId
+               << " size=" << i->size
+               << " pinned=" << i->pinnedSize
+               << " steal=" << i->stealCount
+               << "]";
+        }
+    }
     return os;
 }
 
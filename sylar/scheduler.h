@@ -11,6 +11,7 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
 #include <iostream>
 #include "fiber.h"
 #include "thread.h"
@@ -33,14 +34,21 @@ public:
      * @param[in] threads 线程数量
      * @param[in] use_caller 是否将当前线程也作为调度线程，即如果为true，调度协程在main函数所在的线程，如果为false，则调度协程在另外一个线程。即是否将main线程也参与执行任务
      * @param[in] name 协程调度器名称
+     * @param[in] work_stealing 是否启用工作窃取模式
+     * @details 工作窃取模式下每个调度线程拥有自己的本地任务队列，其它线程投递的任务进入全局注入队列，
+     *          空闲线程会随机选择一个线程窃取其一半的任务，从而避免所有线程争抢同一把锁
      */
-    Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+              ,bool work_stealing = false);
 
     virtual ~Scheduler();
 
     //返回协程调度器名称
     const std::string& getName() const { return m_name;}
 
+    //是否为工作窃取模式
+    bool isWorkStealing() const { return m_workStealing;}
+
     //返回协程调度器
     static Scheduler* GetThis();
 
@@ -65,12 +73,21 @@ public:
     template<class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
         bool need_tickle = false;
-        {
-            //SYLAR_LOG_INFO(SYLAR_LOG_ROOT())<<"任务加入";
-            MutexType::Lock lock(m_mutex);
-            // 将任务加入到队列中，若任务队列原来为空，则tickle
-            need_tickle = scheduleNoLock(fc, thread);
-            
+        FiberAndThread ft(fc, thread);
+        if(!ft.fiber && !ft.cb) {
+            return;
+        }
+        // 协程任务优先走无锁注入队列，不加锁也不分配链表节点
+        if(!injectFiber(ft, need_tickle)) {
+            if(m_workStealing) {
+                need_tickle = pushTask(ft);
+            } else {
+                //SYLAR_LOG_INFO(SYLAR_LOG_ROOT())<<"任务加入";
+                MutexType::Lock lock(m_mutex);
+                // 将任务加入到队列中，若任务队列原来为空，则tickle
+                need_tickle = m_fibers.empty();
+                m_fibers.push_back(std::move(ft));
+            }
         }
 
         if(need_tickle) {
@@ -78,6 +95,27 @@ public:
         }
     }
 
+    /**
+     * @brief 无锁注入队列的统计信息
+     */
+    struct InjectStats {
+        /// 入队次数
+        uint64_t enqueue = 0;
+        /// 消费者批量取出的次数
+        uint64_t batches = 0;
+        /// 当前队列长度
+        uint64_t depth = 0;
+        /// 最大队列长度
+        uint64_t max_depth = 0;
+        /// 入队到被取出的总延迟(微秒)
+        uint64_t total_latency_us = 0;
+        /// 入队到被取出的最大延迟(微秒)
+        uint64_t max_latency_us = 0;
+    };
+
+    //返回无锁注入队列的统计信息
+    InjectStats getInjectStats() const;
+
     /**
      * @brief 批量调度协程
      * @param[in] begin 协程数组的开始
@@ -87,6 +125,19 @@ public:
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
+        if(m_workStealing) {
+            while(begin != end) {
+                FiberAndThread ft(&*begin, -1);
+                if(ft.fiber || ft.cb) {
+                    need_tickle = pushTask(ft) || need_tickle;
+                }
+                ++begin;
+            }
+            if(need_tickle) {
+                tickle();
+            }
+            return;
+        }
         {
             MutexType::Lock lock(m_mutex);
             while(begin != end) {
@@ -125,7 +176,29 @@ protected:
 
     //是否有空闲线程
     bool hasIdleThreads() { return m_idleThreadCount > 0;}
+
+    //无锁注入队列中是否有等待取出的协程
+    bool hasInjectedTasks() const { return m_injectSize > 0;}
 private:
+    struct FiberAndThread;
+
+    /**
+     * @brief 将协程放入无锁注入队列
+     * @param[in,out] ft 任务，成功时ft.fiber被置空
+     * @param[out] need_tickle 是否需要tickle
+     * @return 是否放入，回调任务、协程已经在队列中、或者工作窃取模式下可以直接放入本地队列时返回false，走原来的路径
+     */
+    bool injectFiber(FiberAndThread& ft, bool& need_tickle);
+
+    /**
+     * @brief 从无锁注入队列中批量取出协程
+     * @param[out] out 取出的任务追加到该容器
+     * @param[in] max 最多取出的数量
+     * @return 取出的数量
+     * @pre 已经持有m_mutex，保证只有一个消费者
+     */
+    template<class Container>
+    size_t drainInjected(Container& out, size_t max);
 
     //将协程任务 fc 添加到调度器的任务队列 m_fibers 中，且不加锁。
     //fc可以是回调函数也可以是协程
@@ -159,6 +232,10 @@ private:
          */
         FiberAndThread(Fiber::ptr f, int thr)
             :fiber(f), thread(thr) {
+            // 共享栈协程运行过之后只能在绑定的线程上恢复
+            if(thread == -1 && fiber) {
+                thread = fiber->getBoundThread();
+            }
         }
 
         /**
@@ -171,6 +248,9 @@ private:
         FiberAndThread(Fiber::ptr* f, int thr)
             :thread(thr) {
             fiber.swap(*f);
+            if(thread == -1 && fiber) {
+                thread = fiber->getBoundThread();
+            }
         }
 
         /**
@@ -208,17 +288,94 @@ private:
         }
     };
 
+    /**
+     * @brief 工作窃取模式下调度线程的本地任务队列
+     * @details 队列由自旋锁保护，只有所属线程和窃取者会竞争，不会出现所有线程争抢同一把锁的情况
+     */
+    struct WorkerQueue {
+        typedef Spinlock MutexType;
+        /// 自旋锁
+        MutexType mutex;
+        /// 可以被其它线程窃取的任务
+        std::deque<FiberAndThread> tasks;
+        /// 指定在该线程执行的任务，不会被窃取
+        std::deque<FiberAndThread> pinned;
+        /// 所属线程id，线程进入run()之前为-1
+        std::atomic<int> threadId = {-1};
+        /// 队列中的任务数量(tasks + pinned)，用于无锁判断是否为空
+        std::atomic<size_t> size = {0};
+        /// 指定在该线程执行的任务数量
+        std::atomic<size_t> pinnedSize = {0};
+        /// 从其它线程窃取到的任务数量
+        std::atomic<uint64_t> stealCount = {0};
+        /// 调度次数，用于周期性检查全局队列
+        uint32_t tick = 0;
+    };
+
+    /**
+     * @brief 工作窃取模式下投递任务
+     * @return 是否需要tickle
+     * @details 调度线程投递的任务进入本线程的本地队列，指定线程的任务进入目标线程的本地队列，其余进入全局注入队列
+     */
+    bool pushTask(FiberAndThread& ft);
+
+    /**
+     * @brief 工作窃取模式下取出一个可执行任务
+     * @param[out] ft 取出的任务
+     * @param[out] tickle_me 是否需要通知其它线程
+     * @return 是否取到任务，取到时m_activeThreadCount已经+1
+     * @details 顺序为：本地队列 -> 全局注入队列 -> 随机选择其它线程窃取
+     */
+    bool popTask(FiberAndThread& ft, bool& tickle_me);
+
+    /**
+     * @brief 从本地队列中取出一个可执行任务
+     */
+    bool popLocal(WorkerQueue* local, FiberAndThread& ft, bool& tickle_me);
+
+    /**
+     * @brief 从全局注入队列中批量搬运任务到本地队列
+     * @return 是否搬运到任务
+     */
+    bool grabGlobal(WorkerQueue* local);
+
+    /**
+     * @brief 从随机选择的其它线程本地队列中窃取一半任务
+     * @return 是否窃取到任务
+     */
+    bool stealTasks(WorkerQueue* local);
+
 private: 
     // Mutex
     MutexType m_mutex;      
     // 线程池
     std::vector<Thread::ptr> m_threads;     
     // 待执行的协程（任务）队列
-    std::list<FiberAndThread> m_fibers;     
+    std::deque<FiberAndThread> m_fibers;     
+    // 跨线程投递协程的无锁注入队列，由持有m_mutex的调度线程批量取出
+    ds::MpscQueue<Fiber> m_injectQueue;
+    // 注入队列中的协程数量
+    std::atomic<uint64_t> m_injectSize = {0};
+    // 注入队列统计
+    std::atomic<uint64_t> m_injectEnqueue = {0};
+    std::atomic<uint64_t> m_injectBatches = {0};
+    std::atomic<uint64_t> m_injectMaxDepth = {0};
+    std::atomic<uint64_t> m_injectLatency = {0};
+    std::atomic<uint64_t> m_injectMaxLatency = {0};
     // use_caller为true时，为main函数所在线程的调度协程
     Fiber::ptr m_rootFiber;     
     // 协程调度器名称
     std::string m_name;     
+    // 是否为工作窃取模式
+    bool m_workStealing = false;
+    // 工作窃取模式下每个调度线程的本地队列
+    std::vector<WorkerQueue*> m_workers;
+    // 已经注册的本地队列数量
+    std::atomic<size_t> m_workerIndex = {0};
+    // 工作窃取模式下等待执行的任务数量(全局队列 + 所有本地队列)
+    std::atomic<size_t> m_pendingTasks = {0};
+    // 全局注入队列(m_fibers)中的任务数量
+    std::atomic<size_t> m_globalSize = {0};
 
 protected:
     // 线程池的线程ID数组
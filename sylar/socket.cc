@@ -284,9 +284,13 @@ bool Socket::close() {
         return true;
     }
     m_isConnected = false;
-    if(m_sock != -1) {
-        ::close(m_sock);
-        m_sock = -1;
+    // 读写协程可能在不同线程同时关闭，fd只能close一次，否则会关掉已被复用的fd
+    int sock = m_sock;
+    while(sock != -1 && !Atomic::compareAndSwapBool(m_sock, sock, -1)) {
+        sock = m_sock;
+    }
+    if(sock != -1) {
+        ::close(sock);
     }
     return false;
 }
@@ -309,6 +313,13 @@ int Socket::send(const iovec* buffers, size_t length, int flags) {
     return -1;
 }
 
+int Socket::sendFile(int fd, off_t* offset, size_t length) {
+    if(isConnected()) {
+        return ::sendfile(m_sock, fd, offset, length);
+    }
+    return -1;
+}
+
 int Socket::sendTo(const void* buffer, size_t length, const Address::ptr to, int flags) {
     if(isConnected()) {
         return ::sendto(m_sock, buffer, length, flags, to->getAddr(), to->getAddrLen());
@@ -557,6 +568,7 @@ Socket::ptr SSLSocket::accept() {
         return nullptr;
     }
     newSSLsock->m_ctx = m_ctx;
+    newSSLsock->m_alpn = m_alpn;
     // 用newsock来初始化newSSLsock中的m_sock
     if(newSSLsock->init(newsock)) {
         return newSSLsock;
@@ -572,7 +584,11 @@ bool SSLSocket::bind(const Address::ptr addr) {
 //客户端通过 SSL/TLS 协议连接到远程服务器
 //首先调用父类 Socket 的 connect() 方法建立普通的套接字连接，接着进行 SSL/TLS 握手。
 bool SSLSocket::connect(const Address::ptr addr, uint64_t timeout_ms) {
-    bool v = Socket::connect(addr, timeout_ms);
+    return Socket::connect(addr, timeout_ms) && handshake();
+}
+
+bool SSLSocket::handshake() {
+    bool v = isConnected();
     if(v) {
         // SSL_CTX_new(SSLv23_client_method()) 创建一个新的 SSL 上下文对象 m_ctx
         // SSLv23_client_method() 是 SSL/TLS 协议的客户端方法，它支持 SSLv2、SSLv3 和 TLS 协议版本，通常用于客户端连接。
@@ -636,6 +652,22 @@ struct iovec{
     return total;
 }
 
+int SSLSocket::sendFile(int fd, off_t* offset, size_t length) {
+    if(!m_ssl) {
+        return -1;
+    }
+    char buf[16 * 1024];
+    int rt = pread(fd, buf, std::min(length, sizeof(buf)), *offset);
+    if(rt <= 0) {
+        return rt;
+    }
+    rt = SSL_write(m_ssl.get(), buf, rt);
+    if(rt > 0) {
+        *offset += rt;
+    }
+    return rt;
+}
+
 int SSLSocket::sendTo(const void* buffer, size_t length, const Address::ptr to, int flags) {
     SYLAR_ASSERT(false);
     return -1;
@@ -727,6 +759,46 @@ bool SSLSocket::loadCertificates(const std::string& cert_file, const std::string
     return true;
 }
 
+static int alpn_select_cb(SSL* ssl, const unsigned char** out, unsigned char* outlen
+                          ,const unsigned char* in, unsigned int inlen, void* arg) {
+    const std::string* protos = (const std::string*)arg;
+    // 按服务端的优先级选择
+    if(SSL_select_next_proto((unsigned char**)out, outlen
+                , (const unsigned char*)protos->c_str(), protos->size()
+                , in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool SSLSocket::setAlpnProtocols(const std::vector<std::string>& protos) {
+    if(!m_ctx) {
+        SYLAR_LOG_ERROR(g_logger) << "setAlpnProtocols before loadCertificates";
+        return false;
+    }
+    std::shared_ptr<std::string> wire = std::make_shared<std::string>();
+    for(auto& i : protos) {
+        if(i.empty() || i.size() > 255) {
+            return false;
+        }
+        wire->push_back((char)i.size());
+        wire->append(i);
+    }
+    m_alpn = wire;
+    SSL_CTX_set_alpn_select_cb(m_ctx.get(), alpn_select_cb, m_alpn.get());
+    return true;
+}
+
+std::string SSLSocket::getAlpnSelected() const {
+    if(!m_ssl) {
+        return "";
+    }
+    const unsigned char* data = nullptr;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(m_ssl.get(), &data, &len);
+    return data ? std::string((const char*)data, len) : "";
+}
+
 SSLSocket::ptr SSLSocket::CreateTCP(sylar::Address::ptr address) {
     SSLSocket::ptr sock(new SSLSocket(address->getFamily(), TCP, 0));
     return sock;
@@ -7,6 +7,7 @@
 #define __SYLAR_SOCKET_H__
 
 #include <memory>
+#include <vector>
 #include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -245,6 +246,18 @@ public:
      */
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0);
 
+    /**
+     * @brief 发送文件内容(sendfile零拷贝)
+     * @param[in] fd 文件句柄
+     * @param[in, out] offset 文件偏移，返回时更新为发送后的位置
+     * @param[in] length 待发送的长度
+     * @return
+     *      @retval >0 发送成功对应大小的数据
+     *      @retval =0 socket被关闭或文件已到结尾
+     *      @retval <0 socket出错
+     */
+    virtual int sendFile(int fd, off_t* offset, size_t length);
+
     /**
      * @brief 接受数据
      * @param[out] buffer 接收数据的内存
@@ -395,13 +408,36 @@ public:
     virtual int send(const iovec* buffers, size_t length, int flags = 0) override;
     virtual int sendTo(const void* buffer, size_t length, const Address::ptr to, int flags = 0) override;
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0) override;
+    /**
+     * @brief 发送文件内容，SSL需要加密，读入内存后SSL_write
+     */
+    virtual int sendFile(int fd, off_t* offset, size_t length) override;
     virtual int recv(void* buffer, size_t length, int flags = 0) override;
     virtual int recv(iovec* buffers, size_t length, int flags = 0) override;
     virtual int recvFrom(void* buffer, size_t length, Address::ptr from, int flags = 0) override;
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0) override;
 
+    /**
+     * @brief 在已经建立的TCP连接上做客户端SSL握手
+     * @details connect在TCP连接成功后调用，需要分别统计建连和握手耗时时可以
+     *          先调用Socket::connect再调用本方法
+     */
+    bool handshake();
+
     //加载 SSL 证书和私钥
     bool loadCertificates(const std::string& cert_file, const std::string& key_file);
+
+    /**
+     * @brief 设置服务端支持的ALPN协议，按优先级排列，需要在loadCertificates之后调用
+     * @param[in] protos 协议列表，如{"h2", "http/1.1"}
+     */
+    bool setAlpnProtocols(const std::vector<std::string>& protos);
+
+    /**
+     * @brief 握手时协商出的ALPN协议，没有协商时返回空
+     */
+    std::string getAlpnSelected() const;
+
     virtual std::ostream& dump(std::ostream& os) const override;
 protected:
     virtual bool init(int sock) override;
@@ -409,6 +445,8 @@ private:
     //SSL的上下文环境
     std::shared_ptr<SSL_CTX> m_ctx;
     std::shared_ptr<SSL> m_ssl;
+    //ALPN协议列表(wire格式)，SSL_CTX的回调引用它，accept出的socket共享
+    std::shared_ptr<std::string> m_alpn;
 };
 
 /**
@@ -2,11 +2,96 @@
 #include "sylar/util.h"
 #include "sylar/log.h"
 #include "sylar/macro.h"
+#include "sylar/config.h"
+#include <limits.h>
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_write_batch_bytes =
+    sylar::Config::Lookup("async_socket_stream.write_batch_bytes", (uint32_t)(64 * 1024)
+                ,"async socket stream max bytes per batched writev, 0 disable batching");
+
+static sylar::ConfigVar<uint32_t>::ptr g_write_batch_latency =
+    sylar::Config::Lookup("async_socket_stream.write_batch_latency_ms", (uint32_t)0
+                ,"async socket stream max milliseconds to wait for more messages before writev");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ctx_pool_size =
+    sylar::Config::Lookup("async_socket_stream.ctx_pool_size", (uint32_t)1024
+                ,"async socket stream max pooled request contexts per connection");
+
+/// 不超过这个长度的数据拷贝进连续内存，避免iovec过碎
+static const size_t s_copy_threshold = 1024;
+
+AsyncSocketStream::WriteBuffer::WriteBuffer()
+    :m_size(0) {
+}
+
+int AsyncSocketStream::WriteBuffer::write(const void* buffer, size_t length) {
+    if(length == 0) {
+        return 0;
+    }
+    if(!m_segments.empty() && !m_segments.back().ptr
+            && m_segments.back().offset + m_segments.back().length == m_data.size()) {
+        m_segments.back().length += length;
+    } else {
+        m_segments.push_back(Segment{nullptr, m_data.size(), length});
+    }
+    m_data.append((const char*)buffer, length);
+    m_size += length;
+    return length;
+}
+
+int AsyncSocketStream::WriteBuffer::write(ByteArray::ptr ba, size_t length) {
+    length = std::min(length, ba->getReadSize());
+    if(length == 0) {
+        return 0;
+    }
+    if(length <= s_copy_threshold) {
+        char buf[s_copy_threshold];
+        ba->read(buf, length);
+        return write(buf, length);
+    }
+    std::vector<iovec> iovs;
+    ba->getReadBuffers(iovs, length);
+    for(auto& i : iovs) {
+        m_segments.push_back(Segment{(const char*)i.iov_base, 0, i.iov_len});
+    }
+    m_owners.push_back(ba);
+    m_size += length;
+    ba->setPosition(ba->getPosition() + length);
+    return length;
+}
+
+void AsyncSocketStream::WriteBuffer::append(const void* data, size_t length
+                                            ,std::shared_ptr<const void> owner) {
+    if(length <= s_copy_threshold) {
+        write(data, length);
+        return;
+    }
+    m_segments.push_back(Segment{(const char*)data, 0, length});
+    m_owners.push_back(owner);
+    m_size += length;
+}
+
+void AsyncSocketStream::WriteBuffer::clear() {
+    m_data.clear();
+    m_segments.clear();
+    m_owners.clear();
+    m_size = 0;
+}
+
+std::vector<iovec>& AsyncSocketStream::WriteBuffer::getBuffers() {
+    m_iovs.resize(m_segments.size());
+    for(size_t i = 0; i < m_segments.size(); ++i) {
+        auto& seg = m_segments[i];
+        m_iovs[i].iov_base = (void*)(seg.ptr ? seg.ptr : &m_data[seg.offset]);
+        m_iovs[i].iov_len = seg.length;
+    }
+    return m_iovs;
+}
+
 AsyncSocketStream::Ctx::Ctx()
     :sn(0)
     ,timeout(0)
@@ -34,13 +119,28 @@ void AsyncSocketStream::Ctx::doRsp() {
     scd->schedule(&fiber);
 }
 
+void AsyncSocketStream::Ctx::reset() {
+    sn = 0;
+    timeout = 0;
+    result = 0;
+    timed = false;
+    scheduler = nullptr;
+    fiber = nullptr;
+    timer = nullptr;
+}
+
 AsyncSocketStream::AsyncSocketStream(Socket::ptr sock, bool owner)
     :SocketStream(sock, owner)
     ,m_waitSem(2)
     ,m_sn(0)
     ,m_autoConnect(false)
     ,m_iomanager(nullptr)
-    ,m_worker(nullptr) {
+    ,m_worker(nullptr)
+    ,m_writeBatchBytes(g_write_batch_bytes->getValue())
+    ,m_writeBatchLatency(g_write_batch_latency->getValue()) {
+    for(auto& i : m_batchHistogram) {
+        i = 0;
+    }
 }
 
 bool AsyncSocketStream::start() {
@@ -116,6 +216,7 @@ void AsyncSocketStream::doRead() {
 }
 
 void AsyncSocketStream::doWrite() {
+    WriteBuffer::ptr buffer(new WriteBuffer);
     try {
         while(isConnected()) {
             m_sem.wait();
@@ -124,12 +225,10 @@ void AsyncSocketStream::doWrite() {
                 RWMutexType::WriteLock lock(m_queueMutex);
                 m_queue.swap(ctxs);
             }
-            auto self = shared_from_this();
-            for(auto& i : ctxs) {
-                if(!i->doSend(self)) {
-                    innerClose();
-                    break;
-                }
+            if(!sendBatch(ctxs, buffer)) {
+                // 只shutdown，由读协程close: 两个协程可能在不同线程，
+                // 读协程拿到fd后这里close掉，fd被复用时会读到别的连接上
+                ::shutdown(m_socket->getSocket(), SHUT_RDWR);
             }
         }
     } catch (...) {
@@ -143,6 +242,104 @@ void AsyncSocketStream::doWrite() {
     m_waitSem.notify();
 }
 
+bool AsyncSocketStream::sendBatch(std::list<SendCtx::ptr>& ctxs, WriteBuffer::ptr buffer) {
+    auto self = shared_from_this();
+    buffer->clear();
+    size_t messages = 0;
+    uint64_t start = 0;
+    while(!ctxs.empty()) {
+        for(auto& i : ctxs) {
+            if(!m_writeBatchBytes || !i->canBatch()) {
+                // 保持顺序，先写出缓冲里的
+                if(!flushBatch(buffer, messages)) {
+                    return false;
+                }
+                messages = 0;
+                ++m_directSends;
+                if(!i->doSend(self)) {
+                    return false;
+                }
+                continue;
+            }
+            if(buffer->empty()) {
+                start = sylar::GetCurrentMS();
+            }
+            bool ok = i->doSerialize(self, buffer);
+            ++messages;
+            if(!ok) {
+                flushBatch(buffer, messages);
+                return false;
+            }
+            if(buffer->getSize() >= m_writeBatchBytes
+                    || buffer->getBufferCount() >= IOV_MAX / 2) {
+                if(!flushBatch(buffer, messages)) {
+                    return false;
+                }
+                messages = 0;
+            }
+        }
+        ctxs.clear();
+        if(buffer->empty() || !m_writeBatchLatency) {
+            break;
+        }
+        // 在延迟上限内等更多消息入队，凑成更大的一批。
+        // hook的usleep用毫秒定时器，所以延迟按毫秒配置
+        uint64_t used = sylar::GetCurrentMS() - start;
+        if(used >= m_writeBatchLatency) {
+            break;
+        }
+        usleep((m_writeBatchLatency - used) * 1000);
+        RWMutexType::WriteLock lock(m_queueMutex);
+        m_queue.swap(ctxs);
+    }
+    return flushBatch(buffer, messages);
+}
+
+bool AsyncSocketStream::flushBatch(WriteBuffer::ptr buffer, size_t messages) {
+    if(buffer->empty()) {
+        return true;
+    }
+    auto& iovs = buffer->getBuffers();
+    size_t size = buffer->getSize();
+    int rt = 1;
+    // 单个大消息引用的内存块可能超过IOV_MAX
+    for(size_t i = 0; i < iovs.size() && rt > 0; i += IOV_MAX) {
+        rt = writevFixSize(&iovs[i], std::min(iovs.size() - i, (size_t)IOV_MAX));
+    }
+    buffer->clear();
+
+    ++m_batches;
+    m_batchMessages += messages;
+    m_batchBytes += size;
+    // 只有写协程更新，不需要CAS
+    if(messages > m_maxBatchMessages) {
+        m_maxBatchMessages = messages;
+    }
+    if(size > m_maxBatchBytes) {
+        m_maxBatchBytes = size;
+    }
+    size_t bucket = 0;
+    while(bucket < 7 && (messages >> (bucket + 1))) {
+        ++bucket;
+    }
+    ++m_batchHistogram[bucket];
+    return rt > 0;
+}
+
+AsyncSocketStream::WriteStats AsyncSocketStream::getWriteStats() const {
+    WriteStats stats;
+    stats.batches = m_batches;
+    stats.messages = m_batchMessages;
+    stats.bytes = m_batchBytes;
+    stats.direct = m_directSends;
+    stats.maxMessages = m_maxBatchMessages;
+    stats.maxBytes = m_maxBatchBytes;
+    for(size_t i = 0; i < 8; ++i) {
+        stats.histogram[i] = m_batchHistogram[i];
+    }
+    return stats;
+}
+
 void AsyncSocketStream::startRead() {
     m_iomanager->schedule(std::bind(&AsyncSocketStream::doRead, shared_from_this()));
 }
@@ -152,35 +349,104 @@ void AsyncSocketStream::startWrite() {
 }
 
 void AsyncSocketStream::onTimeOut(Ctx::ptr ctx) {
-    {
-        RWMutexType::WriteLock lock(m_mutex);
-        m_ctxs.erase(ctx->sn);
-    }
+    // 代数对得上才删，槽位可能已经被新的请求占用
+    getAndDelCtx(ctx->sn);
     ctx->timed = true;
     ctx->doRsp();
 }
 
 AsyncSocketStream::Ctx::ptr AsyncSocketStream::getCtx(uint32_t sn) {
-    RWMutexType::ReadLock lock(m_mutex);
-    auto it = m_ctxs.find(sn);
-    return it != m_ctxs.end() ? it->second : nullptr;
+    CtxShard& shard = m_ctxShards[SnShard(sn)];
+    uint32_t idx = SnSlot(sn);
+    Spinlock::Lock lock(shard.mutex);
+    if(idx >= shard.slots.size() || shard.slots[idx].gen != SnGen(sn)) {
+        return nullptr;
+    }
+    return shard.slots[idx].ctx;
 }
 
 AsyncSocketStream::Ctx::ptr AsyncSocketStream::getAndDelCtx(uint32_t sn) {
-    Ctx::ptr ctx;
-    RWMutexType::WriteLock lock(m_mutex);
-    auto it = m_ctxs.find(sn);
-    if(it != m_ctxs.end()) {
-        ctx = it->second;
-        m_ctxs.erase(it);
+    CtxShard& shard = m_ctxShards[SnShard(sn)];
+    uint32_t idx = SnSlot(sn);
+    Spinlock::Lock lock(shard.mutex);
+    if(idx >= shard.slots.size() || shard.slots[idx].gen != SnGen(sn)
+            || !shard.slots[idx].ctx) {
+        return nullptr;
     }
+    Ctx::ptr ctx;
+    ctx.swap(shard.slots[idx].ctx);
+    freeSlot(shard, idx);
     return ctx;
 }
 
 bool AsyncSocketStream::addCtx(Ctx::ptr ctx) {
-    RWMutexType::WriteLock lock(m_mutex);
-    m_ctxs.insert(std::make_pair(ctx->sn, ctx));
-    return true;
+    // 轮流使用分片，分片满了再试下一个
+    uint32_t start = m_ctxShardIdx++;
+    for(uint32_t i = 0; i < CTX_SHARD_COUNT; ++i) {
+        uint32_t sid = (start + i) & (CTX_SHARD_COUNT - 1);
+        CtxShard& shard = m_ctxShards[sid];
+        Spinlock::Lock lock(shard.mutex);
+        int32_t idx = shard.freeHead;
+        if(idx >= 0) {
+            shard.freeHead = shard.slots[idx].next;
+        } else if(shard.slots.size() < CTX_MAX_SLOTS) {
+            idx = shard.slots.size();
+            shard.slots.push_back(CtxSlot{1, -1, nullptr});
+        } else {
+            continue;
+        }
+        CtxSlot& slot = shard.slots[idx];
+        slot.ctx = ctx;
+        ++shard.size;
+        ctx->sn = (slot.gen << (CTX_SHARD_BITS + CTX_SLOT_BITS)) | ((uint32_t)idx << CTX_SHARD_BITS) | sid;
+        return true;
+    }
+    SYLAR_LOG_WARN(g_logger) << "AsyncSocketStream too many requests " << this;
+    return false;
+}
+
+void AsyncSocketStream::freeSlot(CtxShard& shard, uint32_t idx) {
+    CtxSlot& slot = shard.slots[idx];
+    // 代数只有16位，回绕时跳过0保证sn不为0
+    if(++slot.gen >> (32 - CTX_SHARD_BITS - CTX_SLOT_BITS)) {
+        slot.gen = 1;
+    }
+    slot.next = shard.freeHead;
+    shard.freeHead = idx;
+    --shard.size;
+}
+
+AsyncSocketStream::Ctx::ptr AsyncSocketStream::popCtx() {
+    CtxShard& shard = m_ctxShards[m_ctxShardIdx & (CTX_SHARD_COUNT - 1)];
+    Spinlock::Lock lock(shard.mutex);
+    if(shard.pool.empty()) {
+        return nullptr;
+    }
+    Ctx::ptr ctx = std::move(shard.pool.back());
+    shard.pool.pop_back();
+    return ctx;
+}
+
+void AsyncSocketStream::releaseCtx(Ctx::ptr ctx) {
+    // 定时器回调或者读协程还拿着的不能复用
+    if(!ctx || ctx.use_count() != 1) {
+        return;
+    }
+    ctx->reset();
+    CtxShard& shard = m_ctxShards[m_ctxShardIdx & (CTX_SHARD_COUNT - 1)];
+    Spinlock::Lock lock(shard.mutex);
+    if(shard.pool.size() < g_ctx_pool_size->getValue() / CTX_SHARD_COUNT) {
+        shard.pool.push_back(std::move(ctx));
+    }
+}
+
+size_t AsyncSocketStream::getCtxCount() {
+    size_t n = 0;
+    for(auto& shard : m_ctxShards) {
+        Spinlock::Lock lock(shard.mutex);
+        n += shard.size;
+    }
+    return n;
 }
 
 bool AsyncSocketStream::enqueue(SendCtx::ptr ctx) {
@@ -202,18 +468,24 @@ bool AsyncSocketStream::innerClose() {
     }
     SocketStream::close();
     m_sem.notify();
-    std::unordered_map<uint32_t, Ctx::ptr> ctxs;
-    {
-        RWMutexType::WriteLock lock(m_mutex);
-        ctxs.swap(m_ctxs);
+    std::vector<Ctx::ptr> ctxs;
+    for(auto& shard : m_ctxShards) {
+        Spinlock::Lock lock(shard.mutex);
+        for(size_t i = 0; i < shard.slots.size(); ++i) {
+            if(shard.slots[i].ctx) {
+                ctxs.push_back(std::move(shard.slots[i].ctx));
+                shard.slots[i].ctx = nullptr;
+                freeSlot(shard, i);
+            }
+        }
     }
     {
         RWMutexType::WriteLock lock(m_queueMutex);
         m_queue.clear();
     }
     for(auto& i : ctxs) {
-        i.second->result = IO_ERROR;
-        i.second->doRsp();
+        i->result = IO_ERROR;
+        i->doRsp();
     }
     return true;
 }
@@ -2,6 +2,7 @@
 #define __SYLAR_STREAMS_ASYNC_SOCKET_STREAM_H__
 
 #include "socket_stream.h"
+#include <atomic>
 #include <list>
 #include <unordered_map>
 #include <boost/any.hpp>
@@ -26,6 +27,80 @@ public:
         TIMEOUT = -1,
         IO_ERROR = -2,
         NOT_CONNECT = -3,
+        /// 在途请求数达到上下文表上限
+        TOO_MANY_REQUESTS = -4,
+    };
+
+    /**
+     * @brief 批量写统计
+     */
+    struct WriteStats {
+        /// 批量写次数，每次一个writevFixSize
+        uint64_t batches;
+        /// 合并进批量写的消息数
+        uint64_t messages;
+        /// 批量写的字节数
+        uint64_t bytes;
+        /// 不支持批量、直接doSend的消息数
+        uint64_t direct;
+        /// 单批最多消息数
+        uint64_t maxMessages;
+        /// 单批最大字节数
+        uint64_t maxBytes;
+        /// 每批消息数分布: [i]为[2^i, 2^(i+1))条，最后一档包含更大的
+        uint64_t histogram[8];
+    };
+
+    /**
+     * @brief 批量写缓冲
+     * @details 小块数据拷贝到连续内存，大块数据只引用不拷贝，
+     *          最后组装成iovec由一次writev写出。只在写协程里使用
+     */
+    class WriteBuffer : public Stream {
+    public:
+        typedef std::shared_ptr<WriteBuffer> ptr;
+
+        WriteBuffer();
+
+        virtual int read(void* buffer, size_t length) override { return -1;}
+        virtual int read(ByteArray::ptr ba, size_t length) override { return -1;}
+        /**
+         * @brief 拷贝写入
+         */
+        virtual int write(const void* buffer, size_t length) override;
+        /**
+         * @brief 写入ByteArray当前位置开始的length字节，较大时引用ba的内存
+         */
+        virtual int write(ByteArray::ptr ba, size_t length) override;
+        virtual void close() override { clear();}
+
+        /**
+         * @brief 引用写入，不拷贝
+         * @param[in] owner 持有data的内存，写出之前保持有效
+         */
+        void append(const void* data, size_t length, std::shared_ptr<const void> owner);
+
+        void clear();
+        bool empty() const { return m_size == 0;}
+        size_t getSize() const { return m_size;}
+        size_t getBufferCount() const { return m_segments.size();}
+
+        /**
+         * @brief 组装iovec，下次写入前有效
+         */
+        std::vector<iovec>& getBuffers();
+    private:
+        struct Segment {
+            /// 为空时数据在m_data的offset处
+            const char* ptr;
+            size_t offset;
+            size_t length;
+        };
+        std::string m_data;
+        std::vector<Segment> m_segments;
+        std::vector<std::shared_ptr<const void> > m_owners;
+        std::vector<iovec> m_iovs;
+        size_t m_size;
     };
 protected:
     struct SendCtx {
@@ -34,6 +109,17 @@ protected:
         virtual ~SendCtx() {}
 
         virtual bool doSend(AsyncSocketStream::ptr stream) = 0;
+
+        /**
+         * @brief 是否可以序列化进批量写缓冲
+         */
+        virtual bool canBatch() const { return false;}
+
+        /**
+         * @brief 序列化到批量写缓冲，canBatch()为true时代替doSend调用
+         * @return 返回false时缓冲里已有的数据写出后断开连接
+         */
+        virtual bool doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) { return false;}
     };
 
     struct Ctx : public SendCtx {
@@ -52,6 +138,11 @@ protected:
         Timer::ptr timer;
 
         virtual void doRsp();
+
+        /**
+         * @brief 放回对象池前清理，子类要清理自己的成员并调用基类
+         */
+        virtual void reset();
     };
 
 public:
@@ -69,6 +160,21 @@ public:
     void setConnectCb(connect_callback v) { m_connectCb = v;}
     void setDisconnectCb(disconnect_callback v) { m_disconnectCb = v;}
 
+    /**
+     * @brief 单批最大字节数，达到后立即写出；为0时不合并，逐个doSend
+     */
+    uint32_t getWriteBatchBytes() const { return m_writeBatchBytes;}
+    void setWriteBatchBytes(uint32_t v) { m_writeBatchBytes = v;}
+
+    /**
+     * @brief 批量写最多等待的毫秒数，为0时不等待，只合并已经排队的消息
+     * @details 等待用协程定时器实现，精度为毫秒
+     */
+    uint32_t getWriteBatchLatency() const { return m_writeBatchLatency;}
+    void setWriteBatchLatency(uint32_t v) { m_writeBatchLatency = v;}
+
+    WriteStats getWriteStats() const;
+
     template<class T>
     void setData(const T& v) { m_data = v;}
 
@@ -88,6 +194,9 @@ protected:
     virtual void onTimeOut(Ctx::ptr ctx);
     virtual Ctx::ptr doRecv() = 0;
 
+    /**
+     * @brief 按sn查找在途请求，sn的代数不匹配(已超时或已完成)返回nullptr
+     */
     Ctx::ptr getCtx(uint32_t sn);
     Ctx::ptr getAndDelCtx(uint32_t sn);
 
@@ -109,9 +218,47 @@ protected:
         return nullptr;
     }
 
+    /**
+     * @brief 登记在途请求并分配sn(覆盖ctx->sn)
+     * @details sn由槽位和代数组成，槽位释放时代数加一，迟到的响应对不上代数会被丢弃
+     * @return 在途请求数达到上限返回false
+     */
     bool addCtx(Ctx::ptr ctx);
+
+    /**
+     * @brief 从对象池取Ctx，池里没有时新建
+     */
+    template<class T>
+    std::shared_ptr<T> newCtx() {
+        auto ctx = std::dynamic_pointer_cast<T>(popCtx());
+        return ctx ? ctx : std::make_shared<T>();
+    }
+
+    /**
+     * @brief 请求结束后放回对象池
+     * @details 只回收没有其他引用的Ctx(定时器、读协程都已放手)，调用方要std::move传入
+     */
+    void releaseCtx(Ctx::ptr ctx);
+
+    /**
+     * @brief 在途请求数
+     */
+    size_t getCtxCount();
+
     bool enqueue(SendCtx::ptr ctx);
 
+    /**
+     * @brief 发送写队列里取出的消息，批量写时在延迟上限内继续收集新入队的消息
+     * @return 写失败返回false
+     */
+    bool sendBatch(std::list<SendCtx::ptr>& ctxs, WriteBuffer::ptr buffer);
+
+    /**
+     * @brief 写出批量写缓冲
+     * @param[in] messages 缓冲里的消息数，用于统计
+     */
+    bool flushBatch(WriteBuffer::ptr buffer, size_t messages);
+
     bool innerClose();
     bool waitFiber();
 protected:
@@ -119,8 +266,49 @@ protected:
     sylar::FiberSemaphore m_waitSem;
     RWMutexType m_queueMutex;
     std::list<SendCtx::ptr> m_queue;
-    RWMutexType m_mutex;
-    std::unordered_map<uint32_t, Ctx::ptr> m_ctxs;
+
+    /// sn的低4位是分片，接着12位是分片内槽位，高16位是代数
+    static const uint32_t CTX_SHARD_BITS = 4;
+    static const uint32_t CTX_SLOT_BITS = 12;
+    static const uint32_t CTX_SHARD_COUNT = 1 << CTX_SHARD_BITS;
+    static const uint32_t CTX_MAX_SLOTS = 1 << CTX_SLOT_BITS;
+
+    static uint32_t SnShard(uint32_t sn) { return sn & (CTX_SHARD_COUNT - 1);}
+    static uint32_t SnSlot(uint32_t sn) { return (sn >> CTX_SHARD_BITS) & (CTX_MAX_SLOTS - 1);}
+    static uint32_t SnGen(uint32_t sn) { return sn >> (CTX_SHARD_BITS + CTX_SLOT_BITS);}
+
+    /**
+     * @brief 上下文表的一个槽位
+     */
+    struct CtxSlot {
+        /// 代数，从1开始，槽位释放时加一
+        uint32_t gen;
+        /// 空闲链表的下一个槽位
+        int32_t next;
+        Ctx::ptr ctx;
+    };
+
+    /**
+     * @brief 上下文表分片，各自一把锁，请求方、读协程、超时只锁sn所在的分片
+     */
+    struct CtxShard {
+        Spinlock mutex;
+        std::vector<CtxSlot> slots;
+        /// 空闲槽位链表头，-1为空
+        int32_t freeHead = -1;
+        size_t size = 0;
+        /// 回收的Ctx
+        std::vector<Ctx::ptr> pool;
+    };
+
+    Ctx::ptr popCtx();
+    /**
+     * @brief 释放槽位，代数加一，调用方持有分片锁
+     */
+    void freeSlot(CtxShard& shard, uint32_t idx);
+
+    CtxShard m_ctxShards[CTX_SHARD_COUNT];
+    std::atomic<uint32_t> m_ctxShardIdx {0};
 
     uint32_t m_sn;
     bool m_autoConnect;
@@ -132,6 +320,16 @@ protected:
     disconnect_callback m_disconnectCb;
 
     boost::any m_data;
+
+    uint32_t m_writeBatchBytes;
+    uint32_t m_writeBatchLatency;
+    std::atomic<uint64_t> m_batches {0};
+    std::atomic<uint64_t> m_batchMessages {0};
+    std::atomic<uint64_t> m_batchBytes {0};
+    std::atomic<uint64_t> m_directSends {0};
+    std::atomic<uint64_t> m_maxBatchMessages {0};
+    std::atomic<uint64_t> m_maxBatchBytes {0};
+    std::atomic<uint64_t> m_batchHistogram[8];
 };
 
 class AsyncSocketStreamManager {
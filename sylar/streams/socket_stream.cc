@@ -45,6 +45,56 @@ int SocketStream::write(const void* buffer, size_t length) {
     return m_socket->send(buffer, length);
 }
 
+int SocketStream::writevFixSize(iovec* buffers, size_t count) {
+    if(!isConnected()) {
+        return -1;
+    }
+    size_t total = 0;
+    for(size_t i = 0; i < count; ++i) {
+        total += buffers[i].iov_len;
+    }
+    while(count > 0) {
+        // 跳过已经写完的块
+        if(buffers->iov_len == 0) {
+            ++buffers;
+            --count;
+            continue;
+        }
+        int rt = m_socket->send(buffers, count);
+        if(rt <= 0) {
+            return rt;
+        }
+        size_t n = rt;
+        while(count > 0 && n >= buffers->iov_len) {
+            n -= buffers->iov_len;
+            ++buffers;
+            --count;
+        }
+        if(count > 0) {
+            buffers->iov_base = (char*)buffers->iov_base + n;
+            buffers->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+int64_t SocketStream::sendFileFixSize(int fd, uint64_t offset, uint64_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    off_t off = offset;
+    uint64_t left = length;
+    while(left > 0) {
+        // sendfile单次最多发送0x7ffff000字节
+        int rt = m_socket->sendFile(fd, &off, std::min(left, (uint64_t)0x7ffff000));
+        if(rt <= 0) {
+            return rt;
+        }
+        left -= rt;
+    }
+    return length;
+}
+
 int SocketStream::write(ByteArray::ptr ba, size_t length) {
     if(!isConnected()) {
         return -1;
@@ -77,6 +77,29 @@ public:
      */
     virtual int write(ByteArray::ptr ba, size_t length) override;
 
+    /**
+     * @brief 用writev写入多块数据，直到全部写完
+     * @param[in, out] buffers 待发送的数据块，部分发送时会被修改
+     * @param[in] count 数据块个数
+     * @return
+     *      @retval >0 全部写完，返回总长度
+     *      @retval =0 socket被远端关闭
+     *      @retval <0 socket错误
+     */
+    int writevFixSize(iovec* buffers, size_t count);
+
+    /**
+     * @brief 发送文件的一段内容，直到全部发完
+     * @param[in] fd 文件句柄
+     * @param[in] offset 文件偏移
+     * @param[in] length 发送长度
+     * @return
+     *      @retval >0 全部发完，返回length
+     *      @retval =0 socket被远端关闭或文件被截断
+     *      @retval <0 socket错误
+     */
+    int64_t sendFileFixSize(int fd, uint64_t offset, uint64_t length);
+
     /**
      * @brief 关闭socket
      */
@@ -91,7 +91,13 @@ void TcpServer::startAccept(Socket::ptr sock) {
              * shared_from_this(): 用于保证 TcpServer 对象在异步操作期间不会被销毁。
              * 实际上起作用的是client，即传给 handleClient 的参数为client
              */
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,shared_from_this(), client));
+            if(m_sharedStack) {
+                Fiber::ptr fiber(new Fiber(std::bind(&TcpServer::handleClient,shared_from_this(), client)
+                                           ,0, false, true));
+                m_ioWorker->schedule(fiber);
+            } else {
+                m_ioWorker->schedule(std::bind(&TcpServer::handleClient,shared_from_this(), client));
+            }
         } else {
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno << " errstr=" << strerror(errno);
         }
@@ -153,6 +159,7 @@ std::string TcpServer::toString(const std::string& prefix) {
     std::stringstream ss;
     ss << prefix << "[type=" << m_type
        << " name=" << m_name << " ssl=" << m_ssl
+       << " shared_stack=" << m_sharedStack
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
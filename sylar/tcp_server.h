@@ -28,6 +28,7 @@ struct TcpServerConf {
     int keepalive = 0;                  //keepalive标志
     int timeout = 1000 * 2 * 60;        //超时时间
     int ssl = 0;                        //是否启用sll
+    int shared_stack = 0;               //连接处理协程是否使用共享栈
     std::string id;      
 
     // 服务器类型，http, ws, rock  
@@ -59,6 +60,7 @@ struct TcpServerConf {
             && timeout == oth.timeout
             && name == oth.name
             && ssl == oth.ssl
+            && shared_stack == oth.shared_stack
             && cert_file == oth.cert_file
             && key_file == oth.key_file
             && accept_worker == oth.accept_worker
@@ -88,6 +90,7 @@ public:
         conf.timeout = node["timeout"].as<int>(conf.timeout);
         conf.name = node["name"].as<std::string>(conf.name);
         conf.ssl = node["ssl"].as<int>(conf.ssl);
+        conf.shared_stack = node["shared_stack"].as<int>(conf.shared_stack);
         conf.cert_file = node["cert_file"].as<std::string>(conf.cert_file);
         conf.key_file = node["key_file"].as<std::string>(conf.key_file);
         conf.accept_worker = node["accept_worker"].as<std::string>();
@@ -115,6 +118,7 @@ public:
         node["keepalive"] = conf.keepalive;
         node["timeout"] = conf.timeout;
         node["ssl"] = conf.ssl;
+        node["shared_stack"] = conf.shared_stack;
         node["cert_file"] = conf.cert_file;
         node["key_file"] = conf.key_file;
         node["accept_worker"] = conf.accept_worker;
@@ -211,6 +215,18 @@ public:
      */
     bool isStop() const { return m_isStop;}
 
+    /**
+     * @brief 连接处理协程是否使用共享栈
+     */
+    bool isSharedStack() const { return m_sharedStack;}
+
+    /**
+     * @brief 设置连接处理协程是否使用共享栈
+     * @details 大量空闲长连接时，每个连接只占用实际使用的栈大小，而不是完整的协程栈。
+     *          协程第一次运行后绑定到该线程，不能再被其它线程调度
+     */
+    void setSharedStack(bool v) { m_sharedStack = v;}
+
     /**
      * @brief 获取TcpServerConf
      */
@@ -268,6 +284,8 @@ protected:
     bool m_isStop;
     //是否启用ssl
     bool m_ssl = false;
+    /// 连接处理协程是否使用共享栈
+    bool m_sharedStack = false;
 
     TcpServerConf::ptr m_conf;
 };
@@ -1,8 +1,261 @@
 #include "timer.h"
 #include "util.h"
+#include "config.h"
 #include"log.h"
+#include <string.h>
+#include <algorithm>
 namespace sylar {
 
+static ConfigVar<bool>::ptr g_timer_wheel =
+    Config::Lookup<bool>("timer.wheel", false, "timer manager use hierarchical timing wheel");
+
+/**
+ * @brief 分层时间轮
+ * @details 第0层256个槽，每槽1毫秒；第1~4层各64个槽，每槽分别为2^8、2^14、2^20、2^26毫秒，
+ *          覆盖2^32毫秒(约49天)，更远的定时器放在溢出链表中。
+ *          定时器按到期时间与当前时间所在的块放到对应的层，时间推进到上层槽位的边界时，
+ *          把该槽的定时器重新分配到下层(cascade)。同一层中的槽位只会在当前位置之后，不会回绕。
+ *          插入/删除只需要修改槽位的双向链表和位图，复杂度O(1)。
+ */
+struct TimerManager::TimerWheel {
+    static const int LEVEL0_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 5;
+    static const int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    /// 溢出链表的槽位
+    static const int OVERFLOW_SLOT = LEVEL0_SIZE + (LEVELS - 1) * LEVEL_SIZE;
+    static const int SLOTS = OVERFLOW_SLOT + 1;
+
+    TimerWheel(uint64_t now)
+        :time(now) {
+        memset(slots, 0, sizeof(slots));
+        memset(bits, 0, sizeof(bits));
+        memset(counts, 0, sizeof(counts));
+    }
+
+    /// 第level层每个槽的时间跨度是2^Shift(level)毫秒
+    static int Shift(int level) {
+        return level == 0 ? 0 : LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+    }
+
+    /// 第level层槽位的起始编号
+    static int Base(int level) {
+        return level == 0 ? 0 : LEVEL0_SIZE + (level - 1) * LEVEL_SIZE;
+    }
+
+    static int LevelOf(int slot) {
+        return slot < LEVEL0_SIZE ? 0 : (slot == OVERFLOW_SLOT ? LEVELS
+                : 1 + (slot - LEVEL0_SIZE) / LEVEL_SIZE);
+    }
+
+    /**
+     * @brief 计算到期时间为expire的定时器应该放的槽位
+     */
+    int slotFor(uint64_t expire) const {
+        // 已经到期的放到下一个要处理的槽
+        if(expire < time) {
+            return time & (LEVEL0_SIZE - 1);
+        }
+        if((expire >> LEVEL0_BITS) == (time >> LEVEL0_BITS)) {
+            return expire & (LEVEL0_SIZE - 1);
+        }
+        for(int level = 1; level < LEVELS; ++level) {
+            int shift = Shift(level);
+            int upper = shift + LEVEL_BITS;
+            if((expire >> upper) == (time >> upper)) {
+                return Base(level) + ((expire >> shift) & (LEVEL_SIZE - 1));
+            }
+        }
+        return OVERFLOW_SLOT;
+    }
+
+    void link(Timer* t) {
+        int slot = slotFor(t->m_next);
+        t->m_wheelSlot = slot;
+        t->m_wheelPrev = nullptr;
+        t->m_wheelNext = slots[slot];
+        if(slots[slot]) {
+            slots[slot]->m_wheelPrev = t;
+        }
+        slots[slot] = t;
+        bits[slot >> 6] |= 1ull << (slot & 63);
+        ++counts[LevelOf(slot)];
+        ++size;
+    }
+
+    void unlink(Timer* t) {
+        int slot = t->m_wheelSlot;
+        if(t->m_wheelPrev) {
+            t->m_wheelPrev->m_wheelNext = t->m_wheelNext;
+        } else {
+            slots[slot] = t->m_wheelNext;
+            if(!slots[slot]) {
+                bits[slot >> 6] &= ~(1ull << (slot & 63));
+            }
+        }
+        if(t->m_wheelNext) {
+            t->m_wheelNext->m_wheelPrev = t->m_wheelPrev;
+        }
+        t->m_wheelPrev = t->m_wheelNext = nullptr;
+        t->m_wheelSlot = -1;
+        --counts[LevelOf(slot)];
+        --size;
+    }
+
+    /**
+     * @brief 取出一个槽的所有定时器
+     */
+    Timer* take(int slot) {
+        Timer* head = slots[slot];
+        if(!head) {
+            return nullptr;
+        }
+        slots[slot] = nullptr;
+        bits[slot >> 6] &= ~(1ull << (slot & 63));
+        int level = LevelOf(slot);
+        for(Timer* t = head; t; t = t->m_wheelNext) {
+            t->m_wheelSlot = -1;
+            --counts[level];
+            --size;
+        }
+        return head;
+    }
+
+    /**
+     * @brief 重新分配一个槽中的定时器
+     */
+    void cascade(int slot) {
+        Timer* t = take(slot);
+        while(t) {
+            Timer* next = t->m_wheelNext;
+            link(t);
+            t = next;
+        }
+    }
+
+    /**
+     * @brief time到达上层槽位的边界时，从高到低重新分配上层当前槽位的定时器
+     */
+    void cascadeAll() {
+        for(int level = LEVELS - 1; level >= 1; --level) {
+            int shift = Shift(level);
+            if(time & ((1ull << shift) - 1)) {
+                continue;
+            }
+            if(level == LEVELS - 1 && counts[LEVELS]) {
+                cascade(OVERFLOW_SLOT);
+            }
+            if(counts[level]) {
+                cascade(Base(level) + ((time >> shift) & (LEVEL_SIZE - 1)));
+            }
+        }
+    }
+
+    /**
+     * @brief 时间往回调整后，以now为当前时间重新分配所有定时器
+     * @details time停在now之后时，比time早到期的定时器都会放到time所在的槽，
+     *          要等时间重新追上time才会处理，所以只要往回调整就要重新分配
+     */
+    void rebase(uint64_t now) {
+        if(now + 1 >= time) {
+            return;
+        }
+        Timer* list = nullptr;
+        for(int i = 0; size && i < SLOTS; ++i) {
+            Timer* t = take(i);
+            while(t) {
+                Timer* next = t->m_wheelNext;
+                t->m_wheelNext = list;
+                list = t;
+                t = next;
+            }
+        }
+        time = now;
+        while(list) {
+            Timer* next = list->m_wheelNext;
+            link(list);
+            list = next;
+        }
+    }
+
+    /**
+     * @brief 在[from, to)范围内找第一个非空的槽位
+     * @return 没有返回-1
+     */
+    int findSlot(int from, int to) const {
+        while(from < to) {
+            uint64_t word = bits[from >> 6] & (~0ull << (from & 63));
+            if(word) {
+                int slot = (from & ~63) + __builtin_ctzll(word);
+                return slot < to ? slot : -1;
+            }
+            from = (from & ~63) + 64;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief 最近一个定时器的到期时间，上层的定时器返回所在槽位的起始时间
+     */
+    uint64_t nearest() const {
+        if(!size) {
+            return ~0ull;
+        }
+        if(counts[0]) {
+            int slot = findSlot(time & (LEVEL0_SIZE - 1), LEVEL0_SIZE);
+            if(slot >= 0) {
+                return (time & ~(uint64_t)(LEVEL0_SIZE - 1)) + slot;
+            }
+        }
+        for(int level = 1; level < LEVELS; ++level) {
+            if(!counts[level]) {
+                continue;
+            }
+            int slot = findSlot(Base(level), Base(level) + LEVEL_SIZE);
+            if(slot >= 0) {
+                int shift = Shift(level);
+                int upper = shift + LEVEL_BITS;
+                return ((time >> upper) << upper) + ((uint64_t)(slot - Base(level)) << shift);
+            }
+        }
+        // 溢出链表在最高层的下一个边界重新分配
+        int shift = Shift(LEVELS - 1);
+        return ((time >> shift) + 1) << shift;
+    }
+
+    /**
+     * @brief 没有需要逐毫秒处理的定时器时，跳到下一个需要cascade的边界
+     */
+    uint64_t nextEventTime() const {
+        if(counts[0]) {
+            return time;
+        }
+        for(int level = 1; level <= LEVELS; ++level) {
+            if(counts[level]) {
+                uint64_t mask = (1ull << Shift(std::min(level, LEVELS - 1))) - 1;
+                return (time + mask) & ~mask;
+            }
+        }
+        return ~0ull;
+    }
+
+    /// 锁，所有操作都是O(1)，使用自旋锁
+    Spinlock mutex;
+    /// 下一个要处理的时间(毫秒)，之前的都已经处理过
+    uint64_t time;
+    /// 定时器总数
+    size_t size = 0;
+    /// 最近一次getNextTimer返回的到期时间，用于判断是否需要onTimerInsertedAtFront
+    uint64_t nearestTime = ~0ull;
+    /// 槽位链表
+    Timer* slots[SLOTS];
+    /// 槽位是否非空的位图
+    uint64_t bits[(SLOTS + 63) / 64];
+    /// 每层的定时器数量，最后一个为溢出链表
+    size_t counts[LEVELS + 1];
+};
+
 bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const {
     if(!lhs && !rhs) {
         return false;
@@ -26,7 +279,7 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs)
 Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
     :m_recurring(recurring)
     ,m_ms(ms)
-    ,m_cb(cb)
+    ,m_cb(std::move(cb))
     ,m_manager(manager) {
     
     // 执行时间为当前时间+执行周期
@@ -39,6 +292,21 @@ Timer::Timer(uint64_t next)
 
 
 bool Timer::cancel() {
+    if(m_manager->m_wheel) {
+        TimerManager::TimerWheel* wheel = m_manager->m_wheel;
+        Spinlock::Lock lock(wheel->mutex);
+        if(!m_cb) {
+            return false;
+        }
+        m_cb = nullptr;
+        if(m_wheelSlot >= 0) {
+            wheel->unlink(this);
+        }
+        Timer::ptr self;
+        self.swap(m_wheelSelf);
+        lock.unlock();
+        return true;
+    }
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if(m_cb) {
         m_cb = nullptr;
@@ -51,6 +319,19 @@ bool Timer::cancel() {
 }
 
 bool Timer::refresh() {
+    if(m_manager->m_wheel) {
+        TimerManager::TimerWheel* wheel = m_manager->m_wheel;
+        Spinlock::Lock lock(wheel->mutex);
+        if(!m_cb || m_wheelSlot < 0) {
+            return false;
+        }
+        uint64_t now_ms = sylar::GetCurrentMS();
+        wheel->rebase(now_ms);
+        wheel->unlink(this);
+        m_next = now_ms + m_ms;
+        wheel->link(this);
+        return true;
+    }
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if(!m_cb) {
         return false;
@@ -72,6 +353,29 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     if(ms == m_ms && !from_now) {
         return true;
     }
+    if(m_manager->m_wheel) {
+        TimerManager::TimerWheel* wheel = m_manager->m_wheel;
+        Spinlock::Lock lock(wheel->mutex);
+        if(!m_cb || m_wheelSlot < 0) {
+            return false;
+        }
+        uint64_t now_ms = sylar::GetCurrentMS();
+        wheel->rebase(now_ms);
+        wheel->unlink(this);
+        uint64_t start = from_now ? now_ms : m_next - m_ms;
+        m_ms = ms;
+        m_next = start + m_ms;
+        wheel->link(this);
+        bool at_front = false;
+        if(m_next < wheel->nearestTime && !m_manager->m_tickled) {
+            m_manager->m_tickled = at_front = true;
+        }
+        lock.unlock();
+        if(at_front) {
+            m_manager->onTimerInsertedAtFront();
+        }
+        return true;
+    }
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if(!m_cb) {
         return false;
@@ -103,16 +407,45 @@ bool Timer::reset(uint64_t ms, bool from_now) {
 
 }
 
-TimerManager::TimerManager() {
+TimerManager::TimerManager()
+    :TimerManager(g_timer_wheel->getValue() ? WHEEL : SET) {
+}
+
+TimerManager::TimerManager(Type type) {
     m_previouseTime = sylar::GetCurrentMS();
+    if(type == WHEEL) {
+        m_wheel = new TimerWheel(m_previouseTime);
+    }
 }
 
 TimerManager::~TimerManager() {
+    if(m_wheel) {
+        // 释放定时器对自身的引用
+        for(int i = 0; i < TimerWheel::SLOTS; ++i) {
+            Timer* t = m_wheel->take(i);
+            while(t) {
+                Timer* next = t->m_wheelNext;
+                t->m_wheelNext = nullptr;
+                t->m_wheelSelf.reset();
+                t = next;
+            }
+        }
+        delete m_wheel;
+    }
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,bool recurring) {
-    // 创建定时器
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    // 创建定时器，使用make_shared让定时器和引用计数只分配一次内存
+    struct TimerImpl : public Timer {
+        TimerImpl(uint64_t ms, std::function<void()>&& cb, bool recurring, TimerManager* manager)
+            :Timer(ms, std::move(cb), recurring, manager) {
+        }
+    };
+    Timer::ptr timer = std::make_shared<TimerImpl>(ms, std::move(cb), recurring, this);
+    if(m_wheel) {
+        wheelAdd(timer);
+        return timer;
+    }
     RWMutexType::WriteLock lock(m_mutex);
     addTimer(timer, lock);
     return timer;
@@ -133,6 +466,9 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
 }
 
 uint64_t TimerManager::getNextTimer() {
+    if(m_wheel) {
+        return wheelNextTimer();
+    }
     RWMutexType::ReadLock lock(m_mutex);
     
     // 不触发 onTimerInsertedAtFront
@@ -159,6 +495,10 @@ uint64_t TimerManager::getNextTimer() {
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
+    if(m_wheel) {
+        wheelListExpired(cbs);
+        return;
+    }
     // 获得当前时间
     uint64_t now_ms = sylar::GetCurrentMS();
     std::vector<Timer::ptr> expired;
@@ -246,8 +586,118 @@ bool TimerManager::detectClockRollover(uint64_t now_ms) {
 }
 
 bool TimerManager::hasTimer() {
+    if(m_wheel) {
+        Spinlock::Lock lock(m_wheel->mutex);
+        return m_wheel->size > 0;
+    }
     RWMutexType::ReadLock lock(m_mutex);
     return !m_timers.empty();
 }
 
+void TimerManager::wheelAdd(Timer::ptr timer) {
+    Timer* t = timer.get();
+    Spinlock::Lock lock(m_wheel->mutex);
+    m_wheel->rebase(sylar::GetCurrentMS());
+    m_wheel->link(t);
+    t->m_wheelSelf.swap(timer);
+    // 比idle正在等待的定时器更早，需要唤醒重新计算超时时间
+    bool at_front = false;
+    if(t->m_next < m_wheel->nearestTime && !m_tickled) {
+        m_tickled = at_front = true;
+    }
+    lock.unlock();
+    if(at_front) {
+        onTimerInsertedAtFront();
+    }
+}
+
+uint64_t TimerManager::wheelNextTimer() {
+    Spinlock::Lock lock(m_wheel->mutex);
+    m_tickled = false;
+    uint64_t now_ms = sylar::GetCurrentMS();
+    m_wheel->rebase(now_ms);
+    uint64_t next = m_wheel->nearest();
+    m_wheel->nearestTime = next;
+    if(next == ~0ull) {
+        return ~0ull;
+    }
+    return now_ms >= next ? 0 : next - now_ms;
+}
+
+void TimerManager::wheelListExpired(std::vector<std::function<void()> >& cbs) {
+    TimerWheel* wheel = m_wheel;
+    // 到期的定时器，通过m_wheelNext串起来，一次加锁全部取出
+    Timer* expired = nullptr;
+    Timer* tail = nullptr;
+    auto append = [&expired, &tail](Timer* list) {
+        if(!list) {
+            return;
+        }
+        if(tail) {
+            tail->m_wheelNext = list;
+        } else {
+            expired = list;
+        }
+        tail = list;
+        while(tail->m_wheelNext) {
+            tail = tail->m_wheelNext;
+        }
+    };
+
+    Spinlock::Lock lock(wheel->mutex);
+    // 在锁内取时间，避免拿到比别的线程已经处理到的time更早的时间
+    uint64_t now_ms = sylar::GetCurrentMS();
+    if(!wheel->size) {
+        wheel->time = now_ms + 1;
+        return;
+    }
+    if(detectClockRollover(now_ms)) {
+        // 时间被调后了，所有定时器都视为到期
+        for(int i = 0; i < TimerWheel::SLOTS; ++i) {
+            append(wheel->take(i));
+        }
+        wheel->time = now_ms + 1;
+    }
+    wheel->rebase(now_ms);
+    while(wheel->time <= now_ms) {
+        uint64_t next = wheel->nextEventTime();
+        if(next > now_ms) {
+            wheel->time = now_ms + 1;
+            break;
+        }
+        wheel->time = next;
+        if(!(wheel->time & (TimerWheel::LEVEL0_SIZE - 1))) {
+            wheel->cascadeAll();
+        }
+        append(wheel->take(wheel->time & (TimerWheel::LEVEL0_SIZE - 1)));
+        ++wheel->time;
+    }
+
+    size_t count = 0;
+    for(Timer* t = expired; t; t = t->m_wheelNext) {
+        ++count;
+    }
+    cbs.reserve(cbs.size() + count);
+    // 先全部取出再处理，循环定时器重新插入时不会影响链表
+    std::vector<Timer::ptr> released;
+    Timer* t = expired;
+    while(t) {
+        Timer* next = t->m_wheelNext;
+        t->m_wheelNext = t->m_wheelPrev = nullptr;
+        if(t->m_recurring) {
+            cbs.push_back(t->m_cb);
+            t->m_next = now_ms + t->m_ms;
+            wheel->link(t);
+        } else {
+            cbs.push_back(std::move(t->m_cb));
+            t->m_cb = nullptr;
+            released.push_back(std::move(t->m_wheelSelf));
+        }
+        t = next;
+    }
+    lock.unlock();
+    // 定时器可能在这里析构，不能持有锁
+    released.clear();
+}
+
 }
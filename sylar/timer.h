@@ -65,6 +65,15 @@ private:
     std::function<void()> m_cb;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
+
+    /// 时间轮槽位链表的前一个定时器
+    Timer* m_wheelPrev = nullptr;
+    /// 时间轮槽位链表的后一个定时器
+    Timer* m_wheelNext = nullptr;
+    /// 所在的时间轮槽位，-1表示不在时间轮中
+    int m_wheelSlot = -1;
+    /// 在时间轮中时持有自身的引用，保证定时器存活
+    Timer::ptr m_wheelSelf;
 private:
 
     /**
@@ -82,6 +91,8 @@ private:
 
 /**
  * @brief 定时器管理器
+ * @details 支持两种存储方式：有序集合(默认)和分层时间轮。
+ *          时间轮的插入/取消/刷新都是O(1)，适合hook中大量短生命周期的超时定时器。
  */
 class TimerManager {
 friend class Timer;
@@ -89,11 +100,28 @@ public:
     /// 读写锁类型
     typedef RWMutex RWMutexType;
 
+    /**
+     * @brief 定时器的存储方式
+     */
+    enum Type {
+        /// 有序集合，插入/取消O(log n)
+        SET = 0,
+        /// 分层时间轮，插入/取消/刷新O(1)，精度1毫秒
+        WHEEL = 1
+    };
+
     /**
      * @brief 构造函数
+     * @details 存储方式由配置timer.wheel决定
      */
     TimerManager();
 
+    /**
+     * @brief 构造函数
+     * @param[in] type 定时器的存储方式
+     */
+    TimerManager(Type type);
+
     /**
      * @brief 析构函数
      */
@@ -131,6 +159,11 @@ public:
      * @brief 是否有定时器
      */
     bool hasTimer();
+
+    /**
+     * @brief 返回定时器的存储方式
+     */
+    Type getTimerType() const { return m_wheel ? WHEEL : SET;}
 protected:
 
     /**
@@ -147,7 +180,23 @@ private:
      * @brief 检测服务器时间是否被调后了
      */
     bool detectClockRollover(uint64_t now_ms);
+
+    /**
+     * @brief 时间轮模式下添加定时器
+     */
+    void wheelAdd(Timer::ptr timer);
+
+    /**
+     * @brief 时间轮模式下的getNextTimer
+     */
+    uint64_t wheelNextTimer();
+
+    /**
+     * @brief 时间轮模式下的listExpiredCb
+     */
+    void wheelListExpired(std::vector<std::function<void()> >& cbs);
 private:
+    struct TimerWheel;
     /// Mutex
     RWMutexType m_mutex;
     /// 定时器集合，即为定时器的最小堆结构，因为set里的元素总是排序过的，所以总是可以很方便地获取到当前的最小定时器。
@@ -156,6 +205,8 @@ private:
     bool m_tickled = false;
     /// 上次执行时间
     uint64_t m_previouseTime = 0;
+    /// 时间轮，为空时使用m_timers
+    TimerWheel* m_wheel = nullptr;
 };
 
 }
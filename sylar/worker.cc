@@ -66,13 +66,14 @@ bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::
         std::string name = i.first;
         int32_t thread_num = sylar::GetParamValue(i.second, "thread_num", 1);
         int32_t worker_num = sylar::GetParamValue(i.second, "worker_num", 1);
+        bool work_stealing = sylar::GetParamValue(i.second, "work_stealing", 0);
 
         for(int32_t x = 0; x < worker_num; ++x) {
             Scheduler::ptr s;
             if(!x) {
-                s = std::make_shared<IOManager>(thread_num, false, name);
+                s = std::make_shared<IOManager>(thread_num, false, name, work_stealing);
             } else {
-                s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x));
+                s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x), work_stealing);
             }
             add(s);
         }
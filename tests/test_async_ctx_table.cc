@@ -0,0 +1,269 @@
+#include "sylar/streams/async_socket_stream.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <signal.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 报文: 4字节sn + 4字节长度 + 内容，请求和响应格式相同
+ */
+struct Packet {
+    uint32_t sn;
+    std::string data;
+};
+
+static bool write_packet(sylar::Stream::ptr stream, const Packet& p) {
+    uint32_t head[2] = {p.sn, (uint32_t)p.data.size()};
+    return stream->writeFixSize(head, sizeof(head)) > 0
+        && (p.data.empty() || stream->writeFixSize(p.data.c_str(), p.data.size()) > 0);
+}
+
+static bool read_packet(sylar::Stream::ptr stream, Packet& p) {
+    uint32_t head[2];
+    if(stream->readFixSize(head, sizeof(head)) <= 0) {
+        return false;
+    }
+    p.sn = head[0];
+    p.data.resize(head[1]);
+    return p.data.empty() || stream->readFixSize(&p.data[0], p.data.size()) > 0;
+}
+
+static std::atomic<int> s_ctx_created {0};
+
+/**
+ * @brief 请求/响应客户端，和RockStream::request的流程一致
+ */
+class Client : public sylar::AsyncSocketStream {
+public:
+    typedef std::shared_ptr<Client> ptr;
+
+    Client(sylar::Socket::ptr sock)
+        :AsyncSocketStream(sock, true) {
+    }
+
+    /**
+     * @param[out] sn 分配到的sn
+     */
+    int request(const std::string& data, uint32_t timeout_ms, std::string& rsp, uint32_t* sn = nullptr) {
+        ReqCtx::ptr ctx = newCtx<ReqCtx>();
+        ctx->data = data;
+        ctx->timeout = timeout_ms;
+        ctx->scheduler = sylar::Scheduler::GetThis();
+        ctx->fiber = sylar::Fiber::GetThis();
+        if(!addCtx(ctx)) {
+            return TOO_MANY_REQUESTS;
+        }
+        if(sn) {
+            *sn = ctx->sn;
+        }
+        ctx->timer = sylar::IOManager::GetThis()->addTimer(timeout_ms,
+                std::bind(&Client::onTimeOut, shared_from_this(), ctx));
+        enqueue(ctx);
+        sylar::Fiber::YieldToHold();
+        int rt = ctx->result;
+        rsp = ctx->rsp;
+        releaseCtx(std::move(ctx));
+        return rt;
+    }
+
+    int getStale() const { return m_stale;}
+    using AsyncSocketStream::getCtxCount;
+protected:
+    struct ReqCtx : public Ctx {
+        typedef std::shared_ptr<ReqCtx> ptr;
+        std::string data;
+        std::string rsp;
+
+        ReqCtx() {
+            ++s_ctx_created;
+        }
+
+        virtual void reset() override {
+            data.clear();
+            rsp.clear();
+            Ctx::reset();
+        }
+
+        virtual bool doSend(AsyncSocketStream::ptr stream) override {
+            return write_packet(stream, Packet{sn, data});
+        }
+    };
+
+    virtual Ctx::ptr doRecv() override {
+        Packet p;
+        if(!read_packet(shared_from_this(), p)) {
+            innerClose();
+            return nullptr;
+        }
+        auto ctx = getAndDelCtxAs<ReqCtx>(p.sn);
+        if(!ctx) {
+            // 超时后迟到的响应
+            ++m_stale;
+            return nullptr;
+        }
+        ctx->result = OK;
+        ctx->rsp = p.data;
+        return ctx;
+    }
+private:
+    std::atomic<int> m_stale {0};
+};
+
+/**
+ * @brief 服务端: 回显内容；"hold"先不回，收到"flush"时先回所有hold的再回flush
+ */
+static void serve(sylar::Socket::ptr sock, sylar::IOManager* iom) {
+    sylar::SocketStream::ptr stream(new sylar::SocketStream(sock));
+    std::vector<Packet> held;
+    Packet p;
+    while(read_packet(stream, p)) {
+        if(p.data == "hold") {
+            held.push_back(p);
+            continue;
+        }
+        if(p.data == "flush") {
+            for(auto& h : held) {
+                write_packet(stream, h);
+            }
+            held.clear();
+        }
+        if(!write_packet(stream, p)) {
+            break;
+        }
+    }
+    stream->close();
+}
+
+/**
+ * @brief 只shutdown，读协程收到EOF后自己close
+ */
+static void stop(Client::ptr client) {
+    ::shutdown(client->getSocket()->getSocket(), SHUT_RDWR);
+}
+
+static Client::ptr make_client(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    sylar::Socket::ptr cs = sylar::Socket::CreateTCPSocket();
+    cs->connect(listener->getLocalAddress());
+    sylar::Socket::ptr ss = listener->accept();
+    iom->schedule([ss, iom](){
+        serve(ss, iom);
+    });
+    Client::ptr client(new Client(cs));
+    client->start();
+    return client;
+}
+
+// 大量在途请求
+void test_concurrent(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    Client::ptr client = make_client(listener, iom);
+    const int fibers = 500;
+    const int n = 20;
+    auto ok = std::make_shared<std::atomic<int> >(0);
+    sylar::FiberSemaphore done;
+    uint64_t start = sylar::GetCurrentUS();
+    for(int i = 0; i < fibers; ++i) {
+        iom->schedule([client, i, n, ok, &done](){
+            for(int j = 0; j < n; ++j) {
+                std::string data = std::to_string(i) + "-" + std::to_string(j);
+                std::string rsp;
+                if(client->request(data, 5000, rsp) == sylar::AsyncSocketStream::OK
+                        && rsp == data) {
+                    ++*ok;
+                }
+            }
+            done.notify();
+        });
+    }
+    for(int i = 0; i < fibers; ++i) {
+        done.wait();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "concurrent requests=" << fibers * n << " used=" << used / 1000
+        << "ms " << (uint64_t)fibers * n * 1000000 / (used + 1) << " req/s"
+        << " ctx_created=" << s_ctx_created;
+    SYLAR_CHECK(*ok == fibers * n);
+    SYLAR_CHECK(client->getCtxCount() == 0 && client->getStale() == 0);
+    stop(client);
+}
+
+// 超时后槽位被复用，迟到的响应对不上代数被丢弃
+void test_stale(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    Client::ptr client = make_client(listener, iom);
+    std::string rsp;
+    uint32_t hold_sn = 0;
+    SYLAR_CHECK(client->request("hold", 50, rsp, &hold_sn) == sylar::AsyncSocketStream::TIMEOUT);
+    SYLAR_CHECK(client->getCtxCount() == 0);
+    // 轮完其他分片，flush落到hold用过的槽位
+    uint32_t sn = 0;
+    for(int i = 0; i < 15; ++i) {
+        SYLAR_CHECK(client->request("x", 1000, rsp, &sn) == 0 && rsp == "x");
+    }
+    uint32_t flush_sn = 0;
+    SYLAR_CHECK(client->request("flush", 1000, rsp, &flush_sn) == 0 && rsp == "flush");
+    SYLAR_LOG_INFO(g_logger) << "hold sn=" << std::hex << hold_sn << " flush sn=" << flush_sn;
+    SYLAR_CHECK(flush_sn != hold_sn && (flush_sn & 0xffff) == (hold_sn & 0xffff));
+    SYLAR_CHECK(client->getStale() == 1);
+    stop(client);
+}
+
+// 请求结束后Ctx回到对象池
+void test_pool(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    Client::ptr client = make_client(listener, iom);
+    std::string rsp;
+    int created = s_ctx_created;
+    for(int i = 0; i < 1000; ++i) {
+        SYLAR_CHECK(client->request("p", 1000, rsp) == 0 && rsp == "p");
+    }
+    SYLAR_LOG_INFO(g_logger) << "1000 requests ctx created=" << s_ctx_created - created;
+    SYLAR_CHECK(s_ctx_created - created <= 16);
+    stop(client);
+}
+
+// 连接断开时在途请求都返回IO_ERROR
+void test_close(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    Client::ptr client = make_client(listener, iom);
+    auto results = std::make_shared<std::vector<int> >();
+    sylar::FiberSemaphore done;
+    for(int i = 0; i < 10; ++i) {
+        iom->schedule([client, results, &done](){
+            std::string rsp;
+            results->push_back(client->request("hold", 5000, rsp));
+            done.notify();
+        });
+    }
+    usleep(50 * 1000);
+    SYLAR_CHECK(client->getCtxCount() == 10);
+    stop(client);
+    for(int i = 0; i < 10; ++i) {
+        done.wait();
+    }
+    for(auto r : *results) {
+        SYLAR_CHECK(r == sylar::AsyncSocketStream::IO_ERROR);
+    }
+    SYLAR_CHECK(client->getCtxCount() == 0);
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    for(int threads : {1, 4}) {
+        sylar::IOManager iom(threads);
+        iom.schedule([&iom, threads](){
+            sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+            listener->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+            listener->listen();
+            test_concurrent(listener, &iom);
+            if(threads == 1) {
+                // 单线程时读协程一定先放手，回收数可预期
+                test_stale(listener, &iom);
+                test_pool(listener, &iom);
+                test_close(listener, &iom);
+            }
+            listener->close();
+        });
+    }
+    return check_result();
+}
@@ -0,0 +1,169 @@
+#include "sylar/sylar.h"
+#include "test_helper.h"
+#include <atomic>
+#include <fstream>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::vector<std::string> read_lines(const std::string& file) {
+    std::vector<std::string> lines;
+    std::ifstream ifs(file);
+    std::string line;
+    while(std::getline(ifs, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// 多线程写入，析构后所有日志都在文件中，且每个线程内部有序
+void test_order(int threads, int count) {
+    std::string file = "/tmp/sylar_async_log_order.log";
+    unlink(file.c_str());
+    sylar::Logger::ptr logger(new sylar::Logger("async_order"));
+    logger->setFormatter("%m%n");
+    logger->addAppender(sylar::LogAppender::ptr(new sylar::AsyncLogAppender(file, 4096)));
+
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger, i, count](){
+            for(int j = 0; j < count; ++j) {
+                SYLAR_LOG_INFO(logger) << i << " " << j;
+            }
+        }, "order_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    logger->clearAppenders();
+
+    std::vector<int> next(threads, 0);
+    auto lines = read_lines(file);
+    SYLAR_CHECK((int)lines.size() == threads * count);
+    for(auto& l : lines) {
+        int t = 0;
+        int n = 0;
+        SYLAR_CHECK(sscanf(l.c_str(), "%d %d", &t, &n) == 2);
+        SYLAR_CHECK(t >= 0 && t < threads && next[t] == n);
+        if(t >= 0 && t < threads) {
+            next[t] = n + 1;
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "order lines=" << lines.size();
+}
+
+// 很小的缓冲区，后台线程来不及写时丢弃并记录条数
+void test_drop() {
+    std::string file = "/tmp/sylar_async_log_drop.log";
+    unlink(file.c_str());
+    sylar::AsyncLogAppender::ptr appender(new sylar::AsyncLogAppender(file, 1024
+                                    ,sylar::AsyncLogAppender::COUNT, 1000));
+    sylar::Logger::ptr logger(new sylar::Logger("async_drop"));
+    logger->setFormatter("%m%n");
+    logger->addAppender(appender);
+    std::string msg(100, 'x');
+    int total = 0;
+    while(total < 10000 || (!appender->getDropped() && total < 10000000)) {
+        SYLAR_LOG_INFO(logger) << msg;
+        ++total;
+    }
+    uint64_t dropped = appender->getDropped();
+    SYLAR_CHECK(dropped > 0);
+    logger->clearAppenders();
+    appender.reset();
+
+    // 丢弃记录可能分多次写入
+    uint64_t written = 0;
+    uint64_t reported = 0;
+    for(auto& l : read_lines(file)) {
+        unsigned long n = 0;
+        if(sscanf(l.c_str(), "AsyncLogAppender dropped %lu log records", &n) == 1) {
+            reported += n;
+        } else {
+            SYLAR_CHECK(l == msg);
+            ++written;
+        }
+    }
+    SYLAR_CHECK(written + dropped == (uint64_t)total);
+    SYLAR_CHECK(reported == dropped);
+    SYLAR_LOG_INFO(g_logger) << "dropped=" << dropped;
+}
+
+// FATAL返回时已经在文件中
+void test_fatal() {
+    std::string file = "/tmp/sylar_async_log_fatal.log";
+    unlink(file.c_str());
+    sylar::Logger::ptr logger(new sylar::Logger("async_fatal"));
+    logger->setFormatter("%p %m%n");
+    logger->addAppender(sylar::LogAppender::ptr(new sylar::AsyncLogAppender(file
+                            ,64 * 1024, sylar::AsyncLogAppender::BLOCK, 10000)));
+    SYLAR_LOG_INFO(logger) << "before";
+    SYLAR_LOG_FATAL(logger) << "boom";
+    auto lines = read_lines(file);
+    SYLAR_CHECK(lines.size() == 2 && lines[1] == "FATAL boom");
+    logger->clearAppenders();
+}
+
+void test_config() {
+    YAML::Node root = YAML::Load(
+        "logs:\n"
+        "  - name: async_conf\n"
+        "    level: info\n"
+        "    appenders:\n"
+        "      - type: AsyncLogAppender\n"
+        "        file: /tmp/sylar_async_log_conf.log\n"
+        "        buffer_size: 8192\n"
+        "        overflow: drop\n"
+        "        flush_interval: 50\n");
+    sylar::Config::LoadFromYaml(root);
+    std::string str = SYLAR_LOG_NAME("async_conf")->toYamlString();
+    SYLAR_CHECK(str.find("AsyncLogAppender") != std::string::npos);
+    SYLAR_CHECK(str.find("overflow: drop") != std::string::npos);
+    SYLAR_CHECK(str.find("buffer_size: 8192") != std::string::npos);
+    SYLAR_LOG_INFO(g_logger) << str;
+    sylar::Config::LoadFromYaml(YAML::Load("logs: []"));
+}
+
+// 对比调用线程上的耗时，max为单次调用的最大耗时
+void bench(const std::string& name, sylar::LogAppender::ptr appender, int threads, int count) {
+    sylar::Logger::ptr logger(new sylar::Logger("bench_" + name));
+    logger->addAppender(appender);
+    std::vector<sylar::Thread::ptr> thrs;
+    std::atomic<uint64_t> max_us {0};
+    uint64_t start = sylar::GetCurrentUS();
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger, count, &max_us](){
+            uint64_t m = 0;
+            for(int j = 0; j < count; ++j) {
+                uint64_t ts = sylar::GetCurrentUS();
+                SYLAR_LOG_INFO(logger) << "bench message " << j;
+                m = std::max(m, sylar::GetCurrentUS() - ts);
+            }
+            uint64_t old = max_us;
+            while(old < m && !max_us.compare_exchange_weak(old, m));
+        }, "bench_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    logger->clearAppenders();
+    SYLAR_LOG_INFO(g_logger) << name << " threads=" << threads << " count=" << count
+        << " used=" << used << "us " << (threads * count * 1000000.0 / used) << "/s"
+        << " max=" << max_us << "us";
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    test_order(4, 10000);
+    test_drop();
+    test_fatal();
+    test_config();
+    for(int t : {1, 4}) {
+        unlink("/tmp/sylar_bench_file.log");
+        unlink("/tmp/sylar_bench_async.log");
+        bench("file", sylar::LogAppender::ptr(new sylar::FileLogAppender("/tmp/sylar_bench_file.log")), t, count);
+        bench("async", sylar::LogAppender::ptr(new sylar::AsyncLogAppender("/tmp/sylar_bench_async.log"
+                        ,1024 * 1024)), t, count);
+    }
+    return check_result();
+}
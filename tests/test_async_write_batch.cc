@@ -0,0 +1,264 @@
+#include "sylar/streams/async_socket_stream.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "sylar/endian.h"
+#include "test_helper.h"
+#include <signal.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 按"4字节长度+内容"发送的测试连接
+ */
+class TestStream : public sylar::AsyncSocketStream {
+public:
+    typedef std::shared_ptr<TestStream> ptr;
+
+    TestStream(sylar::Socket::ptr sock)
+        :AsyncSocketStream(sock, true) {
+    }
+
+    /**
+     * @param[in] batch 是否可以合并
+     * @param[in] fail 发送后断开连接
+     */
+    void send(const std::string& data, bool batch = true, bool fail = false) {
+        MsgCtx::ptr ctx(new MsgCtx);
+        ctx->data = data;
+        ctx->batch = batch;
+        ctx->fail = fail;
+        enqueue(ctx);
+    }
+protected:
+    struct MsgCtx : public SendCtx {
+        typedef std::shared_ptr<MsgCtx> ptr;
+        std::string data;
+        bool batch;
+        bool fail;
+
+        virtual bool doSend(AsyncSocketStream::ptr stream) override {
+            uint32_t len = sylar::byteswapOnLittleEndian((uint32_t)data.size());
+            return stream->writeFixSize(&len, sizeof(len)) > 0
+                && stream->writeFixSize(data.c_str(), data.size()) > 0
+                && !fail;
+        }
+
+        virtual bool canBatch() const override { return batch;}
+
+        virtual bool doSerialize(AsyncSocketStream::ptr stream, WriteBuffer::ptr buffer) override {
+            uint32_t len = sylar::byteswapOnLittleEndian((uint32_t)data.size());
+            buffer->writeFixSize(&len, sizeof(len));
+            if(data.size() > 4096) {
+                // 大消息走ByteArray引用
+                sylar::ByteArray::ptr ba(new sylar::ByteArray);
+                ba->write(data.c_str(), data.size());
+                ba->setPosition(0);
+                buffer->writeFixSize(ba, ba->getReadSize());
+            } else {
+                buffer->writeFixSize(data.c_str(), data.size());
+            }
+            return !fail;
+        }
+    };
+
+    virtual Ctx::ptr doRecv() override {
+        char c;
+        if(read(&c, 1) <= 0) {
+            innerClose();
+        }
+        return nullptr;
+    }
+};
+
+/**
+ * @brief 服务端TestStream和客户端socket
+ */
+struct Peer {
+    TestStream::ptr stream;
+    sylar::SocketStream::ptr client;
+
+    void close() {
+        ::shutdown(client->getSocket()->getSocket(), SHUT_RDWR);
+        client->close();
+    }
+};
+
+static Peer make_peer(sylar::Socket::ptr listener) {
+    Peer peer;
+    sylar::Socket::ptr cs = sylar::Socket::CreateTCPSocket();
+    cs->connect(listener->getLocalAddress());
+    peer.stream.reset(new TestStream(listener->accept()));
+    peer.client.reset(new sylar::SocketStream(cs));
+    peer.stream->start();
+    return peer;
+}
+
+/**
+ * @brief 读n条消息，遇到EOF提前返回
+ */
+static std::vector<std::string> recv_msgs(sylar::SocketStream::ptr client, size_t n) {
+    std::vector<std::string> msgs;
+    while(msgs.size() < n) {
+        uint32_t len = 0;
+        if(client->readFixSize(&len, sizeof(len)) <= 0) {
+            break;
+        }
+        std::string data(sylar::byteswapOnLittleEndian(len), '\0');
+        if(!data.empty() && client->readFixSize(&data[0], data.size()) <= 0) {
+            break;
+        }
+        msgs.push_back(data);
+    }
+    return msgs;
+}
+
+static std::string make_msg(int i) {
+    std::string m = std::to_string(i) + ":";
+    // 混合大小，部分超过WriteBuffer的拷贝阈值
+    m.resize(i % 100 == 7 ? 20000 : 16 + i % 50, 'a' + i % 26);
+    return m;
+}
+
+static uint64_t histogram_sum(const sylar::AsyncSocketStream::WriteStats& s) {
+    uint64_t n = 0;
+    for(auto i : s.histogram) {
+        n += i;
+    }
+    return n;
+}
+
+// 连续入队的消息合并写出，顺序和内容不变
+void test_order(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    Peer peer = make_peer(listener);
+    const int n = 1000;
+    for(int i = 0; i < n; ++i) {
+        // 不可合并的消息夹在中间也保持顺序
+        peer.stream->send(make_msg(i), i % 97 != 5);
+    }
+    auto msgs = recv_msgs(peer.client, n);
+    SYLAR_CHECK(msgs.size() == (size_t)n);
+    for(size_t i = 0; i < msgs.size(); ++i) {
+        if(msgs[i] != make_msg(i)) {
+            SYLAR_CHECK(msgs[i] == make_msg(i));
+            break;
+        }
+    }
+    auto stats = peer.stream->getWriteStats();
+    SYLAR_LOG_INFO(g_logger) << "order: batches=" << stats.batches << " messages=" << stats.messages
+        << " direct=" << stats.direct << " bytes=" << stats.bytes
+        << " max_messages=" << stats.maxMessages << " max_bytes=" << stats.maxBytes;
+    SYLAR_CHECK(stats.messages + stats.direct == (uint64_t)n);
+    SYLAR_CHECK(stats.direct == 11);
+    SYLAR_CHECK(stats.batches < stats.messages / 10);
+    SYLAR_CHECK(histogram_sum(stats) == stats.batches);
+    SYLAR_CHECK(stats.maxBytes < peer.stream->getWriteBatchBytes() + 20000 + 8);
+    peer.close();
+}
+
+// 单批字节数上限
+void test_batch_bytes(sylar::Socket::ptr listener) {
+    Peer peer = make_peer(listener);
+    peer.stream->setWriteBatchBytes(1024);
+    // 每条100+4字节，10条超过1024写出一次
+    for(int i = 0; i < 100; ++i) {
+        peer.stream->send(std::string(100, 'x'));
+    }
+    SYLAR_CHECK(recv_msgs(peer.client, 100).size() == 100);
+    auto stats = peer.stream->getWriteStats();
+    SYLAR_CHECK(stats.batches == 10 && stats.maxMessages == 10 && stats.maxBytes == 1040);
+    SYLAR_CHECK(stats.histogram[3] == 10);
+
+    // 为0时不合并
+    peer.stream->setWriteBatchBytes(0);
+    for(int i = 0; i < 100; ++i) {
+        peer.stream->send(std::string(100, 'x'));
+    }
+    SYLAR_CHECK(recv_msgs(peer.client, 100).size() == 100);
+    stats = peer.stream->getWriteStats();
+    SYLAR_CHECK(stats.batches == 10 && stats.direct == 100);
+    peer.close();
+}
+
+// 在延迟上限内等后续消息
+void test_latency(sylar::Socket::ptr listener) {
+    for(uint32_t latency : {0u, 50u}) {
+        Peer peer = make_peer(listener);
+        peer.stream->setWriteBatchLatency(latency);
+        uint64_t start = sylar::GetCurrentMS();
+        for(int i = 0; i < 10; ++i) {
+            peer.stream->send(make_msg(i));
+            usleep(2 * 1000);
+        }
+        SYLAR_CHECK(recv_msgs(peer.client, 10).size() == 10);
+        uint64_t used = sylar::GetCurrentMS() - start;
+        auto stats = peer.stream->getWriteStats();
+        SYLAR_LOG_INFO(g_logger) << "latency=" << latency << "ms batches=" << stats.batches
+            << " used=" << used << "ms";
+        if(latency) {
+            SYLAR_CHECK(stats.batches == 1 && stats.maxMessages == 10);
+            SYLAR_CHECK(used >= 45 && used < 200);
+        } else {
+            SYLAR_CHECK(stats.batches == 10);
+        }
+        peer.close();
+    }
+}
+
+// 序列化失败: 之前的消息(包括失败的这条已经写入缓冲的部分)写出后断开
+void test_fail(sylar::Socket::ptr listener) {
+    Peer peer = make_peer(listener);
+    for(int i = 0; i < 10; ++i) {
+        peer.stream->send(make_msg(i), true, i == 5);
+    }
+    auto msgs = recv_msgs(peer.client, 10);
+    SYLAR_CHECK(msgs.size() == 6);
+    SYLAR_CHECK(!msgs.empty() && msgs.back() == make_msg(5));
+    peer.close();
+}
+
+void bench(sylar::Socket::ptr listener) {
+    const int n = 200000;
+    std::string data(64, 'b');
+    for(uint32_t bytes : {0u, 64u * 1024}) {
+        Peer peer = make_peer(listener);
+        peer.stream->setWriteBatchBytes(bytes);
+        uint64_t start = sylar::GetCurrentUS();
+        for(int i = 0; i < n; ++i) {
+            peer.stream->send(data);
+            // 模拟业务逻辑间隙，让写协程有机会运行
+            if(i % 100 == 99) {
+                sylar::Fiber::YieldToReady();
+            }
+        }
+        SYLAR_CHECK(recv_msgs(peer.client, n).size() == (size_t)n);
+        uint64_t used = sylar::GetCurrentUS() - start;
+        auto stats = peer.stream->getWriteStats();
+        SYLAR_LOG_INFO(g_logger) << (bytes ? "batched" : "per message")
+            << " messages=" << n << " used=" << used / 1000 << "ms "
+            << (uint64_t)n * 1000000 / (used + 1) << " msg/s"
+            << " batches=" << stats.batches << " direct=" << stats.direct;
+        peer.close();
+    }
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    {
+        // 单线程: 入队时写协程不会并发运行，批次可预期
+        sylar::IOManager iom(1);
+        iom.schedule([&iom](){
+            sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+            listener->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+            listener->listen();
+            test_order(listener, &iom);
+            test_batch_bytes(listener);
+            test_latency(listener);
+            test_fail(listener);
+            bench(listener);
+            listener->close();
+        });
+    }
+    return check_result();
+}
@@ -0,0 +1,55 @@
+#include "sylar/sylar.h"
+#include "sylar/fiber_stack.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_pool() {
+    // 第一轮全部mmap，第二轮从空闲链表复用
+    for(int n = 0; n < 2; ++n) {
+        std::vector<sylar::Fiber::ptr> fibers;
+        for(int i = 0; i < 100; ++i) {
+            fibers.push_back(std::make_shared<sylar::Fiber>([](){}, 0, true));
+        }
+        for(auto& i : fibers) {
+            i->call();
+        }
+        fibers.clear();
+        std::stringstream ss;
+        sylar::FiberStackPool::Dump(ss);
+        SYLAR_LOG_INFO(g_logger) << "round=" << n << " " << ss.str();
+    }
+}
+
+void test_churn() {
+    uint64_t start = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(4, false, "churn");
+        // 在主线程分配，在调度线程释放
+        for(int i = 0; i < 100000; ++i) {
+            sylar::Fiber::ptr f(new sylar::Fiber([](){}));
+            iom.schedule(&f);
+        }
+    }
+    std::stringstream ss;
+    sylar::FiberStackPool::Dump(ss);
+    SYLAR_LOG_INFO(g_logger) << "churn used=" << (sylar::GetCurrentUS() - start) << "us " << ss.str();
+}
+
+void overflow(volatile int depth) {
+    char buf[1024];
+    memset(buf, depth, sizeof(buf));
+    overflow(depth + buf[depth % 1024]);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::Fiber::GetThis();
+    test_pool();
+    test_churn();
+    if(argc > 1) {
+        // 栈溢出会访问到保护页，直接SIGSEGV
+        sylar::Fiber::ptr f(new sylar::Fiber(std::bind(&overflow, 1), 0, true));
+        f->call();
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "sylar/sylar.h"
+#include "sylar/fiber_context.h"
+#include <ucontext.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const uint64_t s_switch_count = 10000000;
+static const size_t s_stack_size = 128 * 1024;
+
+static ucontext_t s_main_uctx;
+static ucontext_t s_fiber_uctx;
+
+static void ucontext_func() {
+    while(true) {
+        swapcontext(&s_fiber_uctx, &s_main_uctx);
+    }
+}
+
+// swapcontext 每次切换都会调用rt_sigprocmask
+void bench_ucontext() {
+    void* stack = malloc(s_stack_size);
+    getcontext(&s_fiber_uctx);
+    s_fiber_uctx.uc_link = nullptr;
+    s_fiber_uctx.uc_stack.ss_sp = stack;
+    s_fiber_uctx.uc_stack.ss_size = s_stack_size;
+    makecontext(&s_fiber_uctx, &ucontext_func, 0);
+
+    uint64_t start = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i < s_switch_count / 2; ++i) {
+        swapcontext(&s_main_uctx, &s_fiber_uctx);
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "ucontext switch=" << s_switch_count
+        << " used=" << used << "us"
+        << " switches/s=" << (uint64_t)(s_switch_count * 1000000.0 / used);
+    free(stack);
+}
+
+#ifdef SYLAR_HAS_FCONTEXT
+static sylar::fcontext_t s_main_fctx;
+static sylar::fcontext_t s_fiber_fctx;
+
+static void fcontext_func() {
+    while(true) {
+        sylar_swap_fcontext(&s_fiber_fctx, s_main_fctx);
+    }
+}
+
+// 汇编实现的切换，只保存callee-saved寄存器
+void bench_fcontext() {
+    void* stack = malloc(s_stack_size);
+    s_fiber_fctx = sylar::MakeFContext(stack, s_stack_size, &fcontext_func);
+
+    uint64_t start = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i < s_switch_count / 2; ++i) {
+        sylar_swap_fcontext(&s_main_fctx, s_fiber_fctx);
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "fcontext switch=" << s_switch_count
+        << " used=" << used << "us"
+        << " switches/s=" << (uint64_t)(s_switch_count * 1000000.0 / used);
+    free(stack);
+}
+#endif
+
+static sylar::Fiber* s_bench_fiber = nullptr;
+
+// Fiber::call/back，使用编译时选择的实现
+void bench_fiber() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([](){
+        for(uint64_t i = 0; i < s_switch_count / 2; ++i) {
+            s_bench_fiber->back();
+        }
+    }, 0, true));
+    s_bench_fiber = fiber.get();
+
+    uint64_t start = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i < s_switch_count / 2; ++i) {
+        fiber->call();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "Fiber("
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+        << "asm"
+#else
+        << "ucontext"
+#endif
+        << ") switch=" << s_switch_count
+        << " used=" << used << "us"
+        << " switches/s=" << (uint64_t)(s_switch_count * 1000000.0 / used);
+    fiber->call();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    bench_ucontext();
+#ifdef SYLAR_HAS_FCONTEXT
+    bench_fcontext();
+#endif
+    bench_fiber();
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "sylar/http/http_parser.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <map>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static std::string dump(const HeaderMap& m) {
+    std::string str;
+    for(auto& i : m) {
+        str.append(i.first).append("=").append(i.second).append(";");
+    }
+    return str;
+}
+
+void test_map() {
+    HeaderMap m;
+    SYLAR_CHECK(m.empty() && m.begin() == m.end());
+    m.set("Content-Type", "text/html");
+    m.set("Host", "www.sylar.top");
+    m.set("content-type", "text/plain");
+    SYLAR_CHECK(m.size() == 2);
+    SYLAR_CHECK(dump(m) == "Content-Type=text/plain;Host=www.sylar.top;");
+
+    StringRef v;
+    SYLAR_CHECK(m.get("CONTENT-TYPE", v) && v == "text/plain");
+    SYLAR_CHECK(!m.get("Content-Typ", v));
+    SYLAR_CHECK(!m.has("content-length") && m.has("host"));
+
+    // 值变长后追加到arena末尾，位置不变
+    m.set("host", "a-much-longer-host-name.example.com");
+    SYLAR_CHECK(dump(m) == "Content-Type=text/plain;Host=a-much-longer-host-name.example.com;");
+
+    SYLAR_CHECK(m.del("CONTENT-type") && !m.del("content-type"));
+    SYLAR_CHECK(dump(m) == "Host=a-much-longer-host-name.example.com;");
+
+    // 参数指向自身
+    for(auto& i : m) {
+        m.set(i.second.data(), i.second.size(), i.first.data(), i.first.size());
+        break;
+    }
+    SYLAR_CHECK(m.get("A-MUCH-longer-host-name.example.com", v) && v == "Host");
+
+    // 反复覆盖触发整理
+    for(int i = 0; i < 1000; ++i) {
+        m.set("x-seq", std::string(i % 100 + 1, 'a' + i % 26));
+    }
+    SYLAR_CHECK(m.get("X-Seq", v) && v == std::string(100, 'a' + 999 % 26));
+    SYLAR_CHECK(m.size() == 3);
+
+    HeaderMap c = m;
+    m.clear();
+    SYLAR_CHECK(m.empty() && c.size() == 3 && c.has("host"));
+}
+
+void test_request() {
+    std::string data = "GET /index?a=1 HTTP/1.1\r\n"
+                       "Host: www.sylar.top\r\n"
+                       "Content-Length: 5\r\n"
+                       "Connection: keep-alive\r\n"
+                       "X-Dup: 1\r\n"
+                       "x-dup: 2\r\n"
+                       "\r\n"
+                       "hello";
+    HttpRequestParser parser;
+    size_t n = parser.execute(&data[0], data.size());
+    SYLAR_CHECK(parser.isFinished() && !parser.hasError());
+    auto req = parser.getData();
+    SYLAR_CHECK(n == data.size() - 5);
+    SYLAR_CHECK(req->getHeader("HOST") == "www.sylar.top");
+    SYLAR_CHECK(req->getHeaderAs<int>("content-length") == 5);
+    int len = 0;
+    SYLAR_CHECK(req->checkGetHeaderAs("Content-Length", len) && len == 5);
+    SYLAR_CHECK(!req->checkGetHeaderAs("Host", len, -1) && len == -1);
+    SYLAR_CHECK(req->getHeader("x-dup") == "2" && req->getHeaders().size() == 4);
+
+    HttpResponse::ptr rsp(new HttpResponse(0x11, false));
+    rsp->setHeader("Server", "sylar");
+    rsp->setHeader("Connection", "close");
+    rsp->setHeader("Content-Type", "text/plain");
+    rsp->setBody("hi");
+    std::string buf;
+    rsp->serializeHeader(buf);
+    SYLAR_CHECK(buf == "HTTP/1.1 200 OK\r\n"
+                 "Server: sylar\r\n"
+                 "Content-Type: text/plain\r\n"
+                 "connection: keep-alive\r\n"
+                 "content-length: 2\r\n\r\n");
+}
+
+// 解析典型浏览器请求头
+void bench() {
+    const std::string data = "GET /api/v1/items?page=2 HTTP/1.1\r\n"
+                             "Host: www.sylar.top\r\n"
+                             "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+                             "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+                             "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                             "Accept-Encoding: gzip, deflate, br\r\n"
+                             "Cache-Control: max-age=0\r\n"
+                             "Connection: keep-alive\r\n"
+                             "Cookie: sid=0123456789abcdef; theme=dark\r\n"
+                             "Referer: https://www.sylar.top/\r\n"
+                             "Upgrade-Insecure-Requests: 1\r\n"
+                             "\r\n";
+    const int n = 200000;
+    std::string buf;
+    size_t total = 0;
+    uint64_t start = sylar::GetCurrentUS();
+    for(int i = 0; i < n; ++i) {
+        buf = data;
+        HttpRequestParser parser;
+        parser.execute(&buf[0], buf.size());
+        auto req = parser.getData();
+        total += req->getHeader("user-agent").size() + req->getHeader("cookie").size();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "parse " << n << " requests used " << used / 1000 << "ms, "
+        << (used * 1000 / n) << "ns/request total=" << total;
+
+    std::vector<std::pair<std::string, std::string> > fields = {
+        {"Host", "www.sylar.top"}, {"User-Agent", "Mozilla/5.0"}, {"Accept", "*/*"},
+        {"Accept-Language", "zh-CN"}, {"Accept-Encoding", "gzip"}, {"Cache-Control", "max-age=0"},
+        {"Connection", "keep-alive"}, {"Cookie", "sid=1"}, {"Referer", "https://www.sylar.top/"}};
+    start = sylar::GetCurrentUS();
+    for(int i = 0; i < n; ++i) {
+        HeaderMap m;
+        for(auto& f : fields) {
+            m.set(f.first, f.second);
+        }
+        StringRef v;
+        total += m.get("cookie", v) ? v.size() : 0;
+    }
+    uint64_t map_used = sylar::GetCurrentUS() - start;
+    start = sylar::GetCurrentUS();
+    for(int i = 0; i < n; ++i) {
+        std::map<std::string, std::string, CaseInsensitiveLess> m;
+        for(auto& f : fields) {
+            m[f.first] = f.second;
+        }
+        total += m["cookie"].size();
+    }
+    uint64_t std_used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "build+lookup HeaderMap " << (map_used * 1000 / n)
+        << "ns std::map " << (std_used * 1000 / n) << "ns total=" << total;
+}
+
+int main(int argc, char** argv) {
+    test_map();
+    test_request();
+    bench();
+    return check_result();
+}
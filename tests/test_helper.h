@@ -0,0 +1,52 @@
+/**
+ * @file test_helper.h
+ * @brief 测试程序公用的检查宏和辅助函数
+ */
+#ifndef __SYLAR_TESTS_TEST_HELPER_H__
+#define __SYLAR_TESTS_TEST_HELPER_H__
+
+#include "sylar/log.h"
+#include "sylar/socket.h"
+#include "sylar/address.h"
+#include <atomic>
+
+/// 检查失败的次数
+static std::atomic<int> s_error {0};
+
+/**
+ * @brief 检查条件，不满足时记录错误并继续执行
+ * @details 与SYLAR_ASSERT不同，失败后不中止进程，由check_result()汇总
+ */
+#define SYLAR_CHECK(x) \
+    do { \
+        if(!(x)) { \
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "check fail: " #x; \
+            ++s_error; \
+        } \
+    } while(0)
+
+/**
+ * @brief 输出检查结果
+ * @return 全部通过返回0，否则返回1，作为main的返回值
+ */
+static int check_result() {
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "error=" << s_error;
+    return s_error ? 1 : 0;
+}
+
+/**
+ * @brief 在127.0.0.1上建立一对相连的TCP socket
+ * @param[out] client 主动连接的一端
+ * @param[out] server accept得到的一端
+ */
+static void make_socket_pair(sylar::Socket::ptr& client, sylar::Socket::ptr& server) {
+    auto addr = sylar::Address::LookupAny("127.0.0.1:0");
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+    listener->bind(addr);
+    listener->listen();
+    client = sylar::Socket::CreateTCPSocket();
+    client->connect(listener->getLocalAddress());
+    server = listener->accept();
+}
+
+#endif
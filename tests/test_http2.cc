@@ -0,0 +1,519 @@
+#include "sylar/http2/http2_session.h"
+#include "sylar/http2/huffman.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "test_helper.h"
+#include <atomic>
+#include <map>
+#include <signal.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http2;
+using sylar::http::HttpRequest;
+using sylar::http::HttpResponse;
+
+static std::string from_hex(const std::string& hex) {
+    std::string out;
+    int v = -1;
+    for(auto c : hex) {
+        if(c == ' ') {
+            continue;
+        }
+        int d = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        if(v < 0) {
+            v = d;
+        } else {
+            out.push_back((char)(v * 16 + d));
+            v = -1;
+        }
+    }
+    return out;
+}
+
+static std::string big_body() {
+    std::string body(1024 * 1024, 0);
+    for(size_t i = 0; i < body.size(); ++i) {
+        body[i] = (char)(i % 251);
+    }
+    return body;
+}
+
+// RFC 7541 附录C
+void test_hpack() {
+    std::string out;
+    HPack::EncodeInteger(10, 5, 0, out);
+    SYLAR_CHECK(out == from_hex("0a"));
+    out.clear();
+    HPack::EncodeInteger(1337, 5, 0, out);
+    SYLAR_CHECK(out == from_hex("1f9a0a"));
+    uint64_t v = 0;
+    SYLAR_CHECK(HPack::DecodeInteger((const uint8_t*)out.c_str(), out.size(), 5, v) == 3 && v == 1337);
+    SYLAR_CHECK(HPack::DecodeInteger((const uint8_t*)out.c_str(), 2, 5, v) == -1);
+
+    // C.4 使用Huffman的请求，编码结果应该逐字节一致
+    std::vector<std::vector<HeaderField> > requests = {
+        {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}},
+        {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}
+            ,{"cache-control", "no-cache"}},
+        {{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}
+            ,{":authority", "www.example.com"}, {"custom-key", "custom-value"}},
+    };
+    std::vector<std::string> wires = {
+        from_hex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"),
+        from_hex("8286 84be 5886 a8eb 1064 9cbf"),
+        from_hex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"),
+    };
+    std::vector<uint32_t> sizes = {57, 110, 164};
+    DynamicTable etable;
+    HPack encoder(etable);
+    DynamicTable dtable;
+    HPack decoder(dtable);
+    for(size_t i = 0; i < requests.size(); ++i) {
+        std::string block;
+        encoder.pack(requests[i], block);
+        SYLAR_CHECK(block == wires[i]);
+        std::vector<HeaderField> headers;
+        SYLAR_CHECK(decoder.parse((const uint8_t*)wires[i].c_str(), wires[i].size(), headers) == 0);
+        SYLAR_CHECK(headers.size() == requests[i].size());
+        for(size_t j = 0; j < headers.size() && j < requests[i].size(); ++j) {
+            SYLAR_CHECK(headers[j].name == requests[i][j].name && headers[j].value == requests[i][j].value);
+        }
+        SYLAR_CHECK(dtable.getSize() == sizes[i] && etable.getSize() == sizes[i]);
+    }
+
+    // 不合法的头部块: 索引0、越界索引、截断的字符串
+    std::vector<HeaderField> headers;
+    for(auto& bad : {from_hex("80"), from_hex("ff00"), from_hex("4085f1e3")}) {
+        SYLAR_CHECK(decoder.parse((const uint8_t*)bad.c_str(), bad.size(), headers) == -1);
+    }
+
+    // 超过32位的索引不能被截断成小索引(2^32+2截断后是:method GET)
+    std::string big;
+    HPack::EncodeInteger(((uint64_t)1 << 32) + 2, 7, 0x80, big);
+    SYLAR_CHECK(HPack::DecodeInteger((const uint8_t*)big.c_str(), big.size(), 7, v) > 0
+            && v == ((uint64_t)1 << 32) + 2);
+    headers.clear();
+    SYLAR_CHECK(decoder.parse((const uint8_t*)big.c_str(), big.size(), headers) == -1);
+    big.clear();
+    HPack::EncodeInteger(((uint64_t)1 << 32) + 2, 4, 0x00, big);
+    HPack::EncodeString("v", big);
+    SYLAR_CHECK(decoder.parse((const uint8_t*)big.c_str(), big.size(), headers) == -1);
+    // 动态表之外的索引
+    big.clear();
+    HPack::EncodeInteger(DynamicTable::STATIC_SIZE + dtable.getCount() + 1, 7, 0x80, big);
+    SYLAR_CHECK(decoder.parse((const uint8_t*)big.c_str(), big.size(), headers) == -1);
+    SYLAR_CHECK(headers.empty());
+
+    // HPACK炸弹: 1字节的索引引用一个大的动态表项，解码后的大小受max_list_size限制
+    DynamicTable bomb_table;
+    HPack bomb_decoder(bomb_table);
+    std::string bomb;
+    bomb.push_back((char)0x40);
+    HPack::EncodeString("x", bomb);
+    HPack::EncodeString(std::string(4000, 'a'), bomb);
+    bomb.append(1000, (char)0xbe);      // 索引62，刚插入的项
+    headers.clear();
+    SYLAR_CHECK(bomb_decoder.parse((const uint8_t*)bomb.c_str(), bomb.size(), headers
+                , 4096, 64 * 1024) == -2);
+    SYLAR_CHECK(headers.size() < 20);
+    // 限制之内的正常解码，每项按name+value+32计算
+    headers.clear();
+    std::string small = from_hex("8286");
+    SYLAR_CHECK(bomb_decoder.parse((const uint8_t*)small.c_str(), small.size(), headers
+                , 4096, (7 + 3 + 32) + (7 + 4 + 32)) == 0 && headers.size() == 2);
+    headers.clear();
+    SYLAR_CHECK(bomb_decoder.parse((const uint8_t*)small.c_str(), small.size(), headers
+                , 4096, (7 + 3 + 32) + (7 + 4 + 32) - 1) == -2);
+    headers.clear();
+
+    // 动态表大小更新不能超过SETTINGS_HEADER_TABLE_SIZE
+    DynamicTable table2;
+    HPack decoder2(table2);
+    std::string update = from_hex("3fe11f");   // 4096
+    SYLAR_CHECK(decoder2.parse((const uint8_t*)update.c_str(), update.size(), headers) == 0);
+    SYLAR_CHECK(decoder2.parse((const uint8_t*)update.c_str(), update.size(), headers, 100) == -1);
+
+    // 敏感字段不加入动态表
+    DynamicTable table3;
+    HPack encoder3(table3);
+    out.clear();
+    encoder3.pack({{"authorization", "secret"}, {"x-a", "b"}}, out);
+    SYLAR_CHECK(table3.getCount() == 1);
+}
+
+void test_huffman() {
+    std::string raw = "www.example.com";
+    std::string out;
+    Huffman::EncodeString(raw, out);
+    SYLAR_CHECK(out == from_hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+    SYLAR_CHECK(Huffman::EncodeLen(raw) == out.size());
+    std::string decoded;
+    SYLAR_CHECK(Huffman::DecodeString((const uint8_t*)out.c_str(), out.size(), decoded));
+    SYLAR_CHECK(decoded == raw);
+
+    for(int n = 0; n < 200; ++n) {
+        std::string s;
+        for(int i = 0; i < n * 3; ++i) {
+            s.push_back((char)(rand() % 256));
+        }
+        std::string e;
+        std::string d;
+        Huffman::EncodeString(s, e);
+        SYLAR_CHECK(Huffman::DecodeString((const uint8_t*)e.c_str(), e.size(), d) && d == s);
+    }
+    // 填充超过7位或不是全1
+    std::string bad = from_hex("ffffffff");
+    SYLAR_CHECK(!Huffman::DecodeString((const uint8_t*)bad.c_str(), bad.size(), decoded));
+    bad = from_hex("f1e3c2e5f23a6ba0ab90f4fe");
+    SYLAR_CHECK(!Huffman::DecodeString((const uint8_t*)bad.c_str(), bad.size(), decoded));
+}
+
+void test_frame() {
+    FrameHeader h;
+    h.length = 0x123456;
+    h.type = FrameType::HEADERS;
+    h.flags = END_HEADERS | END_STREAM;
+    h.id = 0x80000005;
+    uint8_t buf[FRAME_HEADER_SIZE];
+    h.encode(buf);
+    SYLAR_CHECK(buf[0] == 0x12 && buf[1] == 0x34 && buf[2] == 0x56 && buf[3] == 1 && buf[4] == 5);
+    // 保留位被忽略
+    SYLAR_CHECK(buf[5] == 0 && buf[8] == 5);
+    FrameHeader h2;
+    h2.decode(buf);
+    SYLAR_CHECK(h2.length == h.length && h2.type == h.type && h2.flags == h.flags && h2.id == 5);
+
+    auto f = Frame::CreateWindowUpdate(3, 100);
+    SYLAR_CHECK(f->header.id == 3 && f->data == from_hex("00000064"));
+    f = Frame::CreateGoAway(7, Http2Error::PROTOCOL_ERROR, "x");
+    SYLAR_CHECK(f->data == from_hex("00000007 00000001 78"));
+}
+
+static void handler(HttpRequest::ptr req, HttpResponse::ptr rsp) {
+    const std::string& path = req->getPath();
+    if(path == "/hello") {
+        rsp->setHeader("Content-Type", "text/plain");
+        rsp->setBody("hello " + req->getQuery());
+    } else if(path == "/big") {
+        static std::string s_big = big_body();
+        rsp->setBody(s_big);
+    } else if(path == "/echo") {
+        rsp->setHeader("X-Method", sylar::http::HttpMethodToString(req->getMethod()));
+        rsp->setBody(req->getBody());
+    } else if(path == "/cookie") {
+        rsp->setCookie("sid", "1");
+        rsp->setBody(req->getHeader("cookie") + "|" + req->getHeader("host"));
+    } else {
+        rsp->setStatus(sylar::http::HttpStatus::NOT_FOUND);
+    }
+}
+
+// 服务端: 模拟HttpServer::handleHttp2
+static void serve(sylar::Socket::ptr sock, const std::string& init_data = "") {
+    Http2Session::ptr session(new Http2Session(sock, init_data));
+    session->setRequestHandler(handler);
+    session->start();
+    session->waitFinish();
+}
+
+/**
+ * @brief 测试用的最小HTTP/2客户端
+ */
+struct Client {
+    struct Response {
+        std::map<std::string, std::string> headers;
+        std::string body;
+        bool done = false;
+        size_t frames = 0;
+    };
+
+    Client(sylar::Socket::ptr sock)
+        :stream(new sylar::SocketStream(sock))
+        ,encoder(etable)
+        ,decoder(dtable) {
+    }
+
+    void send(Frame::ptr frame) {
+        SYLAR_CHECK(FrameCodec::SerializeTo(stream, frame) > 0);
+    }
+
+    // 收到帧后的自动回复，错误用例中服务端可能已经关闭连接，不检查结果
+    void reply(Frame::ptr frame) {
+        FrameCodec::SerializeTo(stream, frame);
+    }
+
+    void sendPreface(const std::vector<std::pair<SettingsId, uint32_t> >& settings = {}) {
+        stream->writeFixSize(CLIENT_PREFACE, CLIENT_PREFACE_SIZE);
+        send(Frame::CreateSettings(settings));
+    }
+
+    void request(uint32_t id, const std::string& method, const std::string& path
+                 ,const std::vector<HeaderField>& extra = {}, bool end_stream = true) {
+        std::vector<HeaderField> headers = {{":method", method}, {":scheme", "http"}
+            ,{":path", path}, {":authority", "test.local"}};
+        headers.insert(headers.end(), extra.begin(), extra.end());
+        std::string block;
+        encoder.pack(headers, block);
+        send(std::make_shared<Frame>(FrameType::HEADERS
+                    , END_HEADERS | (end_stream ? END_STREAM : 0), id, block));
+    }
+
+    /**
+     * @brief 读一个帧并处理，返回nullptr表示连接关闭或超时
+     */
+    Frame::ptr next() {
+        Http2Error error;
+        Frame::ptr f = FrameCodec::ParseFrom(stream, 1 << 24, error);
+        if(!f) {
+            return nullptr;
+        }
+        uint32_t id = f->header.id;
+        switch(f->header.type) {
+            case FrameType::SETTINGS:
+                if(!f->header.hasFlag(ACK)) {
+                    ++settings;
+                    for(size_t i = 0; i + 6 <= f->data.size(); i += 6) {
+                        if(f->data[i + 1] == (char)SettingsId::MAX_FRAME_SIZE) {
+                            maxFrameSize = ((uint8_t)f->data[i + 4] << 8) | (uint8_t)f->data[i + 5];
+                        }
+                    }
+                    reply(Frame::CreateSettingsAck());
+                } else {
+                    ++settingsAck;
+                }
+                break;
+            case FrameType::HEADERS:
+            case FrameType::CONTINUATION:
+                {
+                    block.append(f->data);
+                    if(f->header.type == FrameType::HEADERS) {
+                        headerEnd = f->header.hasFlag(END_STREAM);
+                    }
+                    if(!f->header.hasFlag(END_HEADERS)) {
+                        break;
+                    }
+                    std::vector<HeaderField> headers;
+                    SYLAR_CHECK(decoder.parse((const uint8_t*)block.c_str(), block.size(), headers) == 0);
+                    block.clear();
+                    for(auto& i : headers) {
+                        responses[id].headers[i.name] += i.value;
+                    }
+                    responses[id].done = headerEnd;
+                }
+                break;
+            case FrameType::DATA:
+                responses[id].body.append(f->data);
+                ++responses[id].frames;
+                SYLAR_CHECK(f->data.size() <= 16384);
+                outstanding += f->data.size();
+                SYLAR_CHECK(outstanding <= 65535);
+                if(f->header.hasFlag(END_STREAM)) {
+                    responses[id].done = true;
+                }
+                if(autoUpdate && !f->data.empty()) {
+                    reply(Frame::CreateWindowUpdate(0, f->data.size()));
+                    if(!responses[id].done) {
+                        reply(Frame::CreateWindowUpdate(id, f->data.size()));
+                    }
+                    outstanding -= f->data.size();
+                }
+                break;
+            case FrameType::RST_STREAM:
+                rst[id] = (Http2Error)(uint8_t)f->data[3];
+                break;
+            case FrameType::GOAWAY:
+                goaway = (Http2Error)(uint8_t)f->data[7];
+                break;
+            case FrameType::PING:
+                ping = f->data;
+                break;
+            default:
+                break;
+        }
+        return f;
+    }
+
+    /**
+     * @brief 读到指定的流都结束
+     */
+    bool wait(const std::vector<uint32_t>& ids) {
+        while(true) {
+            bool all = true;
+            for(auto id : ids) {
+                if(!responses[id].done && !rst.count(id)) {
+                    all = false;
+                }
+            }
+            if(all) {
+                return true;
+            }
+            if(!next()) {
+                return false;
+            }
+        }
+    }
+
+    sylar::SocketStream::ptr stream;
+    DynamicTable etable;
+    HPack encoder;
+    DynamicTable dtable;
+    HPack decoder;
+    std::string block;
+    bool headerEnd = false;
+    std::map<uint32_t, Response> responses;
+    std::map<uint32_t, Http2Error> rst;
+    Http2Error goaway = Http2Error::NO_ERROR;
+    std::string ping;
+    int settings = 0;
+    int settingsAck = 0;
+    uint32_t maxFrameSize = 0;
+    /// 连接窗口上还没有归还的字节数
+    size_t outstanding = 0;
+    bool autoUpdate = true;
+};
+
+// 多个流在一个连接上交错
+void test_multiplex(sylar::IOManager* iom) {
+    sylar::Socket::ptr cs, ss;
+    make_socket_pair(cs, ss);
+    iom->schedule(std::bind(serve, ss, ""));
+    Client client(cs);
+    client.sendPreface();
+    // 大响应放在前面，后面的小响应不需要等它发完
+    client.request(1, "GET", "/big");
+    client.request(3, "GET", "/hello?x=1");
+    client.request(5, "POST", "/echo", {{"content-type", "text/plain"}}, false);
+    client.send(std::make_shared<Frame>(FrameType::DATA, 0, 5, "abc"));
+    client.send(std::make_shared<Frame>(FrameType::DATA, END_STREAM | PADDED, 5
+                , std::string("\x02") + "def" + std::string(2, '\0')));
+    client.request(7, "GET", "/cookie", {{"cookie", "a=1"}, {"cookie", "b=2"}});
+    client.request(9, "HEAD", "/hello");
+    client.request(11, "GET", "/none");
+    SYLAR_CHECK(client.wait({1, 3, 5, 7, 9, 11}));
+    SYLAR_CHECK(client.settings == 1 && client.maxFrameSize == 16384);
+
+    auto& big = client.responses[1];
+    SYLAR_CHECK(big.headers[":status"] == "200" && big.body == big_body());
+    SYLAR_CHECK(big.headers["content-length"] == std::to_string(1024 * 1024));
+    SYLAR_CHECK(big.frames >= 64);
+    auto& hello = client.responses[3];
+    SYLAR_CHECK(hello.body == "hello x=1" && hello.headers["content-type"] == "text/plain");
+    SYLAR_CHECK(client.responses[1].frames > 0);
+    auto& echo = client.responses[5];
+    SYLAR_CHECK(echo.body == "abcdef" && echo.headers["x-method"] == "POST");
+    auto& cookie = client.responses[7];
+    SYLAR_CHECK(cookie.body == "a=1; b=2|test.local" && cookie.headers["set-cookie"] == "sid=1");
+    auto& head = client.responses[9];
+    SYLAR_CHECK(head.headers[":status"] == "200" && head.body.empty() && head.frames == 0);
+    SYLAR_CHECK(head.headers["content-length"] == "6");
+    SYLAR_CHECK(client.responses[11].headers[":status"] == "404");
+    for(auto& i : client.responses) {
+        SYLAR_CHECK(i.second.headers.count("connection") == 0);
+    }
+
+    // PING
+    client.send(Frame::CreatePing(false, "12345678"));
+    while(client.ping.empty() && client.next());
+    SYLAR_CHECK(client.ping == "12345678");
+    cs->close();
+}
+
+// 流量控制: 窗口用完后等待WINDOW_UPDATE或SETTINGS
+void test_flow_control(sylar::IOManager* iom) {
+    sylar::Socket::ptr cs, ss;
+    make_socket_pair(cs, ss);
+    // 连接前言由HTTP/1.1解析缓冲区转交
+    iom->schedule(std::bind(serve, ss, std::string(CLIENT_PREFACE, CLIENT_PREFACE_SIZE)));
+    Client client(cs);
+    client.autoUpdate = false;
+    client.send(Frame::CreateSettings({{SettingsId::INITIAL_WINDOW_SIZE, 1000}}));
+    client.request(1, "GET", "/big");
+    cs->setRecvTimeout(300);
+    while(client.next());
+    SYLAR_CHECK(client.responses[1].body.size() == 1000);
+
+    // 调大初始窗口，流窗口按差值增加，连接窗口仍然限制在65535
+    client.send(Frame::CreateSettings({{SettingsId::INITIAL_WINDOW_SIZE, 2 * 1024 * 1024}}));
+    while(client.next());
+    SYLAR_CHECK(client.responses[1].body.size() == 65535);
+
+    client.send(Frame::CreateWindowUpdate(0, 1024 * 1024 - 65535 + 1000));
+    cs->setRecvTimeout(5000);
+    client.outstanding = 0;
+    client.autoUpdate = true;
+    SYLAR_CHECK(client.wait({1}));
+    SYLAR_CHECK(client.responses[1].body == big_body());
+    cs->close();
+}
+
+// 协议错误
+void test_errors(sylar::IOManager* iom) {
+    struct Case {
+        std::function<void(Client&)> send;
+        Http2Error goaway;
+    };
+    std::vector<Case> cases = {
+        {[](Client& c){ c.send(Frame::CreateWindowUpdate(0, 0));}, Http2Error::PROTOCOL_ERROR},
+        {[](Client& c){ c.send(std::make_shared<Frame>(FrameType::HEADERS, END_HEADERS | END_STREAM
+                        , 1, from_hex("80")));}, Http2Error::COMPRESSION_ERROR},
+        {[](Client& c){ c.send(std::make_shared<Frame>(FrameType::HEADERS, END_STREAM, 1
+                        , from_hex("82"))); c.send(Frame::CreatePing(false, "12345678"));}
+                        , Http2Error::PROTOCOL_ERROR},
+        {[](Client& c){ c.send(std::make_shared<Frame>(FrameType::DATA, 0, 1, "x"));}
+                        , Http2Error::PROTOCOL_ERROR},
+        {[](Client& c){ c.send(std::make_shared<Frame>(FrameType::PING, 0, 0, "1234"));}
+                        , Http2Error::FRAME_SIZE_ERROR},
+        // 服务端读完帧头就发送GOAWAY并关闭，负载可能写不完，不检查写入结果
+        {[](Client& c){ FrameCodec::SerializeTo(c.stream, std::make_shared<Frame>(FrameType::DATA
+                        , 0, 1, std::string(20000, 'x')));}, Http2Error::FRAME_SIZE_ERROR},
+        {[](Client& c){ c.request(3, "GET", "/hello"); c.request(1, "GET", "/hello");}
+                        , Http2Error::PROTOCOL_ERROR},
+    };
+    for(auto& i : cases) {
+        sylar::Socket::ptr cs, ss;
+        make_socket_pair(cs, ss);
+        iom->schedule(std::bind(serve, ss, ""));
+        Client client(cs);
+        cs->setRecvTimeout(5000);
+        client.sendPreface();
+        i.send(client);
+        // 发送GOAWAY后关闭连接
+        while(client.next());
+        SYLAR_CHECK(client.goaway == i.goaway);
+        cs->close();
+    }
+
+    // 流错误只重置流，连接继续可用
+    sylar::Socket::ptr cs, ss;
+    make_socket_pair(cs, ss);
+    iom->schedule(std::bind(serve, ss, ""));
+    Client client(cs);
+    cs->setRecvTimeout(5000);
+    client.sendPreface();
+    client.request(1, "GET", "/hello", {{"Upper", "x"}});
+    client.request(3, "GET", "/hello", {{"connection", "close"}});
+    client.request(5, "GET", "/hello");
+    SYLAR_CHECK(client.wait({1, 3, 5}));
+    SYLAR_CHECK(client.rst[1] == Http2Error::PROTOCOL_ERROR && client.rst[3] == Http2Error::PROTOCOL_ERROR);
+    SYLAR_CHECK(client.responses[5].body == "hello ");
+    SYLAR_CHECK(client.goaway == Http2Error::NO_ERROR);
+    cs->close();
+}
+
+int main(int argc, char** argv) {
+    // 错误用例中服务端会先关闭连接，和Application一样忽略SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    test_hpack();
+    test_huffman();
+    test_frame();
+    {
+        sylar::IOManager iom(2);
+        iom.schedule([&iom](){
+            test_multiplex(&iom);
+            test_flow_control(&iom);
+            test_errors(&iom);
+        });
+    }
+    return check_result();
+}
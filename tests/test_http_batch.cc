@@ -0,0 +1,248 @@
+#include "sylar/http/http_connection.h"
+#include "sylar/http/http_session.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <atomic>
+#include <signal.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+/**
+ * @brief 长连接HTTP服务
+ * @details /slow/N 等待N毫秒后响应，/drop 不响应直接关闭连接，其他路径立即响应
+ */
+static void serve(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    while(auto sock = listener->accept()) {
+        iom->schedule([sock](){
+            HttpSession::ptr session(new HttpSession(sock));
+            while(auto req = session->recvRequest()) {
+                const std::string& path = req->getPath();
+                if(path == "/drop") {
+                    break;
+                }
+                if(path.compare(0, 6, "/slow/") == 0) {
+                    usleep(atoi(path.c_str() + 6) * 1000);
+                }
+                auto rsp = req->createResponse();
+                rsp->setBody("ok " + path);
+                session->sendResponse(rsp);
+            }
+            session->close();
+        });
+    }
+}
+
+static std::string base_url(sylar::Socket::ptr listener) {
+    auto addr = std::dynamic_pointer_cast<sylar::IPAddress>(listener->getLocalAddress());
+    return "http://127.0.0.1:" + std::to_string(addr->getPort());
+}
+
+static bool is_ok(HttpResult::ptr r, const std::string& path) {
+    return r && r->result == 0 && r->response && r->response->getBody() == "ok " + path;
+}
+
+void test_concurrent(sylar::Socket::ptr listener) {
+    std::string base = base_url(listener);
+    std::vector<HttpBatchRequest> reqs;
+    for(int i = 0; i < 10; ++i) {
+        reqs.push_back(HttpBatchRequest(HttpMethod::GET, base + "/slow/" + std::to_string(100 + i)));
+    }
+    reqs.push_back(HttpBatchRequest(HttpMethod::GET, "http://[bad"));
+
+    // 完成回调每个下标恰好一次
+    std::vector<int> completed(reqs.size(), 0);
+    HttpBatchOptions opts;
+    opts.timeoutMs = 2000;
+    opts.onComplete = [&completed](size_t idx, HttpResult::ptr r) {
+        ++completed[idx];
+    };
+    uint64_t start = sylar::GetCurrentMS();
+    auto results = HttpConnection::DoBatch(reqs, opts);
+    uint64_t used = sylar::GetCurrentMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "10 x 100ms concurrent used " << used << "ms";
+    SYLAR_CHECK(used < 500);
+    SYLAR_CHECK(results.size() == reqs.size());
+    for(int i = 0; i < 10; ++i) {
+        SYLAR_CHECK(is_ok(results[i], "/slow/" + std::to_string(100 + i)));
+        SYLAR_CHECK(results[i]->timing.connectUs > 0 && !results[i]->timing.reused);
+        SYLAR_CHECK(results[i]->timing.firstByteUs >= 90 * 1000);
+        SYLAR_CHECK(results[i]->timing.totalUs >= results[i]->timing.firstByteUs);
+    }
+    SYLAR_CHECK(results[10]->result == (int)HttpResult::Error::INVALID_URL);
+    for(auto c : completed) {
+        SYLAR_CHECK(c == 1);
+    }
+    SYLAR_LOG_INFO(g_logger) << results[0]->toString().substr(0, 40) << "... timing(us)="
+        << results[0]->timing.dnsUs << "/" << results[0]->timing.connectUs
+        << "/" << results[0]->timing.firstByteUs << "/" << results[0]->timing.totalUs;
+
+    // 限制并发数
+    opts.concurrency = 2;
+    start = sylar::GetCurrentMS();
+    results = HttpConnection::DoBatch(std::vector<HttpBatchRequest>(reqs.begin(), reqs.begin() + 4), opts);
+    used = sylar::GetCurrentMS() - start;
+    SYLAR_CHECK(results.size() == 4 && used >= 200);
+    for(size_t i = 0; i < results.size(); ++i) {
+        SYLAR_CHECK(is_ok(results[i], "/slow/" + std::to_string(100 + i)));
+    }
+}
+
+void test_deadline(sylar::Socket::ptr listener) {
+    std::string base = base_url(listener);
+    std::vector<HttpBatchRequest> reqs = {
+        HttpBatchRequest(HttpMethod::GET, base + "/slow/2000"),
+        HttpBatchRequest(HttpMethod::GET, base + "/fast"),
+        HttpBatchRequest(HttpMethod::GET, base + "/slow/50"),
+        HttpBatchRequest(HttpMethod::GET, base + "/slow/3000")};
+    std::vector<size_t> order;
+    HttpBatchOptions opts;
+    opts.timeoutMs = 300;
+    opts.onComplete = [&order](size_t idx, HttpResult::ptr r) {
+        order.push_back(idx);
+    };
+    uint64_t start = sylar::GetCurrentMS();
+    auto results = HttpConnection::DoBatch(reqs, opts);
+    uint64_t used = sylar::GetCurrentMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "deadline 300ms used " << used << "ms";
+    SYLAR_CHECK(used >= 300 && used < 600);
+    SYLAR_CHECK(results[0]->result == (int)HttpResult::Error::TIMEOUT);
+    SYLAR_CHECK(is_ok(results[1], "/fast"));
+    SYLAR_CHECK(is_ok(results[2], "/slow/50"));
+    SYLAR_CHECK(results[3]->result == (int)HttpResult::Error::TIMEOUT);
+    // 按完成顺序回调
+    SYLAR_CHECK(order.size() == 4 && order[0] == 1 && order[1] == 2);
+
+    // ~0ull表示不限时，不能因为截止时间溢出而立即超时
+    opts.timeoutMs = ~0ull;
+    opts.onComplete = nullptr;
+    results = HttpConnection::DoBatch({HttpBatchRequest(HttpMethod::GET, base + "/slow/50")
+                                      ,HttpBatchRequest(HttpMethod::GET, base + "/fast")}, opts);
+    SYLAR_CHECK(results.size() == 2 && is_ok(results[0], "/slow/50") && is_ok(results[1], "/fast"));
+}
+
+void test_fail_fast(sylar::Socket::ptr listener) {
+    std::string base = base_url(listener);
+    std::vector<HttpBatchRequest> reqs = {
+        HttpBatchRequest(HttpMethod::GET, base + "/slow/1000"),
+        HttpBatchRequest(HttpMethod::GET, base + "/drop"),
+        HttpBatchRequest(HttpMethod::GET, base + "/slow/1000")};
+    HttpBatchOptions opts;
+    opts.timeoutMs = 3000;
+    opts.failFast = true;
+    uint64_t start = sylar::GetCurrentMS();
+    auto results = HttpConnection::DoBatch(reqs, opts);
+    uint64_t used = sylar::GetCurrentMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "fail fast used " << used << "ms";
+    SYLAR_CHECK(used < 500);
+    SYLAR_CHECK(results[0]->result == (int)HttpResult::Error::CANCELLED);
+    SYLAR_CHECK(results[1]->result == (int)HttpResult::Error::TIMEOUT);
+    SYLAR_CHECK(results[2]->result == (int)HttpResult::Error::CANCELLED);
+
+    // 不要求failFast时其他请求照常完成
+    opts.failFast = false;
+    reqs[0].url = base + "/slow/100";
+    reqs[2].url = base + "/slow/100";
+    results = HttpConnection::DoBatch(reqs, opts);
+    SYLAR_CHECK(is_ok(results[0], "/slow/100") && results[1]->result != 0
+            && is_ok(results[2], "/slow/100"));
+}
+
+void test_pool(sylar::Socket::ptr listener) {
+    auto addr = std::dynamic_pointer_cast<sylar::IPAddress>(listener->getLocalAddress());
+    auto pool = std::make_shared<HttpConnectionPool>("127.0.0.1", "", addr->getPort(), false
+                , 16, 60 * 1000, 0);
+    std::vector<HttpBatchRequest> reqs;
+    for(int i = 0; i < 8; ++i) {
+        reqs.push_back(HttpBatchRequest(HttpMethod::GET, "/slow/50"));
+    }
+    HttpBatchOptions opts;
+    opts.timeoutMs = 2000;
+    opts.concurrency = 4;
+    for(int round = 0; round < 2; ++round) {
+        auto results = pool->doBatch(reqs, opts);
+        int reused = 0;
+        for(auto& r : results) {
+            SYLAR_CHECK(is_ok(r, "/slow/50"));
+            reused += r->timing.reused;
+        }
+        // 第一轮4个协程各建一个连接后复用，第二轮全部复用
+        SYLAR_CHECK(reused == (round == 0 ? 4 : 8));
+    }
+    auto stats = pool->getStats();
+    SYLAR_CHECK(stats.connect == 4 && stats.idle == 4);
+
+    // 被取消的连接不放回连接池，之后的请求不受影响
+    opts.concurrency = 0;
+    opts.failFast = true;
+    reqs = {HttpBatchRequest(HttpMethod::GET, "/slow/1000")
+           ,HttpBatchRequest(HttpMethod::GET, "/slow/1000")
+           ,HttpBatchRequest(HttpMethod::GET, "/drop")};
+    uint64_t start = sylar::GetCurrentMS();
+    auto results = pool->doBatch(reqs, opts);
+    SYLAR_CHECK(sylar::GetCurrentMS() - start < 500);
+    SYLAR_CHECK(results[0]->result == (int)HttpResult::Error::CANCELLED
+            && results[1]->result == (int)HttpResult::Error::CANCELLED
+            && results[2]->result != 0);
+    // 等被取消的请求结束
+    usleep(100 * 1000);
+    SYLAR_CHECK(pool->getStats().idle == 1);
+    for(int i = 0; i < 4; ++i) {
+        SYLAR_CHECK(is_ok(pool->doGet("/after", 1000), "/after"));
+    }
+    SYLAR_LOG_INFO(g_logger) << "pool connect=" << pool->getStats().connect
+        << " hit=" << pool->getStats().hit << " total=" << pool->getStats().total;
+}
+
+// 不在协程里顺序执行
+void test_sequential(const std::string& base) {
+    std::vector<HttpBatchRequest> reqs = {
+        HttpBatchRequest(HttpMethod::GET, base + "/a"),
+        HttpBatchRequest(HttpMethod::GET, base + "/drop"),
+        HttpBatchRequest(HttpMethod::GET, base + "/b")};
+    auto results = HttpConnection::DoBatch(reqs);
+    SYLAR_CHECK(is_ok(results[0], "/a") && results[1]->result != 0 && is_ok(results[2], "/b"));
+    HttpBatchOptions opts;
+    opts.failFast = true;
+    results = HttpConnection::DoBatch(reqs, opts);
+    SYLAR_CHECK(is_ok(results[0], "/a") && results[1]->result != 0
+            && results[2]->result == (int)HttpResult::Error::CANCELLED);
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    sylar::IOManager iom(2, false);
+    sylar::Socket::ptr listener;
+    std::atomic<bool> done(false);
+    iom.schedule([&iom, &listener, &done](){
+        // 监听socket要在协程里创建，accept才会走hook
+        listener = sylar::Socket::CreateTCPSocket();
+        listener->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+        listener->listen();
+        sylar::Socket::ptr sock = listener;
+        iom.schedule([sock, &iom](){
+            serve(sock, &iom);
+        });
+        test_concurrent(listener);
+        test_deadline(listener);
+        test_fail_fast(listener);
+        test_pool(listener);
+        done = true;
+    });
+    // 主线程不在调度器里，轮询等待
+    while(!done) {
+        usleep(10 * 1000);
+    }
+    test_sequential(base_url(listener));
+    // close先唤醒再关fd，accept协程可能在两者之间重新挂起；shutdown一定能唤醒
+    ::shutdown(listener->getSocket(), SHUT_RDWR);
+    iom.schedule([listener](){
+        listener->close();
+    });
+    iom.stop();
+    return check_result();
+}
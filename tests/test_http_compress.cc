@@ -0,0 +1,182 @@
+#include "sylar/http/http_compress.h"
+#include "sylar/streams/zlib_stream.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static std::string make_json(size_t size) {
+    std::string data = "[";
+    for(int i = 0; data.size() < size; ++i) {
+        data += "{\"id\":" + std::to_string(i) + ",\"name\":\"item" + std::to_string(i % 97)
+                + "\",\"enabled\":true},";
+    }
+    data.back() = ']';
+    return data;
+}
+
+static std::string decompress(const std::string& data, HttpCompress::Encoding encoding) {
+    auto zs = encoding == HttpCompress::GZIP ? sylar::ZlibStream::CreateGzip(false)
+                : sylar::ZlibStream::CreateZlib(false);
+    zs->write(data.c_str(), data.size());
+    zs->close();
+    return zs->getResult();
+}
+
+static HttpRequest::ptr make_request(const std::string& accept_encoding) {
+    HttpRequest::ptr req(new HttpRequest);
+    req->setPath("/api/list");
+    if(!accept_encoding.empty()) {
+        req->setHeader("Accept-Encoding", accept_encoding);
+    }
+    return req;
+}
+
+static HttpResponse::ptr make_response(const std::string& body
+                    ,const std::string& type = "application/json; charset=utf-8") {
+    HttpResponse::ptr rsp(new HttpResponse);
+    rsp->setHeader("Content-Type", type);
+    rsp->setBody(body);
+    return rsp;
+}
+
+void test_negotiate() {
+    SYLAR_CHECK(HttpCompress::Negotiate("") == HttpCompress::IDENTITY);
+    SYLAR_CHECK(HttpCompress::Negotiate("gzip, deflate, br") == HttpCompress::GZIP);
+    SYLAR_CHECK(HttpCompress::Negotiate("deflate") == HttpCompress::DEFLATE);
+    SYLAR_CHECK(HttpCompress::Negotiate("gzip;q=0.5, deflate;q=0.8") == HttpCompress::DEFLATE);
+    SYLAR_CHECK(HttpCompress::Negotiate("GZIP ; q=1.0") == HttpCompress::GZIP);
+    SYLAR_CHECK(HttpCompress::Negotiate("gzip;q=0, deflate;q=0") == HttpCompress::IDENTITY);
+    SYLAR_CHECK(HttpCompress::Negotiate("*") == HttpCompress::GZIP);
+    SYLAR_CHECK(HttpCompress::Negotiate("gzip;q=0, *") == HttpCompress::DEFLATE);
+    SYLAR_CHECK(HttpCompress::Negotiate("br, identity") == HttpCompress::IDENTITY);
+}
+
+void test_apply() {
+    std::string body = make_json(300 * 1024);
+    for(auto encoding : {HttpCompress::GZIP, HttpCompress::DEFLATE}) {
+        auto rsp = make_response(body);
+        SYLAR_CHECK(HttpCompress::Apply(make_request(HttpCompress::EncodingToString(encoding)), rsp));
+        SYLAR_CHECK(rsp->getHeader("Content-Encoding") == HttpCompress::EncodingToString(encoding));
+        SYLAR_CHECK(rsp->getHeader("Vary") == "Accept-Encoding");
+        SYLAR_CHECK(rsp->getBody().size() < body.size() / 4);
+        SYLAR_CHECK(decompress(rsp->getBody(), encoding) == body);
+    }
+
+    // 客户端不支持压缩时也要加Vary
+    auto rsp = make_response(body);
+    rsp->setHeader("Vary", "Origin");
+    SYLAR_CHECK(!HttpCompress::Apply(make_request(""), rsp));
+    SYLAR_CHECK(rsp->getBody() == body && rsp->getHeader("Vary") == "Origin, Accept-Encoding");
+
+    // 太小、类型不在白名单、已经编码、部分内容、no-transform
+    rsp = make_response("{}");
+    SYLAR_CHECK(!HttpCompress::Apply(make_request("gzip"), rsp));
+    rsp = make_response(body, "image/png");
+    SYLAR_CHECK(!HttpCompress::Apply(make_request("gzip"), rsp) && rsp->getHeader("Vary").empty());
+    rsp = make_response(body);
+    rsp->setHeader("Content-Encoding", "br");
+    SYLAR_CHECK(!HttpCompress::Apply(make_request("gzip"), rsp) && rsp->getBody() == body);
+    rsp = make_response(body);
+    rsp->setStatus(HttpStatus::PARTIAL_CONTENT);
+    SYLAR_CHECK(!HttpCompress::Apply(make_request("gzip"), rsp));
+    rsp = make_response(body);
+    rsp->setHeader("Cache-Control", "public, no-transform");
+    SYLAR_CHECK(!HttpCompress::Apply(make_request("gzip"), rsp));
+
+    sylar::Config::Lookup<bool>("http.compress.enable")->setValue(false);
+    rsp = make_response(body);
+    SYLAR_CHECK(!HttpCompress::Apply(make_request("gzip"), rsp));
+    sylar::Config::Lookup<bool>("http.compress.enable")->setValue(true);
+}
+
+// 带ETag的响应只压缩一次
+void test_cache() {
+    std::string body = make_json(100 * 1024);
+    std::string first;
+    for(int i = 0; i < 3; ++i) {
+        auto rsp = make_response(body);
+        rsp->setHeader("ETag", "\"v1\"");
+        SYLAR_CHECK(HttpCompress::Apply(make_request("gzip"), rsp));
+        SYLAR_CHECK(rsp->getHeader("ETag") == "W/\"v1\"");
+        if(i == 0) {
+            first = rsp->getBody();
+        } else {
+            SYLAR_CHECK(rsp->getBody() == first);
+        }
+    }
+    // ETag变化后重新压缩
+    std::string body2 = make_json(120 * 1024);
+    auto rsp = make_response(body2);
+    rsp->setHeader("ETag", "\"v2\"");
+    SYLAR_CHECK(HttpCompress::Apply(make_request("gzip"), rsp));
+    SYLAR_CHECK(decompress(rsp->getBody(), HttpCompress::GZIP) == body2);
+    SYLAR_LOG_INFO(g_logger) << HttpCompress::ToStatusString();
+    SYLAR_CHECK(HttpCompress::ToStatusString().find("hit=2") != std::string::npos);
+
+    // ETag相同但查询参数或Host不同，不能拿到别的响应的压缩结果
+    const char* variants[][2] = {{"", "id=1"}, {"", "id=2"}, {"a.example.com", "id=1"}
+                                ,{"b.example.com", "id=1"}};
+    for(size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i) {
+        std::string vbody = make_json(20 * 1024 + i * 1000);
+        auto req = make_request("gzip");
+        req->setQuery(variants[i][1]);
+        if(variants[i][0][0]) {
+            req->setHeader("Host", variants[i][0]);
+        }
+        auto vrsp = make_response(vbody);
+        vrsp->setHeader("ETag", "\"same\"");
+        SYLAR_CHECK(HttpCompress::Apply(req, vrsp));
+        SYLAR_CHECK(decompress(vrsp->getBody(), HttpCompress::GZIP) == vbody);
+    }
+}
+
+// 每次新建ZlibStream和复用线程内z_stream的对比
+void bench(size_t size, int count) {
+    std::string body = make_json(size);
+    uint64_t start = sylar::GetCurrentUS();
+    size_t out_size = 0;
+    for(int i = 0; i < count; ++i) {
+        auto zs = sylar::ZlibStream::Create(true, 4096, sylar::ZlibStream::GZIP, 6);
+        zs->write(body.c_str(), body.size());
+        zs->close();
+        out_size = zs->getResult().size();
+    }
+    uint64_t used_stream = sylar::GetCurrentUS() - start;
+
+    start = sylar::GetCurrentUS();
+    std::string out;
+    for(int i = 0; i < count; ++i) {
+        HttpCompress::Compress(body.c_str(), body.size(), out, HttpCompress::GZIP);
+    }
+    uint64_t used_pool = sylar::GetCurrentUS() - start;
+    SYLAR_CHECK(out.size() == out_size);
+
+    start = sylar::GetCurrentUS();
+    for(int i = 0; i < count; ++i) {
+        auto rsp = make_response(body);
+        rsp->setHeader("ETag", "\"bench\"");
+        HttpCompress::Apply(make_request("gzip"), rsp);
+    }
+    uint64_t used_cache = sylar::GetCurrentUS() - start;
+
+    SYLAR_LOG_INFO(g_logger) << "body=" << size << " gzip=" << out.size()
+        << " ZlibStream=" << (used_stream * 1.0 / count) << "us/op"
+        << " pooled=" << (used_pool * 1.0 / count) << "us/op"
+        << " cached=" << (used_cache * 1.0 / count) << "us/op";
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    test_negotiate();
+    test_apply();
+    test_cache();
+    bench(1024, count * 10);
+    bench(16 * 1024, count);
+    bench(256 * 1024, count / 10);
+    return check_result();
+}
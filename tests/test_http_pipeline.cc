@@ -0,0 +1,120 @@
+#include "sylar/http/http_session.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "test_helper.h"
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+// 模拟HttpServer::handleClient，响应体为请求路径和消息体
+static int serve(HttpSession::ptr session) {
+    int count = 0;
+    while(auto req = session->recvRequest()) {
+        ++count;
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), req->isClose()));
+        rsp->setBody(req->getPath() + ":" + req->getBody());
+        session->sendResponse(rsp, req->isClose() || !session->hasBufferedData());
+        if(req->isClose()) {
+            break;
+        }
+    }
+    return count;
+}
+
+static std::string read_all(sylar::Socket::ptr sock, int* reads = nullptr) {
+    std::string data;
+    char buf[4096];
+    int rt = 0;
+    while((rt = sock->recv(buf, sizeof(buf))) > 0) {
+        data.append(buf, rt);
+        if(reads) {
+            ++*reads;
+        }
+    }
+    return data;
+}
+
+static std::string expect_response(const std::string& body, bool close) {
+    HttpResponse rsp(0x11, close);
+    rsp.setBody(body);
+    return rsp.toString();
+}
+
+// 一次发送多个请求，响应按顺序合并成一次写出
+void test_pipeline() {
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    std::string reqs =
+        "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+        "POST /b HTTP/1.1\r\nHost: x\r\ncontent-length: 5\r\n\r\nhello"
+        "GET /c HTTP/1.1\r\nHost: x\r\nconnection: close\r\n\r\n";
+    SYLAR_CHECK(client->send(reqs.c_str(), reqs.size()) == (int)reqs.size());
+
+    HttpSession::ptr session(new HttpSession(server));
+    SYLAR_CHECK(serve(session) == 3);
+    session->close();
+
+    int reads = 0;
+    std::string data = read_all(client, &reads);
+    SYLAR_CHECK(data == expect_response("/a:", false) + expect_response("/b:hello", false)
+                    + expect_response("/c:", true));
+    SYLAR_CHECK(reads == 1);
+}
+
+// 请求分多次到达、消息体跨越两次读取
+void test_split() {
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    HttpSession::ptr session(new HttpSession(server));
+    int count = 0;
+    sylar::IOManager::GetThis()->schedule([session, &count](){
+        count = serve(session);
+        session->close();
+    });
+    std::string reqs =
+        "POST /a HTTP/1.1\r\ncontent-length: 10\r\n\r\n01234"
+        "|56789GET /b HTTP/1.1\r\n"
+        "|connection: close\r\n\r\n";
+    size_t pos = 0;
+    while(pos < reqs.size()) {
+        size_t next = reqs.find('|', pos);
+        if(next == std::string::npos) {
+            next = reqs.size();
+        }
+        client->send(reqs.c_str() + pos, next - pos);
+        usleep(10 * 1000);
+        pos = next + 1;
+    }
+    std::string data = read_all(client);
+    SYLAR_CHECK(data == expect_response("/a:0123456789", false) + expect_response("/b:", true));
+    SYLAR_CHECK(count == 2);
+}
+
+// 升级后的数据(如websocket帧)通过read从缓冲区中取出
+void test_leftover_read() {
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    std::string reqs = "GET /ws HTTP/1.1\r\n\r\nframe-data";
+    client->send(reqs.c_str(), reqs.size());
+    HttpSession::ptr session(new HttpSession(server));
+    SYLAR_CHECK(session->recvRequest() != nullptr);
+    SYLAR_CHECK(session->hasBufferedData());
+    char buf[10];
+    SYLAR_CHECK(session->readFixSize(buf, sizeof(buf)) == (int)sizeof(buf));
+    SYLAR_CHECK(std::string(buf, sizeof(buf)) == "frame-data");
+    SYLAR_CHECK(!session->hasBufferedData());
+}
+
+int main(int argc, char** argv) {
+    {
+        sylar::IOManager iom(1);
+        iom.schedule([](){
+            test_pipeline();
+            test_split();
+            test_leftover_read();
+        });
+    }
+    return check_result();
+}
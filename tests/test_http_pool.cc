@@ -0,0 +1,168 @@
+#include "sylar/http/http_connection.h"
+#include "sylar/http/http_session.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <signal.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+/**
+ * @brief 长连接HTTP服务，/bye 响应后关闭连接(不带Connection: close)
+ */
+static void serve(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    while(auto sock = listener->accept()) {
+        iom->schedule([sock](){
+            HttpSession::ptr session(new HttpSession(sock));
+            while(auto req = session->recvRequest()) {
+                auto rsp = req->createResponse();
+                rsp->setBody("ok " + req->getPath());
+                session->sendResponse(rsp);
+                if(req->getPath() == "/bye") {
+                    break;
+                }
+            }
+            session->close();
+        });
+    }
+}
+
+static std::string dump(const HttpConnectionPool::Stats& s) {
+    std::stringstream ss;
+    ss << "hit=" << s.hit << " miss=" << s.miss << " connect=" << s.connect
+       << " connect_fail=" << s.connectFail << " connect_avg_us=" << (s.connect ? s.connectUs / s.connect : 0)
+       << " connect_max_us=" << s.connectMaxUs << " wait=" << s.wait << " wait_us=" << s.waitUs
+       << " expired=" << s.expired << " resolve=" << s.resolve
+       << " total=" << s.total << " idle=" << s.idle;
+    return ss.str();
+}
+
+static HttpConnectionPool::ptr make_pool(sylar::Socket::ptr listener, uint32_t max_size = 10) {
+    auto addr = std::dynamic_pointer_cast<sylar::IPAddress>(listener->getLocalAddress());
+    return std::make_shared<HttpConnectionPool>("127.0.0.1", "", addr->getPort(), false
+                , max_size, 60 * 1000, 100);
+}
+
+void test_reuse(sylar::Socket::ptr listener) {
+    auto pool = make_pool(listener);
+    // 存活时间内的连接要复用，不能每次重连
+    for(int i = 0; i < 10; ++i) {
+        auto r = pool->doGet("/a", 1000);
+        SYLAR_CHECK(r->result == 0 && r->response->getBody() == "ok /a");
+    }
+    auto stats = pool->getStats();
+    SYLAR_CHECK(stats.connect == 1 && stats.hit == 9 && stats.miss == 1 && stats.resolve == 1);
+
+    // 后进先出
+    HttpConnection* first = nullptr;
+    HttpConnection* second = nullptr;
+    {
+        auto c1 = pool->getConnection();
+        auto c2 = pool->getConnection();
+        first = c1.get();
+        second = c2.get();
+        SYLAR_CHECK(first != second);
+        c1.reset();
+        c2.reset();
+    }
+    SYLAR_CHECK(pool->getConnection().get() == second);
+    SYLAR_CHECK(pool->getStats().idle == 2 && pool->getStats().resolve == 1);
+
+    // 服务端关闭的空闲连接在取出时发现，请求不会失败
+    auto r = pool->doGet("/bye", 1000);
+    SYLAR_CHECK(r->result == 0);
+    usleep(50 * 1000);
+    r = pool->doGet("/b", 1000);
+    SYLAR_CHECK(r->result == 0 && r->response->getBody() == "ok /b");
+    stats = pool->getStats();
+    SYLAR_CHECK(stats.expired == 1 && stats.total == 1 && stats.connect == 2);
+    SYLAR_LOG_INFO(g_logger) << dump(pool->getStats());
+}
+
+void test_maintain(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    auto pool = make_pool(listener, 4);
+    pool->setMinIdle(3);
+    pool->startMaintain(20, iom);
+    usleep(100 * 1000);
+    auto stats = pool->getStats();
+    SYLAR_CHECK(stats.idle == 3 && stats.total == 3 && stats.miss == 0);
+
+    // 预建的连接直接命中，借出期间维护定时器可能再补一个
+    for(int i = 0; i < 3; ++i) {
+        auto r = pool->doGet("/warm", 1000);
+        SYLAR_CHECK(r->result == 0);
+    }
+    stats = pool->getStats();
+    SYLAR_CHECK(stats.hit == 3 && stats.miss == 0 && stats.connect >= 3);
+
+    // 闲置超时后全部被关闭
+    pool->setMinIdle(0);
+    pool->setMaxIdleTime(30);
+    usleep(100 * 1000);
+    stats = pool->getStats();
+    SYLAR_CHECK(stats.idle == 0 && stats.total == 0 && stats.expired == stats.connect);
+    SYLAR_LOG_INFO(g_logger) << dump(stats);
+}
+
+void test_concurrent(sylar::Socket::ptr listener, sylar::IOManager* iom) {
+    auto pool = make_pool(listener, 32);
+    pool->setMaxConnecting(2);
+    const int n = 16;
+    sylar::FiberSemaphore done;
+    auto ok = std::make_shared<std::atomic<int> >(0);
+    for(int i = 0; i < n; ++i) {
+        iom->schedule([pool, ok, &done](){
+            for(int j = 0; j < 20; ++j) {
+                auto r = pool->doGet("/c", 1000);
+                if(r->result == 0) {
+                    ++*ok;
+                }
+            }
+            done.notify();
+        });
+    }
+    for(int i = 0; i < n; ++i) {
+        done.wait();
+    }
+    auto stats = pool->getStats();
+    SYLAR_CHECK(*ok == n * 20);
+    SYLAR_CHECK(stats.hit + stats.miss == (uint64_t)n * 20);
+    SYLAR_CHECK((int32_t)stats.connect == stats.total && stats.connect <= (uint64_t)n);
+    SYLAR_LOG_INFO(g_logger) << dump(stats);
+}
+
+// 建连名额的等待受请求超时限制
+void test_wait_timeout() {
+    sylar::FiberSemaphore sem(1);
+    SYLAR_CHECK(sem.wait(100));
+    uint64_t start = sylar::GetCurrentMS();
+    SYLAR_CHECK(!sem.wait(50));
+    SYLAR_CHECK(sylar::GetCurrentMS() - start >= 40);
+    sem.notify();
+    SYLAR_CHECK(sem.wait(50));
+    sem.notify();
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    {
+        sylar::IOManager iom(2);
+        iom.schedule([&iom](){
+            sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+            listener->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+            listener->listen();
+            iom.schedule([listener, &iom](){
+                serve(listener, &iom);
+            });
+            test_reuse(listener);
+            test_maintain(listener, &iom);
+            test_concurrent(listener, &iom);
+            test_wait_timeout();
+            listener->close();
+        });
+    }
+    return check_result();
+}
@@ -0,0 +1,127 @@
+#include "sylar/http/http_session.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <atomic>
+#include <sstream>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static HttpResponse::ptr make_response(size_t body_size) {
+    HttpResponse::ptr rsp(new HttpResponse(0x11, false));
+    rsp->setHeader("Content-Type", "application/octet-stream");
+    rsp->setHeader("Server", "sylar/1.0.0");
+    rsp->setHeader("connection", "ignored");
+    rsp->setCookie("sid", "abc", 0, "/");
+    rsp->setBody(std::string(body_size, 'x'));
+    return rsp;
+}
+
+// serializeHeader + body 与 dump 输出一致
+void test_serialize() {
+    for(size_t size : {(size_t)0, (size_t)1, (size_t)1024}) {
+        HttpResponse::ptr rsp = make_response(size);
+        for(bool close : {true, false}) {
+            rsp->setClose(close);
+            std::string buf = "prefix";
+            rsp->serializeHeader(buf);
+            SYLAR_CHECK(buf.substr(6) + rsp->getBody() == rsp->toString());
+        }
+    }
+    HttpResponse::ptr rsp(new HttpResponse(0x10));
+    rsp->setStatus(HttpStatus::NOT_FOUND);
+    rsp->setWebsocket(true);
+    std::string buf;
+    rsp->serializeHeader(buf);
+    SYLAR_CHECK(buf == rsp->toString());
+    SYLAR_CHECK(buf.compare(0, 23, "HTTP/1.0 404 Not Found\r") == 0);
+}
+
+// 建立一对TCP连接，对端协程只负责读空数据
+struct Pipe {
+    sylar::Socket::ptr client;
+    sylar::Socket::ptr server;
+    sylar::FiberSemaphore done;
+    uint64_t bytes = 0;
+
+    Pipe() {
+        auto addr = sylar::Address::LookupAny("127.0.0.1:0");
+        sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+        listener->bind(addr);
+        listener->listen();
+        client = sylar::Socket::CreateTCPSocket();
+        client->connect(listener->getLocalAddress());
+        server = listener->accept();
+        sylar::IOManager::GetThis()->schedule([this](){
+            std::vector<char> buf(256 * 1024);
+            int rt = 0;
+            while((rt = server->recv(&buf[0], buf.size())) > 0) {
+                bytes += rt;
+            }
+            done.notify();
+        });
+    }
+
+    // 关闭发送端，等待对端读完
+    uint64_t finish() {
+        client->close();
+        done.wait();
+        return bytes;
+    }
+};
+
+// 原实现: 整个响应序列化到stringstream再发送
+static int send_stringstream(HttpSession::ptr session, HttpResponse::ptr rsp) {
+    std::stringstream ss;
+    ss << *rsp;
+    std::string data = ss.str();
+    return session->writeFixSize(data.c_str(), data.size());
+}
+
+void test_send() {
+    Pipe pipe;
+    HttpSession::ptr session(new HttpSession(pipe.client, false));
+    HttpResponse::ptr rsp = make_response(100 * 1024);
+    std::string expect = rsp->toString();
+    SYLAR_CHECK(session->sendResponse(rsp) == (int)expect.size());
+    SYLAR_CHECK(pipe.finish() == expect.size());
+}
+
+void bench(size_t body_size, int count) {
+    HttpResponse::ptr rsp = make_response(body_size);
+    size_t size = rsp->toString().size();
+    uint64_t used[2] = {0, 0};
+    for(int mode = 0; mode < 2; ++mode) {
+        Pipe pipe;
+        HttpSession::ptr session(new HttpSession(pipe.client, false));
+        uint64_t start = sylar::GetCurrentUS();
+        for(int i = 0; i < count; ++i) {
+            int rt = mode ? session->sendResponse(rsp) : send_stringstream(session, rsp);
+            SYLAR_CHECK(rt == (int)size);
+        }
+        SYLAR_CHECK(pipe.finish() == size * count);
+        used[mode] = sylar::GetCurrentUS() - start;
+    }
+    SYLAR_LOG_INFO(g_logger) << "body=" << body_size
+        << " stringstream=" << (used[0] * 1.0 / count) << "us/op"
+        << " writev=" << (used[1] * 1.0 / count) << "us/op"
+        << " speedup=" << (used[0] * 1.0 / used[1]);
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    test_serialize();
+    {
+        sylar::IOManager iom(1);
+        iom.schedule([count](){
+            test_send();
+            bench(1024, count);
+            bench(64 * 1024, count / 10);
+            bench(1024 * 1024, count / 100);
+        });
+    }
+    return check_result();
+}
@@ -0,0 +1,307 @@
+#include "sylar/http/http_session.h"
+#include "sylar/http/http_connection.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "test_helper.h"
+#include <atomic>
+#include <string.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static void set_stream_size(uint64_t v) {
+    sylar::Config::Lookup<uint64_t>("http.request.stream_body_size")->setValue(v);
+}
+
+static std::string read_stream(sylar::Stream::ptr stream, size_t piece = 4096) {
+    std::string data;
+    std::vector<char> buf(piece);
+    int rt = 0;
+    while((rt = stream->read(&buf[0], buf.size())) > 0) {
+        data.append(&buf[0], rt);
+    }
+    SYLAR_CHECK(rt == 0);
+    return data;
+}
+
+// chunked请求体读入内存，后面流水线的请求不受影响
+void test_chunked_request() {
+    set_stream_size(0);
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    std::string reqs =
+        "POST /up HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n"
+        "7;ext=1\r\n, world\r\n"
+        "0\r\nx-trailer: 1\r\n\r\n"
+        "GET /next HTTP/1.1\r\n\r\n";
+    client->send(reqs.c_str(), reqs.size());
+    HttpSession::ptr session(new HttpSession(server));
+    auto req = session->recvRequest();
+    SYLAR_CHECK(req && req->getBody() == "hello, world" && !req->getBodyStream());
+    req = session->recvRequest();
+    SYLAR_CHECK(req && req->getPath() == "/next");
+    session->close();
+}
+
+// 块大小只能是十六进制数字，带符号、0x前缀、空白或超长的都拒绝
+void test_invalid_chunk_size() {
+    set_stream_size(0);
+    const char* sizes[] = {"-1", "0x10", " 5", "+5", "5 ", "ffffffffffffffff"
+                        , "1000000000000000", ""};
+    for(auto size : sizes) {
+        sylar::Socket::ptr client, server;
+        make_socket_pair(client, server);
+        std::string req = std::string("POST /up HTTP/1.1\r\n"
+                "transfer-encoding: chunked\r\n\r\n") + size + "\r\nabc";
+        client->send(req.c_str(), req.size());
+        client->close();
+        HttpSession::ptr session(new HttpSession(server));
+        SYLAR_CHECK(!session->recvRequest());
+        session->close();
+    }
+
+    // 15位是允许的最大长度，块扩展前的块大小正常接受
+    set_stream_size(1);
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    std::string req = "POST /up HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n"
+                      "000000000000005;x\r\nhello";
+    client->send(req.c_str(), req.size());
+    client->close();
+    HttpSession::ptr session(new HttpSession(server));
+    auto r = session->recvRequest();
+    SYLAR_CHECK(r && r->getBodyStream());
+    if(r && r->getBodyStream()) {
+        char buf[16];
+        SYLAR_CHECK(r->getBodyStream()->read(buf, sizeof(buf)) == 5);
+        // 连接在块结束前关闭，不能当作正常结束
+        SYLAR_CHECK(r->getBodyStream()->read(buf, sizeof(buf)) < 0);
+    }
+    session->close();
+    set_stream_size(0);
+}
+
+// 消息体以流的方式读取，没读完的部分在下一个请求前丢弃
+void test_stream_request() {
+    set_stream_size(1);
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    HttpSession::ptr session(new HttpSession(server));
+    std::string body(100000, 'a');
+    for(size_t i = 0; i < body.size(); ++i) {
+        body[i] = 'a' + i % 26;
+    }
+    sylar::IOManager::GetThis()->schedule([client, body](){
+        std::string head = "POST /a HTTP/1.1\r\ncontent-length: "
+                    + std::to_string(body.size()) + "\r\n\r\n";
+        client->send(head.c_str(), head.size());
+        client->send(body.c_str(), body.size());
+        std::string chunked = "POST /b HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n"
+                    "3\r\nabc\r\n0\r\n\r\n"
+                    "POST /c HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n"
+                    "4\r\nskip\r\n0\r\n\r\n"
+                    "GET /d HTTP/1.1\r\n\r\n";
+        client->send(chunked.c_str(), chunked.size());
+    });
+    auto req = session->recvRequest();
+    SYLAR_CHECK(req && req->getBodyStream() && req->getBody().empty());
+    SYLAR_CHECK(read_stream(req->getBodyStream(), 333) == body);
+    req = session->recvRequest();
+    SYLAR_CHECK(req && req->getPath() == "/b");
+    SYLAR_CHECK(read_stream(req->getBodyStream()) == "abc");
+    req = session->recvRequest();
+    SYLAR_CHECK(req && req->getPath() == "/c");
+    req = session->recvRequest();
+    SYLAR_CHECK(req && req->getPath() == "/d" && !req->getBodyStream());
+    session->close();
+    set_stream_size(0);
+}
+
+// 服务端以流的方式发送响应，客户端流式接收
+static HttpResponse::ptr stream_response(HttpResponse::ptr rsp
+                        ,std::function<void(HttpBodyWriter::ptr)> cb
+                        ,bool stream, HttpConnection::ptr& conn) {
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    HttpSession::ptr session(new HttpSession(server));
+    conn.reset(new HttpConnection(client));
+    sylar::IOManager::GetThis()->schedule([session, rsp, cb](){
+        auto writer = session->startResponse(rsp);
+        SYLAR_CHECK(writer);
+        if(writer) {
+            cb(writer);
+        }
+        SYLAR_CHECK(session->endResponse());
+        SYLAR_CHECK(!session->isResponseStarted());
+        if(rsp->isClose()) {
+            session->close();
+        }
+    });
+    return conn->recvResponse(stream);
+}
+
+// chunked响应；设置了content-length时不用chunked；HTTP/1.0关闭连接表示结束
+void test_stream_response() {
+    HttpConnection::ptr conn;
+    std::string expect;
+    for(int i = 0; i < 100; ++i) {
+        expect += std::to_string(i) + ",";
+    }
+    auto rsp = stream_response(std::make_shared<HttpResponse>(0x11, false)
+            ,[](HttpBodyWriter::ptr writer){
+        SYLAR_CHECK(writer->isChunked());
+        for(int i = 0; i < 100; ++i) {
+            std::string piece = std::to_string(i) + ",";
+            SYLAR_CHECK(writer->write(piece.c_str(), piece.size()) == (int)piece.size());
+        }
+    }, true, conn);
+    SYLAR_CHECK(rsp && rsp->getHeader("transfer-encoding") == "chunked");
+    SYLAR_CHECK(rsp && read_stream(rsp->getBodyStream(), 7) == expect);
+
+    HttpResponse::ptr fixed(new HttpResponse(0x11, false));
+    fixed->setHeader("content-length", "5");
+    rsp = stream_response(fixed, [](HttpBodyWriter::ptr writer){
+        SYLAR_CHECK(!writer->isChunked());
+        writer->write("12345", 5);
+    }, true, conn);
+    SYLAR_CHECK(rsp && read_stream(rsp->getBodyStream()) == "12345");
+
+    HttpResponse::ptr http10(new HttpResponse(0x10, false));
+    rsp = stream_response(http10, [](HttpBodyWriter::ptr writer){
+        SYLAR_CHECK(!writer->isChunked());
+        writer->write("tail", 4);
+    }, true, conn);
+    SYLAR_CHECK(http10->isClose());
+    SYLAR_CHECK(rsp && read_stream(rsp->getBodyStream()) == "tail");
+}
+
+// 没有消息体的响应在长连接上不能读到连接关闭
+void test_no_body_response() {
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    // 读到连接关闭的话会超时失败，而不是卡住
+    client->setRecvTimeout(1000);
+    HttpConnection::ptr conn(new HttpConnection(client));
+    struct Case {
+        HttpMethod method;
+        const char* response;
+    } cases[] = {
+        {HttpMethod::GET, "HTTP/1.1 100 Continue\r\n\r\n"},
+        {HttpMethod::GET, "HTTP/1.1 204 No Content\r\n\r\n"},
+        {HttpMethod::GET, "HTTP/1.1 304 Not Modified\r\netag: \"1\"\r\n\r\n"},
+        {HttpMethod::HEAD, "HTTP/1.1 200 OK\r\ncontent-length: 5\r\n\r\n"},
+        {HttpMethod::HEAD, "HTTP/1.1 200 OK\r\ntransfer-encoding: chunked\r\n\r\n"},
+        {HttpMethod::GET, "HTTP/1.1 200 OK\r\n\r\n"}
+    };
+    for(auto& c : cases) {
+        HttpRequest::ptr req(new HttpRequest(0x11, false));
+        req->setMethod(c.method);
+        SYLAR_CHECK(conn->sendRequest(req) > 0);
+        server->send(c.response, strlen(c.response));
+        auto rsp = conn->recvResponse(true);
+        SYLAR_CHECK(rsp && read_stream(rsp->getBodyStream()).empty());
+    }
+    // 后面的响应不受影响
+    HttpRequest::ptr req(new HttpRequest(0x11, false));
+    conn->sendRequest(req);
+    std::string last = "HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok";
+    server->send(last.c_str(), last.size());
+    auto rsp = conn->recvResponse(true);
+    SYLAR_CHECK(rsp && read_stream(rsp->getBodyStream()) == "ok");
+
+    // connection: close时读到连接关闭
+    req.reset(new HttpRequest(0x11, false));
+    conn->sendRequest(req);
+    last = "HTTP/1.1 200 OK\r\nconnection: close\r\n\r\nuntil close";
+    server->send(last.c_str(), last.size());
+    server->close();
+    rsp = conn->recvResponse(true);
+    SYLAR_CHECK(rsp && read_stream(rsp->getBodyStream()) == "until close");
+}
+
+// 客户端chunked上传，服务端流式读取
+void test_stream_upload() {
+    set_stream_size(1);
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    HttpSession::ptr session(new HttpSession(server));
+    HttpConnection::ptr conn(new HttpConnection(client));
+    std::string body;
+    sylar::IOManager::GetThis()->schedule([conn, &body](){
+        HttpRequest::ptr req(new HttpRequest(0x11, false));
+        req->setPath("/upload");
+        auto writer = conn->startRequest(req);
+        SYLAR_CHECK(writer && writer->isChunked());
+        for(int i = 0; i < 1000; ++i) {
+            std::string piece(i % 100 + 1, 'a' + i % 26);
+            body += piece;
+            writer->write(piece.c_str(), piece.size());
+        }
+        writer->close();
+    });
+    auto req = session->recvRequest();
+    SYLAR_CHECK(req && req->getPath() == "/upload");
+    SYLAR_CHECK(req && read_stream(req->getBodyStream(), 1000) == body);
+    session->close();
+    set_stream_size(0);
+}
+
+// 对端不读时写入协程挂起，消息体不会在内存中堆积
+void test_backpressure() {
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    HttpSession::ptr session(new HttpSession(server));
+    const size_t total = 64 * 1024 * 1024;
+    std::atomic<uint64_t> written {0};
+    std::atomic<bool> done {false};
+    sylar::IOManager::GetThis()->schedule([session, total, &written, &done](){
+        HttpResponse::ptr rsp(new HttpResponse(0x11, false));
+        auto writer = session->startResponse(rsp);
+        std::string piece(64 * 1024, 'x');
+        while(written < total) {
+            if(writer->write(piece.c_str(), piece.size()) <= 0) {
+                break;
+            }
+            written += piece.size();
+        }
+        session->endResponse();
+        done = true;
+    });
+    // 对端先不读，写入方应该停在socket缓冲区满的位置
+    usleep(200 * 1000);
+    uint64_t blocked_at = written;
+    SYLAR_CHECK(blocked_at < total);
+    SYLAR_LOG_INFO(g_logger) << "writer blocked after " << blocked_at << " bytes";
+
+    HttpConnection::ptr conn(new HttpConnection(client));
+    auto rsp = conn->recvResponse(true);
+    SYLAR_CHECK(rsp);
+    auto stream = rsp->getBodyStream();
+    std::vector<char> buf(256 * 1024);
+    uint64_t read = 0;
+    int rt = 0;
+    while((rt = stream->read(&buf[0], buf.size())) > 0) {
+        read += rt;
+    }
+    SYLAR_CHECK(rt == 0 && read == total && done);
+    session->close();
+}
+
+int main(int argc, char** argv) {
+    {
+        sylar::IOManager iom(1);
+        iom.schedule([](){
+            test_chunked_request();
+            test_invalid_chunk_size();
+            test_stream_request();
+            test_stream_response();
+            test_no_body_response();
+            test_stream_upload();
+            test_backpressure();
+        });
+    }
+    return check_result();
+}
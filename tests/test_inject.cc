@@ -0,0 +1,43 @@
+#include "sylar/sylar.h"
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done {0};
+
+// 协程在两个调度器之间来回切换，每次切换都是跨线程的schedule
+void test_ping_pong(int fibers, int rounds) {
+    uint64_t start = sylar::GetCurrentUS();
+    {
+        sylar::IOManager io(2, false, "io");
+        sylar::IOManager worker(2, false, "worker");
+        for(int i = 0; i < fibers; ++i) {
+            worker.schedule([&io, &worker, rounds](){
+                for(int n = 0; n < rounds; ++n) {
+                    io.switchTo();
+                    worker.switchTo();
+                }
+                ++s_done;
+            });
+        }
+        while(s_done < fibers) {
+            usleep(1000);
+        }
+        uint64_t used = sylar::GetCurrentUS() - start;
+        SYLAR_LOG_INFO(g_logger) << "fibers=" << fibers << " rounds=" << rounds
+            << " done=" << s_done << " used=" << used << "us"
+            << " switch/s=" << (uint64_t)(fibers * rounds * 2 * 1000000.0 / used);
+        std::stringstream ss;
+        io.dump(ss);
+        ss << std::endl;
+        worker.dump(ss);
+        SYLAR_LOG_INFO(g_logger) << ss.str();
+    }
+}
+
+int main(int argc, char** argv) {
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_ping_pong(1000, 100);
+    return 0;
+}
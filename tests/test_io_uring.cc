@@ -0,0 +1,139 @@
+#include "sylar/sylar.h"
+#include "test_helper.h"
+#include <sys/socket.h>
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// accept/connect/send/recv 都走hook，io_uring后端下由ring完成
+void test_echo(const std::string& backend, int rounds) {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+    sylar::IOManager iom(2, false, backend);
+    SYLAR_CHECK(iom.isIoUring() == (backend == "io_uring"));
+
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:0");
+    sylar::Socket::ptr server = sylar::Socket::CreateTCP(addr);
+    SYLAR_CHECK(server->bind(addr));
+    SYLAR_CHECK(server->listen());
+    sylar::Address::ptr local = server->getLocalAddress();
+
+    std::atomic<int> done {0};
+    uint64_t start = sylar::GetCurrentUS();
+    iom.schedule([server](){
+        sylar::Socket::ptr client = server->accept();
+        SYLAR_CHECK(client);
+        if(!client) {
+            return;
+        }
+        char buf[64];
+        while(true) {
+            int rt = client->recv(buf, sizeof(buf));
+            if(rt <= 0) {
+                break;
+            }
+            SYLAR_CHECK(client->send(buf, rt) == rt);
+        }
+    });
+    iom.schedule([local, rounds, &done](){
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local);
+        SYLAR_CHECK(sock->connect(local, 1000));
+        char buf[64];
+        for(int i = 0; i < rounds; ++i) {
+            std::string msg = "ping " + std::to_string(i);
+            SYLAR_CHECK(sock->send(msg.c_str(), msg.size()) == (int)msg.size());
+            int rt = sock->recv(buf, sizeof(buf));
+            SYLAR_CHECK(rt == (int)msg.size() && std::string(buf, rt) == msg);
+        }
+
+        // 超时
+        sock->setRecvTimeout(50);
+        uint64_t ts = sylar::GetCurrentMS();
+        int rt = sock->recv(buf, sizeof(buf));
+        SYLAR_CHECK(rt == -1);
+        SYLAR_CHECK(sylar::GetCurrentMS() - ts >= 40);
+        sock->close();
+        ++done;
+    });
+    while(!done) {
+        usleep(1000);
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    server->close();
+    SYLAR_LOG_INFO(g_logger) << "backend=" << backend << " rounds=" << rounds
+        << " used=" << used << "us rtt=" << (used * 1.0 / rounds) << "us";
+}
+
+// 另一个协程close正在等待读的socket，等待的协程应该返回
+void test_close_wakeup() {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    sylar::IOManager iom(1, false, "close");
+    int sv[2];
+    SYLAR_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    std::atomic<int> done {0};
+    iom.schedule([&sv, &done](){
+        // 在IOManager线程中创建的fd才会被hook管理
+        int fd = dup(sv[0]);
+        sylar::FdMgr::GetInstance()->get(fd, true);
+        sylar::IOManager::GetThis()->schedule([fd](){
+            usleep(50 * 1000);
+            close(fd);
+        });
+        char buf[16];
+        int rt = read(fd, buf, sizeof(buf));
+        SYLAR_CHECK(rt == -1 && errno == EBADF);
+        ++done;
+    });
+    while(!done) {
+        usleep(1000);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    SYLAR_LOG_INFO(g_logger) << "close wakeup done";
+}
+
+void test_fixed_buffers() {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    sylar::Config::Lookup<uint32_t>("iomanager.io_uring.buffers")->setValue(4);
+    sylar::IOManager iom(1, false, "fixed");
+    int sv[2];
+    SYLAR_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    std::atomic<int> done {0};
+    iom.schedule([&iom, &sv, &done](){
+        void* wbuf = nullptr;
+        void* rbuf = nullptr;
+        size_t len = 0;
+        int widx = iom.acquireBuffer(&wbuf, &len);
+        int ridx = iom.acquireBuffer(&rbuf, &len);
+        SYLAR_CHECK(widx >= 0 && ridx >= 0 && len > 0);
+        if(widx < 0 || ridx < 0) {
+            ++done;
+            return;
+        }
+        memset(wbuf, 'x', len);
+        SYLAR_CHECK(iom.writeFixed(sv[1], widx, wbuf, 128) == 128);
+        SYLAR_CHECK(iom.readFixed(sv[0], ridx, rbuf, len) == 128);
+        SYLAR_CHECK(memcmp(rbuf, wbuf, 128) == 0);
+        // 没有数据，超时返回
+        SYLAR_CHECK(iom.readFixed(sv[0], ridx, rbuf, len, -1, 20) == -ETIMEDOUT);
+        iom.releaseBuffer(widx);
+        iom.releaseBuffer(ridx);
+        ++done;
+    });
+    while(!done) {
+        usleep(1000);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    SYLAR_LOG_INFO(g_logger) << "fixed buffers done";
+}
+
+int main(int argc, char** argv) {
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+    test_echo("epoll", rounds);
+    test_echo("io_uring", rounds);
+    test_close_wakeup();
+    test_fixed_buffers();
+    return check_result();
+}
@@ -0,0 +1,100 @@
+#include "sylar/sylar.h"
+#include <atomic>
+#include <stdlib.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_allocs {0};
+
+// 统计堆分配次数
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// 丢弃输出，只统计字节数
+class NullBuf : public std::streambuf {
+public:
+    uint64_t bytes = 0;
+protected:
+    int overflow(int c) override {
+        ++bytes;
+        return c;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        bytes += n;
+        return n;
+    }
+};
+
+// 只做格式化的Appender，测量日志语句本身的开销
+class NullLogAppender : public sylar::LogAppender {
+public:
+    void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) override {
+        static thread_local NullBuf t_buf;
+        static thread_local std::ostream t_os(&t_buf);
+        m_formatter->format(t_os, logger, level, event);
+    }
+    std::string toYamlString() override {
+        return "";
+    }
+};
+
+void bench(int threads, int count) {
+    sylar::Logger::ptr logger(new sylar::Logger("bench"));
+    logger->addAppender(sylar::LogAppender::ptr(new NullLogAppender));
+    std::vector<sylar::Thread::ptr> thrs;
+    std::atomic<uint64_t> total_us {0};
+    std::atomic<int> ready {0};
+    std::atomic<bool> go {false};
+    uint64_t allocs = 0;
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&, i](){
+            // 预热
+            for(int j = 0; j < 1000; ++j) {
+                SYLAR_LOG_INFO(logger) << "warm up " << j;
+            }
+            ++ready;
+            while(!go) {
+                sched_yield();
+            }
+            uint64_t start = sylar::GetCurrentUS();
+            for(int j = 0; j < count; ++j) {
+                SYLAR_LOG_INFO(logger) << "bench message " << j << " thread " << i;
+            }
+            total_us += sylar::GetCurrentUS() - start;
+        }, "log_bench_" + std::to_string(i))));
+    }
+    while(ready != threads) {
+        sched_yield();
+    }
+    uint64_t before = s_allocs;
+    go = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    allocs = s_allocs - before;
+    double per_thread = count * 1000000.0 / (total_us / threads);
+    SYLAR_LOG_INFO(g_logger) << "threads=" << threads << " count=" << count
+        << " lines/s/thread=" << (uint64_t)per_thread
+        << " allocs/line=" << (allocs * 1.0 / (threads * count));
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    bench(1, count);
+    bench(4, count / 4);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "sylar/http/servlets/response_cache_servlet.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "test_helper.h"
+#include <atomic>
+#include <stdexcept>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static std::atomic<int> s_calls {0};
+static std::atomic<bool> s_throw {false};
+
+// 下游servlet: 消息体为调用序号，Cache-Control取查询参数cc
+static int32_t backend(HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr session) {
+    int n = ++s_calls;
+    std::string cc = req->getParam("cc", "max-age=60");
+    if(!cc.empty()) {
+        rsp->setHeader("Cache-Control", cc);
+    }
+    std::string vary = req->getParam("vary");
+    if(!vary.empty()) {
+        rsp->setHeader("Vary", vary);
+    }
+    if(req->getParam("cookie") == "1") {
+        rsp->setCookie("sid", "1");
+    }
+    if(req->getParam("slow") == "1") {
+        usleep(100 * 1000);
+    }
+    if(s_throw.exchange(false)) {
+        throw std::runtime_error("backend error");
+    }
+    rsp->setHeader("Content-Type", "text/plain");
+    rsp->setBody(req->getPath() + "#" + std::to_string(n));
+    return 0;
+}
+
+static HttpResponse::ptr request(ResponseCacheServlet::ptr cache, const std::string& path
+                    ,const std::string& query = ""
+                    ,const std::map<std::string, std::string>& headers = {}
+                    ,HttpMethod method = HttpMethod::GET) {
+    HttpRequest::ptr req(new HttpRequest);
+    req->setMethod(method);
+    req->setPath(path);
+    req->setQuery(query);
+    for(auto& i : headers) {
+        req->setHeader(i.first, i.second);
+    }
+    HttpResponse::ptr rsp(new HttpResponse);
+    cache->handle(req, rsp, nullptr);
+    return rsp;
+}
+
+void test_parse() {
+    SYLAR_CHECK(ResponseCacheServlet::ParseMaxAge("") == -1);
+    SYLAR_CHECK(ResponseCacheServlet::ParseMaxAge("max-age=60") == 60);
+    SYLAR_CHECK(ResponseCacheServlet::ParseMaxAge("public, max-age=60, s-maxage=10") == 10);
+    SYLAR_CHECK(ResponseCacheServlet::ParseMaxAge("max-age=60, private") == -1);
+    SYLAR_CHECK(ResponseCacheServlet::ParseMaxAge("no-store") == -1);
+    SYLAR_CHECK(ResponseCacheServlet::ParseMaxAge("No-Cache, max-age=5") == -1);
+}
+
+void test_cache() {
+    s_calls = 0;
+    ResponseCacheServlet::ptr cache(new ResponseCacheServlet(
+                std::make_shared<FunctionServlet>(backend), 100, {"Accept-Language"}));
+
+    auto rsp = request(cache, "/a");
+    SYLAR_CHECK(rsp->getBody() == "/a#1");
+    rsp = request(cache, "/a");
+    SYLAR_CHECK(rsp->getBody() == "/a#1" && rsp->getHeader("Age") == "0");
+    SYLAR_CHECK(rsp->getHeader("Cache-Control") == "max-age=60");
+
+    // 查询参数、方法、Vary请求头都是key的一部分
+    SYLAR_CHECK(request(cache, "/a", "x=1")->getBody() == "/a#2");
+    SYLAR_CHECK(request(cache, "/a", "x=1")->getBody() == "/a#2");
+    SYLAR_CHECK(request(cache, "/a", "", {}, HttpMethod::HEAD)->getBody() == "/a#3");
+    SYLAR_CHECK(request(cache, "/a", "", {{"Accept-Language", "zh"}})->getBody() == "/a#4");
+    SYLAR_CHECK(request(cache, "/a", "", {{"Accept-Language", "zh"}})->getBody() == "/a#4");
+    SYLAR_CHECK(request(cache, "/a")->getBody() == "/a#1");
+
+    // 请求要求重新生成
+    SYLAR_CHECK(request(cache, "/a", "", {{"Cache-Control", "no-cache"}})->getBody() == "/a#5");
+    SYLAR_CHECK(request(cache, "/a")->getBody() == "/a#5");
+    SYLAR_CHECK(request(cache, "/a", "", {{"Cache-Control", "no-store"}})->getBody() == "/a#6");
+    SYLAR_CHECK(request(cache, "/a", "", {{"Authorization", "Basic eA=="}})->getBody() == "/a#7");
+    SYLAR_CHECK(request(cache, "/a", "", {}, HttpMethod::POST)->getBody() == "/a#8");
+    SYLAR_CHECK(request(cache, "/a")->getBody() == "/a#5");
+
+    // 不可缓存的响应
+    SYLAR_CHECK(request(cache, "/b", "cc=")->getBody() == "/b#9");
+    SYLAR_CHECK(request(cache, "/b", "cc=")->getBody() == "/b#10");
+    SYLAR_CHECK(request(cache, "/b", "cc=private,max-age=9")->getBody() == "/b#11");
+    SYLAR_CHECK(request(cache, "/b", "cc=private,max-age=9")->getBody() == "/b#12");
+    SYLAR_CHECK(request(cache, "/b", "cookie=1")->getBody() == "/b#13");
+    SYLAR_CHECK(request(cache, "/b", "cookie=1")->getBody() == "/b#14");
+    SYLAR_CHECK(request(cache, "/b", "vary=User-Agent")->getBody() == "/b#15");
+    SYLAR_CHECK(request(cache, "/b", "vary=User-Agent")->getBody() == "/b#16");
+    SYLAR_CHECK(request(cache, "/b", "vary=accept-language,Accept-Encoding")->getBody() == "/b#17");
+    SYLAR_CHECK(request(cache, "/b", "vary=accept-language,Accept-Encoding")->getBody() == "/b#17");
+
+    // 过期
+    SYLAR_CHECK(request(cache, "/c", "cc=max-age=1")->getBody() == "/c#18");
+    SYLAR_CHECK(request(cache, "/c", "cc=max-age=1")->getBody() == "/c#18");
+    usleep(1100 * 1000);
+    SYLAR_CHECK(request(cache, "/c", "cc=max-age=1")->getBody() == "/c#19");
+    SYLAR_LOG_INFO(g_logger) << cache->toStatusString();
+}
+
+// 并发未命中只调用一次下游
+void test_coalesce(sylar::IOManager* iom) {
+    s_calls = 0;
+    ResponseCacheServlet::ptr cache(new ResponseCacheServlet(
+                std::make_shared<FunctionServlet>(backend)));
+    const int n = 20;
+    for(auto& query : {"slow=1", "slow=1&cc="}) {
+        std::atomic<int> done {0};
+        std::atomic<int> same {0};
+        sylar::FiberSemaphore finish;
+        int calls = s_calls;
+        for(int i = 0; i < n; ++i) {
+            iom->schedule([&, query](){
+                auto rsp = request(cache, "/slow", query);
+                if(rsp->getBody() == "/slow#" + std::to_string(calls + 1)) {
+                    ++same;
+                }
+                if(++done == n) {
+                    finish.notify();
+                }
+            });
+        }
+        finish.wait();
+        if(std::string(query) == "slow=1") {
+            // 可缓存: 只计算一次，所有请求得到相同结果
+            SYLAR_CHECK(s_calls - calls == 1 && same == n);
+        } else {
+            // 不可缓存: 等待的请求各自计算
+            SYLAR_CHECK(s_calls - calls == n && same == 1);
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << cache->toStatusString();
+    SYLAR_CHECK(cache->getMiss() == 2 && cache->getCoalesce() == (uint64_t)(n - 1) * 2);
+}
+
+// 合并请求的计算者抛出异常时，等待的请求不能一直阻塞
+void test_leader_throw(sylar::IOManager* iom) {
+    ResponseCacheServlet::ptr cache(new ResponseCacheServlet(
+                std::make_shared<FunctionServlet>(backend)));
+    const int n = 10;
+    std::atomic<int> done {0};
+    std::atomic<int> thrown {0};
+    std::atomic<int> ok {0};
+    sylar::FiberSemaphore finish;
+    s_throw = true;
+    for(int i = 0; i < n; ++i) {
+        iom->schedule([&](){
+            try {
+                if(!request(cache, "/throw", "slow=1")->getBody().empty()) {
+                    ++ok;
+                }
+            } catch(std::exception& ex) {
+                ++thrown;
+            }
+            if(++done == n) {
+                finish.notify();
+            }
+        });
+    }
+    finish.wait();
+    SYLAR_CHECK(thrown == 1 && ok == n - 1);
+    SYLAR_CHECK(cache->getCoalesce() == (uint64_t)(n - 1));
+}
+
+int main(int argc, char** argv) {
+    test_parse();
+    {
+        sylar::IOManager iom(2);
+        iom.schedule([&iom](){
+            test_cache();
+            test_coalesce(&iom);
+            test_leader_throw(&iom);
+        });
+    }
+    return check_result();
+}
@@ -0,0 +1,160 @@
+#include "sylar/http/servlet.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static Servlet::ptr named(const std::string& name) {
+    return std::make_shared<NotFoundServlet>(name);
+}
+
+// 返回匹配到的servlet在表中的名称
+static std::string match(ServletDispatch::ptr sd, std::map<Servlet::ptr, std::string>& names
+                         ,const std::string& path, HttpRequest::ptr req = nullptr) {
+    Servlet::ptr slt;
+    if(req) {
+        req->setPath(path);
+        slt = sd->getMatchedServlet(req);
+    } else {
+        slt = sd->getMatchedServlet(path);
+    }
+    auto it = names.find(slt);
+    return it == names.end() ? "default" : it->second;
+}
+
+void test_routes() {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    std::map<Servlet::ptr, std::string> names;
+#define ADD(fun, pattern, name) { \
+        auto slt = named(name); \
+        names[slt] = name; \
+        SYLAR_CHECK(sd->fun(pattern, slt)); \
+    }
+    ADD(addRoute, "/users/list", "list");
+    ADD(addRoute, "/users/:id", "user");
+    ADD(addRoute, "/users/:id/posts/:post", "post");
+    ADD(addRoute, "/users/:id/files/*path", "files");
+    ADD(addRoute, "/static/*", "static");
+    ADD(addRoute, "/u", "u");
+    ADD(addRoute, "/user", "user_exact");
+#undef ADD
+    // 同一位置参数名冲突、通配不在最后
+    SYLAR_CHECK(!sd->addRoute("/users/:uid/x", named("bad")));
+    SYLAR_CHECK(!sd->addRoute("/a/*rest/b", named("bad")));
+
+    SYLAR_CHECK(match(sd, names, "/users/list") == "list");
+    SYLAR_CHECK(match(sd, names, "/users/42") == "user");
+    SYLAR_CHECK(match(sd, names, "/users/") == "default");
+    SYLAR_CHECK(match(sd, names, "/users/42/posts/7") == "post");
+    SYLAR_CHECK(match(sd, names, "/users/42/posts/") == "default");
+    SYLAR_CHECK(match(sd, names, "/users/list/posts/7") == "post");
+    SYLAR_CHECK(match(sd, names, "/static/") == "static");
+    SYLAR_CHECK(match(sd, names, "/static/js/app.js") == "static");
+    SYLAR_CHECK(match(sd, names, "/u") == "u");
+    SYLAR_CHECK(match(sd, names, "/user") == "user_exact");
+    SYLAR_CHECK(match(sd, names, "/use") == "default");
+
+    HttpRequest::ptr req(new HttpRequest);
+    SYLAR_CHECK(match(sd, names, "/users/42/posts/7", req) == "post");
+    SYLAR_CHECK(req->getPathParam("id") == "42");
+    SYLAR_CHECK(req->getPathParamAs<int>("post") == 7);
+    req.reset(new HttpRequest);
+    SYLAR_CHECK(match(sd, names, "/users/9/files/a/b.txt", req) == "files");
+    SYLAR_CHECK(req->getPathParam("path") == "a/b.txt");
+    SYLAR_CHECK(req->hasPathParam("id"));
+    // 参数只记录在路径中的位置，名称忽略大小写，修改路径后清空
+    SYLAR_CHECK(req->getPathParams().size() == 2);
+    SYLAR_CHECK(req->getPathParams()[0].offset == 7 && req->getPathParams()[0].size == 1);
+    SYLAR_CHECK(req->getPathParam("ID") == "9");
+    req->setPath("/other");
+    SYLAR_CHECK(!req->hasPathParam("id") && req->getPathParams().empty());
+
+    // 超过内部容量的参数
+    SYLAR_CHECK(sd->addRoute("/p/:a/:b/:c/:d/:e/:f", named("many")));
+    req.reset(new HttpRequest);
+    match(sd, names, "/p/1/2/3/4/5/6", req);
+    SYLAR_CHECK(req->getPathParams().size() == 6);
+    SYLAR_CHECK(req->getPathParamAs<int>("a") == 1 && req->getPathParamAs<int>("f") == 6);
+
+    sd->delRoute("/users/:id");
+    SYLAR_CHECK(match(sd, names, "/users/42") == "default");
+    SYLAR_CHECK(match(sd, names, "/users/42/posts/7") == "post");
+}
+
+// 精准 > 路由 > 模糊，模糊匹配保持先添加先匹配
+void test_compat() {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    std::map<Servlet::ptr, std::string> names;
+#define ADD(fun, pattern, name) { \
+        auto slt = named(name); \
+        names[slt] = name; \
+        sd->fun(pattern, slt); \
+    }
+    ADD(addServlet, "/sylar/xx", "exact");
+    ADD(addGlobServlet, "/sylar/*", "glob");
+    ADD(addGlobServlet, "/sylar/a/*", "glob_a");
+    ADD(addGlobServlet, "*.html", "html");
+    ADD(addGlobServlet, "/b?/*", "b");
+    ADD(addGlobServlet, "/bx*", "bx");
+    ADD(addRoute, "/sylar/r/:id", "route");
+#undef ADD
+    SYLAR_CHECK(match(sd, names, "/sylar/xx") == "exact");
+    SYLAR_CHECK(match(sd, names, "/sylar/r/1") == "route");
+    SYLAR_CHECK(match(sd, names, "/sylar/r/1/2") == "glob");
+    SYLAR_CHECK(match(sd, names, "/sylar/a/1") == "glob");
+    SYLAR_CHECK(match(sd, names, "/index.html") == "html");
+    SYLAR_CHECK(match(sd, names, "/sylar/index.html") == "glob");
+    SYLAR_CHECK(match(sd, names, "/bx/1") == "b");
+    SYLAR_CHECK(match(sd, names, "/bxx") == "bx");
+    SYLAR_CHECK(match(sd, names, "/x") == "default");
+
+    sd->delGlobServlet("/sylar/*");
+    SYLAR_CHECK(match(sd, names, "/sylar/a/1") == "glob_a");
+    SYLAR_CHECK(match(sd, names, "/sylar/index.html") == "html");
+    SYLAR_CHECK(!sd->getGlobServlet("/sylar/*"));
+    SYLAR_CHECK(sd->getGlobServlet("/sylar/a/*"));
+
+    // 重新添加后顺序排到最后
+    sd->delGlobServlet("/b?/*");
+    auto b = named("b2");
+    names[b] = "b2";
+    sd->addGlobServlet("/b?/*", b);
+    SYLAR_CHECK(match(sd, names, "/bx/1") == "bx");
+}
+
+// 路由数量增加时查找耗时不变
+void bench(int routes, int count) {
+    ServletDispatch::ptr sd(new ServletDispatch);
+    for(int i = 0; i < routes; ++i) {
+        sd->addGlobServlet("/api/v" + std::to_string(i) + "/*", named("glob"));
+        sd->addRoute("/svc" + std::to_string(i) + "/users/:id", named("route"));
+    }
+    std::string glob_path = "/api/v" + std::to_string(routes - 1) + "/items";
+    std::string route_path = "/svc" + std::to_string(routes - 1) + "/users/42";
+    uint64_t start = sylar::GetCurrentUS();
+    for(int i = 0; i < count; ++i) {
+        sd->getMatchedServlet(glob_path);
+    }
+    uint64_t glob_us = sylar::GetCurrentUS() - start;
+    start = sylar::GetCurrentUS();
+    for(int i = 0; i < count; ++i) {
+        sd->getMatchedServlet(route_path);
+    }
+    uint64_t route_us = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "routes=" << routes
+        << " glob=" << (glob_us * 1000.0 / count) << "ns/op"
+        << " route=" << (route_us * 1000.0 / count) << "ns/op";
+}
+
+int main(int argc, char** argv) {
+    test_routes();
+    test_compat();
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    bench(10, count);
+    bench(1000, count);
+    return check_result();
+}
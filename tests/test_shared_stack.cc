@@ -0,0 +1,73 @@
+#include "sylar/sylar.h"
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_error {0};
+static std::atomic<int> s_done {0};
+
+// 栈上放一块数据，切换回来之后检查是否被其它协程踩坏
+static void check_stack(int id, int rounds, bool caller) {
+    char buf[8192];
+    memset(buf, id & 0xff, sizeof(buf));
+    int thread = sylar::GetThreadId();
+    for(int i = 0; i < rounds; ++i) {
+        if(caller) {
+            sylar::Fiber::GetThis()->back();
+        } else {
+            sylar::Fiber::YieldToReady();
+        }
+        for(size_t j = 0; j < sizeof(buf); ++j) {
+            if(buf[j] != (char)(id & 0xff)) {
+                ++s_error;
+                break;
+            }
+        }
+        if(thread != sylar::GetThreadId()) {
+            ++s_error;
+        }
+    }
+    ++s_done;
+}
+
+void test_call() {
+    sylar::Fiber::GetThis();
+    std::vector<sylar::Fiber::ptr> fibers;
+    for(int i = 0; i < 20; ++i) {
+        fibers.push_back(std::make_shared<sylar::Fiber>(std::bind(check_stack, i, 5, true), 0, true, true));
+    }
+    for(int n = 0; n < 6; ++n) {
+        for(auto& i : fibers) {
+            i->call();
+        }
+    }
+    size_t stacks = 0;
+    uint64_t saved = 0;
+    sylar::Fiber::GetSharedStackInfo(stacks, saved);
+    SYLAR_LOG_INFO(g_logger) << "call done=" << s_done << " error=" << s_error
+        << " stacks=" << stacks << " saved_bytes=" << saved;
+}
+
+void test_scheduler() {
+    s_done = 0;
+    uint64_t start = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(4, false, "shared");
+        for(int i = 0; i < 10000; ++i) {
+            sylar::Fiber::ptr f(new sylar::Fiber(std::bind(check_stack, i, 10, false), 0, false, true));
+            iom.schedule(f);
+        }
+    }
+    size_t stacks = 0;
+    uint64_t saved = 0;
+    sylar::Fiber::GetSharedStackInfo(stacks, saved);
+    SYLAR_LOG_INFO(g_logger) << "scheduler done=" << s_done << " error=" << s_error
+        << " saved_bytes=" << saved << " used=" << (sylar::GetCurrentUS() - start) << "us";
+}
+
+int main(int argc, char** argv) {
+    sylar::Thread::SetName("main");
+    test_call();
+    test_scheduler();
+    return s_error ? 1 : 0;
+}
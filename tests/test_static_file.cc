@@ -0,0 +1,234 @@
+#include "sylar/http/servlets/static_file_servlet.h"
+#include "sylar/http/http_connection.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "test_helper.h"
+#include <atomic>
+#include <fstream>
+#include <sys/stat.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static std::string s_root;
+
+static void write_file(const std::string& name, const std::string& data) {
+    std::ofstream ofs(s_root + "/" + name, std::ios::trunc | std::ios::binary);
+    ofs << data;
+}
+
+// 模拟HttpServer::handleClient
+static void serve(HttpSession::ptr session, Servlet::ptr servlet) {
+    while(auto req = session->recvRequest()) {
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), req->isClose()));
+        servlet->handle(req, rsp, session);
+        bool close = rsp->isClose();
+        if(session->isResponseStarted()) {
+            if(!session->endResponse()) {
+                break;
+            }
+        } else {
+            session->sendResponse(rsp, close || !session->hasBufferedData());
+        }
+        if(close) {
+            break;
+        }
+    }
+    session->close();
+}
+
+struct Client {
+    HttpConnection::ptr conn;
+    sylar::Socket::ptr sock;
+
+    Client(Servlet::ptr servlet) {
+        sylar::Socket::ptr server;
+        make_socket_pair(sock, server);
+        conn.reset(new HttpConnection(sock));
+        HttpSession::ptr session(new HttpSession(server));
+        sylar::IOManager::GetThis()->schedule([session, servlet](){
+            serve(session, servlet);
+        });
+    }
+
+    HttpResponse::ptr get(const std::string& path
+                ,const std::map<std::string, std::string>& headers = {}) {
+        HttpRequest::ptr req(new HttpRequest(0x11, false));
+        req->setPath(path);
+        for(auto& i : headers) {
+            req->setHeader(i.first, i.second);
+        }
+        if(conn->sendRequest(req) <= 0) {
+            return nullptr;
+        }
+        return conn->recvResponse();
+    }
+};
+
+static std::string make_data(size_t size) {
+    std::string data(size, 0);
+    for(size_t i = 0; i < size; ++i) {
+        data[i] = 'a' + i % 26;
+    }
+    return data;
+}
+
+void test_parse() {
+    uint64_t off = 0, len = 0;
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=0-9", 100, off, len) == 1 && off == 0 && len == 10);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=90-", 100, off, len) == 1 && off == 90 && len == 10);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=90-200", 100, off, len) == 1 && len == 10);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=-30", 100, off, len) == 1 && off == 70 && len == 30);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=-300", 100, off, len) == 1 && off == 0 && len == 100);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=100-", 100, off, len) == -1);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=0-1,5-6", 100, off, len) == 0);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("items=0-1", 100, off, len) == 0);
+    SYLAR_CHECK(StaticFileServlet::ParseRange("bytes=5-1", 100, off, len) == 0);
+
+    std::string date = StaticFileServlet::FormatHttpDate(784111777);
+    SYLAR_CHECK(date == "Sun, 06 Nov 1994 08:49:37 GMT");
+    SYLAR_CHECK(StaticFileServlet::ParseHttpDate(date) == 784111777);
+    SYLAR_CHECK(StaticFileServlet::ParseHttpDate("yesterday") == -1);
+    SYLAR_CHECK(std::string(StaticFileServlet::GetContentType("/a/b.HTML")) == "text/html; charset=utf-8");
+    SYLAR_CHECK(std::string(StaticFileServlet::GetContentType("/a.d/b")) == "application/octet-stream");
+}
+
+void test_get() {
+    std::string data = make_data(3 * 1024 * 1024 + 7);
+    write_file("big.bin", data);
+    write_file("index.html", "<html></html>");
+    write_file("empty.txt", "");
+    StaticFileServlet::ptr servlet(new StaticFileServlet(s_root, "/static"));
+    Client client(servlet);
+
+    auto rsp = client.get("/static/big.bin");
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::OK && rsp->getBody() == data);
+    SYLAR_CHECK(rsp && !rsp->getHeader("ETag").empty() && !rsp->getHeader("Last-Modified").empty());
+    std::string etag = rsp ? rsp->getHeader("ETag") : "";
+    std::string last_modified = rsp ? rsp->getHeader("Last-Modified") : "";
+
+    rsp = client.get("/static/");
+    SYLAR_CHECK(rsp && rsp->getBody() == "<html></html>");
+    SYLAR_CHECK(rsp && rsp->getHeader("Content-Type") == "text/html; charset=utf-8");
+
+    rsp = client.get("/static/empty.txt");
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::OK && rsp->getBody().empty());
+
+    rsp = client.get("/static/big.bin", {{"Range", "bytes=100-199"}});
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::PARTIAL_CONTENT);
+    SYLAR_CHECK(rsp && rsp->getBody() == data.substr(100, 100));
+    SYLAR_CHECK(rsp && rsp->getHeader("Content-Range") == "bytes 100-199/" + std::to_string(data.size()));
+
+    rsp = client.get("/static/big.bin", {{"Range", "bytes=-10"}});
+    SYLAR_CHECK(rsp && rsp->getBody() == data.substr(data.size() - 10));
+
+    rsp = client.get("/static/big.bin", {{"Range", "bytes=99999999-"}});
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::RANGE_NOT_SATISFIABLE);
+
+    // If-Range不匹配时返回整个文件
+    rsp = client.get("/static/big.bin", {{"Range", "bytes=0-9"}, {"If-Range", "\"old\""}});
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::OK && rsp->getBody().size() == data.size());
+
+    rsp = client.get("/static/big.bin", {{"If-None-Match", "\"x\", W/" + etag}});
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::NOT_MODIFIED && rsp->getBody().empty());
+    rsp = client.get("/static/big.bin", {{"If-None-Match", "\"x\""}
+                , {"If-Modified-Since", last_modified}});
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::OK);
+    rsp = client.get("/static/big.bin", {{"If-Modified-Since", last_modified}});
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::NOT_MODIFIED);
+
+    rsp = client.get("/static/../etc/passwd");
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::FORBIDDEN);
+    rsp = client.get("/static/%2e%2e/etc/passwd");
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::FORBIDDEN);
+    rsp = client.get("/static/missing");
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::NOT_FOUND);
+
+    // 连接在以上请求之后仍然可用
+    rsp = client.get("/static/index.html");
+    SYLAR_CHECK(rsp && rsp->getBody() == "<html></html>");
+}
+
+// 流水线请求: sendfile之前先发出暂存的响应，顺序不乱；HEAD只有响应头
+void test_pipeline_head() {
+    write_file("a.txt", "AAAA");
+    StaticFileServlet::ptr servlet(new StaticFileServlet(s_root));
+    sylar::Socket::ptr client, server;
+    make_socket_pair(client, server);
+    HttpSession::ptr session(new HttpSession(server));
+    std::string reqs =
+        "GET /missing HTTP/1.1\r\n\r\n"
+        "GET /a.txt HTTP/1.1\r\n\r\n"
+        "HEAD /a.txt HTTP/1.1\r\n\r\n"
+        "GET /a.txt HTTP/1.1\r\nconnection: close\r\n\r\n";
+    client->send(reqs.c_str(), reqs.size());
+    serve(session, servlet);
+
+    std::string data;
+    char buf[4096];
+    int rt = 0;
+    while((rt = client->recv(buf, sizeof(buf))) > 0) {
+        data.append(buf, rt);
+    }
+    size_t p1 = data.find("404 Not Found");
+    size_t p2 = data.find("\r\n\r\nAAAA", p1);
+    size_t p3 = data.find("HTTP/1.1 200", p2);
+    size_t p4 = data.find("HTTP/1.1 200", p3 + 1);
+    SYLAR_CHECK(p1 != std::string::npos && p2 != std::string::npos
+            && p3 != std::string::npos && p4 != std::string::npos);
+    // HEAD响应头之后紧跟下一个响应
+    SYLAR_CHECK(p4 != std::string::npos && data.compare(p4 - 4, 4, "\r\n\r\n") == 0);
+    SYLAR_CHECK(data.size() > 4 && data.compare(data.size() - 8, 8, "\r\n\r\nAAAA") == 0);
+}
+
+// 文件变化后重新打开；缓存数量有上限
+void test_cache() {
+    write_file("c.txt", "version1");
+    StaticFileServlet::ptr servlet(new StaticFileServlet(s_root, "", 2, 0));
+    Client client(servlet);
+    auto rsp = client.get("/c.txt");
+    SYLAR_CHECK(rsp && rsp->getBody() == "version1");
+    std::string etag = rsp ? rsp->getHeader("ETag") : "";
+    write_file("c.txt", "version22");
+    rsp = client.get("/c.txt");
+    SYLAR_CHECK(rsp && rsp->getBody() == "version22" && rsp->getHeader("ETag") != etag);
+
+    // 替换成新文件(inode变化)
+    std::string tmp = s_root + "/c.tmp";
+    std::ofstream(tmp) << "version33";
+    rename(tmp.c_str(), (s_root + "/c.txt").c_str());
+    rsp = client.get("/c.txt");
+    SYLAR_CHECK(rsp && rsp->getBody() == "version33");
+
+    unlink((s_root + "/c.txt").c_str());
+    rsp = client.get("/c.txt");
+    SYLAR_CHECK(rsp && rsp->getStatus() == HttpStatus::NOT_FOUND);
+
+    write_file("d1.txt", "1");
+    write_file("d2.txt", "2");
+    write_file("d3.txt", "3");
+    for(auto& name : {"/d1.txt", "/d2.txt", "/d3.txt", "/d1.txt"}) {
+        rsp = client.get(name);
+        SYLAR_CHECK(rsp && rsp->getBody() == std::string(name).substr(2, 1));
+    }
+    std::string status = servlet->toStatusString();
+    SYLAR_LOG_INFO(g_logger) << status;
+    SYLAR_CHECK(status.find("total=2") != std::string::npos);
+}
+
+int main(int argc, char** argv) {
+    char tmpl[] = "/tmp/test_static_file_XXXXXX";
+    s_root = mkdtemp(tmpl);
+    test_parse();
+    {
+        sylar::IOManager iom(1);
+        iom.schedule([](){
+            test_get();
+            test_pipeline_head();
+            test_cache();
+        });
+    }
+    system(("rm -rf " + s_root).c_str());
+    return check_result();
+}
@@ -0,0 +1,169 @@
+#include "sylar/sylar.h"
+#include "test_helper.h"
+#include <atomic>
+#include <stdlib.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+class TestTimerManager : public sylar::TimerManager {
+public:
+    TestTimerManager(Type type)
+        :TimerManager(type) {
+    }
+
+    void onTimerInsertedAtFront() override {
+        ++m_front;
+    }
+
+    int m_front = 0;
+};
+
+static const char* TypeName(sylar::TimerManager::Type type) {
+    return type == sylar::TimerManager::WHEEL ? "wheel" : "set";
+}
+
+// 随机的定时器按时触发，取消的不触发，刷新的按新时间触发
+void test_expire(sylar::TimerManager::Type type) {
+    TestTimerManager mgr(type);
+    SYLAR_CHECK(mgr.getTimerType() == type);
+
+    const int N = 2000;
+    std::vector<uint64_t> expect(N);
+    std::vector<uint64_t> fired(N, 0);
+    std::vector<sylar::Timer::ptr> timers(N);
+    uint64_t start = sylar::GetCurrentMS();
+    for(int i = 0; i < N; ++i) {
+        uint64_t ms = rand() % 1200;
+        expect[i] = start + ms;
+        timers[i] = mgr.addTimer(ms, [i, &fired](){
+            fired[i] = sylar::GetCurrentMS();
+        });
+    }
+    int recurring = 0;
+    auto rt = mgr.addTimer(100, [&recurring](){
+        ++recurring;
+    }, true);
+
+    // 取消三分之一，刷新三分之一到400ms之后
+    for(int i = 0; i < N; i += 3) {
+        SYLAR_CHECK(timers[i]->cancel());
+        SYLAR_CHECK(!timers[i]->cancel());
+        expect[i] = 0;
+    }
+    for(int i = 1; i < N; i += 3) {
+        uint64_t ms = 400 + rand() % 400;
+        expect[i] = sylar::GetCurrentMS() + ms;
+        timers[i]->reset(ms, true);
+    }
+
+    std::vector<std::function<void()> > cbs;
+    while(true) {
+        uint64_t next = mgr.getNextTimer();
+        if(sylar::GetCurrentMS() - start > 1500) {
+            break;
+        }
+        if(next) {
+            usleep(std::min(next, (uint64_t)5) * 1000);
+        }
+        mgr.listExpiredCb(cbs);
+        for(auto& cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+    }
+    rt->cancel();
+
+    int late = 0;
+    for(int i = 0; i < N; ++i) {
+        if(!expect[i]) {
+            SYLAR_CHECK(fired[i] == 0);
+            continue;
+        }
+        SYLAR_CHECK(fired[i] >= expect[i]);
+        if(fired[i] > expect[i] + 10) {
+            ++late;
+        }
+    }
+    SYLAR_CHECK(late < N / 100);
+    SYLAR_CHECK(recurring >= 13 && recurring <= 15);
+    SYLAR_CHECK(!mgr.hasTimer());
+    SYLAR_LOG_INFO(g_logger) << "expire type=" << TypeName(type) << " late=" << late
+        << " recurring=" << recurring << " front=" << mgr.m_front;
+}
+
+// 长时间的定时器在上层，getNextTimer不能晚于真实的到期时间
+void test_next_timer(sylar::TimerManager::Type type) {
+    TestTimerManager mgr(type);
+    SYLAR_CHECK(mgr.getNextTimer() == ~0ull);
+    uint64_t ms[] = {10, 300, 20000, 2000000, 100000000, 5000000000ull};
+    for(auto m : ms) {
+        auto t = mgr.addTimer(m, [](){});
+        uint64_t next = mgr.getNextTimer();
+        SYLAR_CHECK(next <= m);
+        t->cancel();
+    }
+    SYLAR_CHECK(!mgr.hasTimer());
+    SYLAR_CHECK(mgr.getNextTimer() == ~0ull);
+}
+
+void bench(sylar::TimerManager::Type type, int threads, int count) {
+    TestTimerManager mgr(type);
+    std::vector<sylar::Thread::ptr> thrs;
+    uint64_t start = sylar::GetCurrentUS();
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&mgr, count](){
+            std::vector<sylar::Timer::ptr> timers;
+            timers.reserve(1000);
+            for(int n = 0; n < count; n += 1000) {
+                for(int k = 0; k < 1000; ++k) {
+                    timers.push_back(mgr.addTimer(5000 + k, [](){}));
+                }
+                for(auto& t : timers) {
+                    t->cancel();
+                }
+                timers.clear();
+            }
+        }, "bench_" + std::to_string(i)));
+    }
+    for(auto& t : thrs) {
+        t->join();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "bench type=" << TypeName(type) << " threads=" << threads
+        << " add+cancel=" << (uint64_t)threads * count << " used=" << used / 1000 << "ms"
+        << " ops/s=" << (uint64_t)(threads * count * 1000000.0 / used);
+}
+
+// IOManager使用时间轮，hook的usleep走定时器
+void test_iomanager() {
+    sylar::Config::Lookup<bool>("timer.wheel")->setValue(true);
+    std::atomic<int> done {0};
+    uint64_t start = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(2, false, "wheel");
+        SYLAR_CHECK(iom.getTimerType() == sylar::TimerManager::WHEEL);
+        for(int i = 0; i < 1000; ++i) {
+            iom.schedule([&done, i](){
+                usleep((i % 100) * 1000);
+                ++done;
+            });
+        }
+    }
+    SYLAR_CHECK(done == 1000);
+    SYLAR_LOG_INFO(g_logger) << "iomanager wheel done=" << done
+        << " used=" << (sylar::GetCurrentMS() - start) << "ms";
+}
+
+int main(int argc, char** argv) {
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    for(auto type : {sylar::TimerManager::SET, sylar::TimerManager::WHEEL}) {
+        test_next_timer(type);
+        test_expire(type);
+        bench(type, 1, count);
+        bench(type, 4, count / 4);
+    }
+    test_iomanager();
+    return check_result();
+}
@@ -0,0 +1,66 @@
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_count = {0};
+static std::atomic<uint64_t> s_pinned_error = {0};
+
+void fib_task(int depth) {
+    ++s_count;
+    if(depth > 0) {
+        // 在调度线程中产生的任务进入本地队列，由空闲线程窃取
+        sylar::Scheduler::GetThis()->schedule(std::bind(&fib_task, depth - 1));
+        sylar::Scheduler::GetThis()->schedule(std::bind(&fib_task, depth - 2));
+    }
+}
+
+void pinned_task(int thread) {
+    ++s_count;
+    if(sylar::GetThreadId() != thread) {
+        ++s_pinned_error;
+    }
+}
+
+void run(bool work_stealing) {
+    s_count = 0;
+    s_pinned_error = 0;
+    uint64_t start = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(4, false, "ws", work_stealing);
+        iom.schedule(std::bind(&fib_task, 20));
+
+        iom.schedule([&iom](){
+            // 指定线程的任务不会被其它线程窃取
+            int thread = sylar::GetThreadId();
+            for(int i = 0; i < 1000; ++i) {
+                iom.schedule(std::bind(&pinned_task, thread), thread);
+            }
+        });
+
+        iom.schedule([](){
+            for(int i = 0; i < 10; ++i) {
+                sylar::Scheduler::GetThis()->schedule([](){
+                    usleep(1000);
+                    ++s_count;
+                });
+            }
+        });
+
+        sleep(1);
+        std::stringstream ss;
+        iom.dump(ss);
+        SYLAR_LOG_INFO(g_logger) << ss.str();
+    }
+    SYLAR_LOG_INFO(g_logger) << "work_stealing=" << work_stealing
+        << " count=" << s_count
+        << " pinned_error=" << s_pinned_error
+        << " used=" << (sylar::GetCurrentMS() - start) << "ms";
+}
+
+int main(int argc, char** argv) {
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    run(false);
+    run(true);
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include "sylar/http/ws_connection.h"
+#include "sylar/http/ws_session.h"
+#include "sylar/streams/socket_stream.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <set>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static std::string negotiate(const std::string& offer) {
+    std::string rsp;
+    auto d = WSDeflate::ServerNegotiate(offer, rsp);
+    return d ? rsp : "null";
+}
+
+void test_negotiate() {
+    SYLAR_CHECK(negotiate("permessage-deflate") == "permessage-deflate");
+    SYLAR_CHECK(negotiate("permessage-deflate; client_max_window_bits") == "permessage-deflate");
+    SYLAR_CHECK(negotiate("x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=10;"
+                " client_max_window_bits=\"12\"")
+            == "permessage-deflate; server_max_window_bits=10; client_max_window_bits=12");
+    // 不合法的参数组跳过，使用下一组
+    SYLAR_CHECK(negotiate("permessage-deflate; foo, PerMessage-Deflate; server_no_context_takeover")
+            == "permessage-deflate; server_no_context_takeover");
+    SYLAR_CHECK(negotiate("permessage-deflate; server_max_window_bits=8") == "null");
+    SYLAR_CHECK(negotiate("permessage-deflate; server_max_window_bits=16") == "null");
+    SYLAR_CHECK(negotiate("permessage-deflate; server_max_window_bits=010") == "null");
+    SYLAR_CHECK(negotiate("permessage-deflate; server_max_window_bits") == "null");
+    SYLAR_CHECK(negotiate("permessage-deflate; client_no_context_takeover; client_no_context_takeover") == "null");
+    SYLAR_CHECK(negotiate("x-webkit-deflate-frame") == "null");
+
+    // 内存预算: 客户端不接受限制窗口时只能缩小服务端的压缩窗口和内存级别
+    auto max_memory = sylar::Config::Lookup<uint32_t>("websocket.deflate.max_memory");
+    max_memory->setValue(64 * 1024);
+    std::string rsp;
+    auto d = WSDeflate::ServerNegotiate("permessage-deflate", rsp);
+    SYLAR_CHECK(d && d->getMemory() <= 64 * 1024 && d->getParams().clientMaxWindowBits == 15);
+    max_memory->setValue(40 * 1024);
+    SYLAR_CHECK(negotiate("permessage-deflate") == "null");
+    d = WSDeflate::ServerNegotiate("permessage-deflate; client_max_window_bits", rsp);
+    SYLAR_CHECK(d && d->getMemory() <= 40 * 1024 && d->getParams().clientMaxWindowBits < 15);
+    SYLAR_CHECK(rsp.find("client_max_window_bits=") != std::string::npos);
+    SYLAR_LOG_INFO(g_logger) << "budget 40K: " << rsp << " memory=" << d->getMemory();
+    max_memory->setValue(320 * 1024);
+
+    // 客户端
+    SYLAR_CHECK(WSDeflate::ClientOffer() == "permessage-deflate; client_max_window_bits");
+    d = WSDeflate::ClientAccept("permessage-deflate; server_max_window_bits=10; client_no_context_takeover");
+    SYLAR_CHECK(d && d->getParams().serverMaxWindowBits == 10 && d->getParams().clientNoContextTakeover);
+    SYLAR_CHECK(!WSDeflate::ClientAccept("permessage-deflate; client_max_window_bits"));
+    SYLAR_CHECK(!WSDeflate::ClientAccept("permessage-deflate; client_max_window_bits=8"));
+    SYLAR_CHECK(!WSDeflate::ClientAccept("permessage-deflate, permessage-deflate"));
+    SYLAR_CHECK(!WSDeflate::ClientAccept("permessage-deflate; x=1"));
+}
+
+static std::string make_json(int i) {
+    return "{\"type\":\"ticker\",\"symbol\":\"BTC-USDT\",\"seq\":" + std::to_string(i)
+        + ",\"bid\":\"" + std::to_string(60000 + i % 97) + ".25\",\"ask\":\""
+        + std::to_string(60001 + i % 89) + ".75\",\"volume\":\"1234.5678\",\"ts\":"
+        + std::to_string(1700000000000ull + i * 13) + "}";
+}
+
+void test_roundtrip() {
+    for(bool no_context : {false, true}) {
+        WSDeflate::Params params;
+        params.serverNoContextTakeover = no_context;
+        params.clientNoContextTakeover = no_context;
+        WSDeflate server(params, true);
+        WSDeflate client(params, false);
+        SYLAR_CHECK(server.isValid() && client.isValid());
+
+        std::string msg = make_json(1);
+        std::string first, second, out;
+        SYLAR_CHECK(server.compress(msg.data(), msg.size(), first));
+        SYLAR_CHECK(client.decompress(first.data(), first.size(), out, 1024) && out == msg);
+        SYLAR_CHECK(server.compress(msg.data(), msg.size(), second));
+        SYLAR_CHECK(client.decompress(second.data(), second.size(), out, 1024) && out == msg);
+        // 上下文接管时重复的消息只需要一个回溯引用
+        if(no_context) {
+            SYLAR_CHECK(second == first);
+        } else {
+            SYLAR_CHECK(second.size() * 3 < first.size());
+        }
+
+        // 反方向，包括空消息
+        for(auto& m : {std::string(), make_json(2), std::string(100000, 'z')}) {
+            std::string c;
+            SYLAR_CHECK(client.compress(m.data(), m.size(), c));
+            SYLAR_CHECK(server.decompress(c.data(), c.size(), out, m.size() + 1) && out == m);
+        }
+    }
+
+    // 解压后超过上限时失败，不会无限分配
+    WSDeflate::Params params;
+    WSDeflate server(params, true);
+    WSDeflate client(params, false);
+    std::string zeros(10 * 1024 * 1024, 0), c, out;
+    SYLAR_CHECK(server.compress(zeros.data(), zeros.size(), c));
+    SYLAR_CHECK(c.size() < 64 * 1024);
+    SYLAR_CHECK(!client.decompress(c.data(), c.size(), out, 1024 * 1024));
+    SYLAR_CHECK(out.size() <= 1024 * 1024 + 1);
+    std::string bad(100, (char)0xff);
+    SYLAR_CHECK(!client.decompress(bad.data(), bad.size(), out, 1024 * 1024));
+}
+
+// 两端都启用压缩收发，包括不压缩的短消息和分片消息
+void test_frames(sylar::IOManager* iom) {
+    sylar::Socket::ptr cs, ss;
+    make_socket_pair(cs, ss);
+    sylar::SocketStream::ptr client(new sylar::SocketStream(cs));
+    sylar::SocketStream::ptr server(new sylar::SocketStream(ss));
+    WSDeflate::Params params;
+    WSDeflate::ptr cd(new WSDeflate(params, false));
+    WSDeflate::ptr sd(new WSDeflate(params, true));
+
+    std::vector<std::string> msgs = {"", "hi", make_json(1), make_json(2), std::string(70000, 'x')
+                                    ,make_json(3)};
+    iom->schedule([client, cd, msgs](){
+        for(auto& m : msgs) {
+            SYLAR_CHECK(WSSendMessage(client.get(), std::make_shared<WSFrameMessage>(WSFrameHead::TEXT_FRAME, m)
+                        , true, true, cd.get()) > 0);
+        }
+        WSSendMessage(client.get(), std::make_shared<WSFrameMessage>(WSFrameHead::BIN_FRAME, "hello "), true, false, cd.get());
+        WSSendMessage(client.get(), std::make_shared<WSFrameMessage>(WSFrameHead::CONTINUE, "world"), true, true, cd.get());
+    });
+    for(auto& m : msgs) {
+        auto msg = WSRecvMessage(server.get(), false, sd.get());
+        SYLAR_CHECK(msg && msg->getOpcode() == WSFrameHead::TEXT_FRAME && msg->getData() == m);
+    }
+    auto msg = WSRecvMessage(server.get(), false, sd.get());
+    SYLAR_CHECK(msg && msg->getOpcode() == WSFrameHead::BIN_FRAME && msg->getData() == "hello world");
+
+    // 多个协程并发发送，压缩顺序和发送顺序一致
+    const int n = 200;
+    for(int i = 0; i < 4; ++i) {
+        iom->schedule([server, sd, i, n](){
+            for(int j = i; j < n; j += 4) {
+                WSSendMessage(server.get(), std::make_shared<WSFrameMessage>(WSFrameHead::TEXT_FRAME
+                            , make_json(j)), false, true, sd.get());
+            }
+        });
+    }
+    std::set<std::string> expect, got;
+    for(int i = 0; i < n; ++i) {
+        expect.insert(make_json(i));
+        msg = WSRecvMessage(client.get(), true, cd.get());
+        SYLAR_CHECK(msg);
+        if(msg) {
+            got.insert(msg->getData());
+        }
+    }
+    SYLAR_CHECK(expect == got);
+
+    // 没有协商压缩时收到RSV1置位的帧断开连接
+    iom->schedule([server, sd](){
+        WSSendMessage(server.get(), std::make_shared<WSFrameMessage>(WSFrameHead::TEXT_FRAME
+                    , make_json(0)), false, true, sd.get());
+    });
+    SYLAR_CHECK(!WSRecvMessage(client.get(), true));
+    client->close();
+    server->close();
+}
+
+// WSSession和WSConnection握手协商
+void test_handshake(sylar::IOManager* iom) {
+    auto addr = sylar::Address::LookupAny("127.0.0.1:0");
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+    listener->bind(addr);
+    listener->listen();
+    iom->schedule([listener](){
+        auto sock = listener->accept();
+        WSSession::ptr session(new WSSession(sock));
+        SYLAR_CHECK(session->handleShake() && session->getDeflate());
+        while(auto msg = session->recvMessage()) {
+            session->sendMessage(msg);
+        }
+    });
+
+    sylar::Uri::ptr uri(new sylar::Uri);
+    uri->setScheme("ws");
+    uri->setHost("127.0.0.1");
+    uri->setPort(std::dynamic_pointer_cast<sylar::IPAddress>(listener->getLocalAddress())->getPort());
+    uri->setPath("/");
+    auto res = WSConnection::Create(uri, 1000);
+    SYLAR_CHECK(res.second && res.second->getDeflate());
+    if(!res.second) {
+        return;
+    }
+    SYLAR_CHECK(res.first->response->getHeader("Sec-WebSocket-Extensions") == "permessage-deflate");
+    auto conn = res.second;
+    for(int i = 0; i < 10; ++i) {
+        std::string m = make_json(i);
+        SYLAR_CHECK(conn->sendMessage(m) > 0);
+        auto msg = conn->recvMessage();
+        SYLAR_CHECK(msg && msg->getData() == m);
+    }
+    conn->close();
+}
+
+// 典型行情推送的压缩率和耗时
+void bench() {
+    const int n = 100000;
+    for(bool no_context : {false, true}) {
+        WSDeflate::Params params;
+        params.serverNoContextTakeover = no_context;
+        params.clientNoContextTakeover = no_context;
+        WSDeflate server(params, true);
+        WSDeflate client(params, false);
+        size_t raw = 0, compressed = 0;
+        std::string c, out;
+        uint64_t start = sylar::GetCurrentUS();
+        for(int i = 0; i < n; ++i) {
+            std::string m = make_json(i);
+            server.compress(m.data(), m.size(), c);
+            raw += m.size();
+            compressed += c.size();
+        }
+        uint64_t used = sylar::GetCurrentUS() - start;
+        start = sylar::GetCurrentUS();
+        for(int i = 0; i < n; ++i) {
+            std::string m = make_json(i);
+            std::string cc;
+            client.compress(m.data(), m.size(), cc);
+            server.decompress(cc.data(), cc.size(), out, 1024);
+        }
+        uint64_t round_used = sylar::GetCurrentUS() - start;
+        SYLAR_LOG_INFO(g_logger) << "context_takeover=" << !no_context
+            << " raw=" << raw / n << "B compressed=" << compressed / n << "B"
+            << " ratio=" << (double)compressed / raw
+            << " compress=" << used * 1000 / n << "ns"
+            << " compress+decompress=" << round_used * 1000 / n << "ns"
+            << " memory=" << server.getMemory();
+    }
+}
+
+int main(int argc, char** argv) {
+    test_negotiate();
+    test_roundtrip();
+    {
+        sylar::IOManager iom(2);
+        iom.schedule([&iom](){
+            test_frames(&iom);
+            test_handshake(&iom);
+        });
+    }
+    bench();
+    return check_result();
+}
@@ -0,0 +1,294 @@
+#include "sylar/http/ws_hub.h"
+#include "sylar/streams/socket_stream.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+#include <signal.h>
+#include <sys/ioctl.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+/**
+ * @brief 服务端WSSession和客户端SocketStream
+ */
+struct Peer {
+    WSSession::ptr session;
+    sylar::SocketStream::ptr client;
+};
+
+static Peer make_peer(sylar::Socket::ptr listener, int buf_size = 0) {
+    Peer peer;
+    sylar::Socket::ptr cs = sylar::Socket::CreateTCPSocket();
+    if(buf_size) {
+        cs->setOption(SOL_SOCKET, SO_RCVBUF, buf_size);
+    }
+    cs->connect(listener->getLocalAddress());
+    sylar::Socket::ptr ss = listener->accept();
+    if(buf_size) {
+        ss->setOption(SOL_SOCKET, SO_SNDBUF, buf_size);
+    }
+    peer.session.reset(new WSSession(ss));
+    peer.client.reset(new sylar::SocketStream(cs));
+    return peer;
+}
+
+static sylar::Socket::ptr make_listener() {
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+    listener->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+    listener->listen();
+    return listener;
+}
+
+void test_publish(sylar::IOManager* iom) {
+    auto listener = make_listener();
+    WSHub::ptr hub = std::make_shared<WSHub>(iom);
+    std::vector<Peer> peers;
+    for(int i = 0; i < 4; ++i) {
+        peers.push_back(make_peer(listener));
+    }
+    // 0,1订阅a; 2订阅b; 3订阅a和b
+    SYLAR_CHECK(hub->subscribe("a", peers[0].session));
+    SYLAR_CHECK(hub->subscribe("a", peers[1].session));
+    SYLAR_CHECK(!hub->subscribe("a", peers[1].session));
+    SYLAR_CHECK(hub->subscribe("b", peers[2].session));
+    SYLAR_CHECK(hub->subscribe("a", peers[3].session));
+    SYLAR_CHECK(hub->subscribe("b", peers[3].session));
+    SYLAR_CHECK(hub->getSubscriberCount("a") == 3 && hub->getSubscriberCount("b") == 2);
+
+    SYLAR_CHECK(hub->publish("a", "a1") == 3);
+    SYLAR_CHECK(hub->publish("b", std::string(70000, 'b'), WSFrameHead::BIN_FRAME) == 2);
+    SYLAR_CHECK(hub->publish("c", "c1") == 0);
+    // 单发和广播保持顺序
+    SYLAR_CHECK(hub->send(peers[3].session, "direct"));
+    SYLAR_CHECK(hub->publish("a", "a2") == 3);
+
+    std::vector<std::vector<std::string> > expect = {
+        {"a1", "a2"},
+        {"a1", "a2"},
+        {std::string(70000, 'b')},
+        {"a1", std::string(70000, 'b'), "direct", "a2"}};
+    for(size_t i = 0; i < peers.size(); ++i) {
+        for(auto& e : expect[i]) {
+            auto msg = WSRecvMessage(peers[i].client.get(), true);
+            SYLAR_CHECK(msg && msg->getData() == e);
+        }
+    }
+
+    SYLAR_CHECK(hub->unsubscribe("a", peers[0].session));
+    SYLAR_CHECK(!hub->unsubscribe("a", peers[0].session));
+    hub->remove(peers[3].session);
+    SYLAR_CHECK(hub->getSubscriberCount("a") == 1 && hub->getSubscriberCount("b") == 1);
+    SYLAR_CHECK(!hub->send(peers[3].session, "x"));
+    SYLAR_CHECK(hub->publish("a", "a3") == 1);
+    auto msg = WSRecvMessage(peers[1].client.get(), true);
+    SYLAR_CHECK(msg && msg->getData() == "a3");
+
+    auto stats = hub->getStats();
+    SYLAR_CHECK(stats.published == 5 && stats.queued == 10 && stats.dropped == 0);
+    for(auto& p : peers) {
+        hub->remove(p.session);
+        p.client->close();
+        p.session->close();
+    }
+}
+
+static std::string seq_msg(int seq, size_t size) {
+    std::string m = std::to_string(seq) + ":";
+    m.resize(size, 'x');
+    return m;
+}
+
+static int msg_seq(WSFrameMessage::ptr msg) {
+    return msg ? atoi(msg->getData().c_str()) : -1;
+}
+
+// 客户端不读，发送队列堆积到上限后按策略处理
+void test_slow(sylar::IOManager* iom, WSHub::SlowPolicy policy) {
+    auto listener = make_listener();
+    WSHub::ptr hub = std::make_shared<WSHub>(iom);
+    hub->setSlowPolicy(policy);
+    hub->setMaxQueueBytes(256 * 1024);
+    Peer fast = make_peer(listener);
+    Peer slow = make_peer(listener, 4096);
+    hub->subscribe("t", fast.session);
+    hub->subscribe("t", slow.session);
+
+    const int n = 200;
+    const size_t size = 16 * 1024;
+    sylar::FiberSemaphore done;
+    auto fast_count = std::make_shared<int>(0);
+    iom->schedule([fast, fast_count, n, &done](){
+        for(int i = 0; i < n; ++i) {
+            auto msg = WSRecvMessage(fast.client.get(), true);
+            if(msg_seq(msg) != i) {
+                break;
+            }
+            ++*fast_count;
+        }
+        done.notify();
+    });
+    // BUFFER时占住慢连接的发送锁，发送协程写不出去，队列一定在上限处满:
+    // 前buffered帧排队，之后的被拒绝
+    sylar::FiberSemaphore& slow_lock = slow.session->getSendLock();
+    const size_t frame_size = WSEncodeFrame(WSFrameHead::TEXT_FRAME, seq_msg(0, size)).size();
+    const int buffered = hub->getMaxQueueBytes() / frame_size;
+    if(policy == WSHub::BUFFER) {
+        slow_lock.wait();
+    }
+    for(int i = 0; i < n; ++i) {
+        size_t count = hub->publish("t", seq_msg(i, size));
+        if(policy == WSHub::BUFFER) {
+            SYLAR_CHECK(count == (i < buffered ? 2u : 1u));
+        }
+        // 让发送协程有机会运行
+        if(i % 4 == 3) {
+            usleep(1000);
+        }
+    }
+    usleep(100 * 1000);
+    // 快连接不受慢连接影响
+    fast.client->close();
+    done.wait();
+    SYLAR_CHECK(*fast_count == n);
+
+    auto stats = hub->getStats();
+    SYLAR_LOG_INFO(g_logger) << "policy=" << policy << " queued=" << stats.queued
+        << " dropped=" << stats.dropped << " disconnected=" << stats.disconnected
+        << " writes=" << stats.writes;
+    if(policy == WSHub::DISCONNECT) {
+        SYLAR_CHECK(stats.disconnected == 1 && stats.dropped == 0);
+        // 已经写进socket的帧读完后收到EOF
+        int last = -1;
+        while(auto msg = WSRecvMessage(slow.client.get(), true)) {
+            SYLAR_CHECK(msg_seq(msg) == last + 1);
+            last = msg_seq(msg);
+        }
+        SYLAR_CHECK(last < n - 1);
+    } else if(policy == WSHub::BUFFER) {
+        SYLAR_CHECK(stats.disconnected == 0 && stats.dropped == (uint64_t)(n - buffered));
+        SYLAR_CHECK(stats.queued == (uint64_t)(n + buffered));
+        // 放开发送锁后，排队的帧按顺序全部发出
+        slow_lock.notify();
+        for(int i = 0; i < buffered; ++i) {
+            auto msg = WSRecvMessage(slow.client.get(), true);
+            SYLAR_CHECK(msg_seq(msg) == i);
+        }
+        // 超过上限之后的帧都被丢弃，队列已经发空
+        usleep(100 * 1000);
+        int avail = -1;
+        ioctl(slow.client->getSocket()->getSocket(), FIONREAD, &avail);
+        SYLAR_CHECK(avail == 0);
+        SYLAR_LOG_INFO(g_logger) << "slow consumer received " << buffered;
+    } else {
+        SYLAR_CHECK(stats.disconnected == 0 && stats.dropped > 0);
+        // 现在开始读，所有排队的帧都能收到
+        auto received = std::make_shared<std::vector<int> >();
+        iom->schedule([slow, received, n, &done](){
+            while(true) {
+                auto msg = WSRecvMessage(slow.client.get(), true);
+                received->push_back(msg_seq(msg));
+                if(received->back() < 0 || received->back() == n - 1) {
+                    break;
+                }
+            }
+            done.notify();
+        });
+        usleep(100 * 1000);
+        slow.client->close();
+        done.wait();
+        std::vector<int> seqs = *received;
+        // 读完排队的帧后被close唤醒
+        if(!seqs.empty() && seqs.back() < 0) {
+            seqs.pop_back();
+        }
+        SYLAR_CHECK(!seqs.empty());
+        bool gap = false;
+        for(size_t i = 1; i < seqs.size(); ++i) {
+            if(seqs[i] != seqs[i - 1] + 1) {
+                gap = true;
+            }
+        }
+        // 丢弃旧的，最后一条一定能收到
+        SYLAR_CHECK(gap && seqs.back() == n - 1);
+        SYLAR_LOG_INFO(g_logger) << "slow consumer received " << seqs.size()
+            << " last=" << seqs.back();
+    }
+    hub->remove(fast.session);
+    hub->remove(slow.session);
+    slow.client->close();
+    fast.session->close();
+    slow.session->close();
+}
+
+// 同一条消息发给多个连接: 逐个sendMessage和WSHub对比
+void bench(sylar::IOManager* iom) {
+    auto listener = make_listener();
+    const int conns = 50;
+    const int n = 2000;
+    std::vector<Peer> peers;
+    WSHub::ptr hub = std::make_shared<WSHub>(iom);
+    for(int i = 0; i < conns; ++i) {
+        peers.push_back(make_peer(listener));
+        hub->subscribe("bench", peers.back().session);
+    }
+    std::string data(256, 'd');
+
+    for(int round = 0; round < 2; ++round) {
+        sylar::FiberSemaphore done;
+        for(auto& p : peers) {
+            auto client = p.client;
+            iom->schedule([client, n, &done](){
+                for(int i = 0; i < n; ++i) {
+                    if(!WSRecvMessage(client.get(), true)) {
+                        break;
+                    }
+                }
+                done.notify();
+            });
+        }
+        uint64_t start = sylar::GetCurrentUS();
+        for(int i = 0; i < n; ++i) {
+            if(round == 0) {
+                for(auto& p : peers) {
+                    p.session->sendMessage(data);
+                }
+            } else {
+                hub->publish("bench", data);
+            }
+        }
+        uint64_t publish_used = sylar::GetCurrentUS() - start;
+        for(int i = 0; i < conns; ++i) {
+            done.wait();
+        }
+        uint64_t used = sylar::GetCurrentUS() - start;
+        SYLAR_LOG_INFO(g_logger) << (round == 0 ? "sendMessage" : "WSHub")
+            << " conns=" << conns << " messages=" << n
+            << " publish=" << publish_used / 1000 << "ms"
+            << " delivered=" << used / 1000 << "ms"
+            << " " << (uint64_t)conns * n * 1000000 / (used + 1) << " frames/s"
+            << (round == 1 ? " writes=" + std::to_string(hub->getStats().writes) : "");
+    }
+    for(auto& p : peers) {
+        hub->remove(p.session);
+        p.client->close();
+        p.session->close();
+    }
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    {
+        sylar::IOManager iom(2);
+        iom.schedule([&iom](){
+            test_publish(&iom);
+            test_slow(&iom, WSHub::BUFFER);
+            test_slow(&iom, WSHub::DROP);
+            test_slow(&iom, WSHub::DISCONNECT);
+            bench(&iom);
+        });
+    }
+    return check_result();
+}
@@ -0,0 +1,153 @@
+#include "sylar/http/ws_session.h"
+#include "sylar/streams/socket_stream.h"
+#include "sylar/log.h"
+#include "sylar/iomanager.h"
+#include "sylar/util.h"
+#include "test_helper.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static void naive_mask(const uint8_t* src, uint8_t* dst, size_t len, const uint8_t* mask) {
+    for(size_t i = 0; i < len; ++i) {
+        dst[i] = src[i] ^ mask[i % 4];
+    }
+}
+
+// 各种长度和地址对齐下和逐字节实现比较
+void test_mask() {
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    std::vector<uint8_t> src(1100), expect(1100), out(1100);
+    for(size_t i = 0; i < src.size(); ++i) {
+        src[i] = rand();
+    }
+    int fail = 0;
+    for(size_t align = 0; align < 8; ++align) {
+        for(size_t len = 0; len + align <= 1090; len += (len < 300 ? 1 : 37)) {
+            naive_mask(&src[align], &expect[0], len, mask);
+            WSMask(&src[align], &out[align], len, mask);
+            if(memcmp(&expect[0], &out[align], len)) {
+                ++fail;
+            }
+            // 原地运算
+            std::vector<uint8_t> tmp(src.begin() + align, src.begin() + align + len);
+            WSMask(tmp.data(), tmp.data(), len, mask);
+            if(len && memcmp(&expect[0], tmp.data(), len)) {
+                ++fail;
+            }
+        }
+    }
+    SYLAR_CHECK(fail == 0);
+}
+
+// 客户端发送带掩码的帧，服务端接收解码
+void test_frames(sylar::IOManager* iom) {
+    sylar::Socket::ptr cs, ss;
+    make_socket_pair(cs, ss);
+    sylar::SocketStream::ptr client(new sylar::SocketStream(cs));
+    sylar::SocketStream::ptr server(new sylar::SocketStream(ss));
+
+    std::vector<size_t> sizes = {0, 1, 125, 126, 1000, 65535, 65536, 1024 * 1024 + 3};
+    std::vector<std::string> msgs;
+    for(auto size : sizes) {
+        std::string m(size, 0);
+        for(size_t i = 0; i < size; ++i) {
+            m[i] = 'a' + i % 26;
+        }
+        msgs.push_back(m);
+    }
+    iom->schedule([client, msgs](){
+        for(auto& m : msgs) {
+            auto msg = std::make_shared<WSFrameMessage>(WSFrameHead::BIN_FRAME, m);
+            SYLAR_CHECK(WSSendMessage(client.get(), msg, true, true) > 0);
+            // 发送不修改调用方的消息
+            SYLAR_CHECK(msg->getData() == m);
+        }
+        // 分片消息: 首帧带opcode，空的中间帧，结束帧
+        WSSendMessage(client.get(), std::make_shared<WSFrameMessage>(WSFrameHead::TEXT_FRAME, "hello "), true, false);
+        WSSendMessage(client.get(), std::make_shared<WSFrameMessage>(WSFrameHead::CONTINUE, ""), true, false);
+        WSSendMessage(client.get(), std::make_shared<WSFrameMessage>(WSFrameHead::CONTINUE, "world"), true, true);
+    });
+    for(auto& m : msgs) {
+        auto msg = WSRecvMessage(server.get(), false);
+        SYLAR_CHECK(msg && msg->getOpcode() == WSFrameHead::BIN_FRAME && msg->getData() == m);
+    }
+    auto msg = WSRecvMessage(server.get(), false);
+    SYLAR_CHECK(msg && msg->getOpcode() == WSFrameHead::TEXT_FRAME && msg->getData() == "hello world");
+
+    // 服务端发送不带掩码，客户端接收
+    iom->schedule([server](){
+        WSSendMessage(server.get(), std::make_shared<WSFrameMessage>(WSFrameHead::TEXT_FRAME
+                    , std::string(70000, 'x')), false, true);
+    });
+    msg = WSRecvMessage(client.get(), true);
+    SYLAR_CHECK(msg && msg->getData() == std::string(70000, 'x'));
+    client->close();
+    server->close();
+}
+
+// 64位长度: 最高位为1、以及和已收到的长度相加会溢出的都要拒绝
+void test_bad_length() {
+    auto frame = [](uint8_t b0, uint64_t length) -> std::string {
+        std::string f;
+        f.push_back((char)b0);
+        f.push_back((char)127);
+        for(int i = 7; i >= 0; --i) {
+            f.push_back((char)(length >> (i * 8)));
+        }
+        return f;
+    };
+    std::vector<std::string> cases = {
+        frame(0x82, 0xfffffffffffffff6ull),
+        // 先收10字节，后一帧的长度加上去超过2^64
+        std::string("\x01\x0a" "0123456789", 12) + frame(0x80, 0xfffffffffffffffbull),
+        std::string("\x01\x0a" "0123456789", 12) + frame(0x80, 0x7fffffffffffffffull)
+    };
+    for(auto& c : cases) {
+        sylar::Socket::ptr cs, ss;
+        make_socket_pair(cs, ss);
+        sylar::SocketStream::ptr client(new sylar::SocketStream(cs));
+        ss->send(c.c_str(), c.size());
+        ss->close();
+        SYLAR_CHECK(!WSRecvMessage(client.get(), true));
+        client->close();
+    }
+}
+
+// 单核掩码吞吐
+void bench() {
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    for(size_t size : {(size_t)125, (size_t)4096, (size_t)1024 * 1024}) {
+        std::string buf(size, 'x');
+        size_t loops = std::max((size_t)1, (size_t)(512 * 1024 * 1024) / size);
+        uint64_t start = sylar::GetCurrentUS();
+        for(size_t i = 0; i < loops; ++i) {
+            naive_mask((const uint8_t*)&buf[0], (uint8_t*)&buf[0], size, mask);
+        }
+        uint64_t naive_used = sylar::GetCurrentUS() - start + 1;
+        start = sylar::GetCurrentUS();
+        for(size_t i = 0; i < loops; ++i) {
+            WSMask(&buf[0], &buf[0], size, mask);
+        }
+        uint64_t used = sylar::GetCurrentUS() - start + 1;
+        double mb = (double)size * loops / 1024 / 1024;
+        SYLAR_LOG_INFO(g_logger) << "mask size=" << size
+            << " naive=" << (uint64_t)(mb * 1000000 / naive_used) << "MB/s"
+            << " WSMask=" << (uint64_t)(mb * 1000000 / used) << "MB/s"
+            << " check=" << (int)buf[size / 2];
+    }
+}
+
+int main(int argc, char** argv) {
+    test_mask();
+    {
+        sylar::IOManager iom(2);
+        iom.schedule([&iom](){
+            test_frames(&iom);
+            test_bad_length();
+        });
+    }
+    bench();
+    return check_result();
+}